@@ -0,0 +1,268 @@
+/** @file
+  Page-backed arena allocator shared by the utilities.
+
+  Memory comes from the firmware a block of pages at a time and is handed
+  out by bumping an offset, so a tool that allocates in a loop makes one
+  AllocatePages call per block instead of one pool call per object, and
+  its peak footprint is the number of blocks it touched. Small objects
+  that are freed and reallocated repeatedly go through size-class slabs,
+  whose free lists are threaded through the freed objects themselves.
+**/
+
+#include "ArenaLib.h"
+
+/* Payload starts this far into a block, keeping it ARENA_ALIGNMENT aligned */
+#define ARENA_HEADER_SIZE  ALIGN_VALUE (sizeof (ARENA_BLOCK), ARENA_ALIGNMENT)
+
+STATIC
+VOID
+ArenaReleaseBlock (
+  IN OUT ARENA        *Arena,
+  IN     ARENA_BLOCK  *Block
+  )
+{
+  Arena->PagesHeld -= Block->Pages;
+  Arena->PageCalls++;
+  FreePages(Block, Block->Pages);
+}
+
+/**
+  Push a new block big enough for Size payload bytes.
+
+  @retval NULL  AllocatePages failed.
+**/
+STATIC
+ARENA_BLOCK *
+ArenaGrow (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  )
+{
+  ARENA_BLOCK *Block;
+  UINTN       Pages;
+
+  if (Size > MAX_UINTN - ARENA_HEADER_SIZE - EFI_PAGE_SIZE) {
+    return NULL;
+  }
+  Pages = MAX(Arena->BlockPages, EFI_SIZE_TO_PAGES(ARENA_HEADER_SIZE + Size));
+
+  Arena->PageCalls++;
+  Block = AllocatePages(Pages);
+  if (Block == NULL) {
+    return NULL;
+  }
+
+  Block->Next  = Arena->Blocks;
+  Block->Pages = Pages;
+  Block->Size  = EFI_PAGES_TO_SIZE(Pages) - ARENA_HEADER_SIZE;
+  Block->Used  = 0;
+  Arena->Blocks = Block;
+
+  Arena->PagesHeld += Pages;
+  if (Arena->PagesHeld > Arena->PeakPages) {
+    Arena->PeakPages = Arena->PagesHeld;
+  }
+  return Block;
+}
+
+/**
+  Slab class for Size, or ARENA_SLAB_CLASSES when it is too big for one.
+**/
+STATIC
+UINTN
+ArenaSlabClass (
+  IN UINTN  Size
+  )
+{
+  UINTN Class;
+
+  for (Class = 0; Class < ARENA_SLAB_CLASSES; Class++) {
+    if (Size <= ((UINTN)1 << (ARENA_SLAB_MIN_SHIFT + Class))) {
+      break;
+    }
+  }
+  return Class;
+}
+
+VOID
+ArenaInit (
+  OUT ARENA  *Arena,
+  IN  UINTN  BlockPages
+  )
+{
+  ZeroMem(Arena, sizeof(*Arena));
+  Arena->BlockPages = (BlockPages != 0) ? BlockPages : ARENA_DEFAULT_PAGES;
+}
+
+VOID *
+ArenaAlloc (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  )
+{
+  ARENA_BLOCK *Block;
+  VOID        *Buffer;
+
+  if (Size > MAX_UINTN - ARENA_ALIGNMENT) {
+    return NULL;
+  }
+  Size = ALIGN_VALUE(Size, ARENA_ALIGNMENT);
+
+  Block = Arena->Blocks;
+  if (Block == NULL || Block->Size - Block->Used < Size) {
+    Block = ArenaGrow(Arena, Size);
+    if (Block == NULL) {
+      return NULL;
+    }
+  }
+
+  Buffer = (UINT8 *)Block + ARENA_HEADER_SIZE + Block->Used;
+  Block->Used += Size;
+  Arena->Allocations++;
+  return Buffer;
+}
+
+VOID *
+ArenaAllocZero (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  )
+{
+  VOID *Buffer;
+
+  Buffer = ArenaAlloc(Arena, Size);
+  if (Buffer != NULL) {
+    ZeroMem(Buffer, Size);
+  }
+  return Buffer;
+}
+
+VOID *
+ArenaSlabAlloc (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  )
+{
+  UINTN Class;
+  VOID  *Buffer;
+
+  Class = ArenaSlabClass(Size);
+  if (Class == ARENA_SLAB_CLASSES) {
+    return ArenaAlloc(Arena, Size);
+  }
+
+  Buffer = Arena->FreeList[Class];
+  if (Buffer != NULL) {
+    Arena->FreeList[Class] = *(VOID **)Buffer;
+    Arena->Allocations++;
+    return Buffer;
+  }
+  return ArenaAlloc(Arena, (UINTN)1 << (ARENA_SLAB_MIN_SHIFT + Class));
+}
+
+VOID
+ArenaSlabFree (
+  IN OUT ARENA  *Arena,
+  IN     VOID   *Buffer,
+  IN     UINTN  Size
+  )
+{
+  UINTN Class;
+
+  if (Buffer == NULL) {
+    return;
+  }
+
+  //
+  // Oversized objects came from the bump allocator and only go back in bulk
+  //
+  Class = ArenaSlabClass(Size);
+  if (Class == ARENA_SLAB_CLASSES) {
+    return;
+  }
+  *(VOID **)Buffer       = Arena->FreeList[Class];
+  Arena->FreeList[Class] = Buffer;
+}
+
+ARENA_MARK
+ArenaMark (
+  IN ARENA  *Arena
+  )
+{
+  ARENA_MARK Mark;
+
+  Mark.Block = Arena->Blocks;
+  Mark.Used  = (Mark.Block != NULL) ? Mark.Block->Used : 0;
+  return Mark;
+}
+
+VOID
+ArenaRewind (
+  IN OUT ARENA       *Arena,
+  IN     ARENA_MARK  Mark
+  )
+{
+  ARENA_BLOCK *Block;
+
+  while (Arena->Blocks != NULL && Arena->Blocks != Mark.Block) {
+    Block         = Arena->Blocks;
+    Arena->Blocks = Block->Next;
+    ArenaReleaseBlock(Arena, Block);
+  }
+  if (Arena->Blocks != NULL) {
+    Arena->Blocks->Used = Mark.Used;
+  }
+
+  //
+  // Free objects may lie past the mark; drop the lists rather than walk them
+  //
+  ZeroMem(Arena->FreeList, sizeof(Arena->FreeList));
+}
+
+VOID
+ArenaReset (
+  IN OUT ARENA  *Arena
+  )
+{
+  ARENA_BLOCK *Block;
+
+  while (Arena->Blocks != NULL && Arena->Blocks->Next != NULL) {
+    Block         = Arena->Blocks;
+    Arena->Blocks = Block->Next;
+    ArenaReleaseBlock(Arena, Block);
+  }
+  if (Arena->Blocks != NULL) {
+    Arena->Blocks->Used = 0;
+  }
+  ZeroMem(Arena->FreeList, sizeof(Arena->FreeList));
+}
+
+VOID
+ArenaFree (
+  IN OUT ARENA  *Arena
+  )
+{
+  ARENA_BLOCK *Block;
+
+  while (Arena->Blocks != NULL) {
+    Block         = Arena->Blocks;
+    Arena->Blocks = Block->Next;
+    ArenaReleaseBlock(Arena, Block);
+  }
+  ZeroMem(Arena->FreeList, sizeof(Arena->FreeList));
+}
+
+VOID
+ArenaPrintStats (
+  IN ARENA         *Arena,
+  IN CONST CHAR16  *Label
+  )
+{
+  Print(L"%s: %d allocations, %d page calls, %d pages held, peak %d pages (%d KB)\n",
+        Label,
+        Arena->Allocations,
+        Arena->PageCalls,
+        Arena->PagesHeld,
+        Arena->PeakPages,
+        EFI_PAGES_TO_SIZE(Arena->PeakPages) / SIZE_1KB);
+}
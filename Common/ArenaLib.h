@@ -0,0 +1,129 @@
+/** @file
+  Page-backed arena allocator shared by the utilities - Header
+  - Bump allocation out of blocks obtained with AllocatePages
+  - Size-class slabs with per-class free lists for small, recycled objects
+  - Bulk release: rewind to a mark, reset, or give every page back at once
+**/
+
+#ifndef __ARENA_LIB_H__
+#define __ARENA_LIB_H__
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiLib.h>
+
+/* Every arena allocation is aligned to this many bytes */
+#define ARENA_ALIGNMENT         16
+
+/* Pages per block unless a single request needs more */
+#define ARENA_DEFAULT_PAGES     4
+
+/* Slab size classes: 16, 32, 64, ... 2048 bytes */
+#define ARENA_SLAB_MIN_SHIFT    4
+#define ARENA_SLAB_CLASSES      8
+#define ARENA_SLAB_MAX_SIZE     (1U << (ARENA_SLAB_MIN_SHIFT + ARENA_SLAB_CLASSES - 1))
+
+typedef struct _ARENA_BLOCK  ARENA_BLOCK;
+
+/* Header at the start of every block; the payload follows it */
+struct _ARENA_BLOCK {
+  ARENA_BLOCK  *Next;           /* older block */
+  UINTN        Pages;
+  UINTN        Size;            /* payload bytes */
+  UINTN        Used;            /* payload bytes handed out */
+};
+
+typedef struct {
+  ARENA_BLOCK  *Blocks;         /* newest first; allocation bumps the head */
+  UINTN        BlockPages;
+  VOID         *FreeList[ARENA_SLAB_CLASSES];
+
+  /* Statistics, kept across ArenaReset() */
+  UINTN        PageCalls;       /* AllocatePages + FreePages issued */
+  UINTN        Allocations;     /* requests served */
+  UINTN        PagesHeld;
+  UINTN        PeakPages;
+} ARENA;
+
+/* Position to rewind to with ArenaRewind() */
+typedef struct {
+  ARENA_BLOCK  *Block;
+  UINTN        Used;
+} ARENA_MARK;
+
+/* Set up an empty arena; no memory is taken until the first allocation */
+VOID
+ArenaInit (
+  OUT ARENA  *Arena,
+  IN  UINTN  BlockPages
+  );
+
+/* Bump-allocate Size bytes; NULL when out of pages. Contents are undefined. */
+VOID *
+ArenaAlloc (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  );
+
+VOID *
+ArenaAllocZero (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  );
+
+/*
+  Allocate from the smallest size class that holds Size, reusing a freed
+  object of that class when there is one. Sizes above ARENA_SLAB_MAX_SIZE
+  fall back to ArenaAlloc().
+*/
+VOID *
+ArenaSlabAlloc (
+  IN OUT ARENA  *Arena,
+  IN     UINTN  Size
+  );
+
+/* Return an ArenaSlabAlloc() object; Size must match the allocation */
+VOID
+ArenaSlabFree (
+  IN OUT ARENA  *Arena,
+  IN     VOID   *Buffer,
+  IN     UINTN  Size
+  );
+
+ARENA_MARK
+ArenaMark (
+  IN ARENA  *Arena
+  );
+
+/*
+  Release everything allocated since Mark. Blocks added after the mark go
+  back to the firmware; slab free lists are emptied.
+*/
+VOID
+ArenaRewind (
+  IN OUT ARENA       *Arena,
+  IN     ARENA_MARK  Mark
+  );
+
+/* Release every allocation but keep the oldest block for reuse */
+VOID
+ArenaReset (
+  IN OUT ARENA  *Arena
+  );
+
+/* Give all pages back to the firmware */
+VOID
+ArenaFree (
+  IN OUT ARENA  *Arena
+  );
+
+/* One line of statistics, prefixed with Label */
+VOID
+ArenaPrintStats (
+  IN ARENA         *Arena,
+  IN CONST CHAR16  *Label
+  );
+
+#endif /* __ARENA_LIB_H__ */
@@ -0,0 +1,69 @@
+/** @file
+  Call latency measurement shared by the utilities.
+
+  The benchmarks time every call on its own with the TimerLib performance
+  counter and report the distribution rather than an average, since a few
+  slow calls (a flash erase, a pool growing) are what matter most.
+**/
+
+#include "LatencyLib.h"
+
+/* 0 until the counter direction has been read, then 1 (up) or 2 (down) */
+STATIC UINT8  mCounterDirection;
+
+UINT64
+ElapsedTicks (
+  IN UINT64  Start,
+  IN UINT64  End
+  )
+{
+  UINT64 CounterStart;
+  UINT64 CounterEnd;
+
+  if (mCounterDirection == 0) {
+    GetPerformanceCounterProperties(&CounterStart, &CounterEnd);
+    mCounterDirection = (CounterEnd > CounterStart) ? 1 : 2;
+  }
+  return (mCounterDirection == 1) ? End - Start : Start - End;
+}
+
+/**
+  Sort tick samples ascending (Shell sort; a few thousand samples at most).
+**/
+STATIC
+VOID
+SortSamples (
+  IN OUT UINT64  *Samples,
+  IN     UINTN   Count
+  )
+{
+  UINT64 Key;
+  UINTN  Gap;
+  UINTN  i;
+  UINTN  j;
+
+  for (Gap = Count / 2; Gap > 0; Gap /= 2) {
+    for (i = Gap; i < Count; i++) {
+      Key = Samples[i];
+      for (j = i; j >= Gap && Samples[j - Gap] > Key; j -= Gap) {
+        Samples[j] = Samples[j - Gap];
+      }
+      Samples[j] = Key;
+    }
+  }
+}
+
+VOID
+ComputeLatencyStats (
+  IN OUT UINT64         *Samples,
+  IN     UINTN          Count,
+  OUT    LATENCY_STATS  *Stats
+  )
+{
+  SortSamples(Samples, Count);
+  Stats->Min = GetTimeInNanoSecond(Samples[0]);
+  Stats->P50 = GetTimeInNanoSecond(Samples[Count / 2]);
+  Stats->P90 = GetTimeInNanoSecond(Samples[(Count * 90) / 100]);
+  Stats->P99 = GetTimeInNanoSecond(Samples[(Count * 99) / 100]);
+  Stats->Max = GetTimeInNanoSecond(Samples[Count - 1]);
+}
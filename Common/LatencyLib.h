@@ -0,0 +1,38 @@
+/** @file
+  Call latency measurement shared by the utilities - Header
+  - Elapsed ticks between two TimerLib performance counter readings
+  - Min/median/P90/P99/max summary of a set of per-call samples
+**/
+
+#ifndef __LATENCY_LIB_H__
+#define __LATENCY_LIB_H__
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/TimerLib.h>
+
+/* Latency summary of one set of calls, in nanoseconds */
+typedef struct {
+  UINT64  Min;
+  UINT64  P50;
+  UINT64  P90;
+  UINT64  P99;
+  UINT64  Max;
+} LATENCY_STATS;
+
+/* Ticks between two performance counter readings, whichever way the counter runs */
+UINT64
+ElapsedTicks (
+  IN UINT64  Start,
+  IN UINT64  End
+  );
+
+/* Reduce Count (at least 1) tick samples to a summary; Samples are sorted in place */
+VOID
+ComputeLatencyStats (
+  IN OUT UINT64         *Samples,
+  IN     UINTN          Count,
+  OUT    LATENCY_STATS  *Stats
+  );
+
+#endif /* __LATENCY_LIB_H__ */
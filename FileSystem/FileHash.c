@@ -0,0 +1,486 @@
+/** @file
+  Streaming file hashes for FileSystem.efi
+  - SHA-256 per FIPS 180-4; 64-byte blocks, any update size
+  - CRC32C (Castagnoli, reflected polynomial 0x82F63B78)
+  - The first FsHashInit() probes CPUID once and switches to the SHA-NI
+    and SSE4.2 code paths when the processor has them. Those paths are
+    built with GCC/Clang target attributes on X64 only; other toolchains
+    and architectures always use the portable code.
+**/
+
+#include "FileHash.h"
+
+#if defined (MDE_CPU_X64) && defined (__GNUC__)
+#define FS_HASH_X86_ACCEL  1
+#else
+#define FS_HASH_X86_ACCEL  0
+#endif
+
+#define CRC32C_POLY  0x82F63B78
+
+STATIC BOOLEAN  mHashCpuProbed = FALSE;
+STATIC BOOLEAN  mHasShaNi      = FALSE;
+STATIC BOOLEAN  mHasSse42      = FALSE;
+STATIC UINT32   mCrc32cTable[8][256];
+
+STATIC CONST UINT32 mSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+STATIC CONST UINT32 mSha256Init[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* ------------------------- CPU probe ------------------------- */
+
+STATIC
+VOID
+HashProbeCpu (
+  VOID
+  )
+{
+  UINT32 MaxLeaf;
+  UINT32 Ebx, Ecx;
+  UINT32 Crc;
+  UINTN  Index;
+  UINTN  Bit;
+  UINTN  Slice;
+
+  if (mHashCpuProbed) {
+    return;
+  }
+  mHashCpuProbed = TRUE;
+
+  /* Slicing-by-8 tables are needed even when SSE4.2 is present (short tails) */
+  for (Index = 0; Index < 256; Index++) {
+    Crc = (UINT32)Index;
+    for (Bit = 0; Bit < 8; Bit++) {
+      Crc = (Crc >> 1) ^ ((Crc & 1) ? CRC32C_POLY : 0);
+    }
+    mCrc32cTable[0][Index] = Crc;
+  }
+  for (Index = 0; Index < 256; Index++) {
+    Crc = mCrc32cTable[0][Index];
+    for (Slice = 1; Slice < 8; Slice++) {
+      Crc = mCrc32cTable[0][Crc & 0xFF] ^ (Crc >> 8);
+      mCrc32cTable[Slice][Index] = Crc;
+    }
+  }
+
+#if FS_HASH_X86_ACCEL
+  AsmCpuid(0, &MaxLeaf, NULL, NULL, NULL);
+
+  /* CPUID.01h:ECX - SSSE3 [9], SSE4.1 [19], SSE4.2 [20] */
+  AsmCpuid(1, NULL, NULL, &Ecx, NULL);
+  mHasSse42 = (BOOLEAN)((Ecx & BIT20) != 0);
+
+  /* CPUID.(07h,0):EBX - SHA [29]; the SHA-NI path also needs SSSE3/SSE4.1 */
+  if (MaxLeaf >= 7 && (Ecx & BIT9) != 0 && (Ecx & BIT19) != 0) {
+    AsmCpuidEx(7, 0, NULL, &Ebx, NULL, NULL);
+    mHasShaNi = (BOOLEAN)((Ebx & BIT29) != 0);
+  }
+#else
+  (VOID)MaxLeaf;
+  (VOID)Ebx;
+  (VOID)Ecx;
+#endif
+}
+
+CONST CHAR16 *
+FsHashEngineName (
+  VOID
+  )
+{
+  HashProbeCpu();
+
+  if (mHasShaNi && mHasSse42) {
+    return L"SHA-NI, SSE4.2";
+  } else if (mHasShaNi) {
+    return L"SHA-NI, table CRC";
+  } else if (mHasSse42) {
+    return L"portable SHA, SSE4.2";
+  }
+  return L"portable";
+}
+
+/* ------------------------- CRC32C ------------------------- */
+
+STATIC
+UINT32
+Crc32cTable (
+  IN UINT32       Crc,
+  IN CONST UINT8  *Data,
+  IN UINTN        Size
+  )
+{
+  UINT32 Lo;
+  UINT32 Hi;
+
+  while (Size > 0 && ((UINTN)Data & 7) != 0) {
+    Crc = mCrc32cTable[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+    Size--;
+  }
+
+  while (Size >= 8) {
+    Lo   = *(CONST UINT32 *)Data ^ Crc;
+    Hi   = *(CONST UINT32 *)(Data + 4);
+    Crc  = mCrc32cTable[7][Lo & 0xFF] ^
+           mCrc32cTable[6][(Lo >> 8) & 0xFF] ^
+           mCrc32cTable[5][(Lo >> 16) & 0xFF] ^
+           mCrc32cTable[4][Lo >> 24] ^
+           mCrc32cTable[3][Hi & 0xFF] ^
+           mCrc32cTable[2][(Hi >> 8) & 0xFF] ^
+           mCrc32cTable[1][(Hi >> 16) & 0xFF] ^
+           mCrc32cTable[0][Hi >> 24];
+    Data += 8;
+    Size -= 8;
+  }
+
+  while (Size > 0) {
+    Crc = mCrc32cTable[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+    Size--;
+  }
+
+  return Crc;
+}
+
+#if FS_HASH_X86_ACCEL
+__attribute__((target ("sse4.2")))
+STATIC
+UINT32
+Crc32cSse42 (
+  IN UINT32       Crc,
+  IN CONST UINT8  *Data,
+  IN UINTN        Size
+  )
+{
+  UINT64 Crc64;
+
+  while (Size > 0 && ((UINTN)Data & 7) != 0) {
+    Crc = __builtin_ia32_crc32qi(Crc, *Data++);
+    Size--;
+  }
+
+  Crc64 = Crc;
+  while (Size >= 32) {
+    Crc64 = __builtin_ia32_crc32di(Crc64, ((CONST UINT64 *)Data)[0]);
+    Crc64 = __builtin_ia32_crc32di(Crc64, ((CONST UINT64 *)Data)[1]);
+    Crc64 = __builtin_ia32_crc32di(Crc64, ((CONST UINT64 *)Data)[2]);
+    Crc64 = __builtin_ia32_crc32di(Crc64, ((CONST UINT64 *)Data)[3]);
+    Data += 32;
+    Size -= 32;
+  }
+  while (Size >= 8) {
+    Crc64 = __builtin_ia32_crc32di(Crc64, *(CONST UINT64 *)Data);
+    Data += 8;
+    Size -= 8;
+  }
+  Crc = (UINT32)Crc64;
+
+  while (Size > 0) {
+    Crc = __builtin_ia32_crc32qi(Crc, *Data++);
+    Size--;
+  }
+
+  return Crc;
+}
+#endif
+
+UINT32
+FsCrc32cUpdate (
+  IN UINT32      Crc,
+  IN CONST VOID  *Data,
+  IN UINTN       Size
+  )
+{
+  HashProbeCpu();
+
+  Crc = ~Crc;
+#if FS_HASH_X86_ACCEL
+  if (mHasSse42) {
+    return ~Crc32cSse42(Crc, (CONST UINT8 *)Data, Size);
+  }
+#endif
+  return ~Crc32cTable(Crc, (CONST UINT8 *)Data, Size);
+}
+
+/* ------------------------- SHA-256 ------------------------- */
+
+#define ROR32(x, n)     (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA_CH(x, y, z)   (((x) & (y)) ^ (~(x) & (z)))
+#define SHA_MAJ(x, y, z)  (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA_BSIG0(x)    (ROR32 (x, 2) ^ ROR32 (x, 13) ^ ROR32 (x, 22))
+#define SHA_BSIG1(x)    (ROR32 (x, 6) ^ ROR32 (x, 11) ^ ROR32 (x, 25))
+#define SHA_SSIG0(x)    (ROR32 (x, 7) ^ ROR32 (x, 18) ^ ((x) >> 3))
+#define SHA_SSIG1(x)    (ROR32 (x, 17) ^ ROR32 (x, 19) ^ ((x) >> 10))
+
+STATIC
+VOID
+Sha256BlocksPortable (
+  IN OUT UINT32       State[8],
+  IN     CONST UINT8  *Data,
+  IN     UINTN        Blocks
+  )
+{
+  UINT32 W[64];
+  UINT32 A, B, C, D, E, F, G, H;
+  UINT32 T1, T2;
+  UINTN  i;
+
+  while (Blocks-- > 0) {
+    for (i = 0; i < 16; i++) {
+      W[i] = ((UINT32)Data[4 * i] << 24) | ((UINT32)Data[4 * i + 1] << 16) |
+             ((UINT32)Data[4 * i + 2] << 8) | (UINT32)Data[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+      W[i] = SHA_SSIG1(W[i - 2]) + W[i - 7] + SHA_SSIG0(W[i - 15]) + W[i - 16];
+    }
+
+    A = State[0]; B = State[1]; C = State[2]; D = State[3];
+    E = State[4]; F = State[5]; G = State[6]; H = State[7];
+
+    for (i = 0; i < 64; i++) {
+      T1 = H + SHA_BSIG1(E) + SHA_CH(E, F, G) + mSha256K[i] + W[i];
+      T2 = SHA_BSIG0(A) + SHA_MAJ(A, B, C);
+      H = G; G = F; F = E; E = D + T1;
+      D = C; C = B; B = A; A = T1 + T2;
+    }
+
+    State[0] += A; State[1] += B; State[2] += C; State[3] += D;
+    State[4] += E; State[5] += F; State[6] += G; State[7] += H;
+
+    Data += 64;
+  }
+}
+
+#if FS_HASH_X86_ACCEL
+/*
+  SHA-NI block function. Written with the compiler builtins rather than
+  <immintrin.h>, which drags in C library headers the firmware build
+  does not have.
+*/
+typedef INT32      V4SI  __attribute__ ((vector_size (16)));
+typedef INT64      V2DI  __attribute__ ((vector_size (16)));
+typedef INT16      V8HI  __attribute__ ((vector_size (16)));
+typedef CHAR8      V16QI __attribute__ ((vector_size (16)));
+typedef INT32      V4SI_U __attribute__ ((vector_size (16), aligned (1)));
+
+#define SHA_SHUF32(a, imm)      __builtin_ia32_pshufd ((a), (imm))
+#define SHA_ALIGNR(a, b, n)     ((V4SI)__builtin_ia32_palignr128 ((V2DI)(a), (V2DI)(b), (n) * 8))
+#define SHA_BLEND16(a, b, imm)  ((V4SI)__builtin_ia32_pblendw128 ((V8HI)(a), (V8HI)(b), (imm)))
+#define SHA_BSWAP(a, m)         ((V4SI)__builtin_ia32_pshufb128 ((V16QI)(a), (V16QI)(m)))
+
+__attribute__((target ("sha,sse4.1,ssse3")))
+STATIC
+VOID
+Sha256BlocksShaNi (
+  IN OUT UINT32       State[8],
+  IN     CONST UINT8  *Data,
+  IN     UINTN        Blocks
+  )
+{
+  V4SI   State0, State1, AbefSave, CdghSave;
+  V4SI   Msg, Tmp;
+  V4SI   W[4];
+  V4SI   Mask;
+  UINTN  g;
+
+  Mask   = (V4SI){ 0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f };
+
+  State0 = *(CONST V4SI_U *)&State[0];
+  State1 = *(CONST V4SI_U *)&State[4];
+
+  Tmp    = SHA_SHUF32(State0, 0xB1);          /* CDAB */
+  State1 = SHA_SHUF32(State1, 0x1B);          /* EFGH */
+  State0 = SHA_ALIGNR(Tmp, State1, 8);        /* ABEF */
+  State1 = SHA_BLEND16(State1, Tmp, 0xF0);    /* CDGH */
+
+  while (Blocks-- > 0) {
+    AbefSave = State0;
+    CdghSave = State1;
+
+    /*
+      16 groups of 4 rounds. The message schedule lives in W[0..3] and is
+      extended in place: group g uses W[g%4], finishes W[(g+1)%4] with
+      sha256msg2 and starts W[(g-1)%4] with sha256msg1.
+    */
+    for (g = 0; g < 16; g++) {
+      if (g < 4) {
+        W[g] = SHA_BSWAP(*(CONST V4SI_U *)(Data + 16 * g), Mask);
+      }
+
+      Msg    = W[g & 3] + *(CONST V4SI_U *)&mSha256K[4 * g];
+      State1 = __builtin_ia32_sha256rnds2(State1, State0, Msg);
+
+      if (g >= 3 && g <= 14) {
+        Tmp            = SHA_ALIGNR(W[g & 3], W[(g - 1) & 3], 4);
+        W[(g + 1) & 3] = __builtin_ia32_sha256msg2(W[(g + 1) & 3] + Tmp, W[g & 3]);
+      }
+
+      Msg    = SHA_SHUF32(Msg, 0x0E);
+      State0 = __builtin_ia32_sha256rnds2(State0, State1, Msg);
+
+      if (g >= 1 && g <= 12) {
+        W[(g - 1) & 3] = __builtin_ia32_sha256msg1(W[(g - 1) & 3], W[g & 3]);
+      }
+    }
+
+    State0 += AbefSave;
+    State1 += CdghSave;
+    Data   += 64;
+  }
+
+  Tmp    = SHA_SHUF32(State0, 0x1B);          /* FEBA */
+  State1 = SHA_SHUF32(State1, 0xB1);          /* DCHG */
+  State0 = SHA_BLEND16(Tmp, State1, 0xF0);    /* DCBA */
+  State1 = SHA_ALIGNR(State1, Tmp, 8);        /* HGFE */
+
+  *(V4SI_U *)&State[0] = State0;
+  *(V4SI_U *)&State[4] = State1;
+}
+#endif
+
+STATIC
+VOID
+Sha256Blocks (
+  IN OUT UINT32       State[8],
+  IN     CONST UINT8  *Data,
+  IN     UINTN        Blocks
+  )
+{
+#if FS_HASH_X86_ACCEL
+  if (mHasShaNi) {
+    Sha256BlocksShaNi(State, Data, Blocks);
+    return;
+  }
+#endif
+  Sha256BlocksPortable(State, Data, Blocks);
+}
+
+STATIC
+VOID
+Sha256Update (
+  IN OUT FS_SHA256_CONTEXT  *Ctx,
+  IN     CONST UINT8        *Data,
+  IN     UINTN              Size
+  )
+{
+  UINTN Take;
+
+  Ctx->Length += Size;
+
+  if (Ctx->BlockUsed > 0) {
+    Take = 64 - Ctx->BlockUsed;
+    if (Take > Size) {
+      Take = Size;
+    }
+    CopyMem(Ctx->Block + Ctx->BlockUsed, Data, Take);
+    Ctx->BlockUsed += Take;
+    Data += Take;
+    Size -= Take;
+    if (Ctx->BlockUsed < 64) {
+      return;
+    }
+    Sha256Blocks(Ctx->State, Ctx->Block, 1);
+    Ctx->BlockUsed = 0;
+  }
+
+  if (Size >= 64) {
+    Sha256Blocks(Ctx->State, Data, Size / 64);
+    Data += Size & ~(UINTN)63;
+    Size &= 63;
+  }
+
+  if (Size > 0) {
+    CopyMem(Ctx->Block, Data, Size);
+    Ctx->BlockUsed = Size;
+  }
+}
+
+STATIC
+VOID
+Sha256Final (
+  IN OUT FS_SHA256_CONTEXT  *Ctx,
+  OUT    UINT8              Digest[FS_SHA256_DIGEST_SIZE]
+  )
+{
+  UINT64 BitLength;
+  UINTN  i;
+
+  BitLength = Ctx->Length * 8;
+
+  Ctx->Block[Ctx->BlockUsed++] = 0x80;
+  if (Ctx->BlockUsed > 56) {
+    ZeroMem(Ctx->Block + Ctx->BlockUsed, 64 - Ctx->BlockUsed);
+    Sha256Blocks(Ctx->State, Ctx->Block, 1);
+    Ctx->BlockUsed = 0;
+  }
+  ZeroMem(Ctx->Block + Ctx->BlockUsed, 56 - Ctx->BlockUsed);
+  for (i = 0; i < 8; i++) {
+    Ctx->Block[56 + i] = (UINT8)(BitLength >> (56 - 8 * i));
+  }
+  Sha256Blocks(Ctx->State, Ctx->Block, 1);
+
+  for (i = 0; i < 8; i++) {
+    Digest[4 * i]     = (UINT8)(Ctx->State[i] >> 24);
+    Digest[4 * i + 1] = (UINT8)(Ctx->State[i] >> 16);
+    Digest[4 * i + 2] = (UINT8)(Ctx->State[i] >> 8);
+    Digest[4 * i + 3] = (UINT8)(Ctx->State[i]);
+  }
+}
+
+/* ------------------------- Combined context ------------------------- */
+
+VOID
+FsHashInit (
+  OUT FS_HASH_CONTEXT  *Context,
+  IN  UINT32           Kinds
+  )
+{
+  HashProbeCpu();
+
+  ZeroMem(Context, sizeof(*Context));
+  Context->Kinds = Kinds;
+  CopyMem(Context->Sha256.State, mSha256Init, sizeof(mSha256Init));
+}
+
+VOID
+FsHashUpdate (
+  IN OUT FS_HASH_CONTEXT  *Context,
+  IN     CONST VOID       *Data,
+  IN     UINTN            Size
+  )
+{
+  if ((Context->Kinds & FS_HASH_SHA256) != 0) {
+    Sha256Update(&Context->Sha256, (CONST UINT8 *)Data, Size);
+  }
+  if ((Context->Kinds & FS_HASH_CRC32C) != 0) {
+    Context->Crc32c = FsCrc32cUpdate(Context->Crc32c, Data, Size);
+  }
+}
+
+VOID
+FsHashFinal (
+  IN OUT FS_HASH_CONTEXT  *Context,
+  OUT    UINT8            Sha256[FS_SHA256_DIGEST_SIZE],
+  OUT    UINT32           *Crc32c
+  )
+{
+  if (Sha256 != NULL) {
+    if ((Context->Kinds & FS_HASH_SHA256) != 0) {
+      Sha256Final(&Context->Sha256, Sha256);
+    } else {
+      ZeroMem(Sha256, FS_SHA256_DIGEST_SIZE);
+    }
+  }
+  if (Crc32c != NULL) {
+    *Crc32c = Context->Crc32c;
+  }
+}
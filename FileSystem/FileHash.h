@@ -0,0 +1,68 @@
+/** @file
+  Streaming file hashes for FileSystem.efi - Header
+  - SHA-256 (portable, or SHA-NI when CPUID reports it)
+  - CRC32C  (slicing-by-8 table, or SSE4.2 CRC32 instruction)
+**/
+
+#ifndef __FILE_HASH_H__
+#define __FILE_HASH_H__
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#define FS_SHA256_DIGEST_SIZE  32
+
+/* Which hashes an FS_HASH_CONTEXT computes */
+#define FS_HASH_SHA256         BIT0
+#define FS_HASH_CRC32C         BIT1
+#define FS_HASH_ALL            (FS_HASH_SHA256 | FS_HASH_CRC32C)
+
+typedef struct {
+  UINT32  State[8];
+  UINT64  Length;             /* total bytes hashed */
+  UINT8   Block[64];          /* partial block not yet compressed */
+  UINTN   BlockUsed;
+} FS_SHA256_CONTEXT;
+
+typedef struct {
+  UINT32             Kinds;   /* FS_HASH_xxx */
+  FS_SHA256_CONTEXT  Sha256;
+  UINT32             Crc32c;
+} FS_HASH_CONTEXT;
+
+VOID
+FsHashInit (
+  OUT FS_HASH_CONTEXT  *Context,
+  IN  UINT32           Kinds
+  );
+
+VOID
+FsHashUpdate (
+  IN OUT FS_HASH_CONTEXT  *Context,
+  IN     CONST VOID       *Data,
+  IN     UINTN            Size
+  );
+
+VOID
+FsHashFinal (
+  IN OUT FS_HASH_CONTEXT  *Context,
+  OUT    UINT8            Sha256[FS_SHA256_DIGEST_SIZE],
+  OUT    UINT32           *Crc32c
+  );
+
+/* Running CRC32C with the usual pre/post inversion; start from 0 */
+UINT32
+FsCrc32cUpdate (
+  IN UINT32      Crc,
+  IN CONST VOID  *Data,
+  IN UINTN       Size
+  );
+
+/* Short description of the code paths picked from CPUID, e.g. "SHA-NI, SSE4.2" */
+CONST CHAR16 *
+FsHashEngineName (
+  VOID
+  );
+
+#endif /* __FILE_HASH_H__ */
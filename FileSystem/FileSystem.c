@@ -1,11 +1,17 @@
 /** @file
-  This application operates on the file system of the device from which it was loaded. It supports the following commands:
+  This application operates on the file system of the device from which it was loaded,
+  or on any other volume named by a prefix (see -vol). It supports the following commands:
     - Create an empty file
-    - Copy a file
-    - Read a file and display its content
+    - Copy a file, optionally skipping all-zero blocks or resumable
+    - Display a file page by page, as text or hex
+    - Decompress gzip, zlib or EDK II compressed files while copying or displaying
     - Delete a file
-    - Merge two files into a third file
+    - Merge any number of files into one, with a merge benchmark
+    - Benchmark the volume (throughput per chunk size, metadata costs)
     - Show file information
+    - Compute or verify SHA-256 / CRC32C of a file, optionally while copying
+    - List, copy or delete a directory tree
+    - List file system volumes
 **/
 
 #include <Uefi.h>
@@ -14,10 +20,19 @@
 #include <Library/UefiApplicationEntryPoint.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/TimerLib.h>
 #include <Protocol/SimpleFileSystem.h>
 #include <Protocol/LoadedImage.h>
 #include <Protocol/EfiShellParameters.h>
+#include <Protocol/Shell.h>
+#include <Protocol/Decompress.h>
 #include <Guid/FileInfo.h>
+#include <Guid/FileSystemInfo.h>
+#include "FileHash.h"
+#include "Inflate.h"
+#include "../Common/LatencyLib.h"
 
 //
 // Get root directory on the *current storage device* where this
@@ -73,379 +88,3894 @@ GetRootOnCurrentDevice (
 }
 
 //
-// Read a whole file into a buffer (allocated).
-// Caller must FreePool(Buffer) when done.
+// File system volumes.
 //
+// Every EFI_SIMPLE_FILE_SYSTEM_PROTOCOL handle is a volume; roots are opened
+// on first use and closed at exit. A file argument may name its volume with a
+// prefix ending in ':' before the first '\':
+//   vol2:\EFI\Boot\file     volume index as listed by -vol
+//   fs1:\file               shell mapping (needs the UEFI Shell)
+//   PciRoot(0x0)/...:\file  device path text of the volume
+// Without a prefix the path is relative to the volume this image was loaded
+// from, as before.
+//
+#define FS_MAX_VOLUMES  64
+
+typedef struct {
+  EFI_HANDLE         Handle;
+  EFI_FILE_PROTOCOL  *Root;
+} FS_VOLUME;
+
+STATIC FS_VOLUME  mVolumes[FS_MAX_VOLUMES];
+STATIC UINTN      mVolumeCount = 0;
+
 STATIC
 EFI_STATUS
-ReadFileToBuffer (
-  IN  EFI_FILE_PROTOCOL  *Root,
-  IN  CHAR16             *FileName,
-  OUT VOID               **Buffer,
-  OUT UINTN              *BufferSize
+EnumerateVolumes (
+  VOID
   )
 {
-  EFI_STATUS        Status;
-  EFI_FILE_PROTOCOL *File;
-  EFI_FILE_INFO     *FileInfo;
-  UINTN             InfoSize;
-  VOID              *LocalBuffer;
-  UINTN             Size;
+  EFI_STATUS Status;
+  EFI_HANDLE *Handles;
+  UINTN      HandleCount;
+  UINTN      Index;
 
-  if (Root == NULL || FileName == NULL || Buffer == NULL || BufferSize == NULL) {
-    return EFI_INVALID_PARAMETER;
+  if (mVolumeCount > 0) {
+    return EFI_SUCCESS;
+  }
+
+  Status = gBS->LocateHandleBuffer(
+                  ByProtocol,
+                  &gEfiSimpleFileSystemProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &Handles
+                  );
+  if (EFI_ERROR(Status)) {
+    Print(L"No file system volumes found: %r\n", Status);
+    return Status;
+  }
+
+  for (Index = 0; Index < HandleCount && Index < FS_MAX_VOLUMES; Index++) {
+    mVolumes[Index].Handle = Handles[Index];
+    mVolumes[Index].Root   = NULL;
   }
+  mVolumeCount = Index;
+
+  FreePool(Handles);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+OpenVolumeRoot (
+  IN  UINTN              Index,
+  OUT EFI_FILE_PROTOCOL  **Root
+  )
+{
+  EFI_STATUS                       Status;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL  *SimpleFs;
 
-  *Buffer = NULL;
-  *BufferSize = 0;
+  if (Index >= mVolumeCount) {
+    Print(L"No volume %d (%d volumes found)\n", Index, mVolumeCount);
+    return EFI_NOT_FOUND;
+  }
 
-  // Open the file for read
-  Status = Root->Open(
-                    Root,
-                    &File,
-                    FileName,
-                    EFI_FILE_MODE_READ,
-                    0
+  if (mVolumes[Index].Root == NULL) {
+    Status = gBS->HandleProtocol(
+                    mVolumes[Index].Handle,
+                    &gEfiSimpleFileSystemProtocolGuid,
+                    (VOID **)&SimpleFs
                     );
-  if (EFI_ERROR (Status)) {
-    Print(L"Open file '%s' failed: %r\n", FileName, Status);
+    if (!EFI_ERROR(Status)) {
+      Status = SimpleFs->OpenVolume(SimpleFs, &mVolumes[Index].Root);
+    }
+    if (EFI_ERROR(Status)) {
+      Print(L"OpenVolume vol%d failed: %r\n", Index, Status);
+      mVolumes[Index].Root = NULL;
+      return Status;
+    }
+  }
+
+  *Root = mVolumes[Index].Root;
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+CloseVolumes (
+  VOID
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < mVolumeCount; Index++) {
+    if (mVolumes[Index].Root != NULL) {
+      mVolumes[Index].Root->Close(mVolumes[Index].Root);
+      mVolumes[Index].Root = NULL;
+    }
+  }
+}
+
+//
+// Find the volume whose device path is exactly DevicePath.
+//
+STATIC
+EFI_STATUS
+FindVolumeByDevicePath (
+  IN  CONST EFI_DEVICE_PATH_PROTOCOL *DevicePath,
+  OUT UINTN                          *Index
+  )
+{
+  EFI_STATUS               Status;
+  EFI_DEVICE_PATH_PROTOCOL *Remaining;
+  EFI_HANDLE               Handle;
+
+  Remaining = (EFI_DEVICE_PATH_PROTOCOL *)DevicePath;
+  Status = gBS->LocateDevicePath(&gEfiSimpleFileSystemProtocolGuid, &Remaining, &Handle);
+  if (EFI_ERROR(Status) || !IsDevicePathEnd(Remaining)) {
+    return EFI_NOT_FOUND;
+  }
+
+  for (*Index = 0; *Index < mVolumeCount; (*Index)++) {
+    if (mVolumes[*Index].Handle == Handle) {
+      return EFI_SUCCESS;
+    }
+  }
+  return EFI_NOT_FOUND;
+}
+
+//
+// Split Spec into the root of the volume it names and the path on it.
+// *Path points into Spec.
+//
+STATIC
+EFI_STATUS
+ResolveFileSpec (
+  IN  EFI_FILE_PROTOCOL  *DefaultRoot,
+  IN  CHAR16             *Spec,
+  OUT EFI_FILE_PROTOCOL  **Root,
+  OUT CHAR16             **Path
+  )
+{
+  EFI_STATUS               Status;
+  CHAR16                   Prefix[256];
+  CHAR16                   *End;
+  UINTN                    Colon;
+  UINTN                    Index;
+  EFI_SHELL_PROTOCOL       *Shell;
+  CONST EFI_DEVICE_PATH_PROTOCOL *MapPath;
+  EFI_DEVICE_PATH_PROTOCOL *TextPath;
+
+  //
+  // The volume prefix ends at the last ':' before the first '\'.
+  //
+  Colon = MAX_UINTN;
+  for (Index = 0; Spec[Index] != L'\0' && Spec[Index] != L'\\'; Index++) {
+    if (Spec[Index] == L':') {
+      Colon = Index;
+    }
+  }
+
+  if (Colon == MAX_UINTN) {
+    *Root = DefaultRoot;
+    *Path = Spec;
+    return EFI_SUCCESS;
+  }
+
+  if (Colon + 2 > ARRAY_SIZE(Prefix)) {
+    Print(L"Volume name too long in '%s'\n", Spec);
+    return EFI_INVALID_PARAMETER;
+  }
+  CopyMem(Prefix, Spec, Colon * sizeof(CHAR16));
+  Prefix[Colon] = L'\0';
+
+  *Path = (Spec[Colon + 1] != L'\0') ? &Spec[Colon + 1] : L"\\";
+
+  Status = EnumerateVolumes();
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  if (StrnCmp(Prefix, L"vol", 3) == 0 && Prefix[3] >= L'0' && Prefix[3] <= L'9') {
+    if (RETURN_ERROR(StrDecimalToUintnS(&Prefix[3], &End, &Index)) || *End != L'\0') {
+      Print(L"Bad volume number in '%s'\n", Spec);
+      return EFI_INVALID_PARAMETER;
+    }
+    return OpenVolumeRoot(Index, Root);
+  }
+
+  //
+  // Shell mapping such as fs0: first, then device path text.
+  //
+  Status = gBS->LocateProtocol(&gEfiShellProtocolGuid, NULL, (VOID **)&Shell);
+  if (!EFI_ERROR(Status)) {
+    Prefix[Colon]     = L':';
+    Prefix[Colon + 1] = L'\0';
+    MapPath = Shell->GetDevicePathFromMap(Prefix);
+    Prefix[Colon]     = L'\0';
+    if (MapPath != NULL && !EFI_ERROR(FindVolumeByDevicePath(MapPath, &Index))) {
+      return OpenVolumeRoot(Index, Root);
+    }
+  }
+
+  TextPath = ConvertTextToDevicePath(Prefix);
+  if (TextPath != NULL) {
+    Status = FindVolumeByDevicePath(TextPath, &Index);
+    FreePool(TextPath);
+    if (!EFI_ERROR(Status)) {
+      return OpenVolumeRoot(Index, Root);
+    }
+  }
+
+  Print(L"Unknown volume '%s' (see -vol)\n", Prefix);
+  return EFI_NOT_FOUND;
+}
+
+//
+// EFI_FILE_PROTOCOL::Open() for a file argument that may carry a volume
+// prefix; unprefixed names are opened relative to DefaultRoot.
+//
+STATIC
+EFI_STATUS
+OpenFileSpec (
+  IN  EFI_FILE_PROTOCOL  *DefaultRoot,
+  OUT EFI_FILE_PROTOCOL  **File,
+  IN  CHAR16             *Spec,
+  IN  UINT64             OpenMode,
+  IN  UINT64             Attributes
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Root;
+  CHAR16            *Path;
+
+  Status = ResolveFileSpec(DefaultRoot, Spec, &Root, &Path);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  return Root->Open(Root, File, Path, OpenMode, Attributes);
+}
+
+//
+// Longest path, in characters, that the commands build or compare.
+//
+#define FS_MAX_PATH  512
+
+//
+// Handle of the volume a root returned by ResolveFileSpec lives on, or
+// NULL if it cannot be told.
+//
+STATIC
+EFI_HANDLE
+VolumeOfRoot (
+  IN EFI_FILE_PROTOCOL *DefaultRoot,
+  IN EFI_FILE_PROTOCOL *Root
+  )
+{
+  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+  UINTN                     Index;
+
+  if (Root == DefaultRoot) {
+    if (EFI_ERROR(gBS->HandleProtocol(gImageHandle, &gEfiLoadedImageProtocolGuid,
+                                      (VOID **)&LoadedImage))) {
+      return NULL;
+    }
+    return LoadedImage->DeviceHandle;
+  }
+
+  for (Index = 0; Index < mVolumeCount; Index++) {
+    if (mVolumes[Index].Root == Root) {
+      return mVolumes[Index].Handle;
+    }
+  }
+  return NULL;
+}
+
+//
+// Copy Path to Out in canonical form: no leading, trailing or doubled
+// '\', with "." and ".." components resolved.
+//
+STATIC
+EFI_STATUS
+NormalizePath (
+  IN  CONST CHAR16 *Path,
+  OUT CHAR16       *Out,
+  IN  UINTN        OutCount
+  )
+{
+  UINTN Length;
+  UINTN End;
+
+  Length = 0;
+  while (*Path != L'\0') {
+    while (*Path == L'\\') {
+      Path++;
+    }
+    for (End = 0; Path[End] != L'\0' && Path[End] != L'\\'; End++) {
+    }
+    if (End == 0 || (End == 1 && Path[0] == L'.')) {
+      // nothing
+    } else if (End == 2 && Path[0] == L'.' && Path[1] == L'.') {
+      while (Length > 0 && Out[Length - 1] != L'\\') {
+        Length--;
+      }
+      if (Length > 0) {
+        Length--;
+      }
+    } else {
+      if (Length + End + 2 > OutCount) {
+        return EFI_BUFFER_TOO_SMALL;
+      }
+      if (Length > 0) {
+        Out[Length++] = L'\\';
+      }
+      CopyMem(&Out[Length], Path, End * sizeof(CHAR16));
+      Length += End;
+    }
+    Path += End;
+  }
+  Out[Length] = L'\0';
+  return EFI_SUCCESS;
+}
+
+//
+// How the file or directory named by spec B relates to the one named by
+// spec A. Both specs are resolved to their volume and a normalized path,
+// and the paths are compared without regard to case, as FAT does.
+//
+typedef enum {
+  SpecUnrelated,
+  SpecSame,
+  SpecInside          // B lies below A
+} FS_SPEC_RELATION;
+
+STATIC
+FS_SPEC_RELATION
+CompareFileSpecs (
+  IN EFI_FILE_PROTOCOL *DefaultRoot,
+  IN CHAR16            *SpecA,
+  IN CHAR16            *SpecB
+  )
+{
+  EFI_FILE_PROTOCOL *RootA;
+  EFI_FILE_PROTOCOL *RootB;
+  CHAR16            *Path;
+  CHAR16            PathA[FS_MAX_PATH];
+  CHAR16            PathB[FS_MAX_PATH];
+  EFI_HANDLE        Volume;
+  UINTN             Index;
+
+  if (EFI_ERROR(ResolveFileSpec(DefaultRoot, SpecA, &RootA, &Path)) ||
+      EFI_ERROR(NormalizePath(Path, PathA, ARRAY_SIZE(PathA))) ||
+      EFI_ERROR(ResolveFileSpec(DefaultRoot, SpecB, &RootB, &Path)) ||
+      EFI_ERROR(NormalizePath(Path, PathB, ARRAY_SIZE(PathB)))) {
+    return SpecUnrelated;
+  }
+
+  if (RootA != RootB) {
+    Volume = VolumeOfRoot(DefaultRoot, RootA);
+    if (Volume == NULL || Volume != VolumeOfRoot(DefaultRoot, RootB)) {
+      return SpecUnrelated;
+    }
+  }
+
+  for (Index = 0; PathA[Index] != L'\0'; Index++) {
+    if (CharToUpper(PathA[Index]) != CharToUpper(PathB[Index])) {
+      return SpecUnrelated;
+    }
+  }
+  if (PathB[Index] == L'\0') {
+    return SpecSame;
+  }
+  if (Index == 0 || PathB[Index] == L'\\') {
+    return SpecInside;
+  }
+  return SpecUnrelated;
+}
+
+//
+// The copy commands truncate or pre-size the destination before reading
+// the source, so writing a file onto itself would destroy it.
+//
+STATIC
+BOOLEAN
+IsSameFile (
+  IN EFI_FILE_PROTOCOL *DefaultRoot,
+  IN CHAR16            *SrcFile,
+  IN CHAR16            *DstFile
+  )
+{
+  if (CompareFileSpecs(DefaultRoot, SrcFile, DstFile) != SpecSame) {
+    return FALSE;
+  }
+  Print(L"'%s' and '%s' are the same file\n", SrcFile, DstFile);
+  return TRUE;
+}
+
+//
+// -vol: list all volumes.
+//
+STATIC
+EFI_STATUS
+DoListVolumes (
+  IN EFI_HANDLE ImageHandle
+  )
+{
+  EFI_STATUS                Status;
+  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+  EFI_FILE_PROTOCOL         *Root;
+  EFI_FILE_SYSTEM_INFO      *FsInfo;
+  UINTN                     InfoSize;
+  CHAR16                    *PathText;
+  UINTN                     Index;
+
+  Status = EnumerateVolumes();
+  if (EFI_ERROR(Status)) {
     return Status;
   }
 
-  // First, get file size using GetInfo with EFI_FILE_INFO_GUID.
+  LoadedImage = NULL;
+  gBS->HandleProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid, (VOID **)&LoadedImage);
+
+  Print(L"Vol    Size(MB)   Free(MB)  RO  Label / Device path\n");
+  for (Index = 0; Index < mVolumeCount; Index++) {
+    Print(L"%cvol%-2d",
+          (LoadedImage != NULL && LoadedImage->DeviceHandle == mVolumes[Index].Handle) ? L'*' : L' ',
+          Index);
+
+    FsInfo = NULL;
+    if (!EFI_ERROR(OpenVolumeRoot(Index, &Root))) {
+      InfoSize = 0;
+      Status = Root->GetInfo(Root, &gEfiFileSystemInfoGuid, &InfoSize, NULL);
+      if (Status == EFI_BUFFER_TOO_SMALL) {
+        FsInfo = AllocatePool(InfoSize);
+        if (FsInfo != NULL &&
+            EFI_ERROR(Root->GetInfo(Root, &gEfiFileSystemInfoGuid, &InfoSize, FsInfo))) {
+          FreePool(FsInfo);
+          FsInfo = NULL;
+        }
+      }
+    }
+
+    if (FsInfo != NULL) {
+      Print(L" %10ld %10ld  %s  %s\n",
+            RShiftU64(FsInfo->VolumeSize, 20),
+            RShiftU64(FsInfo->FreeSpace, 20),
+            FsInfo->ReadOnly ? L"Y" : L"N",
+            FsInfo->VolumeLabel);
+      FreePool(FsInfo);
+    } else {
+      Print(L" %10s %10s  ?\n", L"?", L"?");
+    }
+
+    PathText = ConvertDevicePathToText(DevicePathFromHandle(mVolumes[Index].Handle), FALSE, FALSE);
+    Print(L"       %s\n", (PathText != NULL) ? PathText : L"(no device path)");
+    if (PathText != NULL) {
+      FreePool(PathText);
+    }
+  }
+  Print(L"* = volume this image was loaded from\n");
+
+  return EFI_SUCCESS;
+}
+
+//
+// Size of an open file from EFI_FILE_INFO.
+//
+STATIC
+EFI_STATUS
+GetFileSize (
+  IN  EFI_FILE_PROTOCOL *File,
+  OUT UINT64            *Size
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *Info;
+  UINTN         InfoSize;
+
   InfoSize = 0;
   Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, NULL);
   if (Status != EFI_BUFFER_TOO_SMALL) {
-    Print(L"GetInfo (size) failed: %r\n", Status);
-    File->Close(File);
     return Status;
   }
 
-  FileInfo = AllocatePool (InfoSize);
-  if (FileInfo == NULL) {
-    File->Close(File);
+  Info = AllocatePool(InfoSize);
+  if (Info == NULL) {
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, FileInfo);
-  if (EFI_ERROR (Status)) {
-    Print(L"GetInfo failed: %r\n", Status);
-    FreePool(FileInfo);
-    File->Close(File);
+  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
+  if (!EFI_ERROR(Status)) {
+    *Size = Info->FileSize;
+  }
+  FreePool(Info);
+  return Status;
+}
+
+//
+// Grow or truncate an open file through SetInfo. Growing lets the file
+// system allocate all clusters in one go instead of write by write.
+//
+STATIC
+EFI_STATUS
+SetFileSize (
+  IN EFI_FILE_PROTOCOL *File,
+  IN UINT64            Size
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *Info;
+  UINTN         InfoSize;
+
+  InfoSize = 0;
+  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, NULL);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
     return Status;
   }
 
-  Size = (UINTN) FileInfo->FileSize;
-  LocalBuffer = AllocatePool (Size + 1);  // +1 for ASCII NUL if text
-  if (LocalBuffer == NULL) {
-    FreePool(FileInfo);
-    File->Close(File);
-    return EFI_OUT_OF_RESOURCES;
+  Info = AllocatePool(InfoSize);
+  if (Info == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
+  if (!EFI_ERROR(Status) && Info->FileSize != Size) {
+    Info->FileSize = Size;
+    Status = File->SetInfo(File, &gEfiFileInfoGuid, InfoSize, Info);
+  }
+  FreePool(Info);
+  return Status;
+}
+
+//
+// Streaming copy engine.
+//
+// Data is moved in FS_CHUNK_SIZE pieces through two buffers. When both file
+// handles implement EFI_FILE_PROTOCOL revision 2, ReadEx/WriteEx are issued
+// with an event in the token so the read of chunk N+1 overlaps the write of
+// chunk N. A handle that does not support the asynchronous calls (revision 1,
+// or a driver returning EFI_UNSUPPORTED) is driven with plain Read/Write.
+// With no Dst the engine only reads, e.g. to feed Hash; with a Hash context
+// every chunk is hashed while the next transfers are in flight.
+//
+#define FS_CHUNK_SIZE  SIZE_1MB
+
+typedef struct {
+  EFI_FILE_IO_TOKEN  Token;
+  UINTN              Capacity;
+  BOOLEAN            Pending;   // TRUE while an async request is in flight
+} FS_IO_SLOT;
+
+typedef struct {
+  EFI_FILE_PROTOCOL  *Src;
+  EFI_FILE_PROTOCOL  *Dst;        // OPTIONAL
+  BOOLEAN            SrcAsync;
+  BOOLEAN            DstAsync;
+  FS_IO_SLOT         Slot[2];
+  UINT64             BytesCopied;
+  FS_HASH_CONTEXT    *Hash;       // OPTIONAL
+} FS_STREAM;
+
+STATIC
+BOOLEAN
+FileSupportsAsyncIo (
+  IN EFI_FILE_PROTOCOL *File
+  )
+{
+  return (BOOLEAN)(File->Revision >= EFI_FILE_PROTOCOL_REVISION2 &&
+                   File->ReadEx != NULL && File->WriteEx != NULL);
+}
+
+STATIC
+VOID
+StreamFree (
+  IN FS_STREAM *Stream
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < 2; Index++) {
+    if (Stream->Slot[Index].Token.Event != NULL) {
+      gBS->CloseEvent(Stream->Slot[Index].Token.Event);
+      Stream->Slot[Index].Token.Event = NULL;
+    }
+    if (Stream->Slot[Index].Token.Buffer != NULL) {
+      FreePool(Stream->Slot[Index].Token.Buffer);
+      Stream->Slot[Index].Token.Buffer = NULL;
+    }
+  }
+}
+
+STATIC
+EFI_STATUS
+StreamInit (
+  OUT FS_STREAM         *Stream,
+  IN  EFI_FILE_PROTOCOL *Src,
+  IN  EFI_FILE_PROTOCOL *Dst OPTIONAL
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  ZeroMem(Stream, sizeof(*Stream));
+  Stream->Src      = Src;
+  Stream->Dst      = Dst;
+  Stream->SrcAsync = FileSupportsAsyncIo(Src);
+  Stream->DstAsync = (Dst != NULL) ? FileSupportsAsyncIo(Dst) : FALSE;
+
+  for (Index = 0; Index < 2; Index++) {
+    Stream->Slot[Index].Capacity     = FS_CHUNK_SIZE;
+    Stream->Slot[Index].Token.Buffer = AllocatePool(FS_CHUNK_SIZE);
+    if (Stream->Slot[Index].Token.Buffer == NULL) {
+      StreamFree(Stream);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    if (Stream->SrcAsync || Stream->DstAsync) {
+      Status = gBS->CreateEvent(0, 0, NULL, NULL, &Stream->Slot[Index].Token.Event);
+      if (EFI_ERROR(Status)) {
+        // No events, no overlap: run both sides synchronously.
+        Stream->SrcAsync = FALSE;
+        Stream->DstAsync = FALSE;
+      }
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Start a read (IsWrite == FALSE) or write of Slot->Token.BufferSize bytes.
+// If the request was queued asynchronously Slot->Pending is set and the
+// caller must StreamWait() on it; otherwise the request is already complete
+// and its result is in Slot->Token.Status / Slot->Token.BufferSize.
+//
+STATIC
+EFI_STATUS
+StreamSubmit (
+  IN     EFI_FILE_PROTOCOL *File,
+  IN OUT BOOLEAN           *Async,
+  IN OUT FS_IO_SLOT        *Slot,
+  IN     BOOLEAN           IsWrite
+  )
+{
+  EFI_STATUS Status;
+
+  Slot->Pending = FALSE;
+
+  if (*Async && Slot->Token.Event != NULL) {
+    Slot->Token.Status = EFI_NOT_READY;
+    if (IsWrite) {
+      Status = File->WriteEx(File, &Slot->Token);
+    } else {
+      Status = File->ReadEx(File, &Slot->Token);
+    }
+
+    if (!EFI_ERROR(Status)) {
+      Slot->Pending = TRUE;
+      return EFI_SUCCESS;
+    }
+    if (Status != EFI_UNSUPPORTED) {
+      Slot->Token.Status = Status;
+      return Status;
+    }
+
+    // Driver only implements the blocking interface; stop trying.
+    *Async = FALSE;
+  }
+
+  if (IsWrite) {
+    Status = File->Write(File, &Slot->Token.BufferSize, Slot->Token.Buffer);
+  } else {
+    Status = File->Read(File, &Slot->Token.BufferSize, Slot->Token.Buffer);
+  }
+  Slot->Token.Status = Status;
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+StreamWait (
+  IN OUT FS_IO_SLOT *Slot
+  )
+{
+  UINTN Index;
+
+  if (Slot->Pending) {
+    gBS->WaitForEvent(1, &Slot->Token.Event, &Index);
+    Slot->Pending = FALSE;
+  }
+  return Slot->Token.Status;
+}
+
+//
+// Copy everything from the current position of Stream->Src to the current
+// position of Stream->Dst. Stream->BytesCopied accumulates across calls, so
+// one stream can be reused to append several sources.
+//
+STATIC
+EFI_STATUS
+StreamRun (
+  IN OUT FS_STREAM *Stream
+  )
+{
+  EFI_STATUS  Status;
+  EFI_STATUS  ReadStatus;
+  FS_IO_SLOT  *Cur;
+  FS_IO_SLOT  *Next;
+  UINTN       Length;
+
+  Cur  = &Stream->Slot[0];
+  Next = &Stream->Slot[1];
+
+  Cur->Token.BufferSize = Cur->Capacity;
+  StreamSubmit(Stream->Src, &Stream->SrcAsync, Cur, FALSE);
+  Status = StreamWait(Cur);
+  if (EFI_ERROR(Status)) {
+    Print(L"Read source failed: %r\n", Status);
+    return Status;
+  }
+
+  while (Cur->Token.BufferSize > 0) {
+    Length = Cur->Token.BufferSize;
+
+    //
+    // Queue the write of this chunk first, then the read of the next one,
+    // so the two transfers run concurrently when both sides are async.
+    //
+    if (Stream->Dst != NULL) {
+      StreamSubmit(Stream->Dst, &Stream->DstAsync, Cur, TRUE);
+    }
+
+    Next->Token.BufferSize = Next->Capacity;
+    StreamSubmit(Stream->Src, &Stream->SrcAsync, Next, FALSE);
+
+    if (Stream->Hash != NULL) {
+      FsHashUpdate(Stream->Hash, Cur->Token.Buffer, Length);
+    }
+
+    Status     = StreamWait(Cur);
+    ReadStatus = StreamWait(Next);
+
+    if (EFI_ERROR(Status)) {
+      Print(L"Write dest file failed: %r\n", Status);
+      return Status;
+    }
+    if (Cur->Token.BufferSize != Length) {
+      Print(L"Short write to dest file (%d of %d bytes)\n", Cur->Token.BufferSize, Length);
+      return EFI_DEVICE_ERROR;
+    }
+    if (EFI_ERROR(ReadStatus)) {
+      Print(L"Read source failed: %r\n", ReadStatus);
+      return ReadStatus;
+    }
+
+    Stream->BytesCopied += Length;
+
+    Cur  = Next;
+    Next = (Cur == &Stream->Slot[0]) ? &Stream->Slot[1] : &Stream->Slot[0];
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// When set, DoCreateOrCopy and DoDeleteFile only report failures. The
+// benchmarks use this to drive the real command paths without flooding
+// the console.
+//
+STATIC BOOLEAN  mQuiet = FALSE;
+
+//
+// Create (empty) file or copy from source file.
+// If Hash is given, the copied data is fed into it on the way through.
+//
+STATIC
+EFI_STATUS
+DoCreateOrCopy (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *SrcFile OPTIONAL,
+  IN CHAR16            *DstFile,
+  IN FS_HASH_CONTEXT   *Hash OPTIONAL
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Src = NULL;
+  EFI_FILE_PROTOCOL *Dst;
+  FS_STREAM         Stream;
+
+  if (Root == NULL || DstFile == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (SrcFile != NULL) {
+    if (IsSameFile(Root, SrcFile, DstFile)) {
+      return EFI_INVALID_PARAMETER;
+    }
+    Status = OpenFileSpec(Root, &Src, SrcFile, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) {
+      Print(L"Open file '%s' failed: %r\n", SrcFile, Status);
+      return Status;
+    }
+  }
+
+  // Open/create destination file
+  Status = OpenFileSpec(
+             Root,
+             &Dst,
+             DstFile,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR (Status)) {
+    Print(L"Create/open dest file '%s' failed: %r\n", DstFile, Status);
+    if (Src != NULL) {
+      Src->Close(Src);
+    }
+    return Status;
+  }
+
+  // Drop any old contents so a shorter copy leaves no stale tail
+  Status = SetFileSize(Dst, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Truncate dest file '%s' failed: %r\n", DstFile, Status);
+    if (Src != NULL) {
+      Src->Close(Src);
+    }
+    Dst->Close(Dst);
+    return Status;
+  }
+
+  if (Src != NULL) {
+    Status = StreamInit(&Stream, Src, Dst);
+    if (!EFI_ERROR(Status)) {
+      Stream.Hash = Hash;
+      Status = StreamRun(&Stream);
+      if (!EFI_ERROR(Status) && !mQuiet) {
+        Print(L"Copied %ld bytes from '%s' to '%s' (%s I/O)\n",
+              Stream.BytesCopied, SrcFile, DstFile,
+              (Stream.SrcAsync && Stream.DstAsync) ? L"overlapped" : L"synchronous");
+      }
+      StreamFree(&Stream);
+    } else {
+      Print(L"Allocate copy buffers failed: %r\n", Status);
+    }
+    Src->Close(Src);
+  } else if (!mQuiet) {
+    // Just create empty file
+    Print(L"Created empty file '%s'\n", DstFile);
+  }
+
+  Dst->Close(Dst);
+
+  return Status;
+}
+
+//
+// Compressed input.
+//
+// An FS_DECODER hands out the decompressed contents of an open file.
+// gzip and zlib data is inflated as it is read (Inflate.c), with fixed
+// buffers whatever the file size. EDK II/Tiano compressed files go through
+// EFI_DECOMPRESS_PROTOCOL, whose interface only takes whole buffers, so
+// for those the compressed file and its output are held in memory.
+//
+// Reads are sequential; reading at an earlier offset restarts the inflate
+// from the beginning of the file. The paged viewer keeps a window of decoded
+// bytes around the screen, so only paging back past the start of that window
+// re-decodes the stream.
+//
+#define FS_DECODE_TIANO       3
+#define FS_DEFLATE_MAX_RATIO  1032        // deflate cannot expand data further
+
+typedef struct {
+  EFI_FILE_PROTOCOL  *File;
+  UINT32             Format;         // FS_INFLATE_xxx or FS_DECODE_TIANO
+  FS_INFLATE         *Inflate;
+  UINT8              *Output;        // Tiano: whole decompressed image
+  UINT8              *Scratch;       // inflate: discard buffer for seeks
+  UINT64             CompressedSize;
+  UINT64             Size;           // decompressed size, once known
+  BOOLEAN            SizeKnown;
+  UINT64             Position;       // decompressed bytes handed out
+} FS_DECODER;
+
+STATIC
+EFI_STATUS
+DecoderInput (
+  IN     VOID  *Context,
+  OUT    VOID  *Buffer,
+  IN OUT UINTN *Size
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = Context;
+  return File->Read(File, Size, Buffer);
+}
+
+STATIC
+CONST CHAR16 *
+DecoderName (
+  IN FS_DECODER *Decoder
+  )
+{
+  switch (Decoder->Format) {
+  case FS_INFLATE_GZIP:
+    return L"gzip";
+  case FS_INFLATE_ZLIB:
+    return L"zlib";
+  case FS_DECODE_TIANO:
+    return L"EDK II";
+  default:
+    return L"?";
+  }
+}
+
+//
+// Decompress a whole Tiano/EFI compressed file into Decoder->Output.
+//
+STATIC
+EFI_STATUS
+DecoderLoadTiano (
+  IN FS_DECODER *Decoder
+  )
+{
+  EFI_STATUS              Status;
+  EFI_DECOMPRESS_PROTOCOL *Decompress;
+  UINT8                   *Source;
+  VOID                    *Scratch;
+  UINTN                   Size;
+  UINT32                  DestinationSize;
+  UINT32                  ScratchSize;
+
+  Status = gBS->LocateProtocol(&gEfiDecompressProtocolGuid, NULL, (VOID **)&Decompress);
+  if (EFI_ERROR(Status)) {
+    Print(L"EFI_DECOMPRESS_PROTOCOL not available: %r\n", Status);
+    return Status;
+  }
+
+  Source = AllocatePool((UINTN)Decoder->CompressedSize);
+  if (Source == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Size   = (UINTN)Decoder->CompressedSize;
+  Status = Decoder->File->SetPosition(Decoder->File, 0);
+  if (!EFI_ERROR(Status)) {
+    Status = Decoder->File->Read(Decoder->File, &Size, Source);
+  }
+  if (!EFI_ERROR(Status) && Size != Decoder->CompressedSize) {
+    Status = EFI_END_OF_FILE;
+  }
+  if (!EFI_ERROR(Status)) {
+    Status = Decompress->GetInfo(Decompress, Source, (UINT32)Size, &DestinationSize, &ScratchSize);
+  }
+  if (EFI_ERROR(Status)) {
+    FreePool(Source);
+    return Status;
+  }
+
+  Decoder->Output = AllocatePool(MAX(DestinationSize, 1));
+  Scratch         = AllocatePool(ScratchSize);
+  if (Decoder->Output == NULL || Scratch == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+  } else {
+    Status = Decompress->Decompress(Decompress, Source, (UINT32)Size,
+                                    Decoder->Output, DestinationSize, Scratch, ScratchSize);
+  }
+
+  if (Scratch != NULL) {
+    FreePool(Scratch);
+  }
+  FreePool(Source);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Decoder->Size      = DestinationSize;
+  Decoder->SizeKnown = TRUE;
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+DecoderClose (
+  IN FS_DECODER *Decoder
+  )
+{
+  FsInflateClose(Decoder->Inflate);
+  if (Decoder->Output != NULL) {
+    FreePool(Decoder->Output);
+  }
+  if (Decoder->Scratch != NULL) {
+    FreePool(Decoder->Scratch);
+  }
+  ZeroMem(Decoder, sizeof(*Decoder));
+}
+
+//
+// Recognize the compression format of File and prepare to decode it.
+// EFI_UNSUPPORTED if the file is not compressed in a known format.
+//
+STATIC
+EFI_STATUS
+DecoderOpen (
+  IN  EFI_FILE_PROTOCOL *File,
+  OUT FS_DECODER        *Decoder
+  )
+{
+  EFI_STATUS Status;
+  UINT8      Head[8];
+  UINT32     Trailer;
+  UINTN      Size;
+
+  ZeroMem(Decoder, sizeof(*Decoder));
+  Decoder->File = File;
+
+  Status = GetFileSize(File, &Decoder->CompressedSize);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  ZeroMem(Head, sizeof(Head));
+  Size   = sizeof(Head);
+  Status = File->SetPosition(File, 0);
+  if (!EFI_ERROR(Status)) {
+    Status = File->Read(File, &Size, Head);
+  }
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // EDK II compressed data starts with UINT32 CompressedSize and
+  // UINT32 OriginalSize; the compressed size excludes that header.
+  //
+  if (Size == sizeof(Head) &&
+      (UINT64)ReadUnaligned32((UINT32 *)Head) + 8 == Decoder->CompressedSize) {
+    Decoder->Format = FS_DECODE_TIANO;
+    Status = DecoderLoadTiano(Decoder);
+    if (EFI_ERROR(Status)) {
+      DecoderClose(Decoder);
+    }
+    return Status;
+  }
+
+  Decoder->Format = FsInflateDetect(Head, Size);
+  if (Decoder->Format == FS_INFLATE_NONE) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // gzip's trailer holds the size modulo 4 GB, which is exact whenever the
+  // compressed file is too small to expand past 4 GB.
+  //
+  if (Decoder->Format == FS_INFLATE_GZIP &&
+      Decoder->CompressedSize < DivU64x32(SIZE_4GB, FS_DEFLATE_MAX_RATIO)) {
+    Size   = sizeof(Trailer);
+    Status = File->SetPosition(File, Decoder->CompressedSize - sizeof(Trailer));
+    if (!EFI_ERROR(Status)) {
+      Status = File->Read(File, &Size, &Trailer);
+    }
+    if (!EFI_ERROR(Status) && Size == sizeof(Trailer)) {
+      Decoder->Size      = Trailer;
+      Decoder->SizeKnown = TRUE;
+    }
+  }
+
+  Decoder->Scratch = AllocatePool(FS_CHUNK_SIZE);
+  if (Decoder->Scratch == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = File->SetPosition(File, 0);
+  if (!EFI_ERROR(Status)) {
+    Status = FsInflateOpen(Decoder->Format, DecoderInput, File, &Decoder->Inflate);
+  }
+  if (EFI_ERROR(Status)) {
+    DecoderClose(Decoder);
+  }
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+DecoderRewind (
+  IN FS_DECODER *Decoder
+  )
+{
+  EFI_STATUS Status;
+
+  Decoder->Position = 0;
+  if (Decoder->Format == FS_DECODE_TIANO) {
+    return EFI_SUCCESS;
+  }
+
+  FsInflateClose(Decoder->Inflate);
+  Decoder->Inflate = NULL;
+  Status = Decoder->File->SetPosition(Decoder->File, 0);
+  if (!EFI_ERROR(Status)) {
+    Status = FsInflateOpen(Decoder->Format, DecoderInput, Decoder->File, &Decoder->Inflate);
+  }
+  return Status;
+}
+
+//
+// Read up to *Size decompressed bytes from the current position;
+// *Size = 0 at the end of the data.
+//
+STATIC
+EFI_STATUS
+DecoderRead (
+  IN     FS_DECODER *Decoder,
+  OUT    VOID       *Buffer,
+  IN OUT UINTN      *Size
+  )
+{
+  EFI_STATUS Status;
+
+  if (Decoder->Format == FS_DECODE_TIANO) {
+    if (*Size > Decoder->Size - Decoder->Position) {
+      *Size = (UINTN)(Decoder->Size - Decoder->Position);
+    }
+    CopyMem(Buffer, Decoder->Output + Decoder->Position, *Size);
+    Decoder->Position += *Size;
+    return EFI_SUCCESS;
+  }
+
+  if (Decoder->Inflate == NULL) {
+    *Size = 0;
+    return EFI_NOT_READY;
+  }
+
+  Status = FsInflateRead(Decoder->Inflate, Buffer, Size);
+  Decoder->Position += *Size;
+  if (!EFI_ERROR(Status) && *Size == 0 && !Decoder->SizeKnown) {
+    Decoder->Size      = Decoder->Position;
+    Decoder->SizeKnown = TRUE;
+  }
+  return Status;
+}
+
+//
+// Move to decompressed offset Offset (rewinding if it lies behind).
+//
+STATIC
+EFI_STATUS
+DecoderSeek (
+  IN FS_DECODER *Decoder,
+  IN UINT64     Offset
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  if (Offset < Decoder->Position) {
+    Status = DecoderRewind(Decoder);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  if (Decoder->Format == FS_DECODE_TIANO) {
+    Decoder->Position = MIN(Offset, Decoder->Size);
+    return EFI_SUCCESS;
+  }
+
+  while (Decoder->Position < Offset) {
+    Size   = (UINTN)MIN(Offset - Decoder->Position, FS_CHUNK_SIZE);
+    Status = DecoderRead(Decoder, Decoder->Scratch, &Size);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    if (Size == 0) {
+      break;
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+//
+// Decompressed size, decoding the whole stream once if the format does
+// not record it.
+//
+STATIC
+EFI_STATUS
+DecoderGetSize (
+  IN  FS_DECODER *Decoder,
+  OUT UINT64     *Size
+  )
+{
+  EFI_STATUS Status;
+
+  if (!Decoder->SizeKnown) {
+    Status = DecoderSeek(Decoder, MAX_UINT64);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    Decoder->Size      = Decoder->Position;
+    Decoder->SizeKnown = TRUE;
+  }
+  *Size = Decoder->Size;
+  return EFI_SUCCESS;
+}
+
+//
+// -cz: decompress SrcFile into DstFile.
+//
+STATIC
+EFI_STATUS
+DoDecompressCopy (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *SrcFile,
+  IN CHAR16            *DstFile
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Src;
+  EFI_FILE_PROTOCOL *Dst = NULL;
+  FS_DECODER        Decoder;
+  UINT8             *Buffer = NULL;
+  UINTN             Length;
+  UINTN             Size;
+
+  if (Root == NULL || SrcFile == NULL || DstFile == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (IsSameFile(Root, SrcFile, DstFile)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = OpenFileSpec(Root, &Src, SrcFile, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", SrcFile, Status);
+    return Status;
+  }
+
+  Status = DecoderOpen(Src, &Decoder);
+  if (EFI_ERROR(Status)) {
+    if (Status == EFI_UNSUPPORTED) {
+      Print(L"'%s' is not gzip, zlib or EDK II compressed\n", SrcFile);
+    } else {
+      Print(L"Decompress '%s' failed: %r\n", SrcFile, Status);
+    }
+    Src->Close(Src);
+    return Status;
+  }
+
+  Buffer = AllocatePool(FS_CHUNK_SIZE);
+  if (Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &Dst,
+             DstFile,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create/open dest file '%s' failed: %r\n", DstFile, Status);
+    Dst = NULL;
+    goto Done;
+  }
+
+  Status = SetFileSize(Dst, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Truncate dest file '%s' failed: %r\n", DstFile, Status);
+    goto Done;
+  }
+
+  while (TRUE) {
+    Length = FS_CHUNK_SIZE;
+    Status = DecoderRead(&Decoder, Buffer, &Length);
+    if (EFI_ERROR(Status)) {
+      Print(L"Decompress '%s' failed at %ld: %r\n", SrcFile, Decoder.Position, Status);
+      goto Done;
+    }
+    if (Length == 0) {
+      break;
+    }
+
+    Size   = Length;
+    Status = Dst->Write(Dst, &Size, Buffer);
+    if (EFI_ERROR(Status)) {
+      Print(L"Write dest file failed: %r\n", Status);
+      goto Done;
+    }
+    if (Size != Length) {
+      Print(L"Short write to dest file (%d of %d bytes)\n", Size, Length);
+      Status = EFI_DEVICE_ERROR;
+      goto Done;
+    }
+  }
+
+  Print(L"Decompressed '%s' (%s, %ld bytes) to '%s' (%ld bytes)\n",
+        SrcFile, DecoderName(&Decoder), Decoder.CompressedSize, DstFile, Decoder.Position);
+
+Done:
+  if (Dst != NULL) {
+    Dst->Close(Dst);
+  }
+  if (Buffer != NULL) {
+    FreePool(Buffer);
+  }
+  DecoderClose(&Decoder);
+  Src->Close(Src);
+  return Status;
+}
+
+//
+// Paged file viewer.
+//
+// Only one screen of the file is in memory at a time: each page is fetched
+// with SetPosition + Read, and paging back in text mode re-reads at most one
+// screen's worth of bytes before the current top to find earlier line starts.
+// A gzip/zlib stream cannot be read at random, so its decoded bytes are kept
+// in a window of FS_VIEW_WINDOW_SIZE bytes around the screen. Pages inside or
+// ahead of the window are served without rewinding; only a page before the
+// window's start decodes the stream again from the beginning.
+// Bytes that are not printable ASCII are shown as '.', so binary files
+// display in full instead of stopping at the first NUL.
+//
+#define FS_VIEW_HEX_WIDTH    16
+#define FS_VIEW_TAB_WIDTH    8
+#define FS_VIEW_WINDOW_SIZE  FS_CHUNK_SIZE
+
+typedef struct {
+  EFI_FILE_PROTOCOL  *File;
+  FS_DECODER         *Decoder;    // compressed file, or NULL
+  CHAR16             *Name;
+  UINT64             FileSize;
+  UINT64             Top;         // offset of the first byte on screen
+  UINT64             SecondLine;  // offset of the second line on screen
+  UINT64             Bottom;      // offset just past the last byte on screen
+  BOOLEAN            Hex;
+  UINTN              Columns;
+  UINTN              Rows;        // rows available for file content
+  UINT8              *Page;       // one screen of file data
+  UINTN              PageSize;
+  CHAR16             *Line;       // one formatted output row
+  UINT8              *Window;     // inflate: decoded bytes from WindowOffset
+  UINT64             WindowOffset;
+  UINTN              WindowSize;  // valid bytes in Window
+  UINTN              WindowCapacity;
+} FS_VIEWER;
+
+//
+// Make the inflate window hold [Offset, Offset + Size), or as much of it as
+// the stream has. The decoder always stands at the end of the window, so
+// moving forward only decodes the new bytes. The window keeps as much as
+// fits before Offset for paging back.
+//
+STATIC
+EFI_STATUS
+ViewerFillWindow (
+  IN OUT FS_VIEWER *Viewer,
+  IN     UINT64    Offset,
+  IN     UINTN     Size
+  )
+{
+  EFI_STATUS Status;
+  UINT64     End;
+  UINT64     Start;
+  UINT64     WindowEnd;
+  UINTN      Length;
+
+  End       = Offset + Size;
+  WindowEnd = Viewer->WindowOffset + Viewer->WindowSize;
+  if (Offset >= Viewer->WindowOffset && End <= WindowEnd) {
+    return EFI_SUCCESS;
+  }
+
+  Start  = (End > Viewer->WindowCapacity) ? End - Viewer->WindowCapacity : 0;
+  Status = EFI_SUCCESS;
+  if (Offset < Viewer->WindowOffset) {
+    //
+    // Behind the window: decode again from the start of the stream.
+    //
+    Viewer->WindowSize = 0;
+    Status = DecoderSeek(Viewer->Decoder, Start);
+  } else {
+    Start = MAX(Start, Viewer->WindowOffset);
+    if (Start >= WindowEnd) {
+      Viewer->WindowSize = 0;
+      Status = DecoderSeek(Viewer->Decoder, Start);
+    } else if (Start > Viewer->WindowOffset) {
+      Viewer->WindowSize = (UINTN)(WindowEnd - Start);
+      CopyMem(Viewer->Window, Viewer->Window + (Start - Viewer->WindowOffset), Viewer->WindowSize);
+    }
+  }
+  Viewer->WindowOffset = Start;
+  if (EFI_ERROR(Status)) {
+    Viewer->WindowSize = 0;
+    return Status;
+  }
+
+  while (Viewer->WindowOffset + Viewer->WindowSize < End) {
+    Length = Viewer->WindowCapacity - Viewer->WindowSize;
+    Status = DecoderRead(Viewer->Decoder, Viewer->Window + Viewer->WindowSize, &Length);
+    if (EFI_ERROR(Status)) {
+      Viewer->WindowSize = 0;
+      return Status;
+    }
+    if (Length == 0) {
+      break;
+    }
+    Viewer->WindowSize += Length;
+  }
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+ViewerReadAt (
+  IN     FS_VIEWER *Viewer,
+  IN     UINT64    Offset,
+  IN OUT UINTN     *Size
+  )
+{
+  EFI_STATUS Status;
+
+  if (Offset >= Viewer->FileSize) {
+    *Size = 0;
+    return EFI_SUCCESS;
+  }
+  if (*Size > Viewer->FileSize - Offset) {
+    *Size = (UINTN)(Viewer->FileSize - Offset);
+  }
+
+  if (Viewer->Window != NULL) {
+    Status = ViewerFillWindow(Viewer, Offset, *Size);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    if (Offset >= Viewer->WindowOffset + Viewer->WindowSize) {
+      *Size = 0;
+    } else {
+      *Size = (UINTN)MIN(*Size, Viewer->WindowOffset + Viewer->WindowSize - Offset);
+    }
+    CopyMem(Viewer->Page, Viewer->Window + (Offset - Viewer->WindowOffset), *Size);
+    return EFI_SUCCESS;
+  }
+
+  if (Viewer->Decoder != NULL) {
+    Status = DecoderSeek(Viewer->Decoder, Offset);
+    if (!EFI_ERROR(Status)) {
+      Status = DecoderRead(Viewer->Decoder, Viewer->Page, Size);
+    }
+    return Status;
+  }
+
+  Status = Viewer->File->SetPosition(Viewer->File, Offset);
+  if (!EFI_ERROR(Status)) {
+    Status = Viewer->File->Read(Viewer->File, Size, Viewer->Page);
+  }
+  return Status;
+}
+
+STATIC
+CHAR16
+ViewerChar (
+  IN UINT8 Byte
+  )
+{
+  return (Byte >= 0x20 && Byte < 0x7F) ? (CHAR16)Byte : L'.';
+}
+
+STATIC
+EFI_STATUS
+ViewerDrawHex (
+  IN OUT FS_VIEWER *Viewer
+  )
+{
+  STATIC CONST CHAR16 HexDigit[] = L"0123456789abcdef";
+  EFI_STATUS Status;
+  UINTN      Size;
+  UINTN      Row;
+  UINTN      Col;
+  UINTN      Pos;
+  UINTN      Base;
+
+  Size = Viewer->Rows * FS_VIEW_HEX_WIDTH;
+  Status = ViewerReadAt(Viewer, Viewer->Top, &Size);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  for (Row = 0; Row * FS_VIEW_HEX_WIDTH < Size; Row++) {
+    Base = Row * FS_VIEW_HEX_WIDTH;
+    UnicodeSPrint(Viewer->Line, (Viewer->Columns + 1) * sizeof(CHAR16),
+                  L"%010lx  ", Viewer->Top + Base);
+    Pos = StrLen(Viewer->Line);
+
+    for (Col = 0; Col < FS_VIEW_HEX_WIDTH; Col++) {
+      if (Base + Col < Size) {
+        Viewer->Line[Pos++] = HexDigit[Viewer->Page[Base + Col] >> 4];
+        Viewer->Line[Pos++] = HexDigit[Viewer->Page[Base + Col] & 0xF];
+      } else {
+        Viewer->Line[Pos++] = L' ';
+        Viewer->Line[Pos++] = L' ';
+      }
+      Viewer->Line[Pos++] = (Col == 7) ? L'-' : L' ';
+    }
+
+    Viewer->Line[Pos++] = L' ';
+    for (Col = 0; Col < FS_VIEW_HEX_WIDTH && Base + Col < Size; Col++) {
+      Viewer->Line[Pos++] = ViewerChar(Viewer->Page[Base + Col]);
+    }
+    Viewer->Line[Pos] = L'\0';
+    Print(L"%s\n", Viewer->Line);
+  }
+
+  Viewer->SecondLine = Viewer->Top + FS_VIEW_HEX_WIDTH;
+  Viewer->Bottom     = Viewer->Top + Size;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+ViewerDrawText (
+  IN OUT FS_VIEWER *Viewer
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+  UINTN      Index;
+  UINTN      Row;
+  UINTN      Col;
+  UINTN      Width;
+  UINT8      Byte;
+
+  Size = Viewer->PageSize;
+  Status = ViewerReadAt(Viewer, Viewer->Top, &Size);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Leave the last column free so a full row does not wrap twice.
+  //
+  Width = Viewer->Columns - 1;
+  Row   = 0;
+  Col   = 0;
+  Viewer->SecondLine = Viewer->Top + Size;
+
+  for (Index = 0; Index < Size && Row < Viewer->Rows; Index++) {
+    Byte = Viewer->Page[Index];
+
+    if (Byte == '\r') {
+      continue;
+    }
+    if (Byte == '\t') {
+      do {
+        Viewer->Line[Col++] = L' ';
+      } while (Col < Width && (Col % FS_VIEW_TAB_WIDTH) != 0);
+    } else if (Byte != '\n') {
+      Viewer->Line[Col++] = ViewerChar(Byte);
+    }
+
+    if (Byte == '\n' || Col >= Width) {
+      Viewer->Line[Col] = L'\0';
+      Print(L"%s\n", Viewer->Line);
+      if (Row == 0) {
+        Viewer->SecondLine = Viewer->Top + Index + 1;
+      }
+      Row++;
+      Col = 0;
+    }
+  }
+
+  if (Col > 0 && Row < Viewer->Rows) {
+    Viewer->Line[Col] = L'\0';
+    Print(L"%s\n", Viewer->Line);
+  }
+
+  Viewer->Bottom = Viewer->Top + Index;
+  return EFI_SUCCESS;
+}
+
+//
+// Text mode: offset of the start of the line Lines lines above the one at
+// From. Only one page of bytes before From is examined, so a very long line
+// moves back by at most one screen.
+//
+STATIC
+UINT64
+ViewerTextBack (
+  IN FS_VIEWER *Viewer,
+  IN UINT64    From,
+  IN UINTN     Lines
+  )
+{
+  UINT64 Start;
+  UINTN  Size;
+  UINTN  Index;
+
+  if (From == 0) {
+    return 0;
+  }
+
+  Start = (From > Viewer->PageSize) ? From - Viewer->PageSize : 0;
+  Size  = (UINTN)(From - Start);
+  if (EFI_ERROR(ViewerReadAt(Viewer, Start, &Size)) || Size == 0) {
+    return Start;
+  }
+
+  //
+  // Page[Size - 1] normally is the '\n' that ends the previous line; it
+  // does not count. The Lines-th '\n' before it ends the line above the
+  // one we want.
+  //
+  Index = Size - 1;
+  while (Index > 0 && Lines > 0) {
+    Index--;
+    if (Viewer->Page[Index] == '\n') {
+      Lines--;
+      if (Lines == 0) {
+        return Start + Index + 1;
+      }
+    }
+  }
+  return Start;
+}
+
+STATIC
+VOID
+ViewerReadLine (
+  OUT CHAR16 *Buffer,
+  IN  UINTN  BufferLen
+  )
+{
+  EFI_INPUT_KEY Key;
+  UINTN         EventIndex;
+  UINTN         Index;
+
+  Index = 0;
+  Buffer[0] = L'\0';
+
+  while (TRUE) {
+    gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
+    if (EFI_ERROR(gST->ConIn->ReadKeyStroke(gST->ConIn, &Key))) {
+      continue;
+    }
+    if (Key.UnicodeChar == CHAR_CARRIAGE_RETURN || Key.ScanCode == SCAN_ESC) {
+      if (Key.ScanCode == SCAN_ESC) {
+        Index = 0;
+      }
+      Buffer[Index] = L'\0';
+      return;
+    }
+    if (Key.UnicodeChar == CHAR_BACKSPACE) {
+      if (Index > 0) {
+        Index--;
+        Print(L"\b \b");
+      }
+      continue;
+    }
+    if (Key.UnicodeChar >= 0x20 && Key.UnicodeChar <= 0x7E && Index + 1 < BufferLen) {
+      Buffer[Index++] = Key.UnicodeChar;
+      Print(L"%c", Key.UnicodeChar);
+    }
+  }
+}
+
+//
+// Read a file one screen at a time; Hex selects the starting mode.
+//
+STATIC
+EFI_STATUS
+DoReadAndDisplay (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName,
+  IN BOOLEAN           Hex,
+  IN BOOLEAN           Decompress
+  )
+{
+  EFI_STATUS    Status;
+  FS_VIEWER     Viewer;
+  FS_DECODER    Decoder;
+  EFI_FILE_INFO *Info;
+  UINTN         InfoSize;
+  UINTN         Columns;
+  UINTN         Rows;
+  UINTN         PageBytes;
+  UINT64        Percent;
+  EFI_INPUT_KEY Key;
+  UINTN         EventIndex;
+  CHAR16        Input[20];
+
+  ZeroMem(&Viewer, sizeof(Viewer));
+  Viewer.Name = FileName;
+  Viewer.Hex  = Hex;
+
+  Status = OpenFileSpec(Root, &Viewer.File, FileName, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", FileName, Status);
+    return Status;
+  }
+
+  InfoSize = 0;
+  Info     = NULL;
+  Status = Viewer.File->GetInfo(Viewer.File, &gEfiFileInfoGuid, &InfoSize, NULL);
+  if (Status == EFI_BUFFER_TOO_SMALL) {
+    Info = AllocatePool(InfoSize);
+    Status = (Info == NULL) ? EFI_OUT_OF_RESOURCES :
+             Viewer.File->GetInfo(Viewer.File, &gEfiFileInfoGuid, &InfoSize, Info);
+  }
+  if (EFI_ERROR(Status)) {
+    Print(L"GetInfo failed: %r\n", Status);
+    goto Done;
+  }
+  Viewer.FileSize = Info->FileSize;
+
+  if (Decompress) {
+    Status = DecoderOpen(Viewer.File, &Decoder);
+    if (EFI_ERROR(Status)) {
+      Print(L"'%s' is not a supported compressed file: %r\n", FileName, Status);
+      goto Done;
+    }
+    Viewer.Decoder = &Decoder;
+    Status = DecoderGetSize(&Decoder, &Viewer.FileSize);
+    if (EFI_ERROR(Status)) {
+      Print(L"Decompress '%s' failed: %r\n", FileName, Status);
+      goto Done;
+    }
+  }
+
+  if (EFI_ERROR(gST->ConOut->QueryMode(gST->ConOut, gST->ConOut->Mode->Mode, &Columns, &Rows))) {
+    Columns = 80;
+    Rows    = 25;
+  }
+  if (Columns < 80) {
+    Columns = 80;
+  }
+  if (Rows < 5) {
+    Rows = 5;
+  }
+  Viewer.Columns  = Columns;
+  Viewer.Rows     = Rows - 2;        // status line + cursor row
+  Viewer.PageSize = Viewer.Rows * Columns;
+  Viewer.Page     = AllocatePool(Viewer.PageSize);
+  Viewer.Line     = AllocatePool((Columns + 1) * sizeof(CHAR16));
+  if (Viewer.Page == NULL || Viewer.Line == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // The EDK II decoder holds its whole output already; gzip/zlib get a
+  // window that also covers a screen before and after the current one.
+  //
+  if (Viewer.Decoder != NULL && Decoder.Format != FS_DECODE_TIANO) {
+    Viewer.WindowCapacity = MAX(FS_VIEW_WINDOW_SIZE, 4 * Viewer.PageSize);
+    Viewer.Window         = AllocatePool(Viewer.WindowCapacity);
+    if (Viewer.Window == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Done;
+    }
+  }
+
+  while (TRUE) {
+    gST->ConOut->ClearScreen(gST->ConOut);
+    Status = Viewer.Hex ? ViewerDrawHex(&Viewer) : ViewerDrawText(&Viewer);
+    if (EFI_ERROR(Status)) {
+      Print(L"Read file failed: %r\n", Status);
+      break;
+    }
+
+    Percent = (Viewer.FileSize == 0) ? 100 :
+              DivU64x64Remainder(MultU64x32(Viewer.Bottom, 100), Viewer.FileSize, NULL);
+    Print(L"-- %s  %lx-%lx/%lx (%ld%%) %s  PgUp/PgDn Up/Dn Home/End g:goto h:hex/text q:quit",
+          Viewer.Name, Viewer.Top, Viewer.Bottom, Viewer.FileSize, Percent,
+          Viewer.Hex ? L"HEX" : L"TEXT");
+
+    gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
+    if (EFI_ERROR(gST->ConIn->ReadKeyStroke(gST->ConIn, &Key))) {
+      continue;
+    }
+
+    PageBytes = Viewer.Rows * FS_VIEW_HEX_WIDTH;
+
+    if (Key.ScanCode == SCAN_ESC || Key.UnicodeChar == L'q' || Key.UnicodeChar == L'Q') {
+      break;
+    } else if (Key.ScanCode == SCAN_PAGE_DOWN || Key.UnicodeChar == L' ') {
+      if (Viewer.Bottom < Viewer.FileSize) {
+        Viewer.Top = Viewer.Bottom;
+      }
+    } else if (Key.ScanCode == SCAN_DOWN || Key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+      if (Viewer.Bottom < Viewer.FileSize) {
+        Viewer.Top = Viewer.SecondLine;
+      }
+    } else if (Key.ScanCode == SCAN_PAGE_UP || Key.UnicodeChar == L'b') {
+      if (Viewer.Hex) {
+        Viewer.Top = (Viewer.Top > PageBytes) ? Viewer.Top - PageBytes : 0;
+      } else {
+        Viewer.Top = ViewerTextBack(&Viewer, Viewer.Top, Viewer.Rows);
+      }
+    } else if (Key.ScanCode == SCAN_UP) {
+      if (Viewer.Hex) {
+        Viewer.Top = (Viewer.Top > FS_VIEW_HEX_WIDTH) ? Viewer.Top - FS_VIEW_HEX_WIDTH : 0;
+      } else {
+        Viewer.Top = ViewerTextBack(&Viewer, Viewer.Top, 1);
+      }
+    } else if (Key.ScanCode == SCAN_HOME) {
+      Viewer.Top = 0;
+    } else if (Key.ScanCode == SCAN_END) {
+      if (Viewer.Hex) {
+        Viewer.Top = (Viewer.FileSize > PageBytes) ?
+                     ((Viewer.FileSize - PageBytes + FS_VIEW_HEX_WIDTH - 1) & ~(UINT64)(FS_VIEW_HEX_WIDTH - 1)) : 0;
+      } else {
+        Viewer.Top = ViewerTextBack(&Viewer, Viewer.FileSize, Viewer.Rows);
+      }
+    } else if (Key.UnicodeChar == L'h' || Key.UnicodeChar == L'H') {
+      Viewer.Hex = (BOOLEAN)!Viewer.Hex;
+      if (Viewer.Hex) {
+        Viewer.Top &= ~(UINT64)(FS_VIEW_HEX_WIDTH - 1);
+      }
+    } else if (Key.UnicodeChar == L'g' || Key.UnicodeChar == L'G') {
+      Print(L"\nGo to offset (hex): ");
+      ViewerReadLine(Input, ARRAY_SIZE(Input));
+      if (Input[0] != L'\0') {
+        Viewer.Top = StrHexToUint64(Input);
+        if (Viewer.Top >= Viewer.FileSize) {
+          Viewer.Top = (Viewer.FileSize > 0) ? Viewer.FileSize - 1 : 0;
+        }
+        if (Viewer.Hex) {
+          Viewer.Top &= ~(UINT64)(FS_VIEW_HEX_WIDTH - 1);
+        }
+      }
+    }
+  }
+
+  Print(L"\n");
+  Status = EFI_SUCCESS;
+
+Done:
+  if (Viewer.Line != NULL) {
+    FreePool(Viewer.Line);
+  }
+  if (Viewer.Page != NULL) {
+    FreePool(Viewer.Page);
+  }
+  if (Viewer.Window != NULL) {
+    FreePool(Viewer.Window);
+  }
+  if (Info != NULL) {
+    FreePool(Info);
+  }
+  if (Viewer.Decoder != NULL) {
+    DecoderClose(Viewer.Decoder);
+  }
+  Viewer.File->Close(Viewer.File);
+  return Status;
+}
+
+//
+// Delete a file.
+//
+STATIC
+EFI_STATUS
+DoDeleteFile (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+
+  if (Root == NULL || FileName == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &File,
+             FileName,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
+             0
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' for delete failed: %r\n", FileName, Status);
+    return Status;
+  }
+
+  Status = File->Delete(File);
+  if (Status == EFI_SUCCESS || Status == EFI_WARN_DELETE_FAILURE) {
+    if (!mQuiet || Status != EFI_SUCCESS) {
+      Print(L"Delete file '%s' status: %r\n", FileName, Status);
+    }
+  } else {
+    Print(L"Delete file '%s' failed: %r\n", FileName, Status);
+  }
+
+  // On success, Delete() already closes the handle.
+  return Status;
+}
+
+//
+// Concatenate SourceCount files into Dst, streaming one source after the
+// other. With Presize the destination is first set to the summed size of
+// the sources; otherwise it is truncated and grows as it is written.
+//
+STATIC
+EFI_STATUS
+MergeFiles (
+  IN  EFI_FILE_PROTOCOL *Root,
+  IN  CHAR16            **Sources,
+  IN  UINTN             SourceCount,
+  IN  CHAR16            *Dst,
+  IN  BOOLEAN           Presize,
+  OUT UINT64            *BytesMerged
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL **Src;
+  EFI_FILE_PROTOCOL *DstFile = NULL;
+  FS_STREAM         Stream;
+  UINT64            Size;
+  UINT64            Total;
+  UINTN             Index;
+
+  *BytesMerged = 0;
+
+  Src = AllocateZeroPool(SourceCount * sizeof(*Src));
+  if (Src == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Total = 0;
+  for (Index = 0; Index < SourceCount; Index++) {
+    Status = OpenFileSpec(Root, &Src[Index], Sources[Index], EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) {
+      Print(L"Open file '%s' failed: %r\n", Sources[Index], Status);
+      goto Done;
+    }
+    Status = GetFileSize(Src[Index], &Size);
+    if (EFI_ERROR(Status)) {
+      Print(L"GetInfo '%s' failed: %r\n", Sources[Index], Status);
+      goto Done;
+    }
+    Total += Size;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &DstFile,
+             Dst,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Open/create dst '%s' failed: %r\n", Dst, Status);
+    DstFile = NULL;
+    goto Done;
+  }
+
+  Status = SetFileSize(DstFile, Presize ? Total : 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Set size of '%s' to %ld failed: %r\n", Dst, Presize ? Total : 0, Status);
+    goto Done;
+  }
+  Status = DstFile->SetPosition(DstFile, 0);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Status = StreamInit(&Stream, Src[0], DstFile);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  for (Index = 0; Index < SourceCount && !EFI_ERROR(Status); Index++) {
+    Stream.Src      = Src[Index];
+    Stream.SrcAsync = FileSupportsAsyncIo(Src[Index]);
+    Status = StreamRun(&Stream);
+  }
+  StreamFree(&Stream);
+
+  //
+  // A source that changed size since it was measured leaves the
+  // pre-sized destination too long or short; trim to what was written.
+  //
+  if (!EFI_ERROR(Status) && Stream.BytesCopied != Total) {
+    Status = SetFileSize(DstFile, Stream.BytesCopied);
+  }
+  *BytesMerged = Stream.BytesCopied;
+
+Done:
+  if (DstFile != NULL) {
+    DstFile->Close(DstFile);
+  }
+  for (Index = 0; Index < SourceCount; Index++) {
+    if (Src[Index] != NULL) {
+      Src[Index]->Close(Src[Index]);
+    }
+  }
+  FreePool(Src);
+  return Status;
+}
+
+//
+// Merge files into a destination file: src1 + src2 + ... + srcN -> dst.
+//
+STATIC
+EFI_STATUS
+DoMergeFiles (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            **Sources,
+  IN UINTN             SourceCount,
+  IN CHAR16            *Dst
+  )
+{
+  EFI_STATUS Status;
+  UINT64     Bytes;
+  UINTN      Index;
+
+  if (Root == NULL || Sources == NULL || SourceCount == 0 || Dst == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  for (Index = 0; Index < SourceCount; Index++) {
+    if (CompareFileSpecs(Root, Sources[Index], Dst) == SpecSame) {
+      Print(L"Destination '%s' is also source '%s'\n", Dst, Sources[Index]);
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  Status = MergeFiles(Root, Sources, SourceCount, Dst, TRUE, &Bytes);
+  if (!EFI_ERROR(Status)) {
+    Print(L"Merged %d files (%ld bytes) -> '%s'\n", SourceCount, Bytes, Dst);
+  }
+  return Status;
+}
+
+//
+// Sparse copy.
+//
+// Disk images are often mostly zeros. The source is scanned in
+// FS_SPARSE_BLOCK units; all-zero blocks are not written, the destination
+// position is moved past them instead and the final size set with SetInfo.
+// A file system that can't position past end-of-file gets the zeros
+// written from a shared zero buffer instead. EDK II's FAT driver accepts
+// the seek but has no holes: it zero-fills the gap itself on the next
+// write, which still saves moving the zeros through this application.
+//
+#define FS_SPARSE_BLOCK  SIZE_64KB
+
+//
+// TRUE if Size bytes at Buffer are all zero. Buffer is pool memory and
+// Size a multiple of 8 except for the tail of the file; eight words are
+// OR-ed per iteration, which compilers turn into vector loads.
+//
+STATIC
+BOOLEAN
+IsZeroBlock (
+  IN CONST UINT8 *Buffer,
+  IN UINTN       Size
+  )
+{
+  CONST UINT64 *Word;
+  UINT64       Acc;
+  UINTN        Count;
+  UINTN        Index;
+
+  Word  = (CONST UINT64 *)Buffer;
+  Count = Size / sizeof(UINT64);
+  Acc   = 0;
+
+  for (Index = 0; Index + 8 <= Count; Index += 8) {
+    Acc |= Word[Index]     | Word[Index + 1] | Word[Index + 2] | Word[Index + 3] |
+           Word[Index + 4] | Word[Index + 5] | Word[Index + 6] | Word[Index + 7];
+    if (Acc != 0) {
+      return FALSE;
+    }
+  }
+  for (; Index < Count; Index++) {
+    Acc |= Word[Index];
+  }
+  for (Index = Count * sizeof(UINT64); Index < Size; Index++) {
+    Acc |= Buffer[Index];
+  }
+  return (BOOLEAN)(Acc == 0);
+}
+
+//
+// Write Length zero bytes at the current position of File.
+//
+STATIC
+EFI_STATUS
+WriteZeros (
+  IN EFI_FILE_PROTOCOL *File,
+  IN CONST UINT8       *Zeros,
+  IN UINTN             ZerosSize,
+  IN UINT64            Length
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  Status = EFI_SUCCESS;
+  while (!EFI_ERROR(Status) && Length > 0) {
+    Size   = (Length < ZerosSize) ? (UINTN)Length : ZerosSize;
+    Status = File->Write(File, &Size, (VOID *)Zeros);
+    Length -= Size;
+  }
+  return Status;
+}
+
+//
+// -cs: copy SrcFile to DstFile, skipping all-zero blocks.
+//
+STATIC
+EFI_STATUS
+DoSparseCopy (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *SrcFile,
+  IN CHAR16            *DstFile
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Src;
+  EFI_FILE_PROTOCOL *Dst;
+  UINT8             *Buffer;
+  UINT8             *Zeros;
+  UINTN             Length;
+  UINTN             Offset;
+  UINTN             Block;
+  UINTN             Size;
+  UINT64            Position;     // bytes of source consumed
+  UINT64            Written;      // position of Dst after the last write
+  UINT64            Skipped;
+  BOOLEAN           CanSeek;
+
+  if (Root == NULL || SrcFile == NULL || DstFile == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (IsSameFile(Root, SrcFile, DstFile)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = OpenFileSpec(Root, &Src, SrcFile, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", SrcFile, Status);
+    return Status;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &Dst,
+             DstFile,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create/open dest file '%s' failed: %r\n", DstFile, Status);
+    Src->Close(Src);
+    return Status;
+  }
+
+  Buffer = AllocatePool(FS_CHUNK_SIZE);
+  Zeros  = AllocateZeroPool(FS_SPARSE_BLOCK);
+  if (Buffer == NULL || Zeros == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // Skipped ranges must read back as zeros, so old contents go first.
+  //
+  Status = SetFileSize(Dst, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Truncate '%s' failed: %r\n", DstFile, Status);
+    goto Done;
+  }
+
+  Position = 0;
+  Written  = 0;
+  Skipped  = 0;
+  CanSeek  = TRUE;
+
+  for (;;) {
+    Length = FS_CHUNK_SIZE;
+    Status = Src->Read(Src, &Length, Buffer);
+    if (EFI_ERROR(Status)) {
+      Print(L"Read source failed: %r\n", Status);
+      goto Done;
+    }
+    if (Length == 0) {
+      break;
+    }
+
+    for (Offset = 0; Offset < Length; Offset += Block) {
+      Block = MIN(FS_SPARSE_BLOCK, Length - Offset);
+      if (IsZeroBlock(Buffer + Offset, Block)) {
+        Skipped += Block;
+        continue;
+      }
+
+      //
+      // Close the gap since the last write: seek over it, or write
+      // zeros once the file system has refused a seek past EOF.
+      //
+      if (Written < Position + Offset) {
+        if (CanSeek) {
+          Status = Dst->SetPosition(Dst, Position + Offset);
+          if (EFI_ERROR(Status)) {
+            CanSeek = FALSE;
+          }
+        }
+        if (!CanSeek) {
+          Status = WriteZeros(Dst, Zeros, FS_SPARSE_BLOCK, Position + Offset - Written);
+          if (EFI_ERROR(Status)) {
+            Print(L"Zero-fill dest file failed: %r\n", Status);
+            goto Done;
+          }
+        }
+      }
+
+      Size   = Block;
+      Status = Dst->Write(Dst, &Size, Buffer + Offset);
+      if (EFI_ERROR(Status)) {
+        Print(L"Write dest file failed: %r\n", Status);
+        goto Done;
+      }
+      Written = Position + Offset + Block;
+    }
+    Position += Length;
+  }
+
+  //
+  // Trailing zeros: extend the file to its full size.
+  //
+  if (Written < Position) {
+    Status = SetFileSize(Dst, Position);
+    if (EFI_ERROR(Status)) {
+      Status = Dst->SetPosition(Dst, Written);
+      if (!EFI_ERROR(Status)) {
+        Status = WriteZeros(Dst, Zeros, FS_SPARSE_BLOCK, Position - Written);
+      }
+      if (EFI_ERROR(Status)) {
+        Print(L"Extend dest file failed: %r\n", Status);
+        goto Done;
+      }
+    }
+  }
+
+  Print(L"Copied %ld bytes from '%s' to '%s', %ld bytes of zeros %s\n",
+        Position, SrcFile, DstFile, Skipped,
+        CanSeek ? L"skipped" : L"zero-filled");
+
+Done:
+  if (Buffer != NULL) {
+    FreePool(Buffer);
+  }
+  if (Zeros != NULL) {
+    FreePool(Zeros);
+  }
+  Dst->Close(Dst);
+  Src->Close(Src);
+  return Status;
+}
+
+//
+// Show file information using EFI_FILE_INFO.
+//
+STATIC
+EFI_STATUS
+DoShowFileInfo (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  UINTN             InfoSize = 0;
+  EFI_FILE_INFO     *Info;
+
+  if (Root == NULL || FileName == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &File,
+             FileName,
+             EFI_FILE_MODE_READ,
+             0
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", FileName, Status);
+    return Status;
+  }
+
+  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, NULL);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    Print(L"GetInfo(size) failed: %r\n", Status);
+    File->Close(File);
+    return Status;
+  }
+
+  Info = AllocatePool(InfoSize);
+  if (Info == NULL) {
+    File->Close(File);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
+  if (EFI_ERROR(Status)) {
+    Print(L"GetInfo failed: %r\n", Status);
+    FreePool(Info);
+    File->Close(File);
+    return Status;
+  }
+
+  
+  Print(L"File: %s\n", Info->FileName);
+  Print(L"  Size:          %d bytes\n", (INT32)Info->FileSize);
+  Print(L"  PhysicalSize:  %d bytes\n", (INT32)Info->PhysicalSize);
+  Print(L"  Attribute:     0x%lx\n", Info->Attribute);
+
+  Print(L"  CreateTime:    %04d-%02d-%02d %02d:%02d:%02d\n",
+        Info->CreateTime.Year, Info->CreateTime.Month, Info->CreateTime.Day,
+        Info->CreateTime.Hour, Info->CreateTime.Minute, Info->CreateTime.Second);
+  Print(L"  LastAccessTime:%04d-%02d-%02d %02d:%02d:%02d\n",
+        Info->LastAccessTime.Year, Info->LastAccessTime.Month, Info->LastAccessTime.Day,
+        Info->LastAccessTime.Hour, Info->LastAccessTime.Minute, Info->LastAccessTime.Second);
+  Print(L"  Modification:  %04d-%02d-%02d %02d:%02d:%02d\n",
+        Info->ModificationTime.Year, Info->ModificationTime.Month, Info->ModificationTime.Day,
+        Info->ModificationTime.Hour, Info->ModificationTime.Minute, Info->ModificationTime.Second);
+
+  FreePool(Info);
+  File->Close(File);
+  return EFI_SUCCESS;
+}
+
+//
+// Recursive directory walk.
+//
+// Directories are enumerated with EFI_FILE_PROTOCOL::Read on the directory
+// handle. All levels share one EFI_FILE_INFO buffer, grown to the largest
+// entry seen, so nothing is allocated per entry; the entry name is copied
+// into Walk->Path before descending because the child's reads overwrite the
+// buffer. At most FS_MAX_TREE_DEPTH directory handles are open at once.
+//
+#define FS_MAX_TREE_DEPTH  16
+
+typedef enum {
+  TreeVisitFile,      // Handle = parent directory, Info = the file
+  TreeVisitDirEnter,  // Handle = parent directory, Info = the directory
+  TreeVisitDirLeave   // Handle = the directory itself, Info = NULL
+} FS_TREE_VISIT;
+
+typedef struct _FS_TREE_WALK FS_TREE_WALK;
+
+typedef
+EFI_STATUS
+(*FS_TREE_CALLBACK) (
+  IN FS_TREE_WALK      *Walk,
+  IN EFI_FILE_PROTOCOL *Handle,
+  IN EFI_FILE_INFO     *Info,
+  IN FS_TREE_VISIT     Visit
+  );
+
+struct _FS_TREE_WALK {
+  EFI_FILE_INFO     *Info;              // shared entry buffer
+  UINTN             InfoSize;           // its capacity in bytes
+  CHAR16            Path[FS_MAX_PATH];  // entry path relative to the walk root
+  UINTN             Depth;
+  UINT64            OpenMode;           // mode used to open subdirectories
+  FS_TREE_CALLBACK  Callback;
+  VOID              *Context;
+  BOOLEAN           HandleClosed;       // set by a DirLeave callback that deleted the handle
+  UINTN             Files;
+  UINTN             Dirs;
+  UINT64            Bytes;
+  UINTN             Errors;
+};
+
+STATIC
+BOOLEAN
+IsDotEntry (
+  IN CHAR16 *Name
+  )
+{
+  return (BOOLEAN)(StrCmp(Name, L".") == 0 || StrCmp(Name, L"..") == 0);
+}
+
+//
+// Append "\Name" (or "Name" at the top) to Walk->Path; returns the old
+// length so the caller can cut the path back afterwards.
+//
+STATIC
+EFI_STATUS
+TreePathPush (
+  IN OUT FS_TREE_WALK *Walk,
+  IN     CHAR16       *Name,
+  OUT    UINTN        *OldLength
+  )
+{
+  *OldLength = StrLen(Walk->Path);
+  if (*OldLength + 1 + StrLen(Name) + 1 > FS_MAX_PATH) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+  if (*OldLength > 0) {
+    StrCatS(Walk->Path, FS_MAX_PATH, L"\\");
+  }
+  StrCatS(Walk->Path, FS_MAX_PATH, Name);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+TreeWalkDir (
+  IN OUT FS_TREE_WALK      *Walk,
+  IN     EFI_FILE_PROTOCOL *Dir
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Child;
+  UINTN             Size;
+  UINTN             OldLength;
+  BOOLEAN           IsDir;
+
+  Status = Dir->SetPosition(Dir, 0);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  while (TRUE) {
+    Size = Walk->InfoSize;
+    Status = Dir->Read(Dir, &Size, Walk->Info);
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+      // Entry with a longer name than any so far: grow the shared buffer.
+      FreePool(Walk->Info);
+      Walk->Info = AllocatePool(Size);
+      if (Walk->Info == NULL) {
+        Walk->InfoSize = 0;
+        return EFI_OUT_OF_RESOURCES;
+      }
+      Walk->InfoSize = Size;
+      continue;
+    }
+    if (EFI_ERROR(Status)) {
+      Print(L"Read directory '%s' failed: %r\n", Walk->Path, Status);
+      return Status;
+    }
+    if (Size == 0) {
+      break;      // end of directory
+    }
+    if (IsDotEntry(Walk->Info->FileName)) {
+      continue;
+    }
+
+    if (EFI_ERROR(TreePathPush(Walk, Walk->Info->FileName, &OldLength))) {
+      Print(L"Path too long, skipping '%s\\%s'\n", Walk->Path, Walk->Info->FileName);
+      Walk->Errors++;
+      continue;
+    }
+
+    IsDir = (BOOLEAN)((Walk->Info->Attribute & EFI_FILE_DIRECTORY) != 0);
+    if (!IsDir) {
+      Walk->Files++;
+      Walk->Bytes += Walk->Info->FileSize;
+      Status = Walk->Callback(Walk, Dir, Walk->Info, TreeVisitFile);
+    } else if (Walk->Depth >= FS_MAX_TREE_DEPTH) {
+      Print(L"Depth limit %d reached, skipping '%s'\n", FS_MAX_TREE_DEPTH, Walk->Path);
+      Walk->Errors++;
+      Status = EFI_SUCCESS;
+    } else {
+      Walk->Dirs++;
+      Status = Walk->Callback(Walk, Dir, Walk->Info, TreeVisitDirEnter);
+      if (!EFI_ERROR(Status)) {
+        Status = Dir->Open(Dir, &Child, Walk->Info->FileName, Walk->OpenMode, 0);
+        if (EFI_ERROR(Status)) {
+          Print(L"Open directory '%s' failed: %r\n", Walk->Path, Status);
+        } else {
+          Walk->Depth++;
+          Status = TreeWalkDir(Walk, Child);
+          Walk->Depth--;
+
+          if (!EFI_ERROR(Status)) {
+            Walk->HandleClosed = FALSE;
+            Status = Walk->Callback(Walk, Child, NULL, TreeVisitDirLeave);
+          }
+          if (!Walk->HandleClosed) {
+            Child->Close(Child);
+          }
+          Walk->HandleClosed = FALSE;
+        }
+      }
+    }
+
+    Walk->Path[OldLength] = L'\0';
+
+    if (Status == EFI_ABORTED || Status == EFI_OUT_OF_RESOURCES) {
+      return Status;
+    }
+    if (EFI_ERROR(Status)) {
+      Walk->Errors++;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Open DirName under Root and walk it. Callback sees paths relative to it.
+//
+STATIC
+EFI_STATUS
+TreeWalk (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *DirName,
+  IN UINT64            OpenMode,
+  IN FS_TREE_CALLBACK  Callback,
+  IN VOID              *Context,
+  OUT FS_TREE_WALK     *Walk
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Dir;
+
+  ZeroMem(Walk, sizeof(*Walk));
+  Walk->OpenMode = OpenMode;
+  Walk->Callback = Callback;
+  Walk->Context  = Context;
+  Walk->InfoSize = SIZE_OF_EFI_FILE_INFO + 128 * sizeof(CHAR16);
+  Walk->Info     = AllocatePool(Walk->InfoSize);
+  if (Walk->Info == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = OpenFileSpec(Root, &Dir, DirName, OpenMode, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open directory '%s' failed: %r\n", DirName, Status);
+  } else {
+    Status = TreeWalkDir(Walk, Dir);
+    Dir->Close(Dir);
+  }
+
+  if (Walk->Info != NULL) {
+    FreePool(Walk->Info);
+    Walk->Info = NULL;
+  }
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+ListTreeCallback (
+  IN FS_TREE_WALK      *Walk,
+  IN EFI_FILE_PROTOCOL *Handle,
+  IN EFI_FILE_INFO     *Info,
+  IN FS_TREE_VISIT     Visit
+  )
+{
+  UINTN Index;
+
+  if (Visit == TreeVisitDirLeave) {
+    return EFI_SUCCESS;
+  }
+
+  for (Index = 0; Index < Walk->Depth; Index++) {
+    Print(L"  ");
+  }
+  if (Visit == TreeVisitDirEnter) {
+    Print(L"%s\\  <DIR>\n", Info->FileName);
+  } else {
+    Print(L"%s  %ld\n", Info->FileName, Info->FileSize);
+  }
+  return EFI_SUCCESS;
+}
+
+//
+// -l: recursive listing.
+//
+STATIC
+EFI_STATUS
+DoListTree (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *DirName
+  )
+{
+  EFI_STATUS   Status;
+  FS_TREE_WALK Walk;
+
+  Print(L"===== %s =====\n", DirName);
+  Status = TreeWalk(Root, DirName, EFI_FILE_MODE_READ, ListTreeCallback, NULL, &Walk);
+  Print(L"%d file(s), %d dir(s), %ld bytes\n", Walk.Files, Walk.Dirs, Walk.Bytes);
+  return Status;
+}
+
+typedef struct {
+  EFI_FILE_PROTOCOL *DstRoot;
+  CHAR16            *DstBase;
+  CHAR16            DstPath[FS_MAX_PATH];
+} FS_TREE_COPY;
+
+STATIC
+EFI_STATUS
+CopyTreeCallback (
+  IN FS_TREE_WALK      *Walk,
+  IN EFI_FILE_PROTOCOL *Handle,
+  IN EFI_FILE_INFO     *Info,
+  IN FS_TREE_VISIT     Visit
+  )
+{
+  FS_TREE_COPY      *Copy;
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Src;
+  EFI_FILE_PROTOCOL *Dst;
+  FS_STREAM         Stream;
+
+  Copy = (FS_TREE_COPY *)Walk->Context;
+  if (Visit == TreeVisitDirLeave) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // UnicodeSPrint would silently cut the name short and copy the entry to
+  // the wrong place. The walker counts the error and, for a directory,
+  // does not descend into it.
+  //
+  if (StrLen(Copy->DstBase) + 1 + StrLen(Walk->Path) >= FS_MAX_PATH) {
+    Print(L"Path too long, skipping '%s\\%s'\n", Copy->DstBase, Walk->Path);
+    return EFI_BUFFER_TOO_SMALL;
+  }
+  UnicodeSPrint(Copy->DstPath, sizeof(Copy->DstPath), L"%s\\%s", Copy->DstBase, Walk->Path);
+
+  if (Visit == TreeVisitDirEnter) {
+    Status = OpenFileSpec(
+             Copy->DstRoot,
+             &Dst,
+             Copy->DstPath,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_DIRECTORY
+             );
+    if (EFI_ERROR(Status)) {
+      Print(L"Create directory '%s' failed: %r\n", Copy->DstPath, Status);
+      return Status;
+    }
+    Dst->Close(Dst);
+    return EFI_SUCCESS;
+  }
+
+  Status = Handle->Open(Handle, &Src, Info->FileName, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", Walk->Path, Status);
+    return Status;
+  }
+
+  Status = OpenFileSpec(
+             Copy->DstRoot,
+             &Dst,
+             Copy->DstPath,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create/open dest file '%s' failed: %r\n", Copy->DstPath, Status);
+    Src->Close(Src);
+    return Status;
+  }
+
+  Status = SetFileSize(Dst, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Truncate dest file '%s' failed: %r\n", Copy->DstPath, Status);
+    Dst->Close(Dst);
+    Src->Close(Src);
+    return Status;
+  }
+
+  Status = StreamInit(&Stream, Src, Dst);
+  if (!EFI_ERROR(Status)) {
+    Status = StreamRun(&Stream);
+    StreamFree(&Stream);
+  }
+  if (!EFI_ERROR(Status)) {
+    Print(L"  %s (%ld bytes)\n", Walk->Path, Stream.BytesCopied);
+  }
+
+  Dst->Close(Dst);
+  Src->Close(Src);
+  return Status;
+}
+
+//
+// -ct: copy a directory tree. DstDir is created if needed; existing files
+// in it are overwritten.
+//
+STATIC
+EFI_STATUS
+DoCopyTree (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *SrcDir,
+  IN CHAR16            *DstDir
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Dst;
+  FS_TREE_COPY      Copy;
+  FS_TREE_WALK      Walk;
+
+  if (CompareFileSpecs(Root, SrcDir, DstDir) != SpecUnrelated) {
+    Print(L"Destination '%s' is inside source '%s'\n", DstDir, SrcDir);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &Dst,
+             DstDir,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_DIRECTORY
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create directory '%s' failed: %r\n", DstDir, Status);
+    return Status;
+  }
+  Dst->Close(Dst);
+
+  Copy.DstRoot = Root;
+  Copy.DstBase = DstDir;
+
+  Status = TreeWalk(Root, SrcDir, EFI_FILE_MODE_READ, CopyTreeCallback, &Copy, &Walk);
+  Print(L"Copied %d file(s), %d dir(s), %ld bytes from '%s' to '%s', %d error(s)\n",
+        Walk.Files, Walk.Dirs, Walk.Bytes, SrcDir, DstDir, Walk.Errors);
+  if (!EFI_ERROR(Status) && Walk.Errors > 0) {
+    Status = EFI_DEVICE_ERROR;
+  }
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+DeleteTreeCallback (
+  IN FS_TREE_WALK      *Walk,
+  IN EFI_FILE_PROTOCOL *Handle,
+  IN EFI_FILE_INFO     *Info,
+  IN FS_TREE_VISIT     Visit
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+
+  if (Visit == TreeVisitDirEnter) {
+    return EFI_SUCCESS;
+  }
+
+  if (Visit == TreeVisitFile) {
+    Status = Handle->Open(Handle, &File, Info->FileName,
+                          EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    if (EFI_ERROR(Status)) {
+      Print(L"Open file '%s' for delete failed: %r\n", Walk->Path, Status);
+      return Status;
+    }
+  } else {
+    // Directory is empty now; delete it through its own handle.
+    File = Handle;
+    Walk->HandleClosed = TRUE;
+  }
+
+  // Delete() closes the handle whatever the outcome.
+  Status = File->Delete(File);
+  if (Status != EFI_SUCCESS) {
+    Print(L"Delete '%s' failed: %r\n", Walk->Path, Status);
+    return EFI_DEVICE_ERROR;
+  }
+  return EFI_SUCCESS;
+}
+
+//
+// -dt: delete a directory tree, children first, then the directory itself.
+//
+STATIC
+EFI_STATUS
+DoDeleteTree (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *DirName
+  )
+{
+  EFI_STATUS   Status;
+  FS_TREE_WALK Walk;
+
+  Status = TreeWalk(
+             Root,
+             DirName,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
+             DeleteTreeCallback,
+             NULL,
+             &Walk
+             );
+  if (!EFI_ERROR(Status) && Walk.Errors == 0) {
+    Status = DoDeleteFile(Root, DirName);
+  }
+  Print(L"Deleted %d file(s), %d dir(s) under '%s', %d error(s)\n",
+        Walk.Files, Walk.Dirs, DirName, Walk.Errors);
+  if (!EFI_ERROR(Status) && Walk.Errors > 0) {
+    Status = EFI_DEVICE_ERROR;
+  }
+  return Status;
+}
+
+//
+// Resumable copy.
+//
+// While copying, <dst>.ckp is rewritten every FS_CHECKPOINT_INTERVAL bytes
+// with the file names, the source size, how far the destination has been
+// written and the CRC32C of that prefix. The destination is flushed
+// before each checkpoint, so the checkpoint never claims more than is on
+// the media. On restart the prefix is re-read and checked against the
+// CRC; if it matches the copy continues from there, otherwise from zero.
+//
+#define FS_CHECKPOINT_SIGNATURE  SIGNATURE_32 ('F', 'S', 'C', 'K')
+#define FS_CHECKPOINT_VERSION    1
+#define FS_CHECKPOINT_INTERVAL   SIZE_16MB
+
+typedef struct {
+  UINT32  Signature;
+  UINT32  Version;
+  UINT64  SrcSize;
+  UINT64  Offset;            // bytes of the destination known good
+  UINT32  Crc32c;            // CRC32C of the first Offset bytes
+  UINT32  Reserved;
+  CHAR16  Src[FS_MAX_PATH];
+  CHAR16  Dst[FS_MAX_PATH];
+} FS_CHECKPOINT;
+
+STATIC
+EFI_STATUS
+CheckpointWrite (
+  IN EFI_FILE_PROTOCOL *Ckp,
+  IN FS_CHECKPOINT     *Checkpoint
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  Status = Ckp->SetPosition(Ckp, 0);
+  if (!EFI_ERROR(Status)) {
+    Size   = sizeof(*Checkpoint);
+    Status = Ckp->Write(Ckp, &Size, Checkpoint);
+  }
+  if (!EFI_ERROR(Status)) {
+    Status = Ckp->Flush(Ckp);
+  }
+  return Status;
+}
+
+//
+// Read and validate an existing checkpoint for this SrcFile/DstFile pair.
+//
+STATIC
+BOOLEAN
+CheckpointLoad (
+  IN  EFI_FILE_PROTOCOL *Ckp,
+  IN  CHAR16            *SrcFile,
+  IN  CHAR16            *DstFile,
+  IN  UINT64            SrcSize,
+  OUT FS_CHECKPOINT     *Checkpoint
+  )
+{
+  UINTN Size;
+
+  Size = sizeof(*Checkpoint);
+  if (EFI_ERROR(Ckp->Read(Ckp, &Size, Checkpoint)) || Size != sizeof(*Checkpoint)) {
+    return FALSE;
+  }
+
+  Checkpoint->Src[FS_MAX_PATH - 1] = L'\0';
+  Checkpoint->Dst[FS_MAX_PATH - 1] = L'\0';
+
+  return (BOOLEAN)(Checkpoint->Signature == FS_CHECKPOINT_SIGNATURE &&
+                   Checkpoint->Version   == FS_CHECKPOINT_VERSION &&
+                   Checkpoint->SrcSize   == SrcSize &&
+                   Checkpoint->Offset    <= SrcSize &&
+                   StrCmp(Checkpoint->Src, SrcFile) == 0 &&
+                   StrCmp(Checkpoint->Dst, DstFile) == 0);
+}
+
+//
+// CRC32C of the first Length bytes of File.
+//
+STATIC
+EFI_STATUS
+CrcFilePrefix (
+  IN  EFI_FILE_PROTOCOL *File,
+  IN  UINT64            Length,
+  IN  UINT8             *Buffer,
+  OUT UINT32            *Crc32c
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  *Crc32c = 0;
+  Status  = File->SetPosition(File, 0);
+  while (!EFI_ERROR(Status) && Length > 0) {
+    Size   = (Length < FS_CHUNK_SIZE) ? (UINTN)Length : FS_CHUNK_SIZE;
+    Status = File->Read(File, &Size, Buffer);
+    if (!EFI_ERROR(Status) && Size == 0) {
+      Status = EFI_END_OF_FILE;
+    }
+    if (!EFI_ERROR(Status)) {
+      *Crc32c = FsCrc32cUpdate(*Crc32c, Buffer, Size);
+      Length -= Size;
+    }
+  }
+  return Status;
+}
+
+//
+// -ck: copy SrcFile to DstFile, resuming from <DstFile>.ckp if present.
+//
+STATIC
+EFI_STATUS
+DoCheckpointCopy (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *SrcFile,
+  IN CHAR16            *DstFile
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *Src;
+  EFI_FILE_PROTOCOL *Dst = NULL;
+  EFI_FILE_PROTOCOL *Ckp = NULL;
+  FS_CHECKPOINT     *Checkpoint;
+  CHAR16            CkpFile[FS_MAX_PATH];
+  UINT8             *Buffer = NULL;
+  UINT64            SrcSize;
+  UINT64            NextCheckpoint;
+  UINT32            Crc32c;
+  UINTN             Length;
+  UINTN             Size;
+
+  if (Root == NULL || SrcFile == NULL || DstFile == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (StrLen(SrcFile) >= FS_MAX_PATH || StrLen(DstFile) + 4 >= FS_MAX_PATH) {
+    Print(L"File name too long\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  if (IsSameFile(Root, SrcFile, DstFile)) {
+    return EFI_INVALID_PARAMETER;
+  }
+  UnicodeSPrint(CkpFile, sizeof(CkpFile), L"%s.ckp", DstFile);
+
+  Checkpoint = AllocateZeroPool(sizeof(*Checkpoint));
+  if (Checkpoint == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = OpenFileSpec(Root, &Src, SrcFile, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open file '%s' failed: %r\n", SrcFile, Status);
+    FreePool(Checkpoint);
+    return Status;
+  }
+
+  Status = GetFileSize(Src, &SrcSize);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Buffer = AllocatePool(FS_CHUNK_SIZE);
+  if (Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &Dst,
+             DstFile,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create/open dest file '%s' failed: %r\n", DstFile, Status);
+    Dst = NULL;
+    goto Done;
+  }
+
+  Status = OpenFileSpec(
+             Root,
+             &Ckp,
+             CkpFile,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create/open checkpoint '%s' failed: %r\n", CkpFile, Status);
+    Ckp = NULL;
+    goto Done;
+  }
+
+  //
+  // Resume only if the checkpoint is ours and the destination still holds
+  // exactly the data it describes.
+  //
+  if (CheckpointLoad(Ckp, SrcFile, DstFile, SrcSize, Checkpoint)) {
+    Status = CrcFilePrefix(Dst, Checkpoint->Offset, Buffer, &Crc32c);
+    if (!EFI_ERROR(Status) && Crc32c == Checkpoint->Crc32c) {
+      Print(L"Resuming at %ld of %ld bytes\n", Checkpoint->Offset, SrcSize);
+    } else {
+      Print(L"Checkpoint does not match '%s', starting over\n", DstFile);
+      Checkpoint->Offset = 0;
+      Checkpoint->Crc32c = 0;
+    }
+  } else {
+    ZeroMem(Checkpoint, sizeof(*Checkpoint));
+    Checkpoint->Signature = FS_CHECKPOINT_SIGNATURE;
+    Checkpoint->Version   = FS_CHECKPOINT_VERSION;
+    Checkpoint->SrcSize   = SrcSize;
+    StrCpyS(Checkpoint->Src, FS_MAX_PATH, SrcFile);
+    StrCpyS(Checkpoint->Dst, FS_MAX_PATH, DstFile);
+  }
+
+  Status = Src->SetPosition(Src, Checkpoint->Offset);
+  if (!EFI_ERROR(Status)) {
+    Status = Dst->SetPosition(Dst, Checkpoint->Offset);
+  }
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Crc32c         = Checkpoint->Crc32c;
+  NextCheckpoint = Checkpoint->Offset + FS_CHECKPOINT_INTERVAL;
+
+  while (Checkpoint->Offset < SrcSize) {
+    Length = FS_CHUNK_SIZE;
+    Status = Src->Read(Src, &Length, Buffer);
+    if (EFI_ERROR(Status)) {
+      Print(L"Read source failed at %ld: %r\n", Checkpoint->Offset, Status);
+      goto Done;
+    }
+    if (Length == 0) {
+      break;
+    }
+
+    Size   = Length;
+    Status = Dst->Write(Dst, &Size, Buffer);
+    if (EFI_ERROR(Status)) {
+      Print(L"Write dest file failed at %ld: %r\n", Checkpoint->Offset, Status);
+      goto Done;
+    }
+
+    Crc32c = FsCrc32cUpdate(Crc32c, Buffer, Length);
+
+    if (Checkpoint->Offset + Length >= NextCheckpoint) {
+      Status = Dst->Flush(Dst);
+      if (EFI_ERROR(Status)) {
+        Print(L"Flush dest file failed: %r\n", Status);
+        goto Done;
+      }
+      Checkpoint->Offset = Checkpoint->Offset + Length;
+      Checkpoint->Crc32c = Crc32c;
+      Status = CheckpointWrite(Ckp, Checkpoint);
+      if (EFI_ERROR(Status)) {
+        Print(L"Write checkpoint failed: %r\n", Status);
+        goto Done;
+      }
+      NextCheckpoint = Checkpoint->Offset + FS_CHECKPOINT_INTERVAL;
+      Print(L"\r%ld / %ld bytes", Checkpoint->Offset, SrcSize);
+    } else {
+      Checkpoint->Offset += Length;
+    }
+  }
+
+  //
+  // A destination left over from a different, longer copy keeps its tail
+  // after a restart from zero; cut it to the source size.
+  //
+  Status = SetFileSize(Dst, Checkpoint->Offset);
+  if (!EFI_ERROR(Status)) {
+    Status = Dst->Flush(Dst);
+  }
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+
+  Print(L"\rCopied %ld bytes from '%s' to '%s', CRC32C %08x\n",
+        Checkpoint->Offset, SrcFile, DstFile, Crc32c);
+
+  //
+  // Done: the checkpoint has served its purpose.
+  //
+  Ckp->Delete(Ckp);
+  Ckp = NULL;
+
+Done:
+  if (Ckp != NULL) {
+    Ckp->Close(Ckp);
+  }
+  if (Dst != NULL) {
+    Dst->Close(Dst);
+  }
+  if (Buffer != NULL) {
+    FreePool(Buffer);
+  }
+  Src->Close(Src);
+  FreePool(Checkpoint);
+  return Status;
+}
+
+//
+// Benchmark helpers. Times come from TimerLib's performance counter;
+// ElapsedTicks takes care of counters that run down.
+//
+STATIC
+UINT64
+BenchElapsedNs (
+  IN UINT64 Begin
+  )
+{
+  return GetTimeInNanoSecond(ElapsedTicks(Begin, GetPerformanceCounter()));
+}
+
+//
+// Throughput in MB/s (10^6 bytes per second).
+//
+STATIC
+UINT64
+BenchMBps (
+  IN UINT64 Bytes,
+  IN UINT64 Ns
+  )
+{
+  if (Ns == 0) {
+    return 0;
+  }
+  return DivU64x64Remainder(MultU64x32(Bytes, 1000), Ns, NULL);
+}
+
+//
+// Create FileName holding Size bytes of a non-zero pattern, written in
+// Chunk-sized writes.
+//
+STATIC
+EFI_STATUS
+BenchWriteFile (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName,
+  IN UINT64            Size,
+  IN UINT8             *Buffer,
+  IN UINTN             Chunk
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  UINTN             Length;
+
+  Status = OpenFileSpec(
+             Root,
+             &File,
+             FileName,
+             EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+             EFI_FILE_ARCHIVE
+             );
+  if (EFI_ERROR(Status)) {
+    Print(L"Create '%s' failed: %r\n", FileName, Status);
+    return Status;
+  }
+
+  Status = SetFileSize(File, 0);
+  while (!EFI_ERROR(Status) && Size > 0) {
+    Length = (Size < Chunk) ? (UINTN)Size : Chunk;
+    Status = File->Write(File, &Length, Buffer);
+    Size  -= Length;
+  }
+  if (EFI_ERROR(Status)) {
+    Print(L"Write '%s' failed: %r\n", FileName, Status);
+  }
+
+  File->Close(File);
+  return Status;
+}
+
+STATIC
+VOID
+BenchDeleteQuietly (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  if (!EFI_ERROR(OpenFileSpec(Root, &File, FileName,
+                              EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+    File->Delete(File);
+  }
+}
+
+//
+// Open or create the benchmark's scratch directory. Dir must be a
+// directory; *Created tells whether the benchmark made it and so may
+// delete it afterwards.
+//
+STATIC
+EFI_STATUS
+BenchOpenDir (
+  IN  EFI_FILE_PROTOCOL *Root,
+  IN  CHAR16            *Dir,
+  OUT BOOLEAN           *Created
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  EFI_FILE_INFO     *Info;
+  UINTN             InfoSize;
+
+  *Created = FALSE;
+  Status = OpenFileSpec(Root, &File, Dir, EFI_FILE_MODE_READ, 0);
+  if (Status == EFI_NOT_FOUND) {
+    Status = OpenFileSpec(
+               Root,
+               &File,
+               Dir,
+               EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+               EFI_FILE_DIRECTORY
+               );
+    *Created = (BOOLEAN)!EFI_ERROR(Status);
+  }
+  if (EFI_ERROR(Status)) {
+    Print(L"Open/create directory '%s' failed: %r\n", Dir, Status);
+    return Status;
+  }
+
+  InfoSize = 0;
+  Info     = NULL;
+  Status   = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, NULL);
+  if (Status == EFI_BUFFER_TOO_SMALL) {
+    Info = AllocatePool(InfoSize);
+    Status = (Info == NULL) ? EFI_OUT_OF_RESOURCES :
+             File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
+  }
+  if (!EFI_ERROR(Status) && (Info->Attribute & EFI_FILE_DIRECTORY) == 0) {
+    Print(L"'%s' is not a directory\n", Dir);
+    Status = EFI_INVALID_PARAMETER;
+  } else if (EFI_ERROR(Status)) {
+    Print(L"GetInfo '%s' failed: %r\n", Dir, Status);
+  }
+  if (Info != NULL) {
+    FreePool(Info);
+  }
+
+  File->Close(File);
+  return Status;
+}
+
+//
+// The benchmarks overwrite and delete their scratch files, so in a
+// directory they did not create none of those names may exist yet.
+//
+STATIC
+EFI_STATUS
+BenchCheckScratch (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  if (EFI_ERROR(OpenFileSpec(Root, &File, FileName, EFI_FILE_MODE_READ, 0))) {
+    return EFI_SUCCESS;
+  }
+  File->Close(File);
+  Print(L"'%s' already exists; use a new or empty directory\n", FileName);
+  return EFI_ACCESS_DENIED;
+}
+
+//
+// Read FileName to the end in Chunk-sized reads.
+//
+STATIC
+EFI_STATUS
+BenchReadFile (
+  IN  EFI_FILE_PROTOCOL *Root,
+  IN  CHAR16            *FileName,
+  IN  UINT8             *Buffer,
+  IN  UINTN             Chunk,
+  OUT UINT64            *Bytes
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  UINTN             Length;
+
+  *Bytes = 0;
+  Status = OpenFileSpec(Root, &File, FileName, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Open '%s' failed: %r\n", FileName, Status);
+    return Status;
+  }
+
+  do {
+    Length = Chunk;
+    Status = File->Read(File, &Length, Buffer);
+    *Bytes += Length;
+  } while (!EFI_ERROR(Status) && Length > 0);
+  if (EFI_ERROR(Status)) {
+    Print(L"Read '%s' failed: %r\n", FileName, Status);
+  }
+
+  File->Close(File);
+  return Status;
+}
+
+//
+// -bench: throughput and metadata costs of the volume holding Dir.
+//   - sequential write and read of FS_BENCH_FILE_SIZE bytes per chunk size
+//   - streaming copy through DoCreateOrCopy
+//   - small-file create/delete through DoCreateOrCopy/DoDeleteFile
+//   - EFI_FILE_INFO GetInfo latency
+//
+#define FS_BENCH_FILE_SIZE    SIZE_32MB
+#define FS_BENCH_SMALL_FILES  128
+#define FS_BENCH_INFO_CALLS   1000
+
+STATIC
+EFI_STATUS
+DoBenchmark (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *Dir
+  )
+{
+  STATIC CONST UINTN ChunkSizes[] = {
+    SIZE_4KB, SIZE_16KB, SIZE_64KB, SIZE_256KB, SIZE_1MB, SIZE_4MB, SIZE_8MB
+  };
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  CHAR16            TestFile[FS_MAX_PATH];
+  CHAR16            CopyFile[FS_MAX_PATH];
+  CHAR16            SmallFile[FS_MAX_PATH];
+  UINT8             *Buffer;
+  UINT64            Begin;
+  UINT64            Ns;
+  UINT64            Bytes;
+  UINT64            Size;
+  UINT64            WriteMBps;
+  UINT64            ReadMBps;
+  UINT64            BestWrite = 0;
+  UINT64            BestRead = 0;
+  UINTN             BestWriteChunk = 0;
+  UINTN             BestReadChunk = 0;
+  UINT64            CopyMBps = 0;
+  UINT64            CreatesPerSec = 0;
+  UINT64            DeletesPerSec = 0;
+  UINT64            InfoNs = 0;
+  UINTN             Index;
+  BOOLEAN           Created;
+
+  Status = BenchOpenDir(Root, Dir, &Created);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  UnicodeSPrint(TestFile, sizeof(TestFile), L"%s\\bench.bin", Dir);
+  UnicodeSPrint(CopyFile, sizeof(CopyFile), L"%s\\copy.bin", Dir);
+  if (!Created) {
+    Status = BenchCheckScratch(Root, TestFile);
+    if (!EFI_ERROR(Status)) {
+      Status = BenchCheckScratch(Root, CopyFile);
+    }
+    for (Index = 0; Index < FS_BENCH_SMALL_FILES && !EFI_ERROR(Status); Index++) {
+      UnicodeSPrint(SmallFile, sizeof(SmallFile), L"%s\\s%04d.tmp", Dir, Index);
+      Status = BenchCheckScratch(Root, SmallFile);
+    }
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  Buffer = AllocatePool(SIZE_8MB);
+  if (Buffer == NULL) {
+    if (Created) {
+      BenchDeleteQuietly(Root, Dir);
+    }
+    return EFI_OUT_OF_RESOURCES;
+  }
+  SetMem(Buffer, SIZE_8MB, 0xA5);
+
+  Print(L"File system benchmark in '%s' (%ld MB test file)\n",
+        Dir, RShiftU64(FS_BENCH_FILE_SIZE, 20));
+  Print(L"   Chunk  Write MB/s  Read MB/s\n");
+  Print(L"--------  ----------  ---------\n");
+
+  //
+  // Sequential write then read at each chunk size. The file is deleted
+  // between sizes so every write pass allocates clusters afresh.
+  //
+  for (Index = 0; Index < ARRAY_SIZE(ChunkSizes); Index++) {
+    BenchDeleteQuietly(Root, TestFile);
+
+    Begin  = GetPerformanceCounter();
+    Status = BenchWriteFile(Root, TestFile, FS_BENCH_FILE_SIZE, Buffer, ChunkSizes[Index]);
+    Ns     = BenchElapsedNs(Begin);
+    if (EFI_ERROR(Status)) {
+      goto Done;
+    }
+    WriteMBps = BenchMBps(FS_BENCH_FILE_SIZE, Ns);
+
+    Begin  = GetPerformanceCounter();
+    Status = BenchReadFile(Root, TestFile, Buffer, ChunkSizes[Index], &Bytes);
+    Ns     = BenchElapsedNs(Begin);
+    if (EFI_ERROR(Status)) {
+      goto Done;
+    }
+    ReadMBps = BenchMBps(Bytes, Ns);
+
+    if (WriteMBps > BestWrite) {
+      BestWrite      = WriteMBps;
+      BestWriteChunk = ChunkSizes[Index];
+    }
+    if (ReadMBps > BestRead) {
+      BestRead      = ReadMBps;
+      BestReadChunk = ChunkSizes[Index];
+    }
+    Print(L"%5d KB  %10ld  %9ld\n", ChunkSizes[Index] / SIZE_1KB, WriteMBps, ReadMBps);
+  }
+
+  //
+  // The commands themselves run quietly from here on, so only the
+  // benchmark's own lines (and any failure) are printed.
+  //
+  mQuiet = TRUE;
+
+  Begin  = GetPerformanceCounter();
+  Status = DoCreateOrCopy(Root, TestFile, CopyFile, NULL);
+  Ns     = BenchElapsedNs(Begin);
+  if (EFI_ERROR(Status)) {
+    goto Done;
+  }
+  CopyMBps = BenchMBps(FS_BENCH_FILE_SIZE, Ns);
+
+  Begin = GetPerformanceCounter();
+  for (Index = 0; Index < FS_BENCH_SMALL_FILES; Index++) {
+    UnicodeSPrint(SmallFile, sizeof(SmallFile), L"%s\\s%04d.tmp", Dir, Index);
+    Status = DoCreateOrCopy(Root, NULL, SmallFile, NULL);
+    if (EFI_ERROR(Status)) {
+      goto Done;
+    }
+  }
+  Ns = BenchElapsedNs(Begin);
+  CreatesPerSec = (Ns == 0) ? 0 : DivU64x64Remainder(MultU64x32(FS_BENCH_SMALL_FILES, 1000000000), Ns, NULL);
+
+  Begin = GetPerformanceCounter();
+  for (Index = 0; Index < FS_BENCH_SMALL_FILES; Index++) {
+    UnicodeSPrint(SmallFile, sizeof(SmallFile), L"%s\\s%04d.tmp", Dir, Index);
+    Status = DoDeleteFile(Root, SmallFile);
+    if (EFI_ERROR(Status)) {
+      goto Done;
+    }
   }
+  Ns = BenchElapsedNs(Begin);
+  DeletesPerSec = (Ns == 0) ? 0 : DivU64x64Remainder(MultU64x32(FS_BENCH_SMALL_FILES, 1000000000), Ns, NULL);
 
-  // Read file content
-  Status = File->Read(File, &Size, LocalBuffer);
-  if (EFI_ERROR (Status)) {
-    Print(L"Read file failed: %r\n", Status);
-    FreePool(LocalBuffer);
-    FreePool(FileInfo);
-    File->Close(File);
-    return Status;
+  Status = OpenFileSpec(Root, &File, TestFile, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(Status)) {
+    goto Done;
   }
-
-  // Close file and free info
+  Begin = GetPerformanceCounter();
+  for (Index = 0; Index < FS_BENCH_INFO_CALLS && !EFI_ERROR(Status); Index++) {
+    Status = GetFileSize(File, &Size);
+  }
+  Ns = BenchElapsedNs(Begin);
   File->Close(File);
-  FreePool(FileInfo);
+  if (EFI_ERROR(Status)) {
+    Print(L"GetInfo failed: %r\n", Status);
+    goto Done;
+  }
+  InfoNs = DivU64x32(Ns, FS_BENCH_INFO_CALLS);
 
-  *Buffer = LocalBuffer;
-  *BufferSize = Size;
-  return EFI_SUCCESS;
+  Print(L"\nSummary\n");
+  Print(L"  Best write          %ld MB/s at %d KB chunks\n", BestWrite, BestWriteChunk / SIZE_1KB);
+  Print(L"  Best read           %ld MB/s at %d KB chunks\n", BestRead, BestReadChunk / SIZE_1KB);
+  Print(L"  Streaming copy      %ld MB/s\n", CopyMBps);
+  Print(L"  Create empty file   %ld files/s\n", CreatesPerSec);
+  Print(L"  Delete file         %ld files/s\n", DeletesPerSec);
+  Print(L"  GetInfo             %ld ns/call\n", InfoNs);
+
+Done:
+  mQuiet = FALSE;
+  for (Index = 0; Index < FS_BENCH_SMALL_FILES; Index++) {
+    UnicodeSPrint(SmallFile, sizeof(SmallFile), L"%s\\s%04d.tmp", Dir, Index);
+    BenchDeleteQuietly(Root, SmallFile);
+  }
+  BenchDeleteQuietly(Root, CopyFile);
+  BenchDeleteQuietly(Root, TestFile);
+  if (Created) {
+    BenchDeleteQuietly(Root, Dir);
+  }
+  FreePool(Buffer);
+  return Status;
 }
 
 //
-// Create (empty) file or copy from source file.
+// -mbench: merge throughput against number of parts and total size, with
+// and without pre-sizing the destination. Scratch files go to Dir.
 //
+#define MBENCH_MAX_PARTS  16
+
 STATIC
 EFI_STATUS
-DoCreateOrCopy (
+DoMergeBenchmark (
   IN EFI_FILE_PROTOCOL *Root,
-  IN CHAR16            *SrcFile OPTIONAL,
-  IN CHAR16            *DstFile
+  IN CHAR16            *Dir
   )
 {
-  EFI_STATUS       Status;
-  EFI_FILE_PROTOCOL *Dst;
-  VOID             *Buffer = NULL;
-  UINTN            Size = 0;
+  STATIC CONST UINTN  PartCounts[] = { 2, 4, 8, 16 };
+  STATIC CONST UINT64 TotalSizes[] = { SIZE_8MB, SIZE_64MB };
+  EFI_STATUS        Status;
+  CHAR16            *Names[MBENCH_MAX_PARTS];
+  CHAR16            Merged[FS_MAX_PATH];
+  UINT8             *Buffer;
+  UINT64            Begin;
+  UINT64            Ns[2];
+  UINT64            Bytes;
+  UINTN             SizeIndex;
+  UINTN             CountIndex;
+  UINTN             Index;
+  UINTN             Pass;
+  BOOLEAN           Created;
 
-  if (Root == NULL || DstFile == NULL) {
-    return EFI_INVALID_PARAMETER;
+  Status = BenchOpenDir(Root, Dir, &Created);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
 
-  if (SrcFile != NULL) {
-    // Copy: read source file into memory
-    Status = ReadFileToBuffer(Root, SrcFile, &Buffer, &Size);
-    if (EFI_ERROR(Status)) {
-      return Status;
-    }
+  ZeroMem(Names, sizeof(Names));
+  Merged[0] = L'\0';
+  Buffer = AllocatePool(FS_CHUNK_SIZE);
+  if (Buffer == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
   }
+  SetMem(Buffer, FS_CHUNK_SIZE, 0x5A);
 
-  // Open/create destination file
-  Status = Root->Open(
-                    Root,
-                    &Dst,
-                    DstFile,
-                    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
-                    EFI_FILE_ARCHIVE
-                    );
-  if (EFI_ERROR (Status)) {
-    Print(L"Create/open dest file '%s' failed: %r\n", DstFile, Status);
-    if (Buffer != NULL) {
-      FreePool(Buffer);
+  for (Index = 0; Index < MBENCH_MAX_PARTS; Index++) {
+    Names[Index] = AllocatePool(FS_MAX_PATH * sizeof(CHAR16));
+    if (Names[Index] == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Done;
     }
-    return Status;
+    UnicodeSPrint(Names[Index], FS_MAX_PATH * sizeof(CHAR16), L"%s\\part%02d.bin", Dir, Index);
   }
+  UnicodeSPrint(Merged, sizeof(Merged), L"%s\\merged.bin", Dir);
 
-  if (Buffer != NULL && Size > 0) {
-    UINTN WriteSize = Size;
-    Status = Dst->Write(Dst, &WriteSize, Buffer);
-    if (EFI_ERROR (Status)) {
-      Print(L"Write dest file failed: %r\n", Status);
-    } else {
-      Print(L"Copied %d bytes from '%s' to '%s'\n", WriteSize, SrcFile, DstFile);
+  if (!Created) {
+    Status = BenchCheckScratch(Root, Merged);
+    for (Index = 0; Index < MBENCH_MAX_PARTS && !EFI_ERROR(Status); Index++) {
+      Status = BenchCheckScratch(Root, Names[Index]);
+    }
+    if (EFI_ERROR(Status)) {
+      //
+      // Nothing was written; keep the user's files.
+      //
+      Merged[0] = L'\0';
+      for (Index = 0; Index < MBENCH_MAX_PARTS; Index++) {
+        FreePool(Names[Index]);
+        Names[Index] = NULL;
+      }
+      goto Done;
     }
-  } else {
-    // Just create empty file
-    Print(L"Created empty file '%s'\n", DstFile);
   }
 
-  Dst->Close(Dst);
+  Print(L"Merge benchmark in '%s' (%d KB chunks)\n", Dir, FS_CHUNK_SIZE / SIZE_1KB);
+  Print(L"Parts  Total(MB)  Presized MB/s  Growing MB/s\n");
+  Print(L"-----  ---------  -------------  ------------\n");
+
+  for (SizeIndex = 0; SizeIndex < ARRAY_SIZE(TotalSizes); SizeIndex++) {
+    for (CountIndex = 0; CountIndex < ARRAY_SIZE(PartCounts); CountIndex++) {
+      for (Index = 0; Index < PartCounts[CountIndex]; Index++) {
+        Status = BenchWriteFile(Root, Names[Index],
+                                DivU64x32(TotalSizes[SizeIndex], (UINT32)PartCounts[CountIndex]),
+                                Buffer, FS_CHUNK_SIZE);
+        if (EFI_ERROR(Status)) {
+          goto Done;
+        }
+      }
+
+      for (Pass = 0; Pass < 2; Pass++) {
+        BenchDeleteQuietly(Root, Merged);
+        Begin  = GetPerformanceCounter();
+        Status = MergeFiles(Root, Names, PartCounts[CountIndex], Merged, (BOOLEAN)(Pass == 0), &Bytes);
+        Ns[Pass] = BenchElapsedNs(Begin);
+        if (EFI_ERROR(Status)) {
+          goto Done;
+        }
+      }
 
+      Print(L"%5d  %9ld  %13ld  %12ld\n",
+            PartCounts[CountIndex],
+            RShiftU64(TotalSizes[SizeIndex], 20),
+            BenchMBps(Bytes, Ns[0]),
+            BenchMBps(Bytes, Ns[1]));
+    }
+  }
+
+Done:
+  if (Merged[0] != L'\0') {
+    BenchDeleteQuietly(Root, Merged);
+  }
+  for (Index = 0; Index < MBENCH_MAX_PARTS; Index++) {
+    if (Names[Index] != NULL) {
+      BenchDeleteQuietly(Root, Names[Index]);
+      FreePool(Names[Index]);
+    }
+  }
+  if (Created) {
+    BenchDeleteQuietly(Root, Dir);
+  }
   if (Buffer != NULL) {
     FreePool(Buffer);
   }
-
   return Status;
 }
 
 //
-// Read file and display (assume ASCII text; print with %a).
+// Print a digest as lowercase hex.
+//
+STATIC
+VOID
+PrintHex (
+  IN CONST UINT8 *Bytes,
+  IN UINTN       Size
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < Size; Index++) {
+    Print(L"%02x", Bytes[Index]);
+  }
+}
+
+STATIC
+VOID
+PrintHashes (
+  IN UINT32      Kinds,
+  IN CONST UINT8 *Sha256,
+  IN UINT32      Crc32c
+  )
+{
+  if ((Kinds & FS_HASH_SHA256) != 0) {
+    Print(L"  SHA-256: ");
+    PrintHex(Sha256, FS_SHA256_DIGEST_SIZE);
+    Print(L"\n");
+  }
+  if ((Kinds & FS_HASH_CRC32C) != 0) {
+    Print(L"  CRC32C:  %08x\n", Crc32c);
+  }
+}
+
+//
+// Parse an expected hash given on the command line: 64 hex digits are a
+// SHA-256 digest, 8 hex digits a CRC32C value.
 //
 STATIC
 EFI_STATUS
-DoReadAndDisplay (
-  IN EFI_FILE_PROTOCOL *Root,
-  IN CHAR16            *FileName
+ParseExpectedHash (
+  IN  CHAR16 *Text,
+  OUT UINT32 *Kind,
+  OUT UINT8  Sha256[FS_SHA256_DIGEST_SIZE],
+  OUT UINT32 *Crc32c
   )
 {
-  EFI_STATUS Status;
-  VOID       *Buffer;
-  UINTN      Size;
+  UINT8 CrcBytes[4];
 
-  Status = ReadFileToBuffer(Root, FileName, &Buffer, &Size);
-  if (EFI_ERROR(Status)) {
-    return Status;
+  if (StrLen(Text) == 2 * FS_SHA256_DIGEST_SIZE) {
+    *Kind = FS_HASH_SHA256;
+    return StrHexToBytes(Text, StrLen(Text), Sha256, FS_SHA256_DIGEST_SIZE);
   }
 
-  ((CHAR8*)Buffer)[Size] = '\0'; // ensure NUL for %a
-  Print(L"===== %s =====\n", FileName);
-  Print(L"%a\n", (CHAR8*)Buffer);
-  Print(L"===== END =====\n");
+  if (StrLen(Text) == 2 * sizeof(CrcBytes)) {
+    *Kind = FS_HASH_CRC32C;
+    if (EFI_ERROR(StrHexToBytes(Text, StrLen(Text), CrcBytes, sizeof(CrcBytes)))) {
+      return EFI_INVALID_PARAMETER;
+    }
+    *Crc32c = ((UINT32)CrcBytes[0] << 24) | ((UINT32)CrcBytes[1] << 16) |
+              ((UINT32)CrcBytes[2] << 8) | (UINT32)CrcBytes[3];
+    return EFI_SUCCESS;
+  }
 
-  FreePool(Buffer);
-  return EFI_SUCCESS;
+  return EFI_INVALID_PARAMETER;
+}
+
+STATIC
+BOOLEAN
+HashMatches (
+  IN FS_HASH_CONTEXT *Hash,
+  IN UINT32          Kind,
+  IN CONST UINT8     *ExpectedSha,
+  IN UINT32          ExpectedCrc
+  )
+{
+  UINT8  Sha256[FS_SHA256_DIGEST_SIZE];
+  UINT32 Crc32c;
+
+  FsHashFinal(Hash, Sha256, &Crc32c);
+  PrintHashes(Kind, Sha256, Crc32c);
+
+  if (Kind == FS_HASH_SHA256) {
+    return (BOOLEAN)(CompareMem(Sha256, ExpectedSha, FS_SHA256_DIGEST_SIZE) == 0);
+  }
+  return (BOOLEAN)(Crc32c == ExpectedCrc);
 }
 
 //
-// Delete a file.
+// Hash a whole file in one streaming pass.
 //
 STATIC
 EFI_STATUS
-DoDeleteFile (
-  IN EFI_FILE_PROTOCOL *Root,
-  IN CHAR16            *FileName
+HashFile (
+  IN  EFI_FILE_PROTOCOL *Root,
+  IN  CHAR16            *FileName,
+  IN OUT FS_HASH_CONTEXT *Hash,
+  OUT UINT64            *Size
   )
 {
   EFI_STATUS        Status;
   EFI_FILE_PROTOCOL *File;
+  FS_STREAM         Stream;
 
-  if (Root == NULL || FileName == NULL) {
-    return EFI_INVALID_PARAMETER;
-  }
-
-  Status = Root->Open(
-                    Root,
-                    &File,
-                    FileName,
-                    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
-                    0
-                    );
+  Status = OpenFileSpec(Root, &File, FileName, EFI_FILE_MODE_READ, 0);
   if (EFI_ERROR(Status)) {
-    Print(L"Open file '%s' for delete failed: %r\n", FileName, Status);
+    Print(L"Open file '%s' failed: %r\n", FileName, Status);
     return Status;
   }
 
-  Status = File->Delete(File);
-  if (Status == EFI_SUCCESS || Status == EFI_WARN_DELETE_FAILURE) {
-    Print(L"Delete file '%s' status: %r\n", FileName, Status);
-  } else {
-    Print(L"Delete file '%s' failed: %r\n", FileName, Status);
+  Status = StreamInit(&Stream, File, NULL);
+  if (!EFI_ERROR(Status)) {
+    Stream.Hash = Hash;
+    Status = StreamRun(&Stream);
+    *Size = Stream.BytesCopied;
+    StreamFree(&Stream);
   }
 
-  // On success, Delete() already closes the handle.
+  File->Close(File);
   return Status;
 }
 
 //
-// Merge two files into a destination file: src1 + src2 -> dst.
+// -h / -hc: print the hashes of a file.
 //
 STATIC
 EFI_STATUS
-DoMergeFiles (
+DoHashFile (
   IN EFI_FILE_PROTOCOL *Root,
-  IN CHAR16            *Src1,
-  IN CHAR16            *Src2,
-  IN CHAR16            *Dst
+  IN CHAR16            *FileName,
+  IN UINT32            Kinds
   )
 {
-  EFI_STATUS        Status;
-  EFI_FILE_PROTOCOL *DstFile;
-  VOID              *Buf1 = NULL;
-  VOID              *Buf2 = NULL;
-  UINTN             Size1 = 0;
-  UINTN             Size2 = 0;
-
-  if (Root == NULL || Src1 == NULL || Src2 == NULL || Dst == NULL) {
-    return EFI_INVALID_PARAMETER;
-  }
+  EFI_STATUS      Status;
+  FS_HASH_CONTEXT Hash;
+  UINT8           Sha256[FS_SHA256_DIGEST_SIZE];
+  UINT32          Crc32c;
+  UINT64          Size;
 
-  Status = ReadFileToBuffer(Root, Src1, &Buf1, &Size1);
+  FsHashInit(&Hash, Kinds);
+  Status = HashFile(Root, FileName, &Hash, &Size);
   if (EFI_ERROR(Status)) {
-    goto Done;
+    return Status;
   }
 
-  Status = ReadFileToBuffer(Root, Src2, &Buf2, &Size2);
-  if (EFI_ERROR(Status)) {
-    goto Done;
-  }
+  FsHashFinal(&Hash, Sha256, &Crc32c);
+  Print(L"%s (%ld bytes, %s)\n", FileName, Size, FsHashEngineName());
+  PrintHashes(Kinds, Sha256, Crc32c);
+  return EFI_SUCCESS;
+}
 
-  Status = Root->Open(
-                    Root,
-                    &DstFile,
-                    Dst,
-                    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
-                    EFI_FILE_ARCHIVE
-                    );
-  if (EFI_ERROR(Status)) {
-    Print(L"Open/create dst '%s' failed: %r\n", Dst, Status);
-    goto Done;
-  }
+//
+// -v: hash a file and compare with an expected SHA-256 or CRC32C.
+//
+STATIC
+EFI_STATUS
+DoVerifyFile (
+  IN EFI_FILE_PROTOCOL *Root,
+  IN CHAR16            *FileName,
+  IN CHAR16            *Expected
+  )
+{
+  EFI_STATUS      Status;
+  FS_HASH_CONTEXT Hash;
+  UINT32          Kind;
+  UINT8           ExpectedSha[FS_SHA256_DIGEST_SIZE];
+  UINT32          ExpectedCrc = 0;
+  UINT64          Size;
 
-  if (Size1 > 0) {
-    UINTN WriteSize = Size1;
-    Status = DstFile->Write(DstFile, &WriteSize, Buf1);
-    if (EFI_ERROR(Status)) {
-      Print(L"Write first file data failed: %r\n", Status);
-      DstFile->Close(DstFile);
-      goto Done;
-    }
+  if (EFI_ERROR(ParseExpectedHash(Expected, &Kind, ExpectedSha, &ExpectedCrc))) {
+    Print(L"Expected hash must be 64 (SHA-256) or 8 (CRC32C) hex digits\n");
+    return EFI_INVALID_PARAMETER;
   }
 
-  if (Size2 > 0) {
-    UINTN WriteSize = Size2;
-    Status = DstFile->Write(DstFile, &WriteSize, Buf2);
-    if (EFI_ERROR(Status)) {
-      Print(L"Write second file data failed: %r\n", Status);
-      DstFile->Close(DstFile);
-      goto Done;
-    }
+  FsHashInit(&Hash, Kind);
+  Status = HashFile(Root, FileName, &Hash, &Size);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
 
-  Print(L"Merged '%s' (%d bytes) + '%s' (%d bytes) -> '%s'\n",
-        Src1, (INT32)Size1, Src2, (INT32)Size2, Dst);
-
-  DstFile->Close(DstFile);
-
-Done:
-  if (Buf1 != NULL) {
-    FreePool(Buf1);
-  }
-  if (Buf2 != NULL) {
-    FreePool(Buf2);
+  Print(L"%s (%ld bytes)\n", FileName, Size);
+  if (!HashMatches(&Hash, Kind, ExpectedSha, ExpectedCrc)) {
+    Print(L"VERIFY FAILED\n");
+    return EFI_CRC_ERROR;
   }
-  return Status;
+  Print(L"Verify OK\n");
+  return EFI_SUCCESS;
 }
 
 //
-// Show file information using EFI_FILE_INFO.
+// -cv: copy and hash the data in the same pass; with an expected hash the
+// result is checked too, otherwise the hashes are printed for the record.
+// The destination is truncated before the copy, so the hash covers all of
+// it. -cvr also reads the destination back and requires the same hash,
+// which catches data the volume did not store as written.
 //
 STATIC
 EFI_STATUS
-DoShowFileInfo (
+DoCopyAndVerify (
   IN EFI_FILE_PROTOCOL *Root,
-  IN CHAR16            *FileName
+  IN CHAR16            *SrcFile,
+  IN CHAR16            *DstFile,
+  IN CHAR16            *Expected OPTIONAL,
+  IN BOOLEAN           ReadBack
   )
 {
-  EFI_STATUS        Status;
-  EFI_FILE_PROTOCOL *File;
-  UINTN             InfoSize = 0;
-  EFI_FILE_INFO     *Info;
+  EFI_STATUS      Status;
+  FS_HASH_CONTEXT SrcHash;
+  FS_HASH_CONTEXT DstHash;
+  UINT32          Kind = FS_HASH_ALL;
+  UINT8           ExpectedSha[FS_SHA256_DIGEST_SIZE];
+  UINT32          ExpectedCrc = 0;
+  UINT8           SrcSha[FS_SHA256_DIGEST_SIZE];
+  UINT8           DstSha[FS_SHA256_DIGEST_SIZE];
+  UINT32          SrcCrc;
+  UINT32          DstCrc;
+  UINT64          Size;
 
-  if (Root == NULL || FileName == NULL) {
+  if (Expected != NULL &&
+      EFI_ERROR(ParseExpectedHash(Expected, &Kind, ExpectedSha, &ExpectedCrc))) {
+    Print(L"Expected hash must be 64 (SHA-256) or 8 (CRC32C) hex digits\n");
     return EFI_INVALID_PARAMETER;
   }
 
-  Status = Root->Open(
-                    Root,
-                    &File,
-                    FileName,
-                    EFI_FILE_MODE_READ,
-                    0
-                    );
+  FsHashInit(&SrcHash, Kind);
+  Status = DoCreateOrCopy(Root, SrcFile, DstFile, &SrcHash);
   if (EFI_ERROR(Status)) {
-    Print(L"Open file '%s' failed: %r\n", FileName, Status);
     return Status;
   }
+  FsHashFinal(&SrcHash, SrcSha, &SrcCrc);
+  PrintHashes(Kind, SrcSha, SrcCrc);
 
-  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, NULL);
-  if (Status != EFI_BUFFER_TOO_SMALL) {
-    Print(L"GetInfo(size) failed: %r\n", Status);
-    File->Close(File);
-    return Status;
+  if (ReadBack) {
+    FsHashInit(&DstHash, Kind);
+    Status = HashFile(Root, DstFile, &DstHash, &Size);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    FsHashFinal(&DstHash, DstSha, &DstCrc);
+    if (CompareMem(SrcSha, DstSha, FS_SHA256_DIGEST_SIZE) != 0 || SrcCrc != DstCrc) {
+      Print(L"VERIFY FAILED: '%s' (%ld bytes) does not read back as the data of '%s'\n",
+            DstFile, Size, SrcFile);
+      return EFI_CRC_ERROR;
+    }
+    Print(L"Read-back OK (%ld bytes)\n", Size);
   }
 
-  Info = AllocatePool(InfoSize);
-  if (Info == NULL) {
-    File->Close(File);
-    return EFI_OUT_OF_RESOURCES;
+  if (Expected == NULL) {
+    return EFI_SUCCESS;
   }
 
-  Status = File->GetInfo(File, &gEfiFileInfoGuid, &InfoSize, Info);
-  if (EFI_ERROR(Status)) {
-    Print(L"GetInfo failed: %r\n", Status);
-    FreePool(Info);
-    File->Close(File);
-    return Status;
+  if ((Kind == FS_HASH_SHA256) ?
+      (CompareMem(SrcSha, ExpectedSha, FS_SHA256_DIGEST_SIZE) != 0) :
+      (SrcCrc != ExpectedCrc)) {
+    Print(L"VERIFY FAILED: data copied to '%s' does not match the expected hash\n", DstFile);
+    return EFI_CRC_ERROR;
   }
-
-  
-  Print(L"File: %s\n", Info->FileName);
-  Print(L"  Size:          %d bytes\n", (INT32)Info->FileSize);
-  Print(L"  PhysicalSize:  %d bytes\n", (INT32)Info->PhysicalSize);
-  Print(L"  Attribute:     0x%lx\n", Info->Attribute);
-
-  Print(L"  CreateTime:    %04d-%02d-%02d %02d:%02d:%02d\n",
-        Info->CreateTime.Year, Info->CreateTime.Month, Info->CreateTime.Day,
-        Info->CreateTime.Hour, Info->CreateTime.Minute, Info->CreateTime.Second);
-  Print(L"  LastAccessTime:%04d-%02d-%02d %02d:%02d:%02d\n",
-        Info->LastAccessTime.Year, Info->LastAccessTime.Month, Info->LastAccessTime.Day,
-        Info->LastAccessTime.Hour, Info->LastAccessTime.Minute, Info->LastAccessTime.Second);
-  Print(L"  Modification:  %04d-%02d-%02d %02d:%02d:%02d\n",
-        Info->ModificationTime.Year, Info->ModificationTime.Month, Info->ModificationTime.Day,
-        Info->ModificationTime.Hour, Info->ModificationTime.Minute, Info->ModificationTime.Second);
-
-  FreePool(Info);
-  File->Close(File);
+  Print(L"Verify OK\n");
   return EFI_SUCCESS;
 }
 
@@ -458,10 +3988,28 @@ PrintUsage (
   Print(L"\nFileSystem.efi usage:\n");
   Print(L"  -c dst              Create empty file\n");
   Print(L"  -c src dst          Copy file\n");
-  Print(L"  -r file             Read and display file\n");
+  Print(L"  -r file             View file page by page (text)\n");
+  Print(L"  -x file             View file page by page (hex)\n");
+  Print(L"  -rz file, -xz file  View a gzip/zlib/EDK II compressed file decompressed\n");
+  Print(L"  -cz src dst         Decompress gzip/zlib/EDK II compressed src into dst\n");
+  Print(L"  -cs src dst         Copy file, skipping all-zero blocks (sparse)\n");
+  Print(L"  -ck src dst         Copy file, resumable from dst.ckp after a failure\n");
   Print(L"  -d file             Delete file\n");
-  Print(L"  -m src1 src2 dst    Merge two files\n");
+  Print(L"  -m src1 .. srcN dst Merge files (N >= 2)\n");
   Print(L"  -i file             Show file information\n");
+  Print(L"  -h file             Show SHA-256 and CRC32C of file\n");
+  Print(L"  -hc file            Show CRC32C only (fast)\n");
+  Print(L"  -v file hash        Verify file against SHA-256 or CRC32C\n");
+  Print(L"  -cv src dst [hash]  Copy, hashing data on the fly; verify if hash given\n");
+  Print(L"  -cvr src dst [hash] As -cv, then read dst back and check it has the same hash\n");
+  Print(L"  -l dir              List directory tree\n");
+  Print(L"  -ct srcdir dstdir   Copy directory tree\n");
+  Print(L"  -dt dir             Delete directory tree\n");
+  Print(L"  -vol                List file system volumes\n");
+  Print(L"  -bench [dir]        Benchmark read/write, copy, create/delete, GetInfo\n");
+  Print(L"  -mbench [dir]       Merge throughput vs. part count and size\n");
+  Print(L"File names may start with a volume: vol<N>:\\path, fs<N>:\\path or\n");
+  Print(L"<device path text>:\\path. Without one, the current volume is used.\n");
 }
 
 EFI_STATUS
@@ -507,20 +4055,46 @@ FileSystemMain (
     return EFI_SUCCESS;
   }
 
-  if (StrCmp(Argv[1], L"-c") == 0) {
+  if (StrCmp(Argv[1], L"-vol") == 0) {
+    Status = DoListVolumes(ImageHandle);
+  } else if (StrCmp(Argv[1], L"-c") == 0) {
     if (Argc == 3) {
       // create empty
-      Status = DoCreateOrCopy(Root, NULL, Argv[2]);
+      Status = DoCreateOrCopy(Root, NULL, Argv[2], NULL);
     } else if (Argc == 4) {
       // copy
-      Status = DoCreateOrCopy(Root, Argv[2], Argv[3]);
+      Status = DoCreateOrCopy(Root, Argv[2], Argv[3], NULL);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-cs") == 0) {
+    if (Argc == 4) {
+      Status = DoSparseCopy(Root, Argv[2], Argv[3]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-ck") == 0) {
+    if (Argc == 4) {
+      Status = DoCheckpointCopy(Root, Argv[2], Argv[3]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-cz") == 0) {
+    if (Argc == 4) {
+      Status = DoDecompressCopy(Root, Argv[2], Argv[3]);
     } else {
       PrintUsage();
       Status = EFI_INVALID_PARAMETER;
     }
-  } else if (StrCmp(Argv[1], L"-r") == 0) {
+  } else if (StrCmp(Argv[1], L"-r") == 0 || StrCmp(Argv[1], L"-x") == 0 ||
+             StrCmp(Argv[1], L"-rz") == 0 || StrCmp(Argv[1], L"-xz") == 0) {
     if (Argc == 3) {
-      Status = DoReadAndDisplay(Root, Argv[2]);
+      Status = DoReadAndDisplay(Root, Argv[2],
+                                (BOOLEAN)(Argv[1][1] == L'x'),
+                                (BOOLEAN)(Argv[1][2] == L'z'));
     } else {
       PrintUsage();
       Status = EFI_INVALID_PARAMETER;
@@ -533,8 +4107,8 @@ FileSystemMain (
       Status = EFI_INVALID_PARAMETER;
     }
   } else if (StrCmp(Argv[1], L"-m") == 0) {
-    if (Argc == 5) {
-      Status = DoMergeFiles(Root, Argv[2], Argv[3], Argv[4]);
+    if (Argc >= 5) {
+      Status = DoMergeFiles(Root, &Argv[2], Argc - 3, Argv[Argc - 1]);
     } else {
       PrintUsage();
       Status = EFI_INVALID_PARAMETER;
@@ -546,11 +4120,70 @@ FileSystemMain (
       PrintUsage();
       Status = EFI_INVALID_PARAMETER;
     }
+  } else if (StrCmp(Argv[1], L"-h") == 0 || StrCmp(Argv[1], L"-hc") == 0) {
+    if (Argc == 3) {
+      Status = DoHashFile(Root, Argv[2],
+                          (StrCmp(Argv[1], L"-h") == 0) ? FS_HASH_ALL : FS_HASH_CRC32C);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-v") == 0) {
+    if (Argc == 4) {
+      Status = DoVerifyFile(Root, Argv[2], Argv[3]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-cv") == 0 || StrCmp(Argv[1], L"-cvr") == 0) {
+    if (Argc == 4 || Argc == 5) {
+      Status = DoCopyAndVerify(Root, Argv[2], Argv[3], (Argc == 5) ? Argv[4] : NULL,
+                               (BOOLEAN)(StrCmp(Argv[1], L"-cvr") == 0));
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-bench") == 0) {
+    if (Argc == 2 || Argc == 3) {
+      Status = DoBenchmark(Root, (Argc == 3) ? Argv[2] : L"\\FsBench");
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-mbench") == 0) {
+    if (Argc == 2 || Argc == 3) {
+      Status = DoMergeBenchmark(Root, (Argc == 3) ? Argv[2] : L"\\FsBench");
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-l") == 0) {
+    if (Argc == 3) {
+      Status = DoListTree(Root, Argv[2]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-ct") == 0) {
+    if (Argc == 4) {
+      Status = DoCopyTree(Root, Argv[2], Argv[3]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
+  } else if (StrCmp(Argv[1], L"-dt") == 0) {
+    if (Argc == 3) {
+      Status = DoDeleteTree(Root, Argv[2]);
+    } else {
+      PrintUsage();
+      Status = EFI_INVALID_PARAMETER;
+    }
   } else {
     PrintUsage();
     Status = EFI_INVALID_PARAMETER;
   }
 
+  CloseVolumes();
   Root->Close(Root);
   return Status;
 }
@@ -0,0 +1,746 @@
+/** @file
+  Streaming deflate decoder for FileSystem.efi
+  - Decodes gzip and zlib streams as a pull-driven state machine: each
+    FsInflateRead() runs until the caller's buffer is full, suspending in
+    the middle of a stored block or a match copy if need be
+  - Huffman codes up to INFLATE_FAST_BITS long are resolved with a single
+    table lookup; longer ones fall back to the canonical-code walk
+  - The gzip CRC32 / ISIZE and zlib Adler-32 trailers are checked
+  - Only the first member of a multi-member gzip file is decoded
+**/
+
+#include "Inflate.h"
+
+#define INFLATE_WINDOW_SIZE  SIZE_32KB      /* deflate maximum distance; power of 2 */
+#define INFLATE_INPUT_SIZE   SIZE_64KB
+#define INFLATE_MAX_BITS     15
+#define INFLATE_FAST_BITS    9
+#define INFLATE_MAX_LITLEN   288
+#define INFLATE_MAX_DIST     30
+
+#define GZIP_FHCRC           BIT1
+#define GZIP_FEXTRA          BIT2
+#define GZIP_FNAME           BIT3
+#define GZIP_FCOMMENT        BIT4
+
+#define CRC32_POLY           0xEDB88320
+#define ADLER32_BASE         65521
+#define ADLER32_NMAX         5552           /* bytes before the sums can overflow */
+
+typedef enum {
+  InflateStateBlock,                        /* next block header (or trailer) */
+  InflateStateStored,
+  InflateStateCodes,
+  InflateStateTrailer,
+  InflateStateDone
+} INFLATE_STATE;
+
+typedef struct {
+  UINT16  Count[INFLATE_MAX_BITS + 1];      /* codes per length */
+  UINT16  Symbol[INFLATE_MAX_LITLEN];       /* symbols in canonical order */
+  UINT16  Fast[1 << INFLATE_FAST_BITS];     /* (Symbol << 4) | Length, 0 = walk */
+} INFLATE_HUFFMAN;
+
+struct _FS_INFLATE {
+  UINT32            Format;
+  FS_INFLATE_INPUT  Input;
+  VOID              *Context;
+  EFI_STATUS        Error;                  /* sticky */
+  INFLATE_STATE     State;
+  BOOLEAN           LastBlock;
+  UINTN             StoredLeft;
+  UINTN             CopyLeft;               /* pending match */
+  UINTN             CopyDist;
+
+  UINT64            BitBuf;                 /* LSB first */
+  UINTN             BitCount;
+  UINTN             PadBits;                /* zero bits appended past end of input */
+  UINTN             InPos;
+  UINTN             InSize;
+  BOOLEAN           InEnd;
+
+  UINT64            Total;
+  UINT32            Crc32;
+  UINT32            Adler32;
+  UINTN             WinPos;
+
+  INFLATE_HUFFMAN   LitLen;
+  INFLATE_HUFFMAN   Dist;
+  UINT8             Window[INFLATE_WINDOW_SIZE];
+  UINT8             InBuf[INFLATE_INPUT_SIZE];
+};
+
+STATIC CONST UINT16 mLenBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+STATIC CONST UINT8  mLenExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+STATIC CONST UINT16 mDistBase[INFLATE_MAX_DIST] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+STATIC CONST UINT8  mDistExtra[INFLATE_MAX_DIST] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+STATIC CONST UINT8  mCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+STATIC BOOLEAN  mCrc32Ready = FALSE;
+STATIC UINT32   mCrc32Table[256];
+
+/* ------------------------- checksums ------------------------- */
+
+STATIC
+VOID
+InflateChecksum (
+  IN FS_INFLATE   *Inflate,
+  IN CONST UINT8  *Data,
+  IN UINTN        Size
+  )
+{
+  UINT32 Crc;
+  UINT32 A;
+  UINT32 B;
+  UINTN  Run;
+
+  if (Inflate->Format == FS_INFLATE_GZIP) {
+    Crc = ~Inflate->Crc32;
+    while (Size-- > 0) {
+      Crc = mCrc32Table[(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+    }
+    Inflate->Crc32 = ~Crc;
+    return;
+  }
+
+  A = Inflate->Adler32 & 0xFFFF;
+  B = Inflate->Adler32 >> 16;
+  while (Size > 0) {
+    Run   = MIN(Size, ADLER32_NMAX);
+    Size -= Run;
+    while (Run-- > 0) {
+      A += *Data++;
+      B += A;
+    }
+    A %= ADLER32_BASE;
+    B %= ADLER32_BASE;
+  }
+  Inflate->Adler32 = (B << 16) | A;
+}
+
+/* ------------------------- bit input ------------------------- */
+
+/* Make at least Need (<= 32) bits available, padding with zeros at end of input */
+STATIC
+VOID
+InflateRefill (
+  IN FS_INFLATE  *Inflate,
+  IN UINTN       Need
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+  UINT8      Byte;
+
+  while (Inflate->BitCount < Need) {
+    if (Inflate->InPos == Inflate->InSize && !Inflate->InEnd) {
+      Size   = INFLATE_INPUT_SIZE;
+      Status = Inflate->Input(Inflate->Context, Inflate->InBuf, &Size);
+      if (EFI_ERROR(Status)) {
+        Inflate->Error = Status;
+        Size = 0;
+      }
+      Inflate->InPos  = 0;
+      Inflate->InSize = Size;
+      Inflate->InEnd  = (BOOLEAN)(Size == 0);
+    }
+
+    if (Inflate->InPos < Inflate->InSize) {
+      Byte = Inflate->InBuf[Inflate->InPos++];
+    } else {
+      Byte = 0;
+      Inflate->PadBits += 8;
+    }
+    Inflate->BitBuf   |= LShiftU64(Byte, Inflate->BitCount);
+    Inflate->BitCount += 8;
+  }
+}
+
+STATIC
+VOID
+InflateDrop (
+  IN FS_INFLATE  *Inflate,
+  IN UINTN       Count
+  )
+{
+  if (Count > Inflate->BitCount - Inflate->PadBits) {
+    /* consumed bits that were never in the input: truncated stream */
+    Inflate->Error    = EFI_VOLUME_CORRUPTED;
+    Inflate->BitBuf   = 0;
+    Inflate->BitCount = 0;
+    Inflate->PadBits  = 0;
+    return;
+  }
+  Inflate->BitBuf    = RShiftU64(Inflate->BitBuf, Count);
+  Inflate->BitCount -= Count;
+}
+
+STATIC
+UINT32
+InflateBits (
+  IN FS_INFLATE  *Inflate,
+  IN UINTN       Count
+  )
+{
+  UINT32 Value;
+
+  InflateRefill(Inflate, Count);
+  Value = (UINT32)Inflate->BitBuf & ((1U << Count) - 1);
+  InflateDrop(Inflate, Count);
+  return Value;
+}
+
+/* ------------------------- Huffman codes ------------------------- */
+
+STATIC
+EFI_STATUS
+InflateBuild (
+  OUT INFLATE_HUFFMAN  *Huffman,
+  IN  CONST UINT8      *Lengths,
+  IN  UINTN            Count
+  )
+{
+  UINT16 Offset[INFLATE_MAX_BITS + 1];
+  UINT16 Next[INFLATE_MAX_BITS + 1];
+  INTN   Left;
+  UINTN  Symbol;
+  UINTN  Length;
+  UINTN  Code;
+  UINTN  Reversed;
+  UINTN  Bit;
+
+  ZeroMem(Huffman->Count, sizeof(Huffman->Count));
+  for (Symbol = 0; Symbol < Count; Symbol++) {
+    Huffman->Count[Lengths[Symbol]]++;
+  }
+  Huffman->Count[0] = 0;
+
+  /* Over-subscribed sets are invalid; incomplete ones are legal (e.g. one distance code) */
+  Left = 1;
+  for (Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+    Left <<= 1;
+    Left  -= Huffman->Count[Length];
+    if (Left < 0) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+  }
+
+  Offset[1] = 0;
+  for (Length = 1; Length < INFLATE_MAX_BITS; Length++) {
+    Offset[Length + 1] = Offset[Length] + Huffman->Count[Length];
+  }
+  for (Symbol = 0; Symbol < Count; Symbol++) {
+    if (Lengths[Symbol] != 0) {
+      Huffman->Symbol[Offset[Lengths[Symbol]]++] = (UINT16)Symbol;
+    }
+  }
+
+  /* Canonical codes, bit-reversed because deflate sends them MSB first */
+  ZeroMem(Huffman->Fast, sizeof(Huffman->Fast));
+  Code = 0;
+  for (Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+    Code = (Code + Huffman->Count[Length - 1]) << 1;
+    Next[Length] = (UINT16)Code;
+  }
+  for (Symbol = 0; Symbol < Count; Symbol++) {
+    Length = Lengths[Symbol];
+    if (Length == 0 || Length > INFLATE_FAST_BITS) {
+      continue;
+    }
+    Code     = Next[Length]++;
+    Reversed = 0;
+    for (Bit = 0; Bit < Length; Bit++) {
+      Reversed = (Reversed << 1) | ((Code >> Bit) & 1);
+    }
+    for (; Reversed < ARRAY_SIZE(Huffman->Fast); Reversed += (UINTN)1 << Length) {
+      Huffman->Fast[Reversed] = (UINT16)((Symbol << 4) | Length);
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+/* Next symbol, or -1 (with Error set) for a code not in the set */
+STATIC
+INTN
+InflateDecode (
+  IN FS_INFLATE       *Inflate,
+  IN INFLATE_HUFFMAN  *Huffman
+  )
+{
+  UINT16 Entry;
+  UINT32 Bits;
+  INTN   Code;
+  INTN   First;
+  INTN   Index;
+  INTN   Count;
+  UINTN  Length;
+
+  InflateRefill(Inflate, INFLATE_MAX_BITS);
+
+  Entry = Huffman->Fast[(UINTN)Inflate->BitBuf & (ARRAY_SIZE(Huffman->Fast) - 1)];
+  if (Entry != 0) {
+    InflateDrop(Inflate, Entry & 0xF);
+    return Entry >> 4;
+  }
+
+  Bits  = (UINT32)Inflate->BitBuf;
+  Code  = 0;
+  First = 0;
+  Index = 0;
+  for (Length = 1; Length <= INFLATE_MAX_BITS; Length++) {
+    Code  |= Bits & 1;
+    Bits >>= 1;
+    Count  = Huffman->Count[Length];
+    if (Code - Count < First) {
+      InflateDrop(Inflate, Length);
+      return Huffman->Symbol[Index + (Code - First)];
+    }
+    Index  += Count;
+    First  += Count;
+    First <<= 1;
+    Code  <<= 1;
+  }
+
+  Inflate->Error = EFI_VOLUME_CORRUPTED;
+  return -1;
+}
+
+STATIC
+EFI_STATUS
+InflateFixedTables (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  UINT8  Lengths[INFLATE_MAX_LITLEN];
+  UINTN  Symbol;
+
+  for (Symbol = 0; Symbol < INFLATE_MAX_LITLEN; Symbol++) {
+    Lengths[Symbol] = (Symbol < 144) ? 8 : (Symbol < 256) ? 9 : (Symbol < 280) ? 7 : 8;
+  }
+  InflateBuild(&Inflate->LitLen, Lengths, INFLATE_MAX_LITLEN);
+
+  SetMem(Lengths, INFLATE_MAX_DIST, 5);
+  return InflateBuild(&Inflate->Dist, Lengths, INFLATE_MAX_DIST);
+}
+
+STATIC
+EFI_STATUS
+InflateDynamicTables (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  UINT8  Lengths[286 + INFLATE_MAX_DIST];
+  UINTN  LitCount;
+  UINTN  DistCount;
+  UINTN  CodeCount;
+  UINTN  Index;
+  UINTN  Repeat;
+  UINT8  Value;
+  INTN   Symbol;
+
+  LitCount  = InflateBits(Inflate, 5) + 257;
+  DistCount = InflateBits(Inflate, 5) + 1;
+  CodeCount = InflateBits(Inflate, 4) + 4;
+  if (LitCount > 286 || DistCount > INFLATE_MAX_DIST) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  /* Code length code, temporarily held in LitLen */
+  ZeroMem(Lengths, sizeof(Lengths));
+  for (Index = 0; Index < CodeCount; Index++) {
+    Lengths[mCodeLengthOrder[Index]] = (UINT8)InflateBits(Inflate, 3);
+  }
+  if (EFI_ERROR(InflateBuild(&Inflate->LitLen, Lengths, 19))) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Index = 0;
+  while (Index < LitCount + DistCount) {
+    Symbol = InflateDecode(Inflate, &Inflate->LitLen);
+    if (Symbol < 0 || EFI_ERROR(Inflate->Error)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    if (Symbol < 16) {
+      Lengths[Index++] = (UINT8)Symbol;
+      continue;
+    }
+
+    if (Symbol == 16) {
+      if (Index == 0) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+      Value  = Lengths[Index - 1];
+      Repeat = 3 + InflateBits(Inflate, 2);
+    } else if (Symbol == 17) {
+      Value  = 0;
+      Repeat = 3 + InflateBits(Inflate, 3);
+    } else {
+      Value  = 0;
+      Repeat = 11 + InflateBits(Inflate, 7);
+    }
+    if (Index + Repeat > LitCount + DistCount) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    while (Repeat-- > 0) {
+      Lengths[Index++] = Value;
+    }
+  }
+
+  /* A block without an end-of-block code could never finish */
+  if (Lengths[256] == 0) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  if (EFI_ERROR(InflateBuild(&Inflate->LitLen, Lengths, LitCount)) ||
+      EFI_ERROR(InflateBuild(&Inflate->Dist, Lengths + LitCount, DistCount))) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+  return Inflate->Error;
+}
+
+/* ------------------------- containers ------------------------- */
+
+STATIC
+EFI_STATUS
+InflateHeader (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  UINT32 Cmf;
+  UINT32 Flags;
+  UINTN  Index;
+  UINTN  Length;
+
+  if (Inflate->Format == FS_INFLATE_ZLIB) {
+    Cmf   = InflateBits(Inflate, 8);
+    Flags = InflateBits(Inflate, 8);
+    if ((Cmf & 0x0F) != 8 || (Cmf >> 4) > 7 || ((Cmf << 8) | Flags) % 31 != 0) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    if ((Flags & BIT5) != 0) {
+      return EFI_UNSUPPORTED;               /* preset dictionary */
+    }
+    Inflate->Adler32 = 1;
+    return Inflate->Error;
+  }
+
+  if (InflateBits(Inflate, 8) != 0x1F || InflateBits(Inflate, 8) != 0x8B ||
+      InflateBits(Inflate, 8) != 8) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+  Flags = InflateBits(Inflate, 8);
+  if ((Flags & 0xE0) != 0) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  /* MTIME, XFL, OS */
+  for (Index = 0; Index < 6; Index++) {
+    InflateBits(Inflate, 8);
+  }
+  if ((Flags & GZIP_FEXTRA) != 0) {
+    Length = InflateBits(Inflate, 16);
+    while (Length-- > 0 && !EFI_ERROR(Inflate->Error)) {
+      InflateBits(Inflate, 8);
+    }
+  }
+  if ((Flags & GZIP_FNAME) != 0) {
+    while (InflateBits(Inflate, 8) != 0 && !EFI_ERROR(Inflate->Error)) {
+    }
+  }
+  if ((Flags & GZIP_FCOMMENT) != 0) {
+    while (InflateBits(Inflate, 8) != 0 && !EFI_ERROR(Inflate->Error)) {
+    }
+  }
+  if ((Flags & GZIP_FHCRC) != 0) {
+    InflateBits(Inflate, 16);
+  }
+  Inflate->Crc32 = 0;
+  return Inflate->Error;
+}
+
+STATIC
+VOID
+InflateTrailer (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  UINT32 Expected;
+  UINT32 Size;
+  UINTN  Index;
+
+  InflateDrop(Inflate, Inflate->BitCount & 7);
+
+  if (Inflate->Format == FS_INFLATE_GZIP) {
+    Expected  = InflateBits(Inflate, 16);
+    Expected |= InflateBits(Inflate, 16) << 16;
+    Size      = InflateBits(Inflate, 16);
+    Size     |= InflateBits(Inflate, 16) << 16;
+    if (!EFI_ERROR(Inflate->Error) &&
+        (Expected != Inflate->Crc32 || Size != (UINT32)Inflate->Total)) {
+      Inflate->Error = EFI_CRC_ERROR;
+    }
+  } else {
+    Expected = 0;
+    for (Index = 0; Index < 4; Index++) {
+      Expected = (Expected << 8) | InflateBits(Inflate, 8);
+    }
+    if (!EFI_ERROR(Inflate->Error) && Expected != Inflate->Adler32) {
+      Inflate->Error = EFI_CRC_ERROR;
+    }
+  }
+  Inflate->State = InflateStateDone;
+}
+
+/* ------------------------- public API ------------------------- */
+
+UINT32
+FsInflateDetect (
+  IN CONST UINT8  *Head,
+  IN UINTN        Size
+  )
+{
+  if (Size >= 3 && Head[0] == 0x1F && Head[1] == 0x8B && Head[2] == 8) {
+    return FS_INFLATE_GZIP;
+  }
+  if (Size >= 2 && (Head[0] & 0x0F) == 8 && (Head[0] >> 4) <= 7 &&
+      ((Head[0] << 8) | Head[1]) % 31 == 0 && (Head[1] & BIT5) == 0) {
+    return FS_INFLATE_ZLIB;
+  }
+  return FS_INFLATE_NONE;
+}
+
+EFI_STATUS
+FsInflateOpen (
+  IN  UINT32            Format,
+  IN  FS_INFLATE_INPUT  Input,
+  IN  VOID              *Context,
+  OUT FS_INFLATE        **Inflate
+  )
+{
+  FS_INFLATE *Inf;
+  EFI_STATUS Status;
+  UINT32     Crc;
+  UINTN      Index;
+  UINTN      Bit;
+
+  if ((Format != FS_INFLATE_GZIP && Format != FS_INFLATE_ZLIB) || Input == NULL || Inflate == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!mCrc32Ready) {
+    for (Index = 0; Index < 256; Index++) {
+      Crc = (UINT32)Index;
+      for (Bit = 0; Bit < 8; Bit++) {
+        Crc = (Crc >> 1) ^ ((Crc & 1) ? CRC32_POLY : 0);
+      }
+      mCrc32Table[Index] = Crc;
+    }
+    mCrc32Ready = TRUE;
+  }
+
+  /* Window and input buffer live in the context; nothing is allocated later */
+  Inf = AllocateZeroPool(sizeof(*Inf));
+  if (Inf == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Inf->Format  = Format;
+  Inf->Input   = Input;
+  Inf->Context = Context;
+  Inf->State   = InflateStateBlock;
+
+  Status = InflateHeader(Inf);
+  if (EFI_ERROR(Status)) {
+    FreePool(Inf);
+    return Status;
+  }
+
+  *Inflate = Inf;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+FsInflateRead (
+  IN     FS_INFLATE  *Inflate,
+  OUT    VOID        *Buffer,
+  IN OUT UINTN       *Size
+  )
+{
+  UINT8      *Out;
+  UINTN      Want;
+  UINTN      Produced;
+  UINTN      Summed;
+  UINTN      Run;
+  INTN       Symbol;
+  UINTN      Length;
+  UINTN      Distance;
+  UINT8      Byte;
+
+  Out      = Buffer;
+  Want     = *Size;
+  Produced = 0;
+  Summed   = 0;
+
+  while (Produced < Want && !EFI_ERROR(Inflate->Error) && Inflate->State != InflateStateDone) {
+    switch (Inflate->State) {
+    case InflateStateBlock:
+      if (Inflate->LastBlock) {
+        Inflate->State = InflateStateTrailer;
+        break;
+      }
+      Inflate->LastBlock = (BOOLEAN)(InflateBits(Inflate, 1) != 0);
+      switch (InflateBits(Inflate, 2)) {
+      case 0:
+        InflateDrop(Inflate, Inflate->BitCount & 7);
+        Length = InflateBits(Inflate, 16);
+        if ((InflateBits(Inflate, 16) ^ 0xFFFF) != Length) {
+          Inflate->Error = EFI_VOLUME_CORRUPTED;
+          break;
+        }
+        Inflate->StoredLeft = Length;
+        Inflate->State      = InflateStateStored;
+        break;
+      case 1:
+        InflateFixedTables(Inflate);
+        Inflate->State = InflateStateCodes;
+        break;
+      case 2:
+        if (EFI_ERROR(InflateDynamicTables(Inflate))) {
+          Inflate->Error = EFI_VOLUME_CORRUPTED;
+          break;
+        }
+        Inflate->State = InflateStateCodes;
+        break;
+      default:
+        Inflate->Error = EFI_VOLUME_CORRUPTED;
+        break;
+      }
+      break;
+
+    case InflateStateStored:
+      if (Inflate->StoredLeft == 0) {
+        Inflate->State = InflateStateBlock;
+        break;
+      }
+      if (Inflate->BitCount == 0 && Inflate->InPos < Inflate->InSize) {
+        /* Byte aligned with nothing buffered: copy straight from the input */
+        Run = MIN(Inflate->StoredLeft, MIN(Inflate->InSize - Inflate->InPos, Want - Produced));
+        CopyMem(Out + Produced, Inflate->InBuf + Inflate->InPos, Run);
+        Inflate->InPos += Run;
+      } else {
+        Run = 1;
+        Out[Produced] = (UINT8)InflateBits(Inflate, 8);
+      }
+      for (Length = 0; Length < Run; Length++) {
+        Inflate->Window[Inflate->WinPos] = Out[Produced + Length];
+        Inflate->WinPos = (Inflate->WinPos + 1) & (INFLATE_WINDOW_SIZE - 1);
+      }
+      Produced            += Run;
+      Inflate->Total      += Run;
+      Inflate->StoredLeft -= Run;
+      break;
+
+    case InflateStateCodes:
+      if (Inflate->CopyLeft > 0) {
+        while (Inflate->CopyLeft > 0 && Produced < Want) {
+          Byte = Inflate->Window[(Inflate->WinPos - Inflate->CopyDist) & (INFLATE_WINDOW_SIZE - 1)];
+          Inflate->Window[Inflate->WinPos] = Byte;
+          Inflate->WinPos = (Inflate->WinPos + 1) & (INFLATE_WINDOW_SIZE - 1);
+          Out[Produced++] = Byte;
+          Inflate->CopyLeft--;
+          Inflate->Total++;
+        }
+        break;
+      }
+
+      Symbol = InflateDecode(Inflate, &Inflate->LitLen);
+      if (Symbol < 0) {
+        break;
+      }
+      if (Symbol < 256) {
+        Inflate->Window[Inflate->WinPos] = (UINT8)Symbol;
+        Inflate->WinPos = (Inflate->WinPos + 1) & (INFLATE_WINDOW_SIZE - 1);
+        Out[Produced++] = (UINT8)Symbol;
+        Inflate->Total++;
+        break;
+      }
+      if (Symbol == 256) {
+        Inflate->State = InflateStateBlock;
+        break;
+      }
+
+      Symbol -= 257;
+      if (Symbol >= (INTN)ARRAY_SIZE(mLenBase)) {
+        Inflate->Error = EFI_VOLUME_CORRUPTED;
+        break;
+      }
+      Length = mLenBase[Symbol] + InflateBits(Inflate, mLenExtra[Symbol]);
+
+      Symbol = InflateDecode(Inflate, &Inflate->Dist);
+      if (Symbol < 0 || Symbol >= INFLATE_MAX_DIST) {
+        Inflate->Error = EFI_VOLUME_CORRUPTED;
+        break;
+      }
+      Distance = mDistBase[Symbol] + InflateBits(Inflate, mDistExtra[Symbol]);
+      if (Distance > Inflate->Total) {
+        Inflate->Error = EFI_VOLUME_CORRUPTED;
+        break;
+      }
+      Inflate->CopyLeft = Length;
+      Inflate->CopyDist = Distance;
+      break;
+
+    case InflateStateTrailer:
+      InflateChecksum(Inflate, Out + Summed, Produced - Summed);
+      Summed = Produced;
+      InflateTrailer(Inflate);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  /* A full buffer can coincide with the last block: finish the trailer now */
+  if (!EFI_ERROR(Inflate->Error) && Inflate->State == InflateStateBlock && Inflate->LastBlock) {
+    Inflate->State = InflateStateTrailer;
+  }
+  InflateChecksum(Inflate, Out + Summed, Produced - Summed);
+  if (!EFI_ERROR(Inflate->Error) && Inflate->State == InflateStateTrailer) {
+    InflateTrailer(Inflate);
+  }
+
+  *Size = Produced;
+  return Inflate->Error;
+}
+
+UINT64
+FsInflateTotal (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  return Inflate->Total;
+}
+
+VOID
+FsInflateClose (
+  IN FS_INFLATE  *Inflate
+  )
+{
+  if (Inflate != NULL) {
+    FreePool(Inflate);
+  }
+}
@@ -0,0 +1,73 @@
+/** @file
+  Streaming deflate decoder for FileSystem.efi - Header
+  - gzip (RFC 1952) and zlib (RFC 1950) containers around deflate (RFC 1951)
+  - Input is pulled through a callback, output is produced on demand into
+    the caller's buffer; memory use is fixed (32 KB window + input buffer)
+**/
+
+#ifndef __INFLATE_H__
+#define __INFLATE_H__
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+/* Container formats recognized by FsInflateDetect() */
+#define FS_INFLATE_NONE        0
+#define FS_INFLATE_GZIP        1
+#define FS_INFLATE_ZLIB        2
+
+/* Bytes FsInflateDetect() wants to look at */
+#define FS_INFLATE_DETECT_SIZE 3
+
+/* Fetch up to *Size bytes of compressed input; *Size = 0 at end of input */
+typedef
+EFI_STATUS
+(*FS_INFLATE_INPUT) (
+  IN     VOID   *Context,
+  OUT    VOID   *Buffer,
+  IN OUT UINTN  *Size
+  );
+
+typedef struct _FS_INFLATE  FS_INFLATE;
+
+UINT32
+FsInflateDetect (
+  IN CONST UINT8  *Head,
+  IN UINTN        Size
+  );
+
+/* Allocate a decoder and parse the container header */
+EFI_STATUS
+FsInflateOpen (
+  IN  UINT32            Format,
+  IN  FS_INFLATE_INPUT  Input,
+  IN  VOID              *Context,
+  OUT FS_INFLATE        **Inflate
+  );
+
+/*
+  Produce up to *Size bytes of decompressed data. *Size = 0 once the
+  stream has ended and its trailer checked out. EFI_VOLUME_CORRUPTED for
+  malformed data, EFI_CRC_ERROR for a trailer mismatch.
+*/
+EFI_STATUS
+FsInflateRead (
+  IN     FS_INFLATE  *Inflate,
+  OUT    VOID        *Buffer,
+  IN OUT UINTN       *Size
+  );
+
+/* Decompressed bytes produced so far */
+UINT64
+FsInflateTotal (
+  IN FS_INFLATE  *Inflate
+  );
+
+VOID
+FsInflateClose (
+  IN FS_INFLATE  *Inflate
+  );
+
+#endif /* __INFLATE_H__ */
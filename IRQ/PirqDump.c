@@ -107,11 +107,13 @@ FindPirqTable (
   )
 {
   EFI_STATUS Status;
+  EFI_STATUS Result;
   EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL *RbIo;
 
   EFI_PHYSICAL_ADDRESS Addr;
   UINT32 Sig;
   PIR_TABLE_HEADER Hdr;
+  ARENA Arena;
 
   RbIo = NULL;
 
@@ -124,6 +126,14 @@ FindPirqTable (
     return EFI_NOT_FOUND;
   }
 
+  /*
+    Candidate copies come from one arena that is reset after each check,
+    so the scan costs a single page allocation however many signatures
+    it hits (unless a table outgrows the first block)
+  */
+  ArenaInit(&Arena, 0);
+  Result = EFI_NOT_FOUND;
+
   /* Per spec/training: Search 0xF0000~0xFFFFF for "$PIR". Scan 16-byte boundary */
   for (Addr = 0xF0000; Addr <= 0xFFFF0; Addr += 0x10) {
 
@@ -157,9 +167,10 @@ FindPirqTable (
     {
       UINT8 *Tmp;
 
-      Tmp = (UINT8*)AllocatePool((UINTN)Hdr.TableSize);
+      Tmp = (UINT8*)ArenaAlloc(&Arena, (UINTN)Hdr.TableSize);
       if (Tmp == NULL) {
-        return EFI_OUT_OF_RESOURCES;
+        Result = EFI_OUT_OF_RESOURCES;
+        break;
       }
 
       Status = RbMemRead(RbIo, Addr, Tmp, (UINTN)Hdr.TableSize);
@@ -168,16 +179,17 @@ FindPirqTable (
           CopyMem(OutHeaderCopy, &Hdr, sizeof(Hdr));
           *OutRbIo      = RbIo;
           *OutTableAddr = Addr;
-          FreePool(Tmp);
-          return EFI_SUCCESS;
+          Result = EFI_SUCCESS;
+          break;
         }
       }
 
-      FreePool(Tmp);
+      ArenaReset(&Arena);
     }
   }
 
-  return EFI_NOT_FOUND;
+  ArenaFree(&Arena);
+  return Result;
 }
 
 VOID
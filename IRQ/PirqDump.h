@@ -13,6 +13,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 #include <Protocol/PciRootBridgeIo.h>
+#include "../Common/ArenaLib.h"
 
 #define PIR_SIGNATURE  SIGNATURE_32('$','P','I','R')
 
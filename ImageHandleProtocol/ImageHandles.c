@@ -16,6 +16,22 @@ which lets users:
 #include <Protocol/LoadedImage.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/SimpleFileSystem.h>
+#include "../Common/ArenaLib.h"
+
+//
+// Protocol name cache buckets (power of two)
+//
+#define NAME_CACHE_BUCKETS 64
+
+//
+// One resolved protocol name, chained per bucket
+//
+typedef struct _NAME_CACHE_ENTRY NAME_CACHE_ENTRY;
+struct _NAME_CACHE_ENTRY {
+  NAME_CACHE_ENTRY *Next;
+  EFI_GUID         Guid;
+  CHAR16           *Name;
+};
 
 //
 // Forward declarations
@@ -24,6 +40,8 @@ VOID DumpAllHandles(VOID);
 VOID SearchByProtocolGuid(VOID);
 VOID SearchByProtocolName(VOID);
 VOID PrintProtocolsOnHandle(EFI_HANDLE Handle);
+CHAR16 *CachedProtocolName(EFI_GUID *Guid);
+VOID ResetNameCache(VOID);
 
 //
 // Global variables
@@ -31,6 +49,15 @@ VOID PrintProtocolsOnHandle(EFI_HANDLE Handle);
 extern EFI_BOOT_SERVICES *gBS;
 extern EFI_SYSTEM_TABLE *gST;
 
+//
+// Per-command scratch memory and the protocol names cached in it.
+// Both are dropped by ResetNameCache() once a menu command finishes.
+//
+STATIC ARENA mArena;
+STATIC NAME_CACHE_ENTRY *mNameCache[NAME_CACHE_BUCKETS];
+STATIC UINTN mNameLookups;
+STATIC UINTN mNameMisses;
+
 //
 // Parse GUID string in format "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
 //
@@ -124,6 +151,7 @@ DumpAllHandles(VOID)
   }
 
   Print(L"Total handles: %d\n", HandleCount);
+  Print(L"Protocol name lookups: %d (%d distinct)\n", mNameLookups, mNameMisses);
 
   // Free the buffer
   if (HandleBuffer != NULL) {
@@ -328,19 +356,77 @@ PrintProtocolsOnHandle(EFI_HANDLE Handle)
   // Print each protocol
   //
   for (Index = 0; Index < ProtocolBufferCount; Index++) {
-    ProtocolName = GetStringNameFromGuid(ProtocolBuffer[Index], NULL);
+    ProtocolName = CachedProtocolName(ProtocolBuffer[Index]);
     Print(L"    %s\n", ProtocolName);
     Print(L"        GUID: %g\n", ProtocolBuffer[Index]);
   }
 
   //
-  // Free the protocol buffer
+  // Free the protocol buffer (allocated by the firmware, not from mArena)
   //
   if (ProtocolBuffer != NULL) {
     FreePool(ProtocolBuffer);
   }
 }
 
+//
+// Look up a protocol name, resolving each GUID only once per command.
+// GetStringNameFromGuid() returns a new pool string (and does its own
+// HII allocations) on every call; the first result is copied into
+// mArena and the pool string is freed.
+//
+CHAR16 *
+CachedProtocolName(EFI_GUID *Guid)
+{
+  NAME_CACHE_ENTRY *Entry;
+  CHAR16 *PoolName;
+  UINTN Bucket;
+
+  mNameLookups++;
+
+  Bucket = Guid->Data1 & (NAME_CACHE_BUCKETS - 1);
+  for (Entry = mNameCache[Bucket]; Entry != NULL; Entry = Entry->Next) {
+    if (CompareGuid(&Entry->Guid, Guid)) {
+      return Entry->Name;
+    }
+  }
+
+  mNameMisses++;
+  PoolName = GetStringNameFromGuid(Guid, NULL);
+
+  Entry = ArenaSlabAlloc(&mArena, sizeof(NAME_CACHE_ENTRY));
+  if (Entry == NULL) {
+    //
+    // Out of pages: hand back the uncached name, leaked as before
+    //
+    return PoolName;
+  }
+  CopyGuid(&Entry->Guid, Guid);
+  Entry->Name = NULL;
+  if (PoolName != NULL) {
+    Entry->Name = ArenaSlabAlloc(&mArena, StrSize(PoolName));
+    if (Entry->Name != NULL) {
+      CopyMem(Entry->Name, PoolName, StrSize(PoolName));
+    }
+    FreePool(PoolName);
+  }
+  Entry->Next = mNameCache[Bucket];
+  mNameCache[Bucket] = Entry;
+  return Entry->Name;
+}
+
+//
+// Drop the cached names and release their memory in one step
+//
+VOID
+ResetNameCache(VOID)
+{
+  ArenaReset(&mArena);
+  ZeroMem(mNameCache, sizeof(mNameCache));
+  mNameLookups = 0;
+  mNameMisses = 0;
+}
+
 //
 // Main entry point
 //
@@ -357,6 +443,7 @@ ShellAppMain (
   UINTN EventIndex;
 
   MenuChoice = 0;
+  ArenaInit(&mArena, 0);
 
   while (TRUE) {
     // Clear screen and show menu
@@ -394,12 +481,15 @@ ShellAppMain (
         break;
       case 4:
         Print(L"Exiting Handle Explorer...\n");
+        ArenaFree(&mArena);
         return EFI_SUCCESS;
       default:
         Print(L"Invalid option! Please select 1-4.\n");
         break;
     }
 
+    ResetNameCache();
+
     Print(L"\nPress any key to continue...");
     gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
     gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);
@@ -0,0 +1,279 @@
+/** @file
+  Table of live allocations for the UEFI Memory Utility.
+
+  Every buffer the user allocates from the menu is kept in a fixed table
+  until it is freed, so several buffers of different memory types,
+  placements and alignments can be held at once, e.g. to reserve aligned
+  DMA or huge-page regions before the OS takes over.
+**/
+
+#include "MemoryUtility.h"
+
+typedef struct {
+  BOOLEAN             InUse;
+  TRACKED_ALLOCATION  Allocation;
+} TRACKED_SLOT;
+
+STATIC TRACKED_SLOT  mTracked[MAX_TRACKED_ALLOCATIONS];
+
+/**
+  AllocatePages with an alignment above the page size.
+
+  For AllocateAnyPages and AllocateMaxAddress the range is over-allocated
+  by the alignment and the unaligned head and tail are returned to the
+  firmware, as MemoryAllocationLib does for AllocateAlignedPages. For
+  AllocateAddress the requested address must already be aligned.
+
+  @param[in]      Type        EFI_ALLOCATE_TYPE.
+  @param[in]      MemoryType  Memory type of the buffer.
+  @param[in]      Pages       Pages wanted.
+  @param[in]      Alignment   Power of two, EFI_PAGE_SIZE or more.
+  @param[in, out] Address     In: address or limit for Type. Out: buffer.
+**/
+STATIC
+EFI_STATUS
+AllocateAlignedPagesOfType (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN     UINT64                Alignment,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Address
+  )
+{
+  EFI_STATUS            Status;
+  EFI_PHYSICAL_ADDRESS  Memory;
+  EFI_PHYSICAL_ADDRESS  Aligned;
+  UINTN                 AlignPages;
+  UINTN                 Head;
+  UINTN                 Tail;
+
+  if (Alignment <= EFI_PAGE_SIZE || Type == AllocateAddress) {
+    if ((*Address & (Alignment - 1)) != 0 && Type == AllocateAddress) {
+      return EFI_INVALID_PARAMETER;
+    }
+    return gBS->AllocatePages(Type, MemoryType, Pages, Address);
+  }
+
+  AlignPages = (UINTN)RShiftU64(Alignment, EFI_PAGE_SHIFT);
+  if (Pages > MAX_UINTN - AlignPages) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Memory = *Address;
+  Status = gBS->AllocatePages(Type, MemoryType, Pages + AlignPages, &Memory);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Aligned = (Memory + Alignment - 1) & ~(Alignment - 1);
+  Head    = (UINTN)RShiftU64(Aligned - Memory, EFI_PAGE_SHIFT);
+  Tail    = AlignPages - Head;
+  if (Head != 0) {
+    gBS->FreePages(Memory, Head);
+  }
+  if (Tail != 0) {
+    gBS->FreePages(Aligned + LShiftU64(Pages, EFI_PAGE_SHIFT), Tail);
+  }
+
+  *Address = Aligned;
+  return EFI_SUCCESS;
+}
+
+/**
+  Allocate a buffer as described by Request and add it to the table.
+
+  @param[in, out]  Request  Kind, Type, MemoryType, Size and Alignment select
+                            the allocation; Address is the target address or
+                            limit for AllocateAddress/AllocateMaxAddress. On
+                            return Address is the buffer and Size is rounded
+                            up to whole pages for page allocations.
+  @param[out]      Index    Table slot of the new allocation.
+
+  @retval EFI_SUCCESS            The buffer was allocated and recorded.
+  @retval EFI_OUT_OF_RESOURCES   The table is full, or the firmware refused.
+  @retval EFI_INVALID_PARAMETER  Bad size or alignment.
+  @retval Other                  AllocatePages/AllocatePool failed.
+**/
+EFI_STATUS
+TrackedAllocate (
+  IN OUT TRACKED_ALLOCATION *Request,
+  OUT    UINTN              *Index
+  )
+{
+  EFI_STATUS Status;
+  VOID       *Pool;
+  UINT64     Pages;
+  UINTN      Slot;
+
+  for (Slot = 0; Slot < MAX_TRACKED_ALLOCATIONS; Slot++) {
+    if (!mTracked[Slot].InUse) {
+      break;
+    }
+  }
+  if (Slot == MAX_TRACKED_ALLOCATIONS) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  if (Request->Size == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Request->Kind == AllocationKindPool) {
+    if (Request->Size > MAX_UINTN) {
+      return EFI_INVALID_PARAMETER;
+    }
+    Status = gBS->AllocatePool(Request->MemoryType, (UINTN)Request->Size, &Pool);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    Request->Address   = (EFI_PHYSICAL_ADDRESS)(UINTN)Pool;
+    Request->Alignment = 0;
+  } else {
+    if (Request->Alignment < EFI_PAGE_SIZE) {
+      Request->Alignment = EFI_PAGE_SIZE;
+    }
+    if ((Request->Alignment & (Request->Alignment - 1)) != 0) {
+      return EFI_INVALID_PARAMETER;
+    }
+    Pages = RShiftU64(Request->Size + EFI_PAGE_MASK, EFI_PAGE_SHIFT);
+    if (Pages > MAX_UINTN) {
+      return EFI_INVALID_PARAMETER;
+    }
+    Status = AllocateAlignedPagesOfType(Request->Type,
+                                        Request->MemoryType,
+                                        (UINTN)Pages,
+                                        Request->Alignment,
+                                        &Request->Address);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    Request->Size = LShiftU64(Pages, EFI_PAGE_SHIFT);
+  }
+
+  mTracked[Slot].InUse = TRUE;
+  CopyMem(&mTracked[Slot].Allocation, Request, sizeof(*Request));
+  *Index = Slot;
+  return EFI_SUCCESS;
+}
+
+/**
+  Return a live allocation, or NULL if the slot is empty or out of range.
+**/
+TRACKED_ALLOCATION *
+TrackedGet (
+  IN UINTN Index
+  )
+{
+  if (Index >= MAX_TRACKED_ALLOCATIONS || !mTracked[Index].InUse) {
+    return NULL;
+  }
+  return &mTracked[Index].Allocation;
+}
+
+/**
+  Free one allocation and clear its slot.
+
+  @retval EFI_NOT_FOUND  The slot holds no allocation.
+  @retval Other          Status of FreePages/FreePool.
+**/
+EFI_STATUS
+TrackedFree (
+  IN UINTN Index
+  )
+{
+  TRACKED_ALLOCATION *Allocation;
+  EFI_STATUS         Status;
+
+  Allocation = TrackedGet(Index);
+  if (Allocation == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (Allocation->Kind == AllocationKindPool) {
+    Status = gBS->FreePool((VOID *)(UINTN)Allocation->Address);
+  } else {
+    Status = gBS->FreePages(Allocation->Address,
+                            (UINTN)RShiftU64(Allocation->Size, EFI_PAGE_SHIFT));
+  }
+  if (!EFI_ERROR(Status)) {
+    mTracked[Index].InUse = FALSE;
+  }
+  return Status;
+}
+
+/**
+  Free every live allocation.
+
+  @return  Number of allocations freed.
+**/
+UINTN
+TrackedFreeAll (
+  VOID
+  )
+{
+  UINTN Index;
+  UINTN Freed;
+
+  Freed = 0;
+  for (Index = 0; Index < MAX_TRACKED_ALLOCATIONS; Index++) {
+    if (mTracked[Index].InUse && !EFI_ERROR(TrackedFree(Index))) {
+      Freed++;
+    }
+  }
+  return Freed;
+}
+
+/**
+  Number of live allocations.
+**/
+UINTN
+TrackedCount (
+  VOID
+  )
+{
+  UINTN Index;
+  UINTN Count;
+
+  Count = 0;
+  for (Index = 0; Index < MAX_TRACKED_ALLOCATIONS; Index++) {
+    if (mTracked[Index].InUse) {
+      Count++;
+    }
+  }
+  return Count;
+}
+
+/**
+  Print the live allocations, numbered from 1 as the menu expects.
+**/
+VOID
+TrackedPrint (
+  VOID
+  )
+{
+  TRACKED_ALLOCATION *Allocation;
+  UINTN              Index;
+
+  Print(L" #  Kind   Memory Type    Address            Size (KB)    Align\n");
+  for (Index = 0; Index < MAX_TRACKED_ALLOCATIONS; Index++) {
+    Allocation = TrackedGet(Index);
+    if (Allocation == NULL) {
+      continue;
+    }
+    Print(L"%2d  %-5s  %-13s  %016lx  %10ld  ",
+          Index + 1,
+          (Allocation->Kind == AllocationKindPool) ? L"Pool" : L"Pages",
+          MemoryTypeName(Allocation->MemoryType),
+          Allocation->Address,
+          RShiftU64(Allocation->Size + SIZE_1KB - 1, 10));
+    if (Allocation->Alignment >= SIZE_1GB) {
+      Print(L"%4ld GB\n", RShiftU64(Allocation->Alignment, 30));
+    } else if (Allocation->Alignment >= SIZE_1MB) {
+      Print(L"%4ld MB\n", RShiftU64(Allocation->Alignment, 20));
+    } else if (Allocation->Alignment != 0) {
+      Print(L"%4ld KB\n", RShiftU64(Allocation->Alignment, 10));
+    } else {
+      Print(L"     -\n");
+    }
+  }
+}
@@ -0,0 +1,351 @@
+/** @file
+  Pool and page allocation micro-benchmark for the UEFI Memory Utility.
+
+  Each run allocates a batch of equally sized buffers with boot services
+  AllocatePool or AllocatePages, then frees them in LIFO, FIFO or random
+  order. Every call is timed on its own with the TimerLib performance
+  counter, and the per-call latency distribution is reported. Small pool
+  sizes are then run through ArenaLib slabs for comparison, counting the
+  firmware calls each approach makes.
+**/
+
+#include "MemoryUtility.h"
+#include <Library/TimerLib.h>
+#include "../Common/ArenaLib.h"
+#include "../Common/LatencyLib.h"
+
+//
+// Upper bound on calls per run, and on memory held by one run
+//
+#define BENCH_MAX_CALLS     2048
+#define BENCH_BYTES_BUDGET  SIZE_64MB
+
+typedef enum {
+  BenchLifo,
+  BenchFifo,
+  BenchRandom,
+  BenchPatternMax
+} BENCH_PATTERN;
+
+STATIC CONST CHAR16  *mPatternName[BenchPatternMax] = { L"LIFO", L"FIFO", L"Random" };
+
+STATIC CONST UINTN   mPoolSizes[] = { 16, 64, 256, SIZE_1KB, SIZE_4KB, SIZE_64KB };
+STATIC CONST UINTN   mPageCounts[] = { 1, 4, 16, 256 };
+
+STATIC UINT32   mBenchSeed;
+
+/**
+  xorshift32; only used to shuffle the free order.
+**/
+STATIC
+UINT32
+BenchRandomNext (
+  VOID
+  )
+{
+  mBenchSeed ^= mBenchSeed << 13;
+  mBenchSeed ^= mBenchSeed >> 17;
+  mBenchSeed ^= mBenchSeed << 5;
+  return mBenchSeed;
+}
+
+/**
+  Fill Order with the free order for Pattern.
+**/
+STATIC
+VOID
+BenchFreeOrder (
+  OUT UINTN          *Order,
+  IN  UINTN          Count,
+  IN  BENCH_PATTERN  Pattern
+  )
+{
+  UINTN Swap;
+  UINTN i;
+  UINTN j;
+
+  for (i = 0; i < Count; i++) {
+    Order[i] = (Pattern == BenchLifo) ? Count - 1 - i : i;
+  }
+  if (Pattern == BenchRandom) {
+    for (i = Count - 1; i > 0; i--) {
+      j        = BenchRandomNext() % (i + 1);
+      Swap     = Order[i];
+      Order[i] = Order[j];
+      Order[j] = Swap;
+    }
+  }
+}
+
+/**
+  Allocate Count buffers, then free them in the order given by Pattern,
+  timing every call.
+
+  @param[in]   Pages       TRUE for AllocatePages (Size in pages), FALSE for AllocatePool (bytes).
+  @param[in]   Size        Size of each allocation.
+  @param[in]   Pattern     Free order.
+  @param[in]   Count       Number of allocations.
+  @param[out]  AllocTicks  Count samples of allocation latency.
+  @param[out]  FreeTicks   Count samples of free latency.
+  @param[in]   Buffers     Scratch array of Count addresses.
+  @param[in]   Order       Scratch array of Count indices.
+
+  @retval EFI_SUCCESS  All calls succeeded.
+  @retval Other        An allocation failed; everything allocated was freed.
+**/
+STATIC
+EFI_STATUS
+BenchRun (
+  IN  BOOLEAN               Pages,
+  IN  UINTN                 Size,
+  IN  BENCH_PATTERN         Pattern,
+  IN  UINTN                 Count,
+  OUT UINT64                *AllocTicks,
+  OUT UINT64                *FreeTicks,
+  IN  EFI_PHYSICAL_ADDRESS  *Buffers,
+  IN  UINTN                 *Order
+  )
+{
+  EFI_STATUS Status;
+  UINT64     Start;
+  UINT64     End;
+  VOID       *Pool;
+  UINTN      i;
+
+  for (i = 0; i < Count; i++) {
+    if (Pages) {
+      Start  = GetPerformanceCounter();
+      Status = gBS->AllocatePages(AllocateAnyPages, EfiBootServicesData, Size, &Buffers[i]);
+      End    = GetPerformanceCounter();
+    } else {
+      Start  = GetPerformanceCounter();
+      Status = gBS->AllocatePool(EfiBootServicesData, Size, &Pool);
+      End    = GetPerformanceCounter();
+      Buffers[i] = (EFI_PHYSICAL_ADDRESS)(UINTN)Pool;
+    }
+    if (EFI_ERROR(Status)) {
+      Print(L"Allocation %d of %d failed: %r\n", i + 1, Count, Status);
+      while (i-- > 0) {
+        if (Pages) {
+          gBS->FreePages(Buffers[i], Size);
+        } else {
+          gBS->FreePool((VOID *)(UINTN)Buffers[i]);
+        }
+      }
+      return Status;
+    }
+    AllocTicks[i] = ElapsedTicks(Start, End);
+  }
+
+  BenchFreeOrder(Order, Count, Pattern);
+
+  for (i = 0; i < Count; i++) {
+    if (Pages) {
+      Start = GetPerformanceCounter();
+      gBS->FreePages(Buffers[Order[i]], Size);
+      End   = GetPerformanceCounter();
+    } else {
+      Start = GetPerformanceCounter();
+      gBS->FreePool((VOID *)(UINTN)Buffers[Order[i]]);
+      End   = GetPerformanceCounter();
+    }
+    FreeTicks[i] = ElapsedTicks(Start, End);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Run one size across all free patterns and print a row per pattern.
+**/
+STATIC
+EFI_STATUS
+BenchSize (
+  IN BOOLEAN               Pages,
+  IN UINTN                 Size,
+  IN UINT64                *AllocTicks,
+  IN UINT64                *FreeTicks,
+  IN EFI_PHYSICAL_ADDRESS  *Buffers,
+  IN UINTN                 *Order
+  )
+{
+  EFI_STATUS    Status;
+  LATENCY_STATS Alloc;
+  LATENCY_STATS Free;
+  UINTN         Bytes;
+  UINTN         Count;
+  UINTN         Pattern;
+
+  Bytes = Pages ? EFI_PAGES_TO_SIZE(Size) : Size;
+  Count = MIN(BENCH_MAX_CALLS, BENCH_BYTES_BUDGET / Bytes);
+
+  for (Pattern = 0; Pattern < BenchPatternMax; Pattern++) {
+    Status = BenchRun(Pages, Size, (BENCH_PATTERN)Pattern, Count, AllocTicks, FreeTicks, Buffers, Order);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    ComputeLatencyStats(AllocTicks, Count, &Alloc);
+    ComputeLatencyStats(FreeTicks, Count, &Free);
+
+    if (Pages) {
+      Print(L"Pages %5d pg ", Size);
+    } else {
+      Print(L"Pool  %6d B ", Size);
+    }
+    Print(L"%-6s %5d | %6ld %6ld %6ld %7ld | %6ld %6ld %6ld %7ld\n",
+          mPatternName[Pattern], Count,
+          Alloc.P50, Alloc.P90, Alloc.P99, Alloc.Max,
+          Free.P50, Free.P90, Free.P99, Free.Max);
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  The pool run again on ArenaLib slabs: Count objects are allocated,
+  freed in random order and allocated again from the slab free lists,
+  which is how a tool recycling its objects behaves. The frees and the
+  second round of allocations are timed, and the row ends with the
+  firmware calls made against the four per object the pool needs.
+**/
+STATIC
+EFI_STATUS
+BenchArenaSize (
+  IN UINTN                 Size,
+  IN UINT64                *AllocTicks,
+  IN UINT64                *FreeTicks,
+  IN EFI_PHYSICAL_ADDRESS  *Buffers,
+  IN UINTN                 *Order
+  )
+{
+  ARENA         Arena;
+  LATENCY_STATS Alloc;
+  LATENCY_STATS Free;
+  UINT64        Start;
+  UINT64        End;
+  VOID          *Object;
+  UINTN         Count;
+  UINTN         i;
+
+  Count = MIN(BENCH_MAX_CALLS, BENCH_BYTES_BUDGET / Size);
+  ArenaInit(&Arena, 0);
+
+  for (i = 0; i < Count; i++) {
+    Object = ArenaSlabAlloc(&Arena, Size);
+    if (Object == NULL) {
+      Print(L"Arena allocation %d of %d failed\n", i + 1, Count);
+      ArenaFree(&Arena);
+      return EFI_OUT_OF_RESOURCES;
+    }
+    Buffers[i] = (EFI_PHYSICAL_ADDRESS)(UINTN)Object;
+  }
+
+  BenchFreeOrder(Order, Count, BenchRandom);
+  for (i = 0; i < Count; i++) {
+    Start = GetPerformanceCounter();
+    ArenaSlabFree(&Arena, (VOID *)(UINTN)Buffers[Order[i]], Size);
+    End   = GetPerformanceCounter();
+    FreeTicks[i] = ElapsedTicks(Start, End);
+  }
+
+  //
+  // Every object now comes off a free list; none of these can fail
+  //
+  for (i = 0; i < Count; i++) {
+    Start  = GetPerformanceCounter();
+    Object = ArenaSlabAlloc(&Arena, Size);
+    End    = GetPerformanceCounter();
+    AllocTicks[i] = ElapsedTicks(Start, End);
+  }
+
+  ArenaFree(&Arena);
+
+  ComputeLatencyStats(AllocTicks, Count, &Alloc);
+  ComputeLatencyStats(FreeTicks, Count, &Free);
+  Print(L"Slab  %6d B %-6s %5d | %6ld %6ld %6ld %7ld | %6ld %6ld %6ld %7ld | %5d %6d\n",
+        Size, mPatternName[BenchRandom], Count,
+        Alloc.P50, Alloc.P90, Alloc.P99, Alloc.Max,
+        Free.P50, Free.P90, Free.P99, Free.Max,
+        Arena.PageCalls, 4 * Count);
+  return EFI_SUCCESS;
+}
+
+/**
+  Time boot services pool and page allocation across a size sweep and
+  LIFO, FIFO and random free orders, and print per-call latency percentiles.
+
+  @retval EFI_SUCCESS  The benchmark ran to completion.
+  @retval Other        An allocation failed.
+**/
+EFI_STATUS
+RunAllocationBenchmark (
+  VOID
+  )
+{
+  EFI_STATUS            Status;
+  UINT64                *AllocTicks;
+  UINT64                *FreeTicks;
+  EFI_PHYSICAL_ADDRESS  *Buffers;
+  UINTN                 *Order;
+  UINT64                Start;
+  LATENCY_STATS         Overhead;
+  UINTN                 i;
+
+  mBenchSeed = 0x2545F491;
+
+  AllocTicks = AllocatePool(BENCH_MAX_CALLS * sizeof(UINT64));
+  FreeTicks  = AllocatePool(BENCH_MAX_CALLS * sizeof(UINT64));
+  Buffers    = AllocatePool(BENCH_MAX_CALLS * sizeof(EFI_PHYSICAL_ADDRESS));
+  Order      = AllocatePool(BENCH_MAX_CALLS * sizeof(UINTN));
+  if (AllocTicks == NULL || FreeTicks == NULL || Buffers == NULL || Order == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // Cost of reading the counter itself, included in every sample below
+  //
+  for (i = 0; i < BENCH_MAX_CALLS; i++) {
+    Start         = GetPerformanceCounter();
+    AllocTicks[i] = ElapsedTicks(Start, GetPerformanceCounter());
+  }
+  ComputeLatencyStats(AllocTicks, BENCH_MAX_CALLS, &Overhead);
+
+  Print(L"\nAllocation benchmark (EfiBootServicesData, latency in ns,\n");
+  Print(L"timer overhead %ld ns per sample)\n\n",
+        Overhead.P50);
+  Print(L"                            |      AllocatePool/Pages       |        FreePool/Pages\n");
+  Print(L"Kind      Size Order  Count |    p50    p90    p99     max |    p50    p90    p99     max\n");
+
+  Status = EFI_SUCCESS;
+  for (i = 0; i < ARRAY_SIZE(mPoolSizes) && !EFI_ERROR(Status); i++) {
+    Status = BenchSize(FALSE, mPoolSizes[i], AllocTicks, FreeTicks, Buffers, Order);
+  }
+  for (i = 0; i < ARRAY_SIZE(mPageCounts) && !EFI_ERROR(Status); i++) {
+    Status = BenchSize(TRUE, mPageCounts[i], AllocTicks, FreeTicks, Buffers, Order);
+  }
+
+  if (!EFI_ERROR(Status)) {
+    Print(L"\n                            |   ArenaSlabAlloc (recycled)   |        ArenaSlabFree         | firmware calls\n");
+    Print(L"Kind      Size Order  Count |    p50    p90    p99     max |    p50    p90    p99     max | arena   pool\n");
+  }
+  for (i = 0; i < ARRAY_SIZE(mPoolSizes) && !EFI_ERROR(Status); i++) {
+    if (mPoolSizes[i] <= ARENA_SLAB_MAX_SIZE) {
+      Status = BenchArenaSize(mPoolSizes[i], AllocTicks, FreeTicks, Buffers, Order);
+    }
+  }
+
+Done:
+  if (AllocTicks != NULL) {
+    FreePool(AllocTicks);
+  }
+  if (FreeTicks != NULL) {
+    FreePool(FreeTicks);
+  }
+  if (Buffers != NULL) {
+    FreePool(Buffers);
+  }
+  if (Order != NULL) {
+    FreePool(Order);
+  }
+  return Status;
+}
@@ -0,0 +1,208 @@
+/** @file
+  Memory map snapshots for the UEFI Memory Utility.
+**/
+
+#include "MemoryUtility.h"
+
+/**
+  Prepare an empty snapshot. No memory is allocated until the first
+  MemoryMapSnapshotTake().
+
+  @param[out]  Snapshot  Snapshot to initialize.
+**/
+VOID
+MemoryMapSnapshotInit (
+  OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  ZeroMem(Snapshot, sizeof(*Snapshot));
+}
+
+/**
+  Capture the current memory map into Snapshot.
+
+  The map buffer is reused if it is large enough. Otherwise it is replaced
+  by one sized from what GetMemoryMap reported plus some slack, because
+  allocating the new buffer can itself add descriptors to the map; the
+  call is retried until it fits.
+
+  @param[in, out]  Snapshot  Snapshot to fill.
+
+  @retval EFI_SUCCESS           Snapshot->Entries holds Count sorted descriptors.
+  @retval EFI_OUT_OF_RESOURCES  A buffer could not be allocated.
+  @retval Other                 GetMemoryMap failed.
+**/
+EFI_STATUS
+MemoryMapSnapshotTake (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  EFI_STATUS             Status;
+  EFI_MEMORY_DESCRIPTOR  *Desc;
+  EFI_MEMORY_DESCRIPTOR  *Key;
+  UINTN                  MapSize;
+  UINTN                  Attempt;
+  UINTN                  Count;
+  UINTN                  i;
+  UINTN                  j;
+
+  Snapshot->Count = 0;
+  Status          = EFI_BUFFER_TOO_SMALL;
+
+  for (Attempt = 0; Attempt < MEMORY_MAP_MAX_ATTEMPTS; Attempt++) {
+    MapSize = Snapshot->MapBufferSize;
+    Status = gBS->GetMemoryMap(&MapSize,
+                               Snapshot->Map,
+                               &Snapshot->MapKey,
+                               &Snapshot->DescriptorSize,
+                               &Snapshot->DescriptorVersion);
+    if (Status != EFI_BUFFER_TOO_SMALL) {
+      break;
+    }
+
+    if (Snapshot->Map != NULL) {
+      FreePool(Snapshot->Map);
+    }
+    Snapshot->MapBufferSize = MapSize + MEMORY_MAP_SLACK_DESCRIPTORS * Snapshot->DescriptorSize;
+    Snapshot->Map = AllocatePool(Snapshot->MapBufferSize);
+    if (Snapshot->Map == NULL) {
+      Snapshot->MapBufferSize = 0;
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Snapshot->MapSize = MapSize;
+  Count = MapSize / Snapshot->DescriptorSize;
+
+  if (Count > Snapshot->EntryCapacity) {
+    if (Snapshot->Entries != NULL) {
+      FreePool(Snapshot->Entries);
+    }
+    Snapshot->EntryCapacity = Count + MEMORY_MAP_SLACK_DESCRIPTORS;
+    Snapshot->Entries = AllocatePool(Snapshot->EntryCapacity * sizeof(EFI_MEMORY_DESCRIPTOR *));
+    if (Snapshot->Entries == NULL) {
+      Snapshot->EntryCapacity = 0;
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  //
+  // Firmware usually returns the map in address order already, which is
+  // the best case for an insertion sort
+  //
+  Desc = Snapshot->Map;
+  for (i = 0; i < Count; i++) {
+    Key = Desc;
+    for (j = i; j > 0 && Snapshot->Entries[j - 1]->PhysicalStart > Key->PhysicalStart; j--) {
+      Snapshot->Entries[j] = Snapshot->Entries[j - 1];
+    }
+    Snapshot->Entries[j] = Key;
+    Desc = NEXT_MEMORY_DESCRIPTOR(Desc, Snapshot->DescriptorSize);
+  }
+  Snapshot->Count = Count;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Release the buffers of a snapshot.
+
+  @param[in, out]  Snapshot  Snapshot to release; it is left empty.
+**/
+VOID
+MemoryMapSnapshotFree (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  if (Snapshot->Map != NULL) {
+    FreePool(Snapshot->Map);
+  }
+  if (Snapshot->Entries != NULL) {
+    FreePool(Snapshot->Entries);
+  }
+  ZeroMem(Snapshot, sizeof(*Snapshot));
+}
+
+/**
+  Return a short display name for a memory type.
+
+  @param[in]  Type  EFI_MEMORY_TYPE value from a memory descriptor.
+
+  @return  Name of the type.
+**/
+CONST CHAR16 *
+MemoryTypeName (
+  IN UINT32 Type
+  )
+{
+  switch (Type) {
+    case EfiReservedMemoryType:       return L"Reserved";
+    case EfiLoaderCode:               return L"LoaderCode";
+    case EfiLoaderData:               return L"LoaderData";
+    case EfiBootServicesCode:         return L"BS Code";
+    case EfiBootServicesData:         return L"BS Data";
+    case EfiRuntimeServicesCode:      return L"RT Code";
+    case EfiRuntimeServicesData:      return L"RT Data";
+    case EfiConventionalMemory:       return L"Conventional";
+    case EfiUnusableMemory:           return L"Unusable";
+    case EfiACPIReclaimMemory:        return L"ACPI Reclaim";
+    case EfiACPIMemoryNVS:            return L"ACPI NVS";
+    case EfiMemoryMappedIO:           return L"MMIO";
+    case EfiMemoryMappedIOPortSpace:  return L"MMIO Port";
+    case EfiPalCode:                  return L"PAL Code";
+    case EfiPersistentMemory:         return L"Persistent";
+    default:                          return L"Unknown";
+  }
+}
+
+/**
+  Whether a memory type is backed by system RAM (as opposed to MMIO,
+  reserved or unusable ranges).
+
+  @param[in]  Type  EFI_MEMORY_TYPE value from a memory descriptor.
+
+  @retval TRUE   The range is RAM.
+  @retval FALSE  Anything else.
+**/
+BOOLEAN
+MemoryTypeIsRam (
+  IN UINT32 Type
+  )
+{
+  switch (Type) {
+    case EfiLoaderCode:
+    case EfiLoaderData:
+    case EfiBootServicesCode:
+    case EfiBootServicesData:
+    case EfiRuntimeServicesCode:
+    case EfiRuntimeServicesData:
+    case EfiConventionalMemory:
+    case EfiACPIReclaimMemory:
+    case EfiACPIMemoryNVS:
+    case EfiPersistentMemory:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/**
+  Print a page count as MB, or KB below 1 MB.
+
+  @param[in]  Pages  Number of 4 KB pages.
+**/
+VOID
+PrintPagesSize (
+  IN UINT64 Pages
+  )
+{
+  if (Pages < 256) {
+    Print(L"%7ld KB", MultU64x32(Pages, 4));
+  } else {
+    Print(L"%7ld MB", RShiftU64(Pages, 8));
+  }
+}
+
@@ -0,0 +1,699 @@
+/** @file
+  Parallel memory test for the UEFI Memory Utility.
+
+  Every EfiConventionalMemory range in the memory map (above 1 MB, less a
+  reserve left for the firmware) is claimed with AllocatePages at its own
+  address and cut into slices. Each test phase is a sweep over all slices;
+  the APs are started on it through MP Services and the BSP works on the
+  same slice queue, so the test scales with the processor count.
+
+  Patterns:
+  - Walking ones: every 64-bit word holds a single set bit whose position
+    follows the word address, so neighbouring words differ in every lane
+  - Address in address: every word holds its own address
+  - Moving inversions: fill, then an ascending check-and-invert sweep and
+    a descending check-and-restore sweep
+
+  On X64 with GCC/Clang the sweeps use SSE2 non-temporal 16-byte stores
+  and 16-byte loads; other builds use the portable 64-bit loops.
+**/
+
+#include "MemoryUtility.h"
+#include <PiDxe.h>
+#include <Library/TimerLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Protocol/MpService.h>
+#include "../Common/LatencyLib.h"
+
+#if defined (MDE_CPU_X64) && defined (__GNUC__)
+#define MEMTEST_SSE2  1
+#else
+#define MEMTEST_SSE2  0
+#endif
+
+//
+// Work unit handed to one processor at a time
+//
+#define MEMTEST_SLICE_PAGES    EFI_SIZE_TO_PAGES (SIZE_64MB)
+
+//
+// Conventional memory left unclaimed for the firmware, and the legacy
+// area below 1 MB, which the test never touches
+//
+#define MEMTEST_RESERVE_PAGES  EFI_SIZE_TO_PAGES (SIZE_64MB)
+#define MEMTEST_LOW_LIMIT      BASE_1MB
+
+//
+// Failures kept with their data; later ones are only counted
+//
+#define MEMTEST_MAX_FAILURES   32
+
+#define MEMTEST_INVERSION_PATTERN  0x5555555555555555ULL
+
+typedef enum {
+  MemTestWalkingOnesWrite,
+  MemTestWalkingOnesVerify,
+  MemTestAddressWrite,
+  MemTestAddressVerify,
+  MemTestInversionFill,
+  MemTestInversionUp,
+  MemTestInversionDown,
+  MemTestPhaseMax
+} MEMTEST_PHASE;
+
+typedef struct {
+  UINT64  *Start;
+  UINTN   Words;
+} MEMTEST_SLICE;
+
+typedef struct {
+  EFI_PHYSICAL_ADDRESS  Address;
+  UINT64                Expected;
+  UINT64                Actual;
+} MEMTEST_FAILURE;
+
+/**
+  State shared by the BSP and the APs during a phase. Only NextSlice,
+  FailureCount and Failures are written while a phase runs.
+**/
+typedef struct {
+  MEMTEST_PHASE             Phase;
+  MEMTEST_SLICE             *Slices;
+  UINT32                    SliceCount;
+  volatile UINT32           NextSlice;
+  volatile UINT32           FailureCount;
+  MEMTEST_FAILURE           Failures[MEMTEST_MAX_FAILURES];
+
+  EFI_MP_SERVICES_PROTOCOL  *Mp;          /* NULL: BSP only */
+  EFI_EVENT                 ApDone;
+  UINTN                     Processors;
+} MEMTEST_CONTEXT;
+
+/**
+  One pattern: the phases it runs and how many times each phase touches
+  every byte (a check-and-write sweep reads and writes it).
+**/
+typedef struct {
+  CONST CHAR16   *Name;
+  MEMTEST_PHASE  First;
+  MEMTEST_PHASE  Last;
+  UINT32         Passes;
+} MEMTEST_PATTERN;
+
+STATIC CONST MEMTEST_PATTERN mMemTestPatterns[] = {
+  { L"Walking ones",       MemTestWalkingOnesWrite, MemTestWalkingOnesVerify, 2 },
+  { L"Address in address", MemTestAddressWrite,     MemTestAddressVerify,     2 },
+  { L"Moving inversions",  MemTestInversionFill,    MemTestInversionDown,     5 }
+};
+
+/**
+  Record a mismatch. Runs on APs, so it must not call any boot service.
+**/
+STATIC
+VOID
+MemTestFail (
+  IN MEMTEST_CONTEXT  *Test,
+  IN volatile UINT64  *Word,
+  IN UINT64           Expected,
+  IN UINT64           Actual
+  )
+{
+  UINT32 Slot;
+
+  Slot = InterlockedIncrement(&Test->FailureCount) - 1;
+  if (Slot < MEMTEST_MAX_FAILURES) {
+    Test->Failures[Slot].Address  = (EFI_PHYSICAL_ADDRESS)(UINTN)Word;
+    Test->Failures[Slot].Expected = Expected;
+    Test->Failures[Slot].Actual   = Actual;
+  }
+}
+
+#if MEMTEST_SSE2
+/*
+  Two-word vectors; stores bypass the caches with MOVNTDQ so a sweep
+  measures (and exercises) the DRAM rather than the LLC. Written with
+  compiler builtins rather than <emmintrin.h>, as in FileHash.c.
+*/
+typedef UINT64  V2DU __attribute__ ((vector_size (16)));
+typedef INT64   V2DI __attribute__ ((vector_size (16)));
+
+#define MEMTEST_STORE(p, v)  __builtin_ia32_movntdq ((V2DI *)(p), (V2DI)(v))
+
+/**
+  Compare one vector; on a mismatch find and record the failing words.
+**/
+STATIC
+VOID
+MemTestCheck2 (
+  IN MEMTEST_CONTEXT  *Test,
+  IN V2DU             *Vec,
+  IN V2DU             Expected
+  )
+{
+  V2DU Actual;
+  V2DU Diff;
+
+  Actual = *Vec;
+  Diff   = Actual ^ Expected;
+  if ((Diff[0] | Diff[1]) != 0) {
+    if (Diff[0] != 0) {
+      MemTestFail(Test, (UINT64 *)Vec, Expected[0], Actual[0]);
+    }
+    if (Diff[1] != 0) {
+      MemTestFail(Test, (UINT64 *)Vec + 1, Expected[1], Actual[1]);
+    }
+  }
+}
+
+STATIC
+VOID
+MemTestRunSlice (
+  IN MEMTEST_CONTEXT  *Test,
+  IN UINT64           *Start,
+  IN UINTN            Words
+  )
+{
+  V2DU  *Vec;
+  V2DU  Value;
+  V2DU  Step;
+  V2DU  Pattern;
+  UINTN Count;
+  UINTN i;
+  UINTN Bit;
+
+  Vec     = (V2DU *)Start;
+  Count   = Words / 2;
+  Bit     = ((UINTN)Start >> 3) & 63;
+  Pattern = (V2DU){ MEMTEST_INVERSION_PATTERN, MEMTEST_INVERSION_PATTERN };
+
+  switch (Test->Phase) {
+    case MemTestWalkingOnesWrite:
+      Value = (V2DU){ 1ULL << Bit, 1ULL << ((Bit + 1) & 63) };
+      for (i = 0; i < Count; i++) {
+        MEMTEST_STORE(&Vec[i], Value);
+        Value = (Value << 2) | (Value >> 62);
+      }
+      break;
+
+    case MemTestWalkingOnesVerify:
+      Value = (V2DU){ 1ULL << Bit, 1ULL << ((Bit + 1) & 63) };
+      for (i = 0; i < Count; i++) {
+        MemTestCheck2(Test, &Vec[i], Value);
+        Value = (Value << 2) | (Value >> 62);
+      }
+      break;
+
+    case MemTestAddressWrite:
+      Value = (V2DU){ (UINT64)(UINTN)Start, (UINT64)(UINTN)Start + 8 };
+      Step  = (V2DU){ 16, 16 };
+      for (i = 0; i < Count; i++) {
+        MEMTEST_STORE(&Vec[i], Value);
+        Value += Step;
+      }
+      break;
+
+    case MemTestAddressVerify:
+      Value = (V2DU){ (UINT64)(UINTN)Start, (UINT64)(UINTN)Start + 8 };
+      Step  = (V2DU){ 16, 16 };
+      for (i = 0; i < Count; i++) {
+        MemTestCheck2(Test, &Vec[i], Value);
+        Value += Step;
+      }
+      break;
+
+    case MemTestInversionFill:
+      for (i = 0; i < Count; i++) {
+        MEMTEST_STORE(&Vec[i], Pattern);
+      }
+      break;
+
+    case MemTestInversionUp:
+      for (i = 0; i < Count; i++) {
+        MemTestCheck2(Test, &Vec[i], Pattern);
+        MEMTEST_STORE(&Vec[i], ~Pattern);
+      }
+      break;
+
+    case MemTestInversionDown:
+      for (i = Count; i-- > 0;) {
+        MemTestCheck2(Test, &Vec[i], ~Pattern);
+        MEMTEST_STORE(&Vec[i], Pattern);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  //
+  // Non-temporal stores are weakly ordered; drain them before the phase
+  // is reported complete
+  //
+  __builtin_ia32_sfence();
+}
+
+#else
+
+/**
+  Walking-ones value for the word at Address.
+**/
+STATIC
+UINT64
+WalkingOne (
+  IN UINTN  Address
+  )
+{
+  return LShiftU64(1, (Address >> 3) & 63);
+}
+
+STATIC
+VOID
+MemTestRunSlice (
+  IN MEMTEST_CONTEXT  *Test,
+  IN UINT64           *Start,
+  IN UINTN            Words
+  )
+{
+  volatile UINT64 *Word;
+  UINT64          *End;
+  UINT64          Actual;
+
+  End = Start + Words;
+
+  switch (Test->Phase) {
+    case MemTestWalkingOnesWrite:
+      for (Word = Start; Word < End; Word++) {
+        *Word = WalkingOne((UINTN)Word);
+      }
+      break;
+
+    case MemTestWalkingOnesVerify:
+      for (Word = Start; Word < End; Word++) {
+        Actual = *Word;
+        if (Actual != WalkingOne((UINTN)Word)) {
+          MemTestFail(Test, Word, WalkingOne((UINTN)Word), Actual);
+        }
+      }
+      break;
+
+    case MemTestAddressWrite:
+      for (Word = Start; Word < End; Word++) {
+        *Word = (UINT64)(UINTN)Word;
+      }
+      break;
+
+    case MemTestAddressVerify:
+      for (Word = Start; Word < End; Word++) {
+        Actual = *Word;
+        if (Actual != (UINT64)(UINTN)Word) {
+          MemTestFail(Test, Word, (UINT64)(UINTN)Word, Actual);
+        }
+      }
+      break;
+
+    case MemTestInversionFill:
+      for (Word = Start; Word < End; Word++) {
+        *Word = MEMTEST_INVERSION_PATTERN;
+      }
+      break;
+
+    case MemTestInversionUp:
+      for (Word = Start; Word < End; Word++) {
+        Actual = *Word;
+        if (Actual != MEMTEST_INVERSION_PATTERN) {
+          MemTestFail(Test, Word, MEMTEST_INVERSION_PATTERN, Actual);
+        }
+        *Word = ~MEMTEST_INVERSION_PATTERN;
+      }
+      break;
+
+    case MemTestInversionDown:
+      for (Word = End; Word-- > Start;) {
+        Actual = *Word;
+        if (Actual != ~MEMTEST_INVERSION_PATTERN) {
+          MemTestFail(Test, Word, ~MEMTEST_INVERSION_PATTERN, Actual);
+        }
+        *Word = MEMTEST_INVERSION_PATTERN;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+#endif
+
+/**
+  Take slices off the shared queue until it is empty. This is the
+  EFI_AP_PROCEDURE for every AP and is also called on the BSP.
+**/
+STATIC
+VOID
+EFIAPI
+MemTestWorker (
+  IN OUT VOID  *Buffer
+  )
+{
+  MEMTEST_CONTEXT *Test;
+  UINT32          Index;
+
+  Test = (MEMTEST_CONTEXT *)Buffer;
+  while (TRUE) {
+    Index = InterlockedIncrement(&Test->NextSlice) - 1;
+    if (Index >= Test->SliceCount) {
+      break;
+    }
+    MemTestRunSlice(Test, Test->Slices[Index].Start, Test->Slices[Index].Words);
+  }
+}
+
+/**
+  Run one phase over every slice on all processors and wait for it to end.
+  If the APs cannot be started the BSP does the whole phase, and the
+  remaining phases run on the BSP only.
+**/
+STATIC
+VOID
+MemTestRunPhase (
+  IN OUT MEMTEST_CONTEXT  *Test,
+  IN     MEMTEST_PHASE    Phase
+  )
+{
+  EFI_STATUS Status;
+  BOOLEAN    ApsStarted;
+  UINTN      Index;
+
+  Test->Phase     = Phase;
+  Test->NextSlice = 0;
+  ApsStarted      = FALSE;
+
+  if (Test->Mp != NULL) {
+    Status = Test->Mp->StartupAllAPs(Test->Mp,
+                                     MemTestWorker,
+                                     FALSE,
+                                     Test->ApDone,
+                                     0,
+                                     Test,
+                                     NULL);
+    if (EFI_ERROR(Status)) {
+      Print(L"StartupAllAPs failed (%r); continuing on the BSP only\n", Status);
+      Test->Mp         = NULL;
+      Test->Processors = 1;
+    } else {
+      ApsStarted = TRUE;
+    }
+  }
+
+  MemTestWorker(Test);
+
+  if (ApsStarted) {
+    gBS->WaitForEvent(1, &Test->ApDone, &Index);
+  }
+}
+
+/**
+  Claim conventional memory at its own address, up to BudgetPages, and
+  cut it into slices.
+
+  @param[in]      Map          Current memory map.
+  @param[in]      BudgetPages  Pages to claim at most.
+  @param[in, out] Test         Slices and SliceCount are filled in.
+  @param[out]     Claims       Claimed ranges, for the release.
+  @param[in]      ClaimCapacity  Entries available in Claims.
+  @param[in]      SliceCapacity  Entries available in Test->Slices.
+
+  @return Number of ranges in Claims.
+**/
+STATIC
+UINTN
+MemTestClaim (
+  IN     MEMORY_MAP_SNAPSHOT  *Map,
+  IN     UINT64               BudgetPages,
+  IN OUT MEMTEST_CONTEXT      *Test,
+  OUT    MEMORY_RANGE         *Claims,
+  IN     UINTN                ClaimCapacity,
+  IN     UINTN                SliceCapacity
+  )
+{
+  EFI_STATUS            Status;
+  EFI_MEMORY_DESCRIPTOR *Desc;
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+  UINT64                Pages;
+  UINT64                Offset;
+  UINT64                SlicePages;
+  UINTN                 ClaimCount;
+  UINTN                 i;
+
+  ClaimCount       = 0;
+  Test->SliceCount = 0;
+
+  for (i = 0; i < Map->Count && BudgetPages > 0 && ClaimCount < ClaimCapacity; i++) {
+    Desc = Map->Entries[i];
+    if (Desc->Type != EfiConventionalMemory) {
+      continue;
+    }
+
+    Start = MAX(Desc->PhysicalStart, MEMTEST_LOW_LIMIT);
+    End   = MEMORY_DESCRIPTOR_END(Desc);
+    if (End > (EFI_PHYSICAL_ADDRESS)MAX_ADDRESS) {
+      End = (EFI_PHYSICAL_ADDRESS)MAX_ADDRESS & ~(EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK;
+    }
+    if (Start >= End) {
+      continue;
+    }
+    Pages = MIN(RShiftU64(End - Start, EFI_PAGE_SHIFT), BudgetPages);
+
+    //
+    // Stop short of the slice table rather than claim memory nobody tests
+    //
+    if (Test->SliceCount + DivU64x64Remainder(Pages + MEMTEST_SLICE_PAGES - 1, MEMTEST_SLICE_PAGES, NULL) > SliceCapacity) {
+      break;
+    }
+
+    Status = gBS->AllocatePages(AllocateAddress, EfiBootServicesData, (UINTN)Pages, &Start);
+    if (EFI_ERROR(Status)) {
+      continue;
+    }
+
+    Claims[ClaimCount].Type  = EfiConventionalMemory;
+    Claims[ClaimCount].Start = Start;
+    Claims[ClaimCount].Pages = Pages;
+    ClaimCount++;
+    BudgetPages -= Pages;
+
+    for (Offset = 0; Offset < Pages; Offset += SlicePages) {
+      SlicePages = MIN(Pages - Offset, MEMTEST_SLICE_PAGES);
+      Test->Slices[Test->SliceCount].Start = (UINT64 *)(UINTN)(Start + LShiftU64(Offset, EFI_PAGE_SHIFT));
+      Test->Slices[Test->SliceCount].Words = (UINTN)SlicePages * (EFI_PAGE_SIZE / sizeof(UINT64));
+      Test->SliceCount++;
+    }
+  }
+
+  return ClaimCount;
+}
+
+/**
+  Print Bytes per Ns as GB/s with two decimals.
+**/
+STATIC
+VOID
+PrintGBps (
+  IN UINT64 Bytes,
+  IN UINT64 Ns
+  )
+{
+  UINT64 Hundredths;
+
+  Hundredths = (Ns == 0) ? 0 : DivU64x64Remainder(MultU64x32(Bytes, 100), Ns, NULL);
+  Print(L"%4ld.%02ld", DivU64x64Remainder(Hundredths, 100, NULL), Hundredths % 100);
+}
+
+/**
+  Claim free memory, run every pattern over it on all processors and
+  report throughput and failing addresses.
+
+  @param[in]  LimitMB  Most memory to test in MB; 0 for all conventional
+                       memory except the firmware reserve.
+
+  @retval EFI_SUCCESS           The test ran; failures, if any, were printed.
+  @retval EFI_OUT_OF_RESOURCES  No memory could be claimed.
+  @retval Other                 The memory map could not be read.
+**/
+EFI_STATUS
+RunMemoryTest (
+  IN UINTN  LimitMB
+  )
+{
+  EFI_STATUS           Status;
+  MEMORY_MAP_SNAPSHOT  Map;
+  MEMTEST_CONTEXT      *Test;
+  MEMORY_RANGE         *Claims;
+  UINTN                ClaimCapacity;
+  UINTN                SliceCapacity;
+  UINTN                ClaimCount;
+  UINTN                Enabled;
+  UINT64               FreePages;
+  UINT64               BudgetPages;
+  UINT64               TestedPages;
+  UINT64               Bytes;
+  UINT64               Ns;
+  UINT64               TotalBytes;
+  UINT64               TotalNs;
+  UINT64               Start;
+  UINT32               Failures;
+  UINTN                Phase;
+  UINTN                i;
+
+  Test   = NULL;
+  Claims = NULL;
+  MemoryMapSnapshotInit(&Map);
+
+  Status = MemoryMapSnapshotTake(&Map);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    return Status;
+  }
+
+  //
+  // Size the bookkeeping from this map. Allocating it splits at most a
+  // few descriptors, which the slack covers.
+  //
+  FreePages     = 0;
+  SliceCapacity = MEMORY_MAP_SLACK_DESCRIPTORS;
+  for (i = 0; i < Map.Count; i++) {
+    if (Map.Entries[i]->Type == EfiConventionalMemory) {
+      FreePages     += Map.Entries[i]->NumberOfPages;
+      SliceCapacity += (UINTN)DivU64x64Remainder(Map.Entries[i]->NumberOfPages, MEMTEST_SLICE_PAGES, NULL) + 1;
+    }
+  }
+  ClaimCapacity = Map.Count + MEMORY_MAP_SLACK_DESCRIPTORS;
+
+  if (FreePages <= MEMTEST_RESERVE_PAGES) {
+    Print(L"Not enough free memory to test\n");
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+  BudgetPages = FreePages - MEMTEST_RESERVE_PAGES;
+  if (LimitMB != 0) {
+    BudgetPages = MIN(BudgetPages, MultU64x32(LimitMB, EFI_SIZE_TO_PAGES(SIZE_1MB)));
+  }
+
+  Test   = AllocateZeroPool(sizeof(MEMTEST_CONTEXT));
+  Claims = AllocatePool(ClaimCapacity * sizeof(MEMORY_RANGE));
+  if (Test != NULL) {
+    Test->Slices = AllocatePool(SliceCapacity * sizeof(MEMTEST_SLICE));
+  }
+  if (Test == NULL || Claims == NULL || Test->Slices == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  //
+  // Processors: everything MP Services has enabled, or just the BSP
+  //
+  Test->Processors = 1;
+  Status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (VOID **)&Test->Mp);
+  if (!EFI_ERROR(Status)) {
+    Status = Test->Mp->GetNumberOfProcessors(Test->Mp, &i, &Enabled);
+  }
+  if (!EFI_ERROR(Status) && Enabled > 1) {
+    Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Test->ApDone);
+  } else {
+    Status = EFI_UNSUPPORTED;
+  }
+  if (EFI_ERROR(Status)) {
+    Test->Mp = NULL;
+  } else {
+    Test->Processors = Enabled;
+  }
+
+  //
+  // Re-read the map now that our own allocations are in it, then claim
+  //
+  Status = MemoryMapSnapshotTake(&Map);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    goto Done;
+  }
+  ClaimCount = MemTestClaim(&Map, BudgetPages, Test, Claims, ClaimCapacity, SliceCapacity);
+  if (Test->SliceCount == 0) {
+    Print(L"No conventional memory could be claimed\n");
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  TestedPages = 0;
+  for (i = 0; i < ClaimCount; i++) {
+    TestedPages += Claims[i].Pages;
+  }
+
+  Print(L"\nMemory test: %ld MB in %d ranges, %d slices, %d processor(s), %s stores\n",
+        RShiftU64(TestedPages, 20 - EFI_PAGE_SHIFT),
+        ClaimCount,
+        Test->SliceCount,
+        Test->Processors,
+        MEMTEST_SSE2 ? L"SSE2 non-temporal" : L"64-bit");
+  Print(L"\nPattern               Time (ms)    GB/s   Errors\n");
+  Print(L"--------------------  ---------  -------  ------\n");
+
+  TotalBytes = 0;
+  TotalNs    = 0;
+  for (i = 0; i < ARRAY_SIZE(mMemTestPatterns); i++) {
+    Failures = Test->FailureCount;
+
+    Start = GetPerformanceCounter();
+    for (Phase = mMemTestPatterns[i].First; Phase <= mMemTestPatterns[i].Last; Phase++) {
+      MemTestRunPhase(Test, (MEMTEST_PHASE)Phase);
+    }
+    Ns = GetTimeInNanoSecond(ElapsedTicks(Start, GetPerformanceCounter()));
+
+    Bytes       = MultU64x32(LShiftU64(TestedPages, EFI_PAGE_SHIFT), mMemTestPatterns[i].Passes);
+    TotalBytes += Bytes;
+    TotalNs    += Ns;
+
+    Print(L"%-20s  %9ld  ", mMemTestPatterns[i].Name, DivU64x64Remainder(Ns, 1000000, NULL));
+    PrintGBps(Bytes, Ns);
+    Print(L"  %6d\n", Test->FailureCount - Failures);
+  }
+
+  Print(L"%-20s  %9ld  ", L"Total", DivU64x64Remainder(TotalNs, 1000000, NULL));
+  PrintGBps(TotalBytes, TotalNs);
+  Print(L"  %6d\n", Test->FailureCount);
+
+  if (Test->FailureCount == 0) {
+    Print(L"\nNo errors found\n");
+  } else {
+    Print(L"\nFailures%s:\n", (Test->FailureCount > MEMTEST_MAX_FAILURES) ? L" (first 32)" : L"");
+    Print(L"Address            Expected           Actual             Bits\n");
+    for (i = 0; i < MIN(Test->FailureCount, MEMTEST_MAX_FAILURES); i++) {
+      Print(L"%016lx   %016lx   %016lx   %016lx\n",
+            Test->Failures[i].Address,
+            Test->Failures[i].Expected,
+            Test->Failures[i].Actual,
+            Test->Failures[i].Expected ^ Test->Failures[i].Actual);
+    }
+  }
+
+  for (i = 0; i < ClaimCount; i++) {
+    gBS->FreePages(Claims[i].Start, (UINTN)Claims[i].Pages);
+  }
+  Status = EFI_SUCCESS;
+
+Done:
+  if (Test != NULL) {
+    if (Test->ApDone != NULL) {
+      gBS->CloseEvent(Test->ApDone);
+    }
+    if (Test->Slices != NULL) {
+      FreePool(Test->Slices);
+    }
+    FreePool(Test);
+  }
+  if (Claims != NULL) {
+    FreePool(Claims);
+  }
+  MemoryMapSnapshotFree(&Map);
+  return Status;
+}
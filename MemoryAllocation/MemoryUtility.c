@@ -3,23 +3,805 @@ This sample application bases on Memory setting
 to show how firmware allocates physical memory before OS boots.
 **/
 
-#include <Uefi.h>
-#include <Library/UefiBootServicesTableLib.h>
-#include <Library/UefiLib.h>
-#include <Library/BaseLib.h>
-#include <Library/BaseMemoryLib.h>
-#include <Library/MemoryAllocationLib.h>
+#include "MemoryUtility.h"
 #include <Library/ShellCEntryLib.h>
 #include <Library/ShellLib.h>
 
+//
+// Width of the histogram bars printed by the memory map analyzer
+//
+#define HISTOGRAM_WIDTH  32
+
+//
+// Memory type slot used for OEM/OS defined and unknown types
+//
+#define OTHER_MEMORY_TYPE  EfiMaxMemoryType
+
+/**
+  Print a horizontal bar of Value relative to Max, HISTOGRAM_WIDTH wide.
+  Any non-zero value gets at least one mark.
+
+  @param[in]  Value  Value to draw.
+  @param[in]  Max    Value drawn as a full bar.
+**/
+STATIC
+VOID
+PrintBar (
+  IN UINT64 Value,
+  IN UINT64 Max
+  )
+{
+  UINTN Length;
+  UINTN i;
+
+  Length = (Max == 0) ? 0 : (UINTN)DivU64x64Remainder(MultU64x32(Value, HISTOGRAM_WIDTH), Max, NULL);
+  if (Value != 0 && Length == 0) {
+    Length = 1;
+  }
+  for (i = 0; i < HISTOGRAM_WIDTH; i++) {
+    Print(i < Length ? L"#" : L" ");
+  }
+}
+
+/**
+  Merge neighbouring ranges of the same type that are physically contiguous.
+
+  @param[in, out]  Ranges  Array sorted by start address.
+  @param[in]       Count   Number of entries.
+
+  @return  Number of entries after merging.
+**/
+STATIC
+UINTN
+CoalesceMemoryRanges (
+  IN OUT MEMORY_RANGE *Ranges,
+  IN     UINTN        Count
+  )
+{
+  UINTN Out;
+  UINTN i;
+
+  Out = 0;
+  for (i = 0; i < Count; i++) {
+    if (Out > 0 &&
+        Ranges[Out - 1].Type == Ranges[i].Type &&
+        Ranges[Out - 1].Start + LShiftU64(Ranges[Out - 1].Pages, EFI_PAGE_SHIFT) == Ranges[i].Start) {
+      Ranges[Out - 1].Pages += Ranges[i].Pages;
+    } else {
+      Ranges[Out++] = Ranges[i];
+    }
+  }
+  return Out;
+}
+
+/**
+  Number of pages of a range that lie below 4 GB.
+
+  @param[in]  Range  Memory range.
+
+  @return  Pages below 4 GB.
+**/
+STATIC
+UINT64
+PagesBelow4G (
+  IN MEMORY_RANGE *Range
+  )
+{
+  UINT64 End;
+
+  if (Range->Start >= SIZE_4GB) {
+    return 0;
+  }
+  End = Range->Start + LShiftU64(Range->Pages, EFI_PAGE_SHIFT);
+  return RShiftU64(MIN(End, SIZE_4GB) - Range->Start, EFI_PAGE_SHIFT);
+}
+
+/**
+  Analyze the current memory map: coalesce it, then print per-type totals,
+  free memory statistics and a histogram of free run sizes.
+
+  @param[in, out]  Snapshot  Snapshot buffer to capture the map into.
+
+  @retval EFI_SUCCESS  The analysis was printed.
+  @retval Other        The memory map could not be read.
+**/
+STATIC
+EFI_STATUS
+AnalyzeMemoryMap (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  //
+  // Free run size buckets: < 1 MB, < 16 MB, < 256 MB, < 4 GB, >= 4 GB (in pages)
+  //
+  STATIC CONST UINT64  BucketLimit[] = { 0x100, 0x1000, 0x10000, 0x100000, MAX_UINT64 };
+  STATIC CONST CHAR16  *BucketName[] = { L"   < 1 MB", L"  < 16 MB", L" < 256 MB", L"   < 4 GB", L"  >= 4 GB" };
+  EFI_STATUS             Status;
+  EFI_MEMORY_DESCRIPTOR  *Desc;
+  MEMORY_RANGE           *Ranges;
+  UINTN                  Count;
+  UINTN                  Runs;
+  UINT64                 TypePages[OTHER_MEMORY_TYPE + 1];
+  UINTN                  TypeRuns[OTHER_MEMORY_TYPE + 1];
+  UINT64                 BucketPages[ARRAY_SIZE(BucketLimit)];
+  UINTN                  BucketRuns[ARRAY_SIZE(BucketLimit)];
+  UINT64                 SystemPages;
+  UINT64                 SystemBelow4G;
+  UINT64                 FreePages;
+  UINT64                 FreeBelow4G;
+  UINTN                  FreeRuns;
+  UINT64                 MaxTypePages;
+  UINT64                 MaxBucketPages;
+  MEMORY_RANGE           *Largest;
+  UINT32                 Type;
+  UINTN                  i;
+  UINTN                  b;
+
+  Status = MemoryMapSnapshotTake(Snapshot);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    return Status;
+  }
+
+  Count  = Snapshot->Count;
+  Ranges = AllocatePool(Count * sizeof(MEMORY_RANGE));
+  if (Ranges == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (i = 0; i < Count; i++) {
+    Desc = Snapshot->Entries[i];
+    Ranges[i].Type  = Desc->Type;
+    Ranges[i].Start = Desc->PhysicalStart;
+    Ranges[i].Pages = Desc->NumberOfPages;
+  }
+
+  Runs = CoalesceMemoryRanges(Ranges, Count);
+
+  ZeroMem(TypePages, sizeof(TypePages));
+  ZeroMem(TypeRuns, sizeof(TypeRuns));
+  ZeroMem(BucketPages, sizeof(BucketPages));
+  ZeroMem(BucketRuns, sizeof(BucketRuns));
+  SystemPages   = 0;
+  SystemBelow4G = 0;
+  FreePages     = 0;
+  FreeBelow4G   = 0;
+  FreeRuns      = 0;
+  Largest       = NULL;
+
+  for (i = 0; i < Runs; i++) {
+    Type = (Ranges[i].Type < OTHER_MEMORY_TYPE) ? Ranges[i].Type : OTHER_MEMORY_TYPE;
+    TypePages[Type] += Ranges[i].Pages;
+    TypeRuns[Type]++;
+
+    //
+    // MMIO ranges describe address space, not memory
+    //
+    if (Type != EfiMemoryMappedIO && Type != EfiMemoryMappedIOPortSpace) {
+      SystemPages   += Ranges[i].Pages;
+      SystemBelow4G += PagesBelow4G(&Ranges[i]);
+    }
+
+    if (Type == EfiConventionalMemory) {
+      FreePages   += Ranges[i].Pages;
+      FreeBelow4G += PagesBelow4G(&Ranges[i]);
+      FreeRuns++;
+      if (Largest == NULL || Ranges[i].Pages > Largest->Pages) {
+        Largest = &Ranges[i];
+      }
+      for (b = 0; Ranges[i].Pages >= BucketLimit[b]; b++) {
+      }
+      BucketPages[b] += Ranges[i].Pages;
+      BucketRuns[b]++;
+    }
+  }
+
+  MaxTypePages = 0;
+  for (Type = 0; Type <= OTHER_MEMORY_TYPE; Type++) {
+    MaxTypePages = MAX(MaxTypePages, TypePages[Type]);
+  }
+  MaxBucketPages = 0;
+  for (b = 0; b < ARRAY_SIZE(BucketLimit); b++) {
+    MaxBucketPages = MAX(MaxBucketPages, BucketPages[b]);
+  }
+
+  Print(L"\nMemory Map Analysis (%d descriptors, %d ranges after merging)\n\n", Count, Runs);
+  Print(L"Type           Ranges       Size  %%\n");
+  for (Type = 0; Type <= OTHER_MEMORY_TYPE; Type++) {
+    if (TypeRuns[Type] == 0) {
+      continue;
+    }
+    Print(L"%-12s  %7d  ", (Type == OTHER_MEMORY_TYPE) ? L"Other" : MemoryTypeName(Type), TypeRuns[Type]);
+    PrintPagesSize(TypePages[Type]);
+    Print(L"  %3ld ",
+          (SystemPages == 0) ? 0 : DivU64x64Remainder(MultU64x32(TypePages[Type], 100), SystemPages, NULL));
+    PrintBar(TypePages[Type], MaxTypePages);
+    Print(L"\n");
+  }
+
+  Print(L"\nSystem memory (excluding MMIO): ");
+  PrintPagesSize(SystemPages);
+  Print(L"\n  below 4 GB:  ");
+  PrintPagesSize(SystemBelow4G);
+  Print(L"   free ");
+  PrintPagesSize(FreeBelow4G);
+  Print(L"\n  above 4 GB:  ");
+  PrintPagesSize(SystemPages - SystemBelow4G);
+  Print(L"   free ");
+  PrintPagesSize(FreePages - FreeBelow4G);
+  Print(L"\n");
+
+  Print(L"\nFree memory: ");
+  PrintPagesSize(FreePages);
+  Print(L" in %d runs\n", FreeRuns);
+  if (Largest != NULL) {
+    Print(L"Largest free run: ");
+    PrintPagesSize(Largest->Pages);
+    Print(L" at 0x%lx-0x%lx\n",
+          Largest->Start, Largest->Start + LShiftU64(Largest->Pages, EFI_PAGE_SHIFT) - 1);
+    //
+    // 0% when all free memory is one run; approaches 100% as it splinters
+    //
+    Print(L"Fragmentation index: %ld%% (1 - largest run / free memory)\n",
+          100 - DivU64x64Remainder(MultU64x32(Largest->Pages, 100), FreePages, NULL));
+  }
+
+  Print(L"\nFree run sizes   Runs       Size\n");
+  for (b = 0; b < ARRAY_SIZE(BucketLimit); b++) {
+    Print(L"%s  %7d  ", BucketName[b], BucketRuns[b]);
+    PrintPagesSize(BucketPages[b]);
+    Print(L"  ");
+    PrintBar(BucketPages[b], MaxBucketPages);
+    Print(L"\n");
+  }
+
+  FreePool(Ranges);
+  return EFI_SUCCESS;
+}
+
+/**
+  Add up the pages of each memory type in a snapshot.
+
+  @param[in]   Snapshot  Memory map snapshot.
+  @param[out]  Pages     OTHER_MEMORY_TYPE + 1 counters, indexed by type.
+**/
+STATIC
+VOID
+SumPagesByType (
+  IN  MEMORY_MAP_SNAPSHOT *Snapshot,
+  OUT UINT64              *Pages
+  )
+{
+  UINT32 Type;
+  UINTN  i;
+
+  ZeroMem(Pages, (OTHER_MEMORY_TYPE + 1) * sizeof(UINT64));
+  for (i = 0; i < Snapshot->Count; i++) {
+    Type = Snapshot->Entries[i]->Type;
+    Pages[(Type < OTHER_MEMORY_TYPE) ? Type : OTHER_MEMORY_TYPE] += Snapshot->Entries[i]->NumberOfPages;
+  }
+}
+
+/**
+  Print one descriptor as a line of a memory map diff.
+
+  @param[in]  Sign  L'+' for a new range, L'-' for a range that went away.
+  @param[in]  Desc  Memory descriptor.
+**/
+STATIC
+VOID
+PrintDiffRange (
+  IN CHAR16                Sign,
+  IN EFI_MEMORY_DESCRIPTOR *Desc
+  )
+{
+  Print(L"  %c %-14s %016lx-%016lx ", Sign, MemoryTypeName(Desc->Type),
+        Desc->PhysicalStart, MEMORY_DESCRIPTOR_END(Desc) - 1);
+  PrintPagesSize(Desc->NumberOfPages);
+  Print(L"\n");
+}
+
+/**
+  Print the differences between two memory map snapshots: per-type page
+  deltas, then every range that only exists in one of them.
+
+  @param[in]  Before  Snapshot taken before the action.
+  @param[in]  After   Snapshot taken after the action.
+**/
+STATIC
+VOID
+PrintMemoryMapDiff (
+  IN MEMORY_MAP_SNAPSHOT *Before,
+  IN MEMORY_MAP_SNAPSHOT *After
+  )
+{
+  UINT64                PagesBefore[OTHER_MEMORY_TYPE + 1];
+  UINT64                PagesAfter[OTHER_MEMORY_TYPE + 1];
+  INT64                 Delta;
+  INT64                 Allocated;
+  EFI_MEMORY_DESCRIPTOR *Old;
+  EFI_MEMORY_DESCRIPTOR *New;
+  UINTN                 Changes;
+  UINT32                Type;
+  UINTN                 i;
+  UINTN                 j;
+
+  SumPagesByType(Before, PagesBefore);
+  SumPagesByType(After, PagesAfter);
+
+  Print(L"\nPer-type change (pages before -> after, delta):\n");
+  Allocated = 0;
+  Changes   = 0;
+  for (Type = 0; Type <= OTHER_MEMORY_TYPE; Type++) {
+    Delta = (INT64)(PagesAfter[Type] - PagesBefore[Type]);
+    if (Delta == 0) {
+      continue;
+    }
+    Print(L"  %-12s %10ld -> %10ld  %+ld pages (%+ld KB)\n",
+          (Type == OTHER_MEMORY_TYPE) ? L"Other" : MemoryTypeName(Type),
+          PagesBefore[Type], PagesAfter[Type], Delta, MultS64x64(Delta, 4));
+    if (Type != EfiConventionalMemory) {
+      Allocated += Delta;
+    }
+    Changes++;
+  }
+  if (Changes == 0) {
+    Print(L"  (none)\n");
+  }
+
+  //
+  // Both views are sorted by address and ranges never overlap within one
+  // map, so a single merge pass pairs up unchanged ranges
+  //
+  Print(L"\nChanged ranges (- before only, + after only):\n");
+  Changes = 0;
+  i = 0;
+  j = 0;
+  while (i < Before->Count || j < After->Count) {
+    Old = (i < Before->Count) ? Before->Entries[i] : NULL;
+    New = (j < After->Count)  ? After->Entries[j]  : NULL;
+
+    if (Old != NULL && New != NULL && Old->PhysicalStart == New->PhysicalStart) {
+      if (Old->Type != New->Type || Old->NumberOfPages != New->NumberOfPages) {
+        PrintDiffRange(L'-', Old);
+        PrintDiffRange(L'+', New);
+        Changes++;
+      }
+      i++;
+      j++;
+    } else if (New == NULL || (Old != NULL && Old->PhysicalStart < New->PhysicalStart)) {
+      PrintDiffRange(L'-', Old);
+      Changes++;
+      i++;
+    } else {
+      PrintDiffRange(L'+', New);
+      Changes++;
+      j++;
+    }
+  }
+  if (Changes == 0) {
+    Print(L"  (none)\n");
+  }
+
+  Print(L"\nNet change of allocated (non-free) memory: %+ld KB\n", MultS64x64(Allocated, 4));
+  Print(L"Note: a few pages of BS Data may be this utility's own buffers.\n");
+}
+
+/**
+  Ask for an action, run it between two memory map snapshots and print
+  what changed.
+
+  The action is either a shell command line (which can also start other
+  utilities or load drivers with the shell's own commands) or an EFI image
+  loaded and started with LoadImage/StartImage. Drivers stay resident, so
+  their allocations show up in the diff.
+
+  @param[in, out]  Before  Snapshot buffer for the map before the action.
+  @param[in, out]  After   Snapshot buffer for the map after the action.
+
+  @retval EFI_SUCCESS  The diff was printed.
+  @retval Other        Input, snapshot or image loading failed.
+**/
+STATIC
+EFI_STATUS
+DiffMemoryMapAroundAction (
+  IN OUT MEMORY_MAP_SNAPSHOT *Before,
+  IN OUT MEMORY_MAP_SNAPSHOT *After
+  )
+{
+  EFI_STATUS                Status;
+  EFI_STATUS                ActionStatus;
+  CHAR16                    *Choice;
+  CHAR16                    *Command;
+  UINTN                     ActionType;
+  EFI_DEVICE_PATH_PROTOCOL  *ImagePath;
+  EFI_HANDLE                ImageHandle;
+
+  Choice  = NULL;
+  Command = NULL;
+
+  Print(L"\nAction to run between snapshots:\n");
+  Print(L"1. Shell command line (e.g. another utility, or 'load driver.efi')\n");
+  Print(L"2. Load and start an EFI image\n");
+  Print(L"Select (1-2): ");
+  Status = ShellPromptForResponse(ShellPromptResponseTypeFreeform, NULL, &Choice);
+  if (EFI_ERROR(Status) || Choice == NULL) {
+    Print(L"Error getting input: %r\n", Status);
+    return EFI_ABORTED;
+  }
+  ActionType = StrDecimalToUintn(Choice);
+  FreePool(Choice);
+  if (ActionType != 1 && ActionType != 2) {
+    Print(L"Invalid action! Please enter 1 or 2.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Print((ActionType == 1) ? L"Command line: " : L"Image path: ");
+  Status = ShellPromptForResponse(ShellPromptResponseTypeFreeform, NULL, &Command);
+  if (EFI_ERROR(Status) || Command == NULL || Command[0] == L'\0') {
+    Print(L"Nothing to run\n");
+    if (Command != NULL) {
+      FreePool(Command);
+    }
+    return EFI_ABORTED;
+  }
+
+  ImagePath = NULL;
+  if (ActionType == 2) {
+    ImagePath = gEfiShellProtocol->GetDevicePathFromFilePath(Command);
+    if (ImagePath == NULL) {
+      Print(L"Cannot resolve '%s'\n", Command);
+      FreePool(Command);
+      return EFI_NOT_FOUND;
+    }
+  }
+
+  //
+  // Size the after-buffer first so that its growth is not part of the diff
+  //
+  Status = MemoryMapSnapshotTake(After);
+  if (!EFI_ERROR(Status)) {
+    Status = MemoryMapSnapshotTake(Before);
+  }
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    goto Done;
+  }
+
+  if (ActionType == 1) {
+    Status = ShellExecute(&gImageHandle, Command, FALSE, NULL, &ActionStatus);
+    if (!EFI_ERROR(Status)) {
+      Status = ActionStatus;
+    }
+  } else {
+    Status = gBS->LoadImage(FALSE, gImageHandle, ImagePath, NULL, 0, &ImageHandle);
+    if (!EFI_ERROR(Status)) {
+      Status = gBS->StartImage(ImageHandle, NULL, NULL);
+    }
+  }
+  ActionStatus = Status;
+
+  Status = MemoryMapSnapshotTake(After);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    goto Done;
+  }
+
+  Print(L"\n'%s' returned %r\n", Command, ActionStatus);
+  Print(L"Memory map: %d descriptors before, %d after\n", Before->Count, After->Count);
+  PrintMemoryMapDiff(Before, After);
+
+Done:
+  if (ImagePath != NULL) {
+    FreePool(ImagePath);
+  }
+  FreePool(Command);
+  return Status;
+}
+
+/**
+  Prompt for a number. Accepts decimal, 0x-prefixed hex, and a K, M or G
+  suffix; an empty line gives Default.
+
+  @param[in]   Prompt   Text shown before the cursor.
+  @param[in]   Default  Value for an empty line.
+  @param[out]  Value    Number entered.
+
+  @retval EFI_SUCCESS            Value is set.
+  @retval EFI_INVALID_PARAMETER  The input is not a number, or overflows.
+  @retval EFI_ABORTED            No input could be read.
+**/
+STATIC
+EFI_STATUS
+PromptForNumber (
+  IN  CONST CHAR16 *Prompt,
+  IN  UINT64       Default,
+  OUT UINT64       *Value
+  )
+{
+  EFI_STATUS Status;
+  CHAR16     *Input;
+  CHAR16     *Text;
+  UINTN      Length;
+  UINTN      Shift;
+
+  Input = NULL;
+  Print(L"%s", Prompt);
+  Status = ShellPromptForResponse(ShellPromptResponseTypeFreeform, NULL, &Input);
+  if (EFI_ERROR(Status) || Input == NULL) {
+    Print(L"Error getting input: %r\n", Status);
+    return EFI_ABORTED;
+  }
+
+  Text = Input;
+  while (*Text == L' ') {
+    Text++;
+  }
+  Length = StrLen(Text);
+  while (Length > 0 && Text[Length - 1] == L' ') {
+    Text[--Length] = L'\0';
+  }
+
+  Status = EFI_SUCCESS;
+  if (Length == 0) {
+    *Value = Default;
+    goto Done;
+  }
+
+  Shift = 0;
+  switch (Text[Length - 1]) {
+    case L'k': case L'K': Shift = 10; break;
+    case L'm': case L'M': Shift = 20; break;
+    case L'g': case L'G': Shift = 30; break;
+    default:              break;
+  }
+  if (Shift != 0) {
+    Text[--Length] = L'\0';
+  }
+
+  if (Length > 2 && Text[0] == L'0' && (Text[1] == L'x' || Text[1] == L'X')) {
+    Status = StrHexToUint64S(Text, NULL, Value);
+  } else {
+    Status = StrDecimalToUint64S(Text, NULL, Value);
+  }
+  if (EFI_ERROR(Status) || Length == 0 || *Value > RShiftU64(MAX_UINT64, Shift)) {
+    Print(L"Invalid number '%s'\n", Input);
+    Status = EFI_INVALID_PARAMETER;
+    goto Done;
+  }
+  *Value = LShiftU64(*Value, Shift);
+
+Done:
+  FreePool(Input);
+  return Status;
+}
+
 /**
-  Memory allocation type enumeration
+  Ask for kind, size, memory type and, for pages, placement and alignment,
+  then allocate and record the buffer.
+
+  @retval EFI_SUCCESS  The buffer was allocated and added to the table.
+  @retval Other        Bad input, or the allocation failed.
 **/
-typedef enum {
-  AllocationTypeNone,
-  AllocationTypePages,
-  AllocationTypePool
-} ALLOCATION_TYPE;
+STATIC
+EFI_STATUS
+AllocateFromMenu (
+  VOID
+  )
+{
+  EFI_STATUS         Status;
+  TRACKED_ALLOCATION Request;
+  UINT64             Value;
+  UINTN              Index;
+  UINT32             Type;
+
+  ZeroMem(&Request, sizeof(Request));
+
+  Print(L"\nAllocation kind:\n");
+  Print(L"1. Pages\n");
+  Print(L"2. Pool\n");
+  Status = PromptForNumber(L"Select (1-2) [1]: ", 1, &Value);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  if (Value != 1 && Value != 2) {
+    Print(L"Invalid allocation kind! Please enter 1 or 2.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  Request.Kind = (Value == 1) ? AllocationKindPages : AllocationKindPool;
+
+  Status = PromptForNumber(L"Size in bytes, K/M/G suffix allowed [4K]: ", SIZE_4KB, &Request.Size);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Print(L"\nMemory type (OEM/OS types 0x70000000 and up are also accepted):\n");
+  for (Type = 0; Type < EfiMaxMemoryType; Type++) {
+    Print(L"%2d. %s\n", Type, MemoryTypeName(Type));
+  }
+  Status = PromptForNumber(L"Select [4 = BS Data]: ", EfiBootServicesData, &Value);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  Request.MemoryType = (EFI_MEMORY_TYPE)(UINT32)Value;
+
+  if (Request.Kind == AllocationKindPages) {
+    Print(L"\nPlacement:\n");
+    Print(L"1. Any address\n");
+    Print(L"2. At or below a maximum address\n");
+    Print(L"3. At a given address\n");
+    Status = PromptForNumber(L"Select (1-3) [1]: ", 1, &Value);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    if (Value == 1) {
+      Request.Type = AllocateAnyPages;
+    } else if (Value == 2 || Value == 3) {
+      Request.Type = (Value == 2) ? AllocateMaxAddress : AllocateAddress;
+      Status = PromptForNumber((Value == 2) ? L"Maximum address (0x...): " : L"Address (0x...): ",
+                               0, &Request.Address);
+      if (EFI_ERROR(Status)) {
+        return Status;
+      }
+    } else {
+      Print(L"Invalid placement! Please enter 1-3.\n");
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Print(L"\nAlignment:\n");
+    Print(L"1. 4 KB\n");
+    Print(L"2. 2 MB\n");
+    Print(L"3. 1 GB\n");
+    Status = PromptForNumber(L"Select (1-3) [1]: ", 1, &Value);
+    if (EFI_ERROR(Status)) {
+      return Status;
+    }
+    if (Value == 1) {
+      Request.Alignment = SIZE_4KB;
+    } else if (Value == 2) {
+      Request.Alignment = SIZE_2MB;
+    } else if (Value == 3) {
+      Request.Alignment = SIZE_1GB;
+    } else {
+      Print(L"Invalid alignment! Please enter 1-3.\n");
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  Status = TrackedAllocate(&Request, &Index);
+  if (EFI_ERROR(Status)) {
+    Print(L"Allocation failed: %r\n", Status);
+    return Status;
+  }
+  Print(L"Allocation #%d: %ld bytes of %s at 0x%lx\n",
+        Index + 1, Request.Size, MemoryTypeName(Request.MemoryType), Request.Address);
+  return EFI_SUCCESS;
+}
+
+/**
+  Ask which allocation to use.
+
+  @param[in]   Prompt  Text shown before the cursor.
+  @param[out]  Index   Table index chosen (0-based).
+
+  @retval EFI_SUCCESS    Index is a live allocation.
+  @retval EFI_NOT_FOUND  No allocations, or no such entry.
+**/
+STATIC
+EFI_STATUS
+SelectAllocation (
+  IN  CONST CHAR16 *Prompt,
+  OUT UINTN        *Index
+  )
+{
+  EFI_STATUS Status;
+  UINT64     Value;
+
+  if (TrackedCount() == 0) {
+    Print(L"No memory allocated! Please allocate memory first.\n");
+    return EFI_NOT_FOUND;
+  }
+
+  Print(L"\n");
+  TrackedPrint();
+  Status = PromptForNumber(Prompt, 0, &Value);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  if (Value == 0 || TrackedGet((UINTN)Value - 1) == NULL) {
+    Print(L"No allocation #%ld\n", Value);
+    return EFI_NOT_FOUND;
+  }
+  *Index = (UINTN)Value - 1;
+  return EFI_SUCCESS;
+}
+
+/**
+  Fill an allocation with 0xAB, copy a test string to its start and show
+  the first bytes.
+**/
+STATIC
+VOID
+WriteToAllocation (
+  VOID
+  )
+{
+  TRACKED_ALLOCATION *Allocation;
+  CHAR16             TestString[] = L"UEFI Memory Test Data";
+  UINT8              *TargetBuffer;
+  UINTN              BufferSize;
+  UINTN              CopySize;
+  UINTN              Index;
+  UINTN              i;
+
+  if (EFI_ERROR(SelectAllocation(L"Allocation to write: ", &Index))) {
+    return;
+  }
+  Allocation   = TrackedGet(Index);
+  TargetBuffer = (UINT8 *)(UINTN)Allocation->Address;
+  BufferSize   = (UINTN)Allocation->Size;
+
+  //
+  // Write test pattern to memory
+  //
+  SetMem(TargetBuffer, BufferSize, 0xAB); // Fill with 0xAB pattern
+
+  //
+  // Copy a string to demonstrate CopyMem
+  //
+  CopySize = StrSize(TestString);
+  if (CopySize > BufferSize) {
+    CopySize = BufferSize;
+  }
+  CopyMem(TargetBuffer, TestString, CopySize);
+
+  Print(L"Successfully wrote data to allocation #%d\n", Index + 1);
+
+  //
+  // Display first few bytes
+  //
+  Print(L"First 32 bytes (hex): ");
+  for (i = 0; i < 32 && i < BufferSize; i++) {
+    Print(L"%02x ", TargetBuffer[i]);
+  }
+  Print(L"\n");
+}
+
+/**
+  Free one allocation, or all of them.
+**/
+STATIC
+VOID
+FreeFromMenu (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINT64     Value;
+
+  if (TrackedCount() == 0) {
+    Print(L"No memory allocated!\n");
+    return;
+  }
+
+  Print(L"\n");
+  TrackedPrint();
+  Status = PromptForNumber(L"Allocation to free (0 = all): ", 0, &Value);
+  if (EFI_ERROR(Status)) {
+    return;
+  }
+
+  if (Value == 0) {
+    Print(L"Freed %d allocation(s)\n", TrackedFreeAll());
+    return;
+  }
+  Status = (Value > MAX_TRACKED_ALLOCATIONS) ? EFI_NOT_FOUND : TrackedFree((UINTN)Value - 1);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to free allocation #%ld: %r\n", Value, Status);
+  } else {
+    Print(L"Successfully freed allocation #%ld\n", Value);
+  }
+}
 
 /**
   UEFI application entry point which has an interface similar to a
@@ -44,37 +826,20 @@ ShellAppMain (
 {
   EFI_STATUS Status = EFI_SUCCESS;
   CHAR16 *UserInput = NULL;
-  CHAR16 *AllocInput = NULL;
   UINTN MenuChoice = 0;
-  UINTN AllocType = 0;
-  VOID *AllocatedPool = NULL;
-  EFI_PHYSICAL_ADDRESS AllocatedPages = 0;
-  UINTN Pages = 1; // 1 page = 4KB
-  UINTN PoolSize = 1; // 1 bytes
-  ALLOCATION_TYPE CurrentAllocation = AllocationTypeNone;
-  
-  //
-  // Mid-block Variables
-  //
-  VOID *TargetBuffer;
-  UINTN BufferSize;
-  CHAR16 TestString[] = L"UEFI Memory Test Data";
-  UINTN CopySize;
+  UINT64 Value;
   UINTN i;
   
   //
   // Memory map variables
   //
-  UINTN MemoryMapSize;
-  EFI_MEMORY_DESCRIPTOR *MemoryMap;
-  UINTN MapKey;
-  UINTN DescriptorSize;
-  UINT32 DescriptorVersion;
-  UINTN TotalMemory;
-  UINTN TotalPages;
+  MEMORY_MAP_SNAPSHOT MemoryMap;
+  MEMORY_MAP_SNAPSHOT MemoryMapAfter;
+  UINT64 TotalPages;
   EFI_MEMORY_DESCRIPTOR *Desc;
-  UINTN NumEntries;
-  CHAR16 *TypeStr;
+
+  MemoryMapSnapshotInit(&MemoryMap);
+  MemoryMapSnapshotInit(&MemoryMapAfter);
 
   //
   // Main application loop
@@ -86,27 +851,27 @@ ShellAppMain (
     Print(L"2. Write Data to Allocated Memory\n");
     Print(L"3. Free Memory\n");
     Print(L"4. Dump Memory Map\n");
-    Print(L"5. Exit\n\n");
+    Print(L"5. Analyze Memory Map\n");
+    Print(L"6. Memory Map Diff Around an Action\n");
+    Print(L"7. Allocation Benchmark\n");
+    Print(L"8. Memory Test (all processors)\n");
+    Print(L"9. Page Table Inspector\n");
+    Print(L"10. MTRR/PAT Cacheability Report\n");
+    Print(L"11. Exit\n\n");
     Print(L"Current Status: ");
-    
-    switch (CurrentAllocation) {
-      case AllocationTypeNone:
-        Print(L"No memory allocated\n\n");
-        break;
-      case AllocationTypePages:
-        Print(L"Pages allocated at 0x%lx (%d pages = %d KB)\n\n", 
-              AllocatedPages, Pages, Pages * 4);
-        break;
-      case AllocationTypePool:
-        Print(L"Pool allocated at 0x%lx (%d bytes)\n\n", 
-              (UINTN)AllocatedPool, PoolSize);
-        break;
+
+    if (TrackedCount() == 0) {
+      Print(L"No memory allocated\n\n");
+    } else {
+      Print(L"%d live allocation(s)\n", TrackedCount());
+      TrackedPrint();
+      Print(L"\n");
     }
 
     //
     // Get user input
     //
-    Print(L"Select option (1-5): ");    
+    Print(L"Select option (1-11): ");    
     Status = ShellPromptForResponse(ShellPromptResponseTypeFreeform,
                                     NULL, 
                                     &UserInput);
@@ -125,246 +890,94 @@ ShellAppMain (
 
     switch (MenuChoice) {
       case 1: // Allocate Memory
-        Print(L"\nAllocation Type:\n");
-        Print(L"1. Allocate Pages (%d pages = %d KB)\n", Pages, Pages * 4);
-        Print(L"2. Allocate Pool (%d bytes)\n", PoolSize);
-        Print(L"Select (1-2): ");
-                
-        Status = ShellPromptForResponse(ShellPromptResponseTypeFreeform, 
-                                       NULL, 
-                                       &AllocInput);
-        
-        if (EFI_ERROR(Status) || AllocInput == NULL) {
-          Print(L"Error getting allocation type input: %r\n", Status);
-          break;
-        }
-
-        AllocType = StrDecimalToUintn(AllocInput);
-        FreePool(AllocInput);
-        AllocInput = NULL;
-
-        //
-        // Free existing allocation before new allocation
-        //
-        if (CurrentAllocation != AllocationTypeNone) {
-          Print(L"Freeing existing allocation first...\n");
-          if (CurrentAllocation == AllocationTypePages) {
-            gBS->FreePages(AllocatedPages, Pages);
-          } else {
-            gBS->FreePool(AllocatedPool);
-          }
-          CurrentAllocation = AllocationTypeNone;
-        }
-
-        if (AllocType == 1) {
-          //
-          // Allocate Pages
-          //
-          Status = gBS->AllocatePages(AllocateAnyPages, 
-                                     EfiBootServicesData, 
-                                     Pages, 
-                                     &AllocatedPages);
-          if (!EFI_ERROR(Status)) {
-            CurrentAllocation = AllocationTypePages;
-            Print(L"Successfully allocated %d pages at 0x%lx\n", 
-                  Pages, AllocatedPages);
-          } else {
-            Print(L"Failed to allocate pages: %r\n", Status);
-          }
-        } else if (AllocType == 2) {
-          //
-          // Allocate Pool
-          //
-          Status = gBS->AllocatePool(EfiBootServicesData, 
-                                    PoolSize, 
-                                    &AllocatedPool);
-          if (!EFI_ERROR(Status)) {
-            CurrentAllocation = AllocationTypePool;
-            Print(L"Successfully allocated pool at 0x%lx\n", (UINTN)AllocatedPool);
-          } else {
-            Print(L"Failed to allocate pool: %r\n", Status);
-          }
-        } else {
-          Print(L"Invalid allocation type! Please enter 1 or 2.\n");
-        }
+        AllocateFromMenu();
         break;
 
       case 2: // Write Data to Memory
-        if (CurrentAllocation == AllocationTypeNone) {
-          Print(L"No memory allocated! Please allocate memory first.\n");
-        } else {
-          if (CurrentAllocation == AllocationTypePages) {
-            TargetBuffer = (VOID *)(UINTN)AllocatedPages;
-            BufferSize = Pages * EFI_PAGE_SIZE;
-          } else {
-            TargetBuffer = AllocatedPool;
-            BufferSize = PoolSize;
-          }
-          
-          //
-          // Write test pattern to memory
-          //
-          SetMem(TargetBuffer, BufferSize, 0xAB); // Fill with 0xAB pattern
-          
-          //
-          // Copy a string to demonstrate CopyMem
-          //
-          CopySize = StrSize(TestString);
-          if (CopySize > BufferSize) {
-            CopySize = BufferSize;
-          }
-          CopyMem(TargetBuffer, TestString, CopySize);
-          
-          Print(L"Successfully wrote data to allocated memory\n");
-          
-          //
-          // Display first few bytes
-          //
-          Print(L"First 32 bytes (hex): ");
-          for (i = 0; i < 32 && i < BufferSize; i++) {
-            Print(L"%02x ", ((UINT8 *)TargetBuffer)[i]);
-          }
-          Print(L"\n");
-        }
+        WriteToAllocation();
         break;
 
       case 3: // Free Memory
-        if (CurrentAllocation == AllocationTypeNone) {
-          Print(L"No memory allocated!\n");
-        } else {
-          if (CurrentAllocation == AllocationTypePages) {
-            Status = gBS->FreePages(AllocatedPages, Pages);
-            if (!EFI_ERROR(Status)) {
-              Print(L"Successfully freed pages\n");
-              CurrentAllocation = AllocationTypeNone;
-            } else {
-              Print(L"Failed to free pages: %r\n", Status);
-            }
-          } else {
-            Status = gBS->FreePool(AllocatedPool);
-            if (!EFI_ERROR(Status)) {
-              Print(L"Successfully freed pool\n");
-              CurrentAllocation = AllocationTypeNone;
-              AllocatedPool = NULL;
-            } else {
-              Print(L"Failed to free pool: %r\n", Status);
-            }
-          }
-        }
+        FreeFromMenu();
         break;
 
       case 4: // Dump Memory Map
-        MemoryMapSize = 0;
-        MemoryMap = NULL;
-        //
-        // First call to get required size
-        //
-        Status = gBS->GetMemoryMap(&MemoryMapSize, 
-                                  MemoryMap, 
-                                  &MapKey, 
-                                  &DescriptorSize, 
-                                  &DescriptorVersion);
-        
-        if (Status == EFI_BUFFER_TOO_SMALL) {
-          //
-          // Re-allocate buffer for memory map if the original one is too small
-          //
-          MemoryMapSize += 2 * DescriptorSize;
-          Status = gBS->AllocatePool(EfiBootServicesData, 
-                                    MemoryMapSize, 
-                                    (VOID **)&MemoryMap);
-          
-          if (!EFI_ERROR(Status)) {
-            //
-            // Get the actual memory map
-            //
-            Status = gBS->GetMemoryMap(&MemoryMapSize, 
-                                      MemoryMap, 
-                                      &MapKey, 
-                                      &DescriptorSize, 
-                                      &DescriptorVersion);
-            
-            if (!EFI_ERROR(Status)) {
-              TotalMemory = 0;
-              TotalPages = 0;
-              Desc = MemoryMap;
-              NumEntries = MemoryMapSize / DescriptorSize;
-              
-              Print(L"\nMemory Map (%d entries):\n", NumEntries);
-              Print(L"Type             Start        End          Attributes\n");
-              Print(L"--------------   ----------   ----------   --------\n");
-              
-              for (i = 0; i < NumEntries; i++) {
-
-                EFI_PHYSICAL_ADDRESS PhysicalEnd;
-                PhysicalEnd = Desc->PhysicalStart + (Desc->NumberOfPages * EFI_PAGE_SIZE) - 1;
-
-                //
-                // Convert memory type to string
-                //
-                switch (Desc->Type) {
-                  case EfiReservedMemoryType:       TypeStr = L"Reserved"; break;
-                  case EfiLoaderCode:               TypeStr = L"LoaderCode"; break;
-                  case EfiLoaderData:               TypeStr = L"LoaderData"; break;
-                  case EfiBootServicesCode:         TypeStr = L"BS Code"; break;
-                  case EfiBootServicesData:         TypeStr = L"BS Data"; break;
-                  case EfiRuntimeServicesCode:      TypeStr = L"RT Code"; break;
-                  case EfiRuntimeServicesData:      TypeStr = L"RT Data"; break;
-                  case EfiConventionalMemory:       TypeStr = L"Conventional"; break;
-                  case EfiUnusableMemory:           TypeStr = L"Unusable"; break;
-                  case EfiACPIReclaimMemory:        TypeStr = L"ACPI Reclaim"; break;
-                  case EfiACPIMemoryNVS:            TypeStr = L"ACPI NVS"; break;
-                  case EfiMemoryMappedIO:           TypeStr = L"MMIO"; break;
-                  case EfiMemoryMappedIOPortSpace:  TypeStr = L"MMIO Port"; break;
-                  case EfiPalCode:                  TypeStr = L"PAL Code"; break;
-                  default:                          TypeStr = L"Unknown"; break;
-                }
-                
-                Print(L"%-14s   0x%08x   0x%08x   %08lx\n", 
-                      TypeStr, 
-                      Desc->PhysicalStart,
-                      PhysicalEnd, 
-                      Desc->Attribute);
-                
-                TotalPages += Desc->NumberOfPages;
-                Desc = NEXT_MEMORY_DESCRIPTOR(Desc, DescriptorSize);
-              }
-              
-              TotalMemory = TotalPages * 4; // Convert pages to KB
-              Print(L"\nTotal Memory: %d KB (%d pages)\n", TotalMemory, TotalPages);
-
-            } else {
-              Print(L"Failed to get memory map on second call: %r\n", Status);
-            }
-            
-            gBS->FreePool(MemoryMap);
-          } else {
-            Print(L"Failed to allocate memory for memory map: %r\n", Status);
-          }
+        Status = MemoryMapSnapshotTake(&MemoryMap);
+        if (EFI_ERROR(Status)) {
+          Print(L"Failed to get memory map: %r\n", Status);
         } else {
-          Print(L"Failed to get memory map size: %r\n", Status);
+          TotalPages = 0;
+
+          Print(L"\nMemory Map (%d entries, sorted by address):\n", MemoryMap.Count);
+          Print(L"Type             Start              End                Attributes\n");
+          Print(L"--------------   ----------------   ----------------   ----------------\n");
+
+          for (i = 0; i < MemoryMap.Count; i++) {
+            Desc = MemoryMap.Entries[i];
+            Print(L"%-14s   %016lx   %016lx   %016lx\n",
+                  MemoryTypeName(Desc->Type),
+                  Desc->PhysicalStart,
+                  MEMORY_DESCRIPTOR_END(Desc) - 1,
+                  Desc->Attribute);
+            TotalPages += Desc->NumberOfPages;
+          }
+
+          Print(L"\nTotal Memory: %ld KB (%ld pages)\n", MultU64x32(TotalPages, 4), TotalPages);
         }
         Print(L"\nPress any key to continue...");
         ShellPromptForResponse(ShellPromptResponseTypeAnyKeyContinue, NULL, NULL);
         break;
 
-      case 5: // Exit
+      case 5: // Analyze Memory Map
+        AnalyzeMemoryMap(&MemoryMap);
+        break;
+
+      case 6: // Memory Map Diff
+        DiffMemoryMapAroundAction(&MemoryMap, &MemoryMapAfter);
+        break;
+
+      case 7: // Allocation Benchmark
+        Status = RunAllocationBenchmark();
+        if (EFI_ERROR(Status)) {
+          Print(L"Allocation benchmark failed: %r\n", Status);
+        }
+        break;
+
+      case 8: // Memory Test
+        Status = PromptForNumber(L"\nMB to test (0 = all free memory) [0]: ", 0, &Value);
+        if (EFI_ERROR(Status)) {
+          break;
+        }
+
+        Status = RunMemoryTest((UINTN)Value);
+        if (EFI_ERROR(Status)) {
+          Print(L"Memory test failed: %r\n", Status);
+        }
+        break;
+
+      case 9: // Page Table Inspector
+        InspectPageTables(&MemoryMap);
+        break;
+
+      case 10: // MTRR/PAT Cacheability Report
+        ShowCacheCoverage(&MemoryMap);
+        break;
+
+      case 11: // Exit
         //
         // Free memory before exiting if any is allocated
         //
-        if (CurrentAllocation != AllocationTypeNone) {
+        if (TrackedCount() != 0) {
           Print(L"Freeing allocated memory before exit...\n");
-          if (CurrentAllocation == AllocationTypePages) {
-            gBS->FreePages(AllocatedPages, Pages);
-          } else {
-            gBS->FreePool(AllocatedPool);
-          }
+          TrackedFreeAll();
         }
+        MemoryMapSnapshotFree(&MemoryMap);
+        MemoryMapSnapshotFree(&MemoryMapAfter);
         Print(L"Exiting UEFI Memory Utility...\n");
         return EFI_SUCCESS;
 
       default:
-        Print(L"Invalid option! Please select 1-5.\n");
+        Print(L"Invalid option! Please select 1-11.\n");
         break;
     }
     
@@ -0,0 +1,207 @@
+/** @file
+  UEFI Memory Utility - Header
+**/
+
+#ifndef __MEMORY_UTILITY_H__
+#define __MEMORY_UTILITY_H__
+
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+/* Extra descriptors allowed for when growing the map buffer */
+#define MEMORY_MAP_SLACK_DESCRIPTORS  8
+
+/* GetMemoryMap attempts before giving up on a map that keeps growing */
+#define MEMORY_MAP_MAX_ATTEMPTS       8
+
+/* Exclusive end address of a memory descriptor */
+#define MEMORY_DESCRIPTOR_END(Desc) \
+  ((Desc)->PhysicalStart + LShiftU64 ((Desc)->NumberOfPages, EFI_PAGE_SHIFT))
+
+/* Memory type encodings shared by the PAT and the MTRRs */
+#define CACHE_TYPE_UC                 0
+#define CACHE_TYPE_WC                 1
+#define CACHE_TYPE_WT                 4
+#define CACHE_TYPE_WP                 5
+#define CACHE_TYPE_WB                 6
+#define CACHE_TYPE_UC_MINUS           7     /* PAT only */
+
+/* Fixed-range MTRR MSRs, and the most variable ranges read */
+#define MTRR_FIXED_COUNT              11
+#define MTRR_MAX_VARIABLE             32
+
+/* MTRR and PAT registers as read by MtrrReadState() */
+typedef struct {
+  BOOLEAN  Supported;                     /* CPUID reports MTRRs */
+  BOOLEAN  Enabled;                       /* MTRR_DEF_TYPE.E */
+  BOOLEAN  FixedEnabled;                  /* fixed ranges present and enabled */
+  BOOLEAN  WcSupported;
+  UINT8    DefaultType;
+  UINT8    AddressBits;                   /* MAXPHYADDR */
+  UINT64   PhysMask;                      /* implemented address bits above 4 KB */
+  UINT64   Pat;                           /* IA32_PAT */
+  UINT64   Fixed[MTRR_FIXED_COUNT];       /* in address order */
+  UINTN    VariableCount;
+  struct {
+    UINT64  Base;                         /* PHYSBASE: address and type */
+    UINT64  Mask;                         /* PHYSMASK: mask and valid bit */
+  } Variable[MTRR_MAX_VARIABLE];
+} MTRR_STATE;
+
+/* One physical range of the memory map, as kept by the analyzer */
+typedef struct {
+  UINT32                Type;
+  EFI_PHYSICAL_ADDRESS  Start;
+  UINT64                Pages;
+} MEMORY_RANGE;
+
+/*
+  A copy of the UEFI memory map. The buffers are kept between snapshots
+  and only grow, so taking repeated snapshots does not allocate once the
+  map has reached its working size.
+*/
+typedef struct {
+  EFI_MEMORY_DESCRIPTOR  *Map;            /* raw map, in firmware order */
+  UINTN                  MapBufferSize;   /* bytes allocated for Map */
+  UINTN                  MapSize;         /* bytes of Map in use */
+  UINTN                  MapKey;
+  UINTN                  DescriptorSize;
+  UINT32                 DescriptorVersion;
+  EFI_MEMORY_DESCRIPTOR  **Entries;       /* Count descriptors sorted by PhysicalStart */
+  UINTN                  EntryCapacity;
+  UINTN                  Count;
+} MEMORY_MAP_SNAPSHOT;
+
+/* Live allocations the menu can hold at once */
+#define MAX_TRACKED_ALLOCATIONS       64
+
+typedef enum {
+  AllocationKindPages,
+  AllocationKindPool
+} ALLOCATION_KIND;
+
+/* One allocation made from the menu, and the request that made it */
+typedef struct {
+  ALLOCATION_KIND       Kind;
+  EFI_ALLOCATE_TYPE     Type;           /* pages only */
+  EFI_MEMORY_TYPE       MemoryType;
+  EFI_PHYSICAL_ADDRESS  Address;        /* buffer; in: target or limit */
+  UINT64                Size;           /* bytes; whole pages for pages */
+  UINT64                Alignment;      /* pages only; 0 for pool */
+} TRACKED_ALLOCATION;
+
+/* Memory map snapshots (MemoryMap.c) */
+VOID
+MemoryMapSnapshotInit (
+  OUT MEMORY_MAP_SNAPSHOT  *Snapshot
+  );
+
+EFI_STATUS
+MemoryMapSnapshotTake (
+  IN OUT MEMORY_MAP_SNAPSHOT  *Snapshot
+  );
+
+VOID
+MemoryMapSnapshotFree (
+  IN OUT MEMORY_MAP_SNAPSHOT  *Snapshot
+  );
+
+CONST CHAR16 *
+MemoryTypeName (
+  IN UINT32  Type
+  );
+
+BOOLEAN
+MemoryTypeIsRam (
+  IN UINT32  Type
+  );
+
+VOID
+PrintPagesSize (
+  IN UINT64  Pages
+  );
+
+/* Allocation table (MemoryAlloc.c) */
+EFI_STATUS
+TrackedAllocate (
+  IN OUT TRACKED_ALLOCATION  *Request,
+  OUT    UINTN               *Index
+  );
+
+TRACKED_ALLOCATION *
+TrackedGet (
+  IN UINTN  Index
+  );
+
+EFI_STATUS
+TrackedFree (
+  IN UINTN  Index
+  );
+
+UINTN
+TrackedFreeAll (
+  VOID
+  );
+
+UINTN
+TrackedCount (
+  VOID
+  );
+
+VOID
+TrackedPrint (
+  VOID
+  );
+
+/* Allocation micro-benchmark (MemoryBench.c) */
+EFI_STATUS
+RunAllocationBenchmark (
+  VOID
+  );
+
+/* Page table walk over the memory map (PageTable.c) */
+CONST CHAR16 *
+CacheTypeName (
+  IN UINT8  Type
+  );
+
+EFI_STATUS
+InspectPageTables (
+  IN OUT MEMORY_MAP_SNAPSHOT  *Snapshot
+  );
+
+/* MTRR/PAT decoding and cacheability report (Mtrr.c) */
+EFI_STATUS
+MtrrReadState (
+  OUT MTRR_STATE  *State
+  );
+
+UINT8
+MtrrLookup (
+  IN  MTRR_STATE  *State,
+  IN  UINT64      Address,
+  OUT UINT64      *Next
+  );
+
+UINT8
+EffectiveCacheType (
+  IN UINT8  MtrrType,
+  IN UINT8  PatType
+  );
+
+EFI_STATUS
+ShowCacheCoverage (
+  IN OUT MEMORY_MAP_SNAPSHOT  *Snapshot
+  );
+
+/* Parallel memory test over free memory (MemoryTest.c); LimitMB 0 = all */
+EFI_STATUS
+RunMemoryTest (
+  IN UINTN  LimitMB
+  );
+
+#endif /* __MEMORY_UTILITY_H__ */
@@ -0,0 +1,424 @@
+/** @file
+  MTRR and PAT decoder for the UEFI Memory Utility.
+
+  Reads the fixed and variable range MTRRs and IA32_PAT, works out the
+  memory type each memory map range ends up with, and flags DRAM that is
+  not write-back and MMIO that is not UC or WC. A stray UC variable MTRR
+  over RAM is a silent, large slowdown for everything that runs there.
+**/
+
+#include "MemoryUtility.h"
+
+#define MSR_IA32_MTRRCAP           0xFE
+#define MSR_IA32_MTRR_DEF_TYPE     0x2FF
+#define MSR_IA32_MTRR_PHYSBASE0    0x200
+#define MSR_IA32_MTRR_PHYSMASK0    0x201
+#define MSR_IA32_PAT               0x277
+
+#define MTRRCAP_VCNT_MASK          0xFF
+#define MTRRCAP_FIX                BIT8
+#define MTRRCAP_WC                 BIT10
+#define MTRR_DEF_TYPE_FE           BIT10
+#define MTRR_DEF_TYPE_E            BIT11
+#define MTRR_PHYSMASK_VALID        BIT11
+
+#define CPUID_VERSION_INFO_EDX_MTRR  BIT12
+
+/**
+  One group of fixed-range MTRRs: MSR, first address, sub-range size
+**/
+typedef struct {
+  UINT32  Msr;
+  UINT32  Base;
+  UINT32  Size;
+} FIXED_MTRR;
+
+STATIC CONST FIXED_MTRR  mFixedMtrrs[MTRR_FIXED_COUNT] = {
+  { 0x250, 0x00000, SIZE_64KB },
+  { 0x258, 0x80000, SIZE_16KB },
+  { 0x259, 0xA0000, SIZE_16KB },
+  { 0x268, 0xC0000, SIZE_4KB  },
+  { 0x269, 0xC8000, SIZE_4KB  },
+  { 0x26A, 0xD0000, SIZE_4KB  },
+  { 0x26B, 0xD8000, SIZE_4KB  },
+  { 0x26C, 0xE0000, SIZE_4KB  },
+  { 0x26D, 0xE8000, SIZE_4KB  },
+  { 0x26E, 0xF0000, SIZE_4KB  },
+  { 0x26F, 0xF8000, SIZE_4KB  }
+};
+
+/*
+  Effective memory type of a page from its MTRR type (row) and PAT type
+  (column), per the Intel SDM table for processors with PAT. Columns are
+  indexed by the 3-bit encoding; 2 and 3 are reserved and read as UC.
+*/
+STATIC CONST UINT8  mEffectiveType[8][8] = {
+  /*         UC  WC  --  --  WT  WP  WB  UC-      PAT */
+  /* UC */ { 0,  1,  0,  0,  0,  0,  0,  0 },
+  /* WC */ { 0,  1,  0,  0,  0,  0,  1,  1 },
+  /* -- */ { 0,  0,  0,  0,  0,  0,  0,  0 },
+  /* -- */ { 0,  0,  0,  0,  0,  0,  0,  0 },
+  /* WT */ { 0,  1,  0,  0,  4,  5,  4,  0 },
+  /* WP */ { 0,  1,  0,  0,  4,  5,  5,  1 },
+  /* WB */ { 0,  1,  0,  0,  4,  5,  6,  0 },
+  /* -- */ { 0,  0,  0,  0,  0,  0,  0,  0 }
+};
+
+/**
+  Read MTRRCAP, MTRR_DEF_TYPE, every fixed and variable MTRR and the PAT.
+
+  @param[out]  State  Register snapshot.
+
+  @retval EFI_SUCCESS      State is filled in.
+  @retval EFI_UNSUPPORTED  The processor has no MTRRs; only Pat is valid.
+**/
+EFI_STATUS
+MtrrReadState (
+  OUT MTRR_STATE *State
+  )
+{
+  UINT64 Capabilities;
+  UINT64 DefType;
+  UINT32 Edx;
+  UINT32 Eax;
+  UINTN  i;
+
+  ZeroMem(State, sizeof(*State));
+  State->Pat = AsmReadMsr64(MSR_IA32_PAT);
+
+  AsmCpuid(1, NULL, NULL, NULL, &Edx);
+  if ((Edx & CPUID_VERSION_INFO_EDX_MTRR) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+  State->Supported = TRUE;
+
+  //
+  // Variable range masks only cover the implemented physical address bits
+  //
+  AsmCpuid(0x80000000, &Eax, NULL, NULL, NULL);
+  if (Eax >= 0x80000008) {
+    AsmCpuid(0x80000008, &Eax, NULL, NULL, NULL);
+    State->AddressBits = (UINT8)(Eax & 0xFF);
+  } else {
+    State->AddressBits = 36;
+  }
+  State->PhysMask = (LShiftU64(1, State->AddressBits) - 1) & ~(UINT64)EFI_PAGE_MASK;
+
+  Capabilities         = AsmReadMsr64(MSR_IA32_MTRRCAP);
+  DefType              = AsmReadMsr64(MSR_IA32_MTRR_DEF_TYPE);
+  State->WcSupported   = (BOOLEAN)((Capabilities & MTRRCAP_WC) != 0);
+  State->Enabled       = (BOOLEAN)((DefType & MTRR_DEF_TYPE_E) != 0);
+  State->FixedEnabled  = (BOOLEAN)((Capabilities & MTRRCAP_FIX) != 0 && (DefType & MTRR_DEF_TYPE_FE) != 0);
+  State->DefaultType   = (UINT8)(DefType & 0xFF);
+  State->VariableCount = MIN((UINTN)(Capabilities & MTRRCAP_VCNT_MASK), MTRR_MAX_VARIABLE);
+
+  if ((Capabilities & MTRRCAP_FIX) != 0) {
+    for (i = 0; i < MTRR_FIXED_COUNT; i++) {
+      State->Fixed[i] = AsmReadMsr64(mFixedMtrrs[i].Msr);
+    }
+  }
+  for (i = 0; i < State->VariableCount; i++) {
+    State->Variable[i].Base = AsmReadMsr64(MSR_IA32_MTRR_PHYSBASE0 + (UINT32)i * 2);
+    State->Variable[i].Mask = AsmReadMsr64(MSR_IA32_MTRR_PHYSMASK0 + (UINT32)i * 2);
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Start and size of a valid variable MTRR, assuming a contiguous mask.
+
+  @retval FALSE  The MTRR is not enabled.
+**/
+STATIC
+BOOLEAN
+MtrrVariableRange (
+  IN  MTRR_STATE  *State,
+  IN  UINTN       Index,
+  OUT UINT64      *Base,
+  OUT UINT64      *Size
+  )
+{
+  UINT64 Mask;
+
+  if ((State->Variable[Index].Mask & MTRR_PHYSMASK_VALID) == 0) {
+    return FALSE;
+  }
+  Mask  = State->Variable[Index].Mask & State->PhysMask;
+  *Base = State->Variable[Index].Base & State->PhysMask;
+  *Size = (~Mask & State->PhysMask) + EFI_PAGE_SIZE;
+  return TRUE;
+}
+
+/**
+  MTRR memory type at Address, and where the next MTRR boundary above it
+  lies, so a caller can step through a range one uniform chunk at a time.
+
+  Overlapping variable ranges resolve as the SDM specifies: UC wins, WT
+  beats WB, other combinations are undefined and the first match is used.
+  Without MTRR support the answer is WB (the PAT alone decides); with the
+  MTRRs disabled it is UC.
+
+  @param[in]   State    Register snapshot from MtrrReadState().
+  @param[in]   Address  Physical address.
+  @param[out]  Next     First address above Address whose type may differ.
+
+  @return  CACHE_TYPE_xx.
+**/
+UINT8
+MtrrLookup (
+  IN  MTRR_STATE  *State,
+  IN  UINT64      Address,
+  OUT UINT64      *Next
+  )
+{
+  CONST FIXED_MTRR *Fixed;
+  UINT64           Base;
+  UINT64           Size;
+  UINT64           Mask;
+  UINT8            Type;
+  UINT8            Match;
+  BOOLEAN          Matched;
+  UINTN            Sub;
+  UINTN            i;
+
+  *Next = MAX_UINT64;
+  if (!State->Supported) {
+    return CACHE_TYPE_WB;
+  }
+  if (!State->Enabled) {
+    return CACHE_TYPE_UC;
+  }
+
+  if (State->FixedEnabled && Address < BASE_1MB) {
+    for (i = MTRR_FIXED_COUNT - 1; mFixedMtrrs[i].Base > Address; i--) {
+    }
+    Fixed = &mFixedMtrrs[i];
+    Sub   = ((UINTN)Address - Fixed->Base) / Fixed->Size;
+    *Next = Fixed->Base + (Sub + 1) * Fixed->Size;
+    return (UINT8)(RShiftU64(State->Fixed[i], Sub * 8) & 0xFF);
+  }
+
+  Matched = FALSE;
+  Type    = State->DefaultType;
+  for (i = 0; i < State->VariableCount; i++) {
+    if (!MtrrVariableRange(State, i, &Base, &Size)) {
+      continue;
+    }
+    Mask = State->Variable[i].Mask & State->PhysMask;
+    if ((Address & Mask) == (Base & Mask)) {
+      Match = (UINT8)(State->Variable[i].Base & 0xFF);
+      if (!Matched) {
+        Type = Match;
+      } else if (Match == CACHE_TYPE_UC || Type == CACHE_TYPE_UC) {
+        Type = CACHE_TYPE_UC;
+      } else if ((Match == CACHE_TYPE_WT && Type == CACHE_TYPE_WB) ||
+                 (Match == CACHE_TYPE_WB && Type == CACHE_TYPE_WT)) {
+        Type = CACHE_TYPE_WT;
+      }
+      Matched = TRUE;
+      if (Base + Size > Address) {
+        *Next = MIN(*Next, Base + Size);
+      }
+    } else if (Base > Address) {
+      *Next = MIN(*Next, Base);
+    }
+  }
+  return Type;
+}
+
+/**
+  Memory type of a page given its MTRR and PAT types.
+**/
+UINT8
+EffectiveCacheType (
+  IN UINT8 MtrrType,
+  IN UINT8 PatType
+  )
+{
+  return mEffectiveType[MtrrType & 7][PatType & 7];
+}
+
+/**
+  Print the fixed-range MTRRs, merging neighbouring sub-ranges of one type.
+**/
+STATIC
+VOID
+PrintFixedMtrrs (
+  IN MTRR_STATE *State
+  )
+{
+  UINT64 Address;
+  UINT64 Start;
+  UINT64 Next;
+  UINT8  Type;
+  UINT8  RunType;
+
+  Print(L"Fixed ranges:");
+  Start   = 0;
+  RunType = MtrrLookup(State, 0, &Next);
+  for (Address = Next; Address < BASE_1MB; Address = Next) {
+    Type = MtrrLookup(State, Address, &Next);
+    if (Type != RunType) {
+      Print(L" %05lx-%05lx %s", Start, Address - 1, CacheTypeName(RunType));
+      Start   = Address;
+      RunType = Type;
+    }
+  }
+  Print(L" %05lx-%05lx %s\n", Start, (UINT64)BASE_1MB - 1, CacheTypeName(RunType));
+}
+
+/**
+  Decode the MTRRs and the PAT, then print the effective memory type of
+  every memory map range for pages mapped with PAT entry 0 (PWT, PCD and
+  PAT clear, as firmware maps memory unless told otherwise). The page
+  table inspector shows the per-page PAT choice.
+
+  Flags:
+    NotWB   RAM that is not write-back
+    Cached  MMIO that is neither UC nor WC
+
+  @param[in, out]  Snapshot  Snapshot buffer to capture the map into.
+
+  @retval EFI_SUCCESS      The report was printed.
+  @retval EFI_UNSUPPORTED  The processor has no MTRRs.
+  @retval Other            The memory map could not be read.
+**/
+EFI_STATUS
+ShowCacheCoverage (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  EFI_STATUS            Status;
+  MTRR_STATE            State;
+  EFI_MEMORY_DESCRIPTOR *Desc;
+  UINT64                ByType[8];
+  UINT64                RamByType[8];
+  UINT64                Address;
+  UINT64                End;
+  UINT64                Next;
+  UINT64                Base;
+  UINT64                Size;
+  UINT8                 Pat0;
+  UINT8                 Type;
+  UINTN                 Used;
+  UINTN                 Flagged;
+  UINTN                 i;
+  UINTN                 t;
+  BOOLEAN               Ram;
+  BOOLEAN               Mmio;
+  BOOLEAN               Bad;
+
+  Status = MtrrReadState(&State);
+  if (EFI_ERROR(Status)) {
+    Print(L"This processor has no MTRRs\n");
+    return Status;
+  }
+
+  Used = 0;
+  for (i = 0; i < State.VariableCount; i++) {
+    if (MtrrVariableRange(&State, i, &Base, &Size)) {
+      Used++;
+    }
+  }
+
+  Print(L"\nMTRRs %s, default %s, fixed ranges %s, %d of %d variable ranges used, WC %s, %d address bits\n",
+        State.Enabled ? L"enabled" : L"DISABLED (all UC)",
+        CacheTypeName(State.DefaultType),
+        State.FixedEnabled ? L"enabled" : L"disabled",
+        Used, State.VariableCount,
+        State.WcSupported ? L"supported" : L"not supported",
+        State.AddressBits);
+
+  if (State.FixedEnabled) {
+    PrintFixedMtrrs(&State);
+  }
+
+  if (Used != 0) {
+    Print(L"\n #  Base              End               Size        Type\n");
+    for (i = 0; i < State.VariableCount; i++) {
+      if (!MtrrVariableRange(&State, i, &Base, &Size)) {
+        continue;
+      }
+      Print(L"%2d  %016lx  %016lx  ", i, Base, Base + Size - 1);
+      PrintPagesSize(RShiftU64(Size, EFI_PAGE_SHIFT));
+      Print(L"  %s%s\n",
+            CacheTypeName((UINT8)(State.Variable[i].Base & 0xFF)),
+            ((Size & (Size - 1)) != 0 || (Base & (Size - 1)) != 0) ? L"  (non-contiguous mask)" : L"");
+    }
+  }
+
+  Print(L"\nPAT:");
+  for (i = 0; i < 8; i++) {
+    Print(L" %d=%s", i, CacheTypeName((UINT8)(RShiftU64(State.Pat, i * 8) & 0x7)));
+  }
+  Print(L"\n");
+
+  Status = MemoryMapSnapshotTake(Snapshot);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    return Status;
+  }
+
+  Pat0 = (UINT8)(State.Pat & 0x7);
+  ZeroMem(RamByType, sizeof(RamByType));
+  Flagged = 0;
+
+  Print(L"\nEffective type for PAT entry 0 (%s) pages:\n", CacheTypeName(Pat0));
+  Print(L"Type           Start             Size        Effective type        Flags\n");
+  Print(L"-------------  ----------------  ----------  --------------------  ------\n");
+
+  for (i = 0; i < Snapshot->Count; i++) {
+    Desc = Snapshot->Entries[i];
+    End  = MEMORY_DESCRIPTOR_END(Desc);
+    ZeroMem(ByType, sizeof(ByType));
+
+    for (Address = Desc->PhysicalStart; Address < End; Address = Next) {
+      Type = EffectiveCacheType(MtrrLookup(&State, Address, &Next), Pat0);
+      if (Next <= Address) {
+        Next = End;
+      }
+      ByType[Type] += MIN(Next, End) - Address;
+    }
+
+    Ram  = MemoryTypeIsRam(Desc->Type);
+    Mmio = (BOOLEAN)(Desc->Type == EfiMemoryMappedIO || Desc->Type == EfiMemoryMappedIOPortSpace);
+    Bad  = FALSE;
+
+    Print(L"%-13s  %016lx  ", MemoryTypeName(Desc->Type), Desc->PhysicalStart);
+    PrintPagesSize(Desc->NumberOfPages);
+    Print(L"  ");
+    Size = End - Desc->PhysicalStart;
+    for (t = 0; t < 8; t++) {
+      if (ByType[t] == 0) {
+        continue;
+      }
+      if (ByType[t] == Size) {
+        Print(L"%-20s", CacheTypeName((UINT8)t));
+      } else {
+        Print(L"%s %ld%% ", CacheTypeName((UINT8)t),
+              DivU64x64Remainder(MultU64x32(ByType[t], 100), Size, NULL));
+      }
+      if (Ram) {
+        RamByType[t] += ByType[t];
+      }
+      if ((Ram && t != CACHE_TYPE_WB) ||
+          (Mmio && t != CACHE_TYPE_UC && t != CACHE_TYPE_WC)) {
+        Bad = TRUE;
+      }
+    }
+    if (Bad) {
+      Flagged++;
+      Print(Ram ? L"  NotWB" : L"  Cached");
+    }
+    Print(L"\n");
+  }
+
+  Print(L"\nRAM by effective type:");
+  for (t = 0; t < 8; t++) {
+    if (RamByType[t] != 0) {
+      Print(L" %s %ld MB", CacheTypeName((UINT8)t), RShiftU64(RamByType[t], 20));
+    }
+  }
+  Print(L"\n%d range(s) flagged\n", Flagged);
+  return EFI_SUCCESS;
+}
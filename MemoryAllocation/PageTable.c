@@ -0,0 +1,485 @@
+/** @file
+  Page table inspector for the UEFI Memory Utility.
+
+  Walks the active CR3 hierarchy (4- or 5-level, X64 builds only) over
+  every memory map range and reports how the range is mapped: page size,
+  present/read-only/no-execute coverage and the effective cacheability
+  of its pages (the PAT entry a page selects, combined with the MTRRs).
+  Protections are checked against the EFI_MEMORY_ATTRIBUTES_TABLE, when
+  the firmware publishes one; the XP/RO/RP bits of a memory map descriptor
+  only say what the range is capable of and are shown for reference. UEFI
+  runs identity mapped, so every page table is read at its physical
+  address.
+**/
+
+#include "MemoryUtility.h"
+#include <Guid/MemoryAttributesTable.h>
+
+#define MSR_IA32_EFER       0xC0000080
+#define IA32_EFER_NXE       BIT11
+#define IA32_CR4_LA57       BIT12
+#define IA32_CR0_WP         BIT16
+
+#define PTE_PRESENT         BIT0
+#define PTE_WRITABLE        BIT1
+#define PTE_PWT             BIT3
+#define PTE_PCD             BIT4
+#define PTE_PS              BIT7      /* large page in PDPTE/PDE */
+#define PTE_PAT_4K          BIT7      /* PAT bit of a 4 KB PTE */
+#define PTE_PAT_LARGE       BIT12     /* PAT bit of a 2 MB/1 GB entry */
+#define PTE_NX              BIT63
+#define PTE_ADDRESS_MASK    0x000FFFFFFFFFF000ULL
+
+/* Cacheability breakdown slots, one per 3-bit PAT/MTRR encoding */
+#define CACHE_TYPE_SLOTS    8
+
+/**
+  How one address is mapped
+**/
+typedef struct {
+  BOOLEAN  Present;
+  UINT64   Size;          /* bytes covered by the leaf (or missing) entry */
+  BOOLEAN  Writable;
+  BOOLEAN  Executable;
+  UINT8    CacheType;     /* CACHE_xx, from the PAT entry the page selects */
+} PAGE_MAPPING;
+
+/**
+  Mapping summary of one memory map range, in bytes
+**/
+typedef struct {
+  UINT64  Bytes4K;
+  UINT64  Bytes2M;
+  UINT64  Bytes1G;
+  UINT64  Splittable4K;   /* 4 KB-mapped bytes in a 2 MB window inside the range */
+  UINT64  NotPresent;
+  UINT64  ReadOnly;
+  UINT64  NoExecute;
+  UINT64  ByCacheType[CACHE_TYPE_SLOTS];
+} PAGE_RANGE_STATS;
+
+/**
+  Paging state shared by the walk
+**/
+typedef struct {
+  UINT64      Root;          /* CR3 table address */
+  UINTN       Levels;        /* 4 or 5 */
+  BOOLEAN     NxEnabled;
+  BOOLEAN     WriteProtect;  /* CR0.WP: RO pages also bind supervisor code */
+  UINT64      Pat;
+  MTRR_STATE  Mtrr;
+} PAGING_STATE;
+
+/**
+  Short name of a PAT/MTRR memory type encoding.
+**/
+CONST CHAR16 *
+CacheTypeName (
+  IN UINT8 Type
+  )
+{
+  switch (Type) {
+    case CACHE_TYPE_UC:        return L"UC";
+    case CACHE_TYPE_WC:        return L"WC";
+    case CACHE_TYPE_WT:        return L"WT";
+    case CACHE_TYPE_WP:        return L"WP";
+    case CACHE_TYPE_WB:        return L"WB";
+    case CACHE_TYPE_UC_MINUS:  return L"UC-";
+    default:                   return L"??";
+  }
+}
+
+#if defined (MDE_CPU_X64)
+
+/**
+  Translate Address through the page tables.
+
+  A missing entry reports the size of the region it would have covered,
+  so the caller can skip all of it in one step.
+**/
+STATIC
+VOID
+PageTableLookup (
+  IN  PAGING_STATE  *Paging,
+  IN  UINT64        Address,
+  OUT PAGE_MAPPING  *Mapping
+  )
+{
+  UINT64 *Table;
+  UINT64 Entry;
+  UINTN  Level;
+  UINTN  Shift;
+  UINTN  PatIndex;
+
+  Mapping->Present    = FALSE;
+  Mapping->Writable   = TRUE;
+  Mapping->Executable = TRUE;
+  Mapping->CacheType  = CACHE_TYPE_UC;
+
+  Table = (UINT64 *)(UINTN)(Paging->Root & PTE_ADDRESS_MASK);
+  Entry = 0;
+  for (Level = Paging->Levels; Level > 0; Level--) {
+    Shift         = 12 + 9 * (Level - 1);
+    Mapping->Size = LShiftU64(1, Shift);
+    Entry         = Table[RShiftU64(Address, Shift) & 0x1FF];
+
+    if ((Entry & PTE_PRESENT) == 0) {
+      return;
+    }
+    if ((Entry & PTE_WRITABLE) == 0) {
+      Mapping->Writable = FALSE;
+    }
+    if (Paging->NxEnabled && (Entry & PTE_NX) != 0) {
+      Mapping->Executable = FALSE;
+    }
+    if (Level == 1 || ((Level == 2 || Level == 3) && (Entry & PTE_PS) != 0)) {
+      break;
+    }
+    Table = (UINT64 *)(UINTN)(Entry & PTE_ADDRESS_MASK);
+  }
+
+  Mapping->Present = TRUE;
+
+  //
+  // PAT index = PAT:PCD:PWT of the leaf; the PAT bit moves for large pages
+  //
+  PatIndex = (UINTN)(Entry & (PTE_PWT | PTE_PCD)) >> 3;
+  if ((Level == 1 && (Entry & PTE_PAT_4K) != 0) || (Level > 1 && (Entry & PTE_PAT_LARGE) != 0)) {
+    PatIndex |= 4;
+  }
+  Mapping->CacheType = (UINT8)(RShiftU64(Paging->Pat, PatIndex * 8) & 0x7);
+}
+
+/**
+  Read CR0/CR3/CR4, EFER, the PAT and the MTRRs.
+
+  @retval EFI_SUCCESS      Paging is on and the layout is understood.
+  @retval EFI_UNSUPPORTED  Paging is off.
+**/
+STATIC
+EFI_STATUS
+ReadPagingState (
+  OUT PAGING_STATE *Paging
+  )
+{
+  if ((AsmReadCr0() & BIT31) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+  Paging->Root         = AsmReadCr3();
+  Paging->Levels       = ((AsmReadCr4() & IA32_CR4_LA57) != 0) ? 5 : 4;
+  Paging->NxEnabled    = (BOOLEAN)((AsmReadMsr64(MSR_IA32_EFER) & IA32_EFER_NXE) != 0);
+  Paging->WriteProtect = (BOOLEAN)((AsmReadCr0() & IA32_CR0_WP) != 0);
+  MtrrReadState(&Paging->Mtrr);
+  Paging->Pat          = Paging->Mtrr.Pat;
+  return EFI_SUCCESS;
+}
+
+/**
+  Walk [Start, End) and sum up how it is mapped. A large page can span
+  several MTRR ranges, so its effective type is summed per MTRR chunk.
+**/
+STATIC
+VOID
+WalkRange (
+  IN  PAGING_STATE      *Paging,
+  IN  UINT64            Start,
+  IN  UINT64            End,
+  OUT PAGE_RANGE_STATS  *Stats
+  )
+{
+  PAGE_MAPPING Mapping;
+  UINT64       Address;
+  UINT64       Next;
+  UINT64       Chunk;
+  UINT64       Window;
+  UINT64       Sub;
+  UINT64       SubNext;
+  UINT8        MtrrType;
+
+  ZeroMem(Stats, sizeof(*Stats));
+
+  for (Address = Start; Address < End; Address = Next) {
+    PageTableLookup(Paging, Address, &Mapping);
+    Next = (Address & ~(Mapping.Size - 1)) + Mapping.Size;
+    if (Next <= Address) {
+      break;
+    }
+    Chunk = MIN(Next, End) - Address;
+
+    if (!Mapping.Present) {
+      Stats->NotPresent += Chunk;
+      continue;
+    }
+
+    if (Mapping.Size == SIZE_1GB) {
+      Stats->Bytes1G += Chunk;
+    } else if (Mapping.Size == SIZE_2MB) {
+      Stats->Bytes2M += Chunk;
+    } else {
+      Stats->Bytes4K += Chunk;
+      Window = Address & ~((UINT64)SIZE_2MB - 1);
+      if (Window >= Start && Window + SIZE_2MB <= End) {
+        Stats->Splittable4K += Chunk;
+      }
+    }
+    if (!Mapping.Writable) {
+      Stats->ReadOnly += Chunk;
+    }
+    if (!Mapping.Executable) {
+      Stats->NoExecute += Chunk;
+    }
+    for (Sub = Address; Sub < MIN(Next, End); Sub = SubNext) {
+      MtrrType = MtrrLookup(&Paging->Mtrr, Sub, &SubNext);
+      if (SubNext <= Sub || SubNext > MIN(Next, End)) {
+        SubNext = MIN(Next, End);
+      }
+      Stats->ByCacheType[EffectiveCacheType(MtrrType, Mapping.CacheType)] += SubNext - Sub;
+    }
+  }
+}
+
+/**
+  Print Part as a whole percentage of Total, 4 columns wide.
+**/
+STATIC
+VOID
+PrintPercent (
+  IN UINT64 Part,
+  IN UINT64 Total
+  )
+{
+  if (Part == 0) {
+    Print(L"   -");
+  } else {
+    Print(L"%3ld%%", DivU64x64Remainder(MultU64x32(Part, 100) + Total - 1, Total, NULL));
+  }
+}
+
+/**
+  Check the page tables against the protections the firmware publishes in
+  the EFI_MEMORY_ATTRIBUTES_TABLE and print every entry they disagree with.
+
+  Flags:
+    XP     table says EFI_MEMORY_XP, but pages are executable
+    RO     table says EFI_MEMORY_RO, but pages are writable
+    RP     table says EFI_MEMORY_RP, but pages are present
+
+  @return  Number of entries flagged.
+**/
+STATIC
+UINTN
+CheckPublishedProtections (
+  IN PAGING_STATE *Paging
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_MEMORY_ATTRIBUTES_TABLE *Table;
+  EFI_MEMORY_DESCRIPTOR       *Entry;
+  PAGE_RANGE_STATS            Stats;
+  UINT64                      Mapped;
+  UINTN                       Flagged;
+  UINTN                       i;
+  BOOLEAN                     Xp;
+  BOOLEAN                     Ro;
+  BOOLEAN                     Rp;
+
+  Status = EfiGetSystemConfigurationTable(&gEfiMemoryAttributesTableGuid, (VOID **)&Table);
+  if (EFI_ERROR(Status) || Table == NULL) {
+    Print(L"\nNo EFI_MEMORY_ATTRIBUTES_TABLE: the Cap column lists what each range\n");
+    Print(L"can support, not what the firmware applied; protections were not checked\n");
+    return 0;
+  }
+
+  Print(L"\nEFI_MEMORY_ATTRIBUTES_TABLE: %d entries\n", Table->NumberOfEntries);
+
+  Flagged = 0;
+  Entry   = (EFI_MEMORY_DESCRIPTOR *)(Table + 1);
+  for (i = 0; i < Table->NumberOfEntries; i++) {
+    WalkRange(Paging, Entry->PhysicalStart, MEMORY_DESCRIPTOR_END(Entry), &Stats);
+    Mapped = EFI_PAGES_TO_SIZE(Entry->NumberOfPages) - Stats.NotPresent;
+
+    Xp = (BOOLEAN)((Entry->Attribute & EFI_MEMORY_XP) != 0 && Stats.NoExecute != Mapped);
+    Ro = (BOOLEAN)((Entry->Attribute & EFI_MEMORY_RO) != 0 && Stats.ReadOnly != Mapped);
+    Rp = (BOOLEAN)((Entry->Attribute & EFI_MEMORY_RP) != 0 && Mapped != 0);
+
+    if (Xp || Ro || Rp) {
+      Print(L"  %-13s  %016lx  ", MemoryTypeName(Entry->Type), Entry->PhysicalStart);
+      PrintPagesSize(Entry->NumberOfPages);
+      Print(L"  %s%s%s\n", Xp ? L"XP " : L"", Ro ? L"RO " : L"", Rp ? L"RP" : L"");
+      Flagged++;
+    }
+
+    Entry = NEXT_MEMORY_DESCRIPTOR(Entry, Table->DescriptorSize);
+  }
+
+  return Flagged;
+}
+
+/**
+  Walk the page tables over every memory map range and print, per range,
+  the page-size mix, protection and effective cacheability, flagging ranges
+  whose mapping wastes TLB reach or leaves RAM badly mapped. Protections
+  are then checked against the EFI_MEMORY_ATTRIBUTES_TABLE.
+
+  The Cap column shows the XP/RO/RP bits of the memory map descriptor.
+  Those are capabilities of the range, not protections the firmware has
+  applied, so they are not compared with the page tables.
+
+  Flags:
+    4K     4 KB pages where a whole 2 MB page would have fit
+    NM     RAM that is not mapped at all
+    NotWB  RAM whose pages are not write-back after PAT and MTRRs
+    XP     attributes table says EFI_MEMORY_XP, but pages are executable
+    RO     attributes table says EFI_MEMORY_RO, but pages are writable
+    RP     attributes table says EFI_MEMORY_RP, but pages are present
+
+  @param[in, out]  Snapshot  Snapshot buffer to capture the map into.
+
+  @retval EFI_SUCCESS      The report was printed.
+  @retval EFI_UNSUPPORTED  Paging is disabled.
+  @retval Other            The memory map could not be read.
+**/
+EFI_STATUS
+InspectPageTables (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  EFI_STATUS            Status;
+  PAGING_STATE          Paging;
+  PAGE_RANGE_STATS      Stats;
+  PAGE_RANGE_STATS      RamTotal;
+  EFI_MEMORY_DESCRIPTOR *Desc;
+  UINT64                Start;
+  UINT64                End;
+  UINT64                Total;
+  UINT64                Mapped;
+  UINTN                 Flagged;
+  UINTN                 Type;
+  UINTN                 Dominant;
+  UINTN                 i;
+  BOOLEAN               Ram;
+
+  Status = ReadPagingState(&Paging);
+  if (EFI_ERROR(Status)) {
+    Print(L"Paging is disabled\n");
+    return Status;
+  }
+
+  Status = MemoryMapSnapshotTake(Snapshot);
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to get memory map: %r\n", Status);
+    return Status;
+  }
+
+  Print(L"\nCR3 %016lx, %d-level paging, NX %s, CR0.WP %s, PAT %016lx\n",
+        Paging.Root, Paging.Levels,
+        Paging.NxEnabled ? L"on" : L"off",
+        Paging.WriteProtect ? L"on" : L"off",
+        Paging.Pat);
+  Print(L"PAT entries:");
+  for (i = 0; i < 8; i++) {
+    Print(L" %d=%s", i, CacheTypeName((UINT8)(RShiftU64(Paging.Pat, i * 8) & 0x7)));
+  }
+  Print(L"\n\n");
+
+  Print(L"Type           Start             Size         4K   2M   1G   NP   RO   NX  Cache  Cap   Flags\n");
+  Print(L"-------------  ----------------  ----------  ---- ---- ---- ---- ---- ----  -----  ----  -----\n");
+
+  ZeroMem(&RamTotal, sizeof(RamTotal));
+  Flagged = 0;
+
+  for (i = 0; i < Snapshot->Count; i++) {
+    Desc  = Snapshot->Entries[i];
+    Start = Desc->PhysicalStart;
+    End   = MEMORY_DESCRIPTOR_END(Desc);
+    Total = End - Start;
+    Ram   = MemoryTypeIsRam(Desc->Type);
+
+    WalkRange(&Paging, Start, End, &Stats);
+    Mapped = Total - Stats.NotPresent;
+
+    //
+    // Cacheability shown is the type covering most of the mapped bytes
+    //
+    Dominant = CACHE_TYPE_SLOTS;
+    for (Type = 0; Type < CACHE_TYPE_SLOTS; Type++) {
+      if (Stats.ByCacheType[Type] != 0 &&
+          (Dominant == CACHE_TYPE_SLOTS || Stats.ByCacheType[Type] > Stats.ByCacheType[Dominant])) {
+        Dominant = Type;
+      }
+    }
+
+    Print(L"%-13s  %016lx  ", MemoryTypeName(Desc->Type), Start);
+    PrintPagesSize(Desc->NumberOfPages);
+    Print(L"  ");
+    PrintPercent(Stats.Bytes4K, Total);
+    Print(L" ");
+    PrintPercent(Stats.Bytes2M, Total);
+    Print(L" ");
+    PrintPercent(Stats.Bytes1G, Total);
+    Print(L" ");
+    PrintPercent(Stats.NotPresent, Total);
+    Print(L" ");
+    PrintPercent(Stats.ReadOnly, Total);
+    Print(L" ");
+    PrintPercent(Stats.NoExecute, Total);
+    Print(L"  %-3s%s  ",
+          (Dominant == CACHE_TYPE_SLOTS) ? L"-" : CacheTypeName((UINT8)Dominant),
+          (Dominant != CACHE_TYPE_SLOTS && Stats.ByCacheType[Dominant] != Mapped) ? L"+" : L" ");
+    Print(L"%s%s%s  ",
+          ((Desc->Attribute & EFI_MEMORY_XP) != 0) ? L"X" : L"-",
+          ((Desc->Attribute & EFI_MEMORY_RO) != 0) ? L"R" : L"-",
+          ((Desc->Attribute & EFI_MEMORY_RP) != 0) ? L"P" : L"-");
+
+    Print(L"%s%s%s\n",
+          (Stats.Splittable4K != 0) ? L"4K " : L"",
+          (Ram && Stats.NotPresent != 0) ? L"NM " : L"",
+          (Ram && Stats.ByCacheType[CACHE_TYPE_WB] != Mapped) ? L"NotWB" : L"");
+
+    if (Stats.Splittable4K != 0 ||
+        (Ram && (Stats.NotPresent != 0 || Stats.ByCacheType[CACHE_TYPE_WB] != Mapped))) {
+      Flagged++;
+    }
+
+    if (Ram) {
+      RamTotal.Bytes4K      += Stats.Bytes4K;
+      RamTotal.Bytes2M      += Stats.Bytes2M;
+      RamTotal.Bytes1G      += Stats.Bytes1G;
+      RamTotal.Splittable4K += Stats.Splittable4K;
+      RamTotal.NotPresent   += Stats.NotPresent;
+      for (Type = 0; Type < CACHE_TYPE_SLOTS; Type++) {
+        RamTotal.ByCacheType[Type] += Stats.ByCacheType[Type];
+      }
+    }
+  }
+
+  Print(L"\nRAM mapped with 4 KB pages: %ld MB (%ld MB of it could use 2 MB pages)\n",
+        RShiftU64(RamTotal.Bytes4K, 20), RShiftU64(RamTotal.Splittable4K, 20));
+  Print(L"RAM mapped with 2 MB pages: %ld MB, with 1 GB pages: %ld MB, not mapped: %ld MB\n",
+        RShiftU64(RamTotal.Bytes2M, 20), RShiftU64(RamTotal.Bytes1G, 20), RShiftU64(RamTotal.NotPresent, 20));
+  Print(L"RAM by effective type:");
+  for (Type = 0; Type < CACHE_TYPE_SLOTS; Type++) {
+    if (RamTotal.ByCacheType[Type] != 0) {
+      Print(L" %s %ld MB", CacheTypeName((UINT8)Type), RShiftU64(RamTotal.ByCacheType[Type], 20));
+    }
+  }
+  Print(L"\n");
+
+  Flagged += CheckPublishedProtections(&Paging);
+  Print(L"\n%d range(s) flagged\n", Flagged);
+
+  return EFI_SUCCESS;
+}
+
+#else
+
+EFI_STATUS
+InspectPageTables (
+  IN OUT MEMORY_MAP_SNAPSHOT *Snapshot
+  )
+{
+  Print(L"The page table inspector needs an X64 build\n");
+  return EFI_UNSUPPORTED;
+}
+
+#endif
@@ -7,11 +7,229 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/PrintLib.h>
 #include <Library/UefiApplicationEntryPoint.h>
+#include <Library/TimerLib.h>
+#include <Library/DevicePathLib.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Protocol/LoadedImage.h>
+#include <Guid/GlobalVariable.h>
+#include "../Common/ArenaLib.h"
+#include "../Common/LatencyLib.h"
 
 #define EFI_VARIABLE_NON_VOLATILE           0x00000001
 #define EFI_VARIABLE_BOOTSERVICE_ACCESS     0x00000002
 #define EFI_VARIABLE_RUNTIME_ACCESS         0x00000004
 
+//
+// Initial variable name buffer, in bytes; it only grows past this for
+// unusually long names
+//
+#define NAME_BUFFER_SIZE                    512
+
+//
+// Initial GetVariable buffer, in bytes; larger variables grow it
+//
+#define DATA_BUFFER_SIZE                    4096
+
+//
+// Snapshot table entries allocated on the first snapshot
+//
+#define SNAPSHOT_INITIAL_ENTRIES            256
+
+//
+// GUID hash over the snapshot; must be a power of two
+//
+#define GUID_HASH_BUCKETS                   64
+
+//
+// End of a GUID hash chain
+//
+#define NO_ENTRY                            MAX_UINTN
+
+//
+// One variable as read by TakeSnapshot(). Name and Data live in
+// mSnapshotArena; Data is NULL if GetVariable failed (see ReadStatus).
+//
+typedef struct {
+  CHAR16     *Name;
+  EFI_GUID   Guid;
+  UINT32     Attributes;
+  UINTN      DataSize;
+  VOID       *Data;
+  EFI_STATUS ReadStatus;
+  UINTN      NextInBucket;  // next entry of the same GUID hash bucket
+} VARIABLE_ENTRY;
+
+//
+// Every variable of the store, read in one GetNextVariableName walk.
+// Entries only grows and is kept between snapshots; names and data are
+// packed into mSnapshotArena, which is reset for every new snapshot.
+// GuidBuckets and ByName index the entries for the searches.
+//
+typedef struct {
+  BOOLEAN        Valid;
+  VARIABLE_ENTRY *Entries;
+  UINTN          Capacity;
+  UINTN          Count;
+  UINTN          NameBytes;
+  UINTN          DataBytes;
+  UINTN          GuidBuckets[GUID_HASH_BUCKETS];  // first entry per bucket
+  UINTN          *ByName;                         // entry indices sorted by name
+} VARIABLE_SNAPSHOT;
+
+//
+// A combined search; unset fields match everything
+//
+typedef struct {
+  BOOLEAN  HasGuid;
+  EFI_GUID Guid;
+  CHAR16   *Pattern;          // name pattern with * and ?, or NULL
+  UINT32   AttributesSet;     // attributes that must be set
+  UINT32   AttributesClear;   // attributes that must be clear
+} VARIABLE_QUERY;
+
+//
+// Export file layout: a header, then one record per variable. Each
+// record is followed by the NUL-terminated name and the raw data, and
+// padded to VARIABLE_FILE_ALIGNMENT. Crc32 covers everything after the
+// header.
+//
+#define VARIABLE_FILE_SIGNATURE             SIGNATURE_32 ('V', 'A', 'R', 'S')
+#define VARIABLE_FILE_VERSION               1
+#define VARIABLE_FILE_ALIGNMENT             8
+#define DEFAULT_EXPORT_FILE                 L"Variables.bin"
+
+typedef struct {
+  UINT32   Signature;
+  UINT32   Version;
+  UINT32   Count;
+  UINT32   Crc32;
+  UINT64   Size;            // bytes after the header
+} VARIABLE_FILE_HEADER;
+
+typedef struct {
+  EFI_GUID Guid;
+  UINT32   Attributes;
+  UINT32   NameSize;        // bytes, including the terminator
+  UINT32   DataSize;
+} VARIABLE_FILE_RECORD;
+
+#define VARIABLE_RECORD_SIZE(NameSize, DataSize) \
+  ALIGN_VALUE (sizeof (VARIABLE_FILE_RECORD) + (NameSize) + (DataSize), VARIABLE_FILE_ALIGNMENT)
+
+//
+// Benchmark: calls per size for volatile and non-volatile variables
+// (non-volatile writes wear the flash, so fewer), the data sizes tried,
+// and how many of the slowest variables the profiler lists
+//
+#define BENCH_VOLATILE_CALLS                256
+#define BENCH_NV_CALLS                      16
+#define BENCH_MIN_CALLS                     4
+#define BENCH_PROFILE_READS                 3
+#define BENCH_PROFILE_TOP                   10
+
+//
+// Store overhead per variable assumed when checking that a benchmark
+// run fits into the remaining NV space
+//
+#define BENCH_HEADER_ESTIMATE               64
+
+typedef enum {
+  BenchCreate,
+  BenchUpdate,
+  BenchRead,
+  BenchDelete,
+  BenchOpMax
+} VAR_BENCH_OP;
+
+STATIC CONST CHAR16 *mBenchOpName[BenchOpMax] = { L"Set create", L"Set update", L"Get", L"Set delete" };
+STATIC CONST UINTN  mBenchSizes[] = { 16, 256, SIZE_1KB, SIZE_4KB };
+
+//
+// Vendor GUID of the VarBenchNNNN variables the benchmark creates and deletes
+//
+STATIC EFI_GUID mBenchGuid = { 0x6f1b2c1e, 0x4a7d, 0x4c3b, { 0x9e, 0x21, 0x5d, 0x8a, 0x73, 0x0f, 0x42, 0xb6 } };
+
+//
+// How variable data is shown or entered
+//
+typedef enum {
+  FormatAuto,
+  FormatHex,
+  FormatU8,
+  FormatU16,
+  FormatU32,
+  FormatU64,
+  FormatGuid,
+  FormatUtf16,
+  FormatAscii,
+  FormatMax
+} VALUE_FORMAT;
+
+STATIC CONST CHAR16 *mFormatNames[FormatMax] = {
+  L"auto", L"hex", L"u8", L"u16", L"u32", L"u64", L"guid", L"utf16", L"ascii"
+};
+
+//
+// Characters accepted for typed data input
+//
+#define DATA_INPUT_LENGTH                   512
+
+//
+// The parts of an EFI_LOAD_OPTION (Boot####, Driver####, ...); the
+// pointers point into the variable data
+//
+typedef struct {
+  UINT32                   Attributes;
+  CHAR16                   *Description;
+  EFI_DEVICE_PATH_PROTOCOL *FilePath;
+  UINTN                    FilePathLength;
+  UINT8                    *OptionalData;
+  UINTN                    OptionalDataSize;
+} LOAD_OPTION_VIEW;
+
+//
+// Store usage of one vendor GUID, summed from the snapshot
+//
+typedef struct {
+  EFI_GUID Guid;
+  UINTN    Variables;
+  UINTN    NvBytes;         // name + data of non-volatile variables
+  UINTN    TotalBytes;      // name + data of all variables
+} GUID_USAGE;
+
+//
+// Attribute combination passed to QueryVariableInfo
+//
+typedef struct {
+  UINT32 Attributes;
+  CHAR16 *Name;
+} STORAGE_CLASS;
+
+STATIC CONST STORAGE_CLASS mStorageClasses[] = {
+  { EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, L"NV+BS+RT" },
+  { EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,                               L"NV+BS" },
+  { EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS |
+    EFI_VARIABLE_HARDWARE_ERROR_RECORD,                                                        L"NV+BS+RT+HR" },
+  { EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,                             L"BS+RT" },
+  { EFI_VARIABLE_BOOTSERVICE_ACCESS,                                                           L"BS" }
+};
+
+//
+// Scratch memory for the current menu command, reset after each one
+//
+STATIC ARENA mArena;
+
+//
+// The snapshot outlives a command; it is retaken after variables change
+//
+STATIC ARENA             mSnapshotArena;
+STATIC VARIABLE_SNAPSHOT mSnapshot;
+
+//
+// Export files live on the volume this image was loaded from
+//
+STATIC EFI_HANDLE        mImageHandle;
+
 //
 // Print GUID helper
 //
@@ -20,287 +238,2468 @@ PrintGuid (
   IN EFI_GUID *Guid
   )
 {
-  Print(L"%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
-         Guid->Data1, Guid->Data2, Guid->Data3,
-         Guid->Data4[0], Guid->Data4[1],
-         Guid->Data4[2], Guid->Data4[3],
-         Guid->Data4[4], Guid->Data4[5],
-         Guid->Data4[6], Guid->Data4[7]);
+  Print(L"%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+         Guid->Data1, Guid->Data2, Guid->Data3,
+         Guid->Data4[0], Guid->Data4[1],
+         Guid->Data4[2], Guid->Data4[3],
+         Guid->Data4[4], Guid->Data4[5],
+         Guid->Data4[6], Guid->Data4[7]);
+}
+
+//
+// ReadLine helper
+//
+EFI_STATUS
+ReadLine (
+  OUT CHAR16 *Buffer,
+  IN  UINTN   BufferLen
+  )
+{
+  UINTN Index;
+  EFI_INPUT_KEY Key;
+  UINTN EventIndex;
+
+  Index = 0;
+  ZeroMem(Buffer, BufferLen * sizeof(CHAR16));
+
+  while (TRUE) {
+    gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
+    gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);
+
+    if (Key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
+      Print(L"\r\n");
+      Buffer[Index] = L'\0';
+      return EFI_SUCCESS;
+    }
+
+    if (Key.UnicodeChar == CHAR_BACKSPACE) {
+      if (Index > 0) {
+        Index--;
+        Print(L"\b \b");
+      }
+      continue;
+    }
+
+    if (Key.UnicodeChar >= 0x20 && Key.UnicodeChar <= 0x7E) {
+      if (Index + 1 < BufferLen) {
+        Buffer[Index++] = Key.UnicodeChar;
+        Print(L"%c", Key.UnicodeChar);
+      }
+    }
+  }
+}
+
+//
+// Parse GUID string like "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+//
+EFI_STATUS
+ParseGuidString (
+  IN  CHAR16   *GuidStr,
+  OUT EFI_GUID *Guid
+  )
+{
+  UINTN i, j, len;
+  CHAR16 temp[3];
+  UINT8 bytes[16];
+
+  if (GuidStr == NULL || Guid == NULL)
+    return EFI_INVALID_PARAMETER;
+
+  len = StrLen(GuidStr);
+  if (len != 36)
+    return EFI_INVALID_PARAMETER;
+
+  j = 0;
+  for (i = 0; i < len && j < 16;) {
+    if (GuidStr[i] == L'-') {
+      i++;
+      continue;
+    }
+    if (i + 1 >= len)
+      return EFI_INVALID_PARAMETER;
+
+    temp[0] = GuidStr[i];
+    temp[1] = GuidStr[i + 1];
+    temp[2] = 0;
+    bytes[j++] = (UINT8)StrHexToUintn(temp);
+    i += 2;
+  }
+
+  if (j != 16)
+    return EFI_INVALID_PARAMETER;
+
+  Guid->Data1 = ((UINT32)bytes[0] << 24) |
+                ((UINT32)bytes[1] << 16) |
+                ((UINT32)bytes[2] << 8)  |
+                ((UINT32)bytes[3]);
+  Guid->Data2 = ((UINT16)bytes[4] << 8) | bytes[5];
+  Guid->Data3 = ((UINT16)bytes[6] << 8) | bytes[7];
+  CopyMem(Guid->Data4, &bytes[8], 8);
+
+  return EFI_SUCCESS;
+}
+
+//
+// GetNextVariableName with a growable name buffer.
+// *Capacity is the buffer size in bytes. A larger buffer is taken from
+// mArena when a name does not fit; the old one is abandoned to the arena
+// rather than freed.
+//
+EFI_STATUS
+GetNextName (
+  IN OUT CHAR16   **Name,
+  IN OUT UINTN    *Capacity,
+  OUT    EFI_GUID *Guid
+  )
+{
+  EFI_STATUS Status;
+  UINTN NameSize;
+  CHAR16 *NewBuf;
+
+  while (TRUE) {
+    NameSize = *Capacity;
+    Status = gRT->GetNextVariableName(&NameSize, *Name, Guid);
+    if (Status != EFI_BUFFER_TOO_SMALL)
+      return Status;
+
+    //
+    // The previous name is still the input for the retry
+    //
+    NewBuf = ArenaAlloc(&mArena, NameSize);
+    if (NewBuf == NULL)
+      return EFI_OUT_OF_RESOURCES;
+    CopyMem(NewBuf, *Name, *Capacity);
+    *Name = NewBuf;
+    *Capacity = NameSize;
+  }
+}
+
+//
+// Bucket of a GUID in the snapshot hash
+//
+UINTN
+GuidBucket (
+  IN EFI_GUID *Guid
+  )
+{
+  return Guid->Data1 & (GUID_HASH_BUCKETS - 1);
+}
+
+//
+// Chain every entry into its GUID bucket and sort the entry indices by
+// name (Shell sort), so GUID lookups are O(1) and name prefixes O(log n)
+//
+EFI_STATUS
+BuildIndex (
+  VOID
+  )
+{
+  UINTN Bucket;
+  UINTN Gap;
+  UINTN Key;
+  UINTN i;
+  UINTN j;
+
+  SetMem(mSnapshot.GuidBuckets, sizeof(mSnapshot.GuidBuckets), 0xFF);
+  for (i = mSnapshot.Count; i > 0; i--) {
+    Bucket = GuidBucket(&mSnapshot.Entries[i - 1].Guid);
+    mSnapshot.Entries[i - 1].NextInBucket = mSnapshot.GuidBuckets[Bucket];
+    mSnapshot.GuidBuckets[Bucket] = i - 1;
+  }
+
+  mSnapshot.ByName = ArenaAlloc(&mSnapshotArena, (mSnapshot.Count + 1) * sizeof(UINTN));
+  if (mSnapshot.ByName == NULL)
+    return EFI_OUT_OF_RESOURCES;
+  for (i = 0; i < mSnapshot.Count; i++)
+    mSnapshot.ByName[i] = i;
+
+  for (Gap = mSnapshot.Count / 2; Gap > 0; Gap /= 2) {
+    for (i = Gap; i < mSnapshot.Count; i++) {
+      Key = mSnapshot.ByName[i];
+      for (j = i;
+           j >= Gap && StrCmp(mSnapshot.Entries[mSnapshot.ByName[j - Gap]].Name, mSnapshot.Entries[Key].Name) > 0;
+           j -= Gap)
+        mSnapshot.ByName[j] = mSnapshot.ByName[j - Gap];
+      mSnapshot.ByName[j] = Key;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Read name, GUID, attributes and data of every variable into mSnapshot.
+// One name buffer and one data buffer are reused for the whole walk, so
+// a variable normally costs one GetNextVariableName and one GetVariable.
+//
+EFI_STATUS
+TakeSnapshot (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN Capacity;
+  CHAR16 *Name;
+  EFI_GUID Guid;
+  UINTN DataCapacity;
+  VOID *Data;
+  UINTN DataSize;
+  UINT32 Attributes;
+  UINTN NameSize;
+  UINTN NewCapacity;
+  VARIABLE_ENTRY *NewEntries;
+  VARIABLE_ENTRY *Entry;
+
+  mSnapshot.Valid = FALSE;
+  mSnapshot.Count = 0;
+  mSnapshot.NameBytes = 0;
+  mSnapshot.DataBytes = 0;
+  ArenaReset(&mSnapshotArena);
+
+  Capacity = NAME_BUFFER_SIZE;
+  Name = ArenaAllocZero(&mArena, Capacity);
+  DataCapacity = DATA_BUFFER_SIZE;
+  Data = ArenaAlloc(&mArena, DataCapacity);
+  if (Name == NULL || Data == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  while (TRUE) {
+    Status = GetNextName(&Name, &Capacity, &Guid);
+
+    if (Status == EFI_NOT_FOUND)
+      break;
+
+    if (EFI_ERROR(Status))
+      return Status;
+
+    if (mSnapshot.Count == mSnapshot.Capacity) {
+      NewCapacity = (mSnapshot.Capacity == 0) ? SNAPSHOT_INITIAL_ENTRIES : mSnapshot.Capacity * 2;
+      NewEntries = ReallocatePool(mSnapshot.Capacity * sizeof(VARIABLE_ENTRY),
+                                  NewCapacity * sizeof(VARIABLE_ENTRY),
+                                  mSnapshot.Entries);
+      if (NewEntries == NULL)
+        return EFI_OUT_OF_RESOURCES;
+      mSnapshot.Entries = NewEntries;
+      mSnapshot.Capacity = NewCapacity;
+    }
+
+    Entry = &mSnapshot.Entries[mSnapshot.Count];
+    NameSize = StrSize(Name);
+    Entry->Name = ArenaAlloc(&mSnapshotArena, NameSize);
+    if (Entry->Name == NULL)
+      return EFI_OUT_OF_RESOURCES;
+    CopyMem(Entry->Name, Name, NameSize);
+    CopyGuid(&Entry->Guid, &Guid);
+
+    while (TRUE) {
+      DataSize = DataCapacity;
+      Status = gRT->GetVariable(Name, &Guid, &Attributes, &DataSize, Data);
+      if (Status != EFI_BUFFER_TOO_SMALL)
+        break;
+
+      Data = ArenaAlloc(&mArena, DataSize);
+      if (Data == NULL)
+        return EFI_OUT_OF_RESOURCES;
+      DataCapacity = DataSize;
+    }
+
+    Entry->ReadStatus = Status;
+    Entry->Attributes = 0;
+    Entry->DataSize = 0;
+    Entry->Data = NULL;
+    if (!EFI_ERROR(Status)) {
+      Entry->Attributes = Attributes;
+      Entry->DataSize = DataSize;
+      if (DataSize != 0) {
+        Entry->Data = ArenaAlloc(&mSnapshotArena, DataSize);
+        if (Entry->Data == NULL)
+          return EFI_OUT_OF_RESOURCES;
+        CopyMem(Entry->Data, Data, DataSize);
+      }
+    }
+
+    mSnapshot.Count++;
+    mSnapshot.NameBytes += NameSize;
+    mSnapshot.DataBytes += Entry->DataSize;
+  }
+
+  Status = BuildIndex();
+  if (EFI_ERROR(Status))
+    return Status;
+
+  mSnapshot.Valid = TRUE;
+  return EFI_SUCCESS;
+}
+
+//
+// Return the current snapshot, taking a new one if variables changed
+//
+VARIABLE_SNAPSHOT *
+GetSnapshot (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  if (!mSnapshot.Valid) {
+    Status = TakeSnapshot();
+    if (EFI_ERROR(Status)) {
+      Print(L"Failed to read variables: %r\n", Status);
+      return NULL;
+    }
+  }
+  return &mSnapshot;
+}
+
+//
+// Mark the snapshot stale after this tool changed a variable
+//
+VOID
+InvalidateSnapshot (
+  VOID
+  )
+{
+  mSnapshot.Valid = FALSE;
+}
+
+//
+// Print attributes as NV|BS|RT..., padded to a fixed column
+//
+VOID
+PrintAttributes (
+  IN UINT32 Attributes
+  )
+{
+  CHAR16 Buffer[32];
+
+  Buffer[0] = L'\0';
+  if ((Attributes & EFI_VARIABLE_NON_VOLATILE) != 0)
+    StrCatS(Buffer, 32, L"NV|");
+  if ((Attributes & EFI_VARIABLE_BOOTSERVICE_ACCESS) != 0)
+    StrCatS(Buffer, 32, L"BS|");
+  if ((Attributes & EFI_VARIABLE_RUNTIME_ACCESS) != 0)
+    StrCatS(Buffer, 32, L"RT|");
+  if ((Attributes & EFI_VARIABLE_HARDWARE_ERROR_RECORD) != 0)
+    StrCatS(Buffer, 32, L"HR|");
+  if ((Attributes & EFI_VARIABLE_AUTHENTICATED_WRITE_ACCESS) != 0)
+    StrCatS(Buffer, 32, L"AW|");
+  if ((Attributes & EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS) != 0)
+    StrCatS(Buffer, 32, L"AT|");
+
+  if (Buffer[0] != L'\0')
+    Buffer[StrLen(Buffer) - 1] = L'\0';
+  else
+    StrCatS(Buffer, 32, L"-");
+
+  Print(L"%-12s", Buffer);
+}
+
+//
+// Print one snapshot entry: GUID, attributes, size and name
+//
+VOID
+PrintEntry (
+  IN VARIABLE_ENTRY *Entry
+  )
+{
+  PrintGuid(&Entry->Guid);
+  Print(L"  ");
+  if (EFI_ERROR(Entry->ReadStatus)) {
+    Print(L"%-12s  %6s", L"?", L"-");
+  } else {
+    PrintAttributes(Entry->Attributes);
+    Print(L"  %6d", Entry->DataSize);
+  }
+  Print(L"  %s", Entry->Name);
+  if (EFI_ERROR(Entry->ReadStatus))
+    Print(L"  (%r)", Entry->ReadStatus);
+  Print(L"\n");
+}
+
+//
+// Column headings matching PrintEntry()
+//
+VOID
+PrintEntryHeader (
+  VOID
+  )
+{
+  Print(L"GUID                                  Attributes      Size  Name\n");
+}
+
+//
+// Match Name against Pattern: * matches any run of characters, ? any one
+// character, everything else itself. On a mismatch after a * the match
+// resumes one character further into Name.
+//
+BOOLEAN
+MatchPattern (
+  IN CHAR16 *Name,
+  IN CHAR16 *Pattern
+  )
+{
+  CHAR16 *Star;
+  CHAR16 *Resume;
+
+  Star = NULL;
+  Resume = NULL;
+  while (*Name != L'\0') {
+    if (*Pattern == L'*') {
+      Star = ++Pattern;
+      Resume = Name;
+    } else if (*Pattern == L'?' || *Pattern == *Name) {
+      Pattern++;
+      Name++;
+    } else if (Star != NULL) {
+      Pattern = Star;
+      Name = ++Resume;
+    } else {
+      return FALSE;
+    }
+  }
+
+  while (*Pattern == L'*')
+    Pattern++;
+  return (BOOLEAN)(*Pattern == L'\0');
+}
+
+//
+// Characters of Pattern before its first wildcard
+//
+UINTN
+LiteralPrefixLength (
+  IN CHAR16 *Pattern
+  )
+{
+  UINTN Length;
+
+  for (Length = 0; Pattern[Length] != L'\0'; Length++) {
+    if (Pattern[Length] == L'*' || Pattern[Length] == L'?')
+      break;
+  }
+  return Length;
+}
+
+//
+// First position in the name index whose name is not below Prefix
+//
+UINTN
+LowerBoundByName (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN CHAR16            *Prefix,
+  IN UINTN             Length
+  )
+{
+  UINTN Low;
+  UINTN High;
+  UINTN Mid;
+
+  Low = 0;
+  High = Snapshot->Count;
+  while (Low < High) {
+    Mid = Low + (High - Low) / 2;
+    if (StrnCmp(Snapshot->Entries[Snapshot->ByName[Mid]].Name, Prefix, Length) < 0)
+      Low = Mid + 1;
+    else
+      High = Mid;
+  }
+  return Low;
+}
+
+//
+// Does one entry satisfy every part of Query
+//
+BOOLEAN
+EntryMatches (
+  IN VARIABLE_ENTRY *Entry,
+  IN VARIABLE_QUERY *Query
+  )
+{
+  if (Query->HasGuid && !CompareGuid(&Entry->Guid, &Query->Guid))
+    return FALSE;
+  if ((Entry->Attributes & Query->AttributesSet) != Query->AttributesSet)
+    return FALSE;
+  if ((Entry->Attributes & Query->AttributesClear) != 0)
+    return FALSE;
+  if (Query->Pattern != NULL && !MatchPattern(Entry->Name, Query->Pattern))
+    return FALSE;
+  return TRUE;
+}
+
+//
+// Collect every entry matching Query into Matches (room for
+// Snapshot->Count entries) and return how many did.
+// The narrowest index decides which entries are looked at: the GUID
+// bucket if a GUID is given, else the name index range of the pattern's
+// literal prefix, else the whole table in name order.
+//
+UINTN
+FindEntries (
+  IN  VARIABLE_SNAPSHOT *Snapshot,
+  IN  VARIABLE_QUERY    *Query,
+  OUT VARIABLE_ENTRY    **Matches
+  )
+{
+  VARIABLE_ENTRY *Entry;
+  UINTN Count;
+  UINTN Length;
+  UINTN Index;
+  UINTN i;
+
+  Count = 0;
+
+  if (Query->HasGuid) {
+    for (Index = Snapshot->GuidBuckets[GuidBucket(&Query->Guid)]; Index != NO_ENTRY; Index = Entry->NextInBucket) {
+      Entry = &Snapshot->Entries[Index];
+      if (EntryMatches(Entry, Query))
+        Matches[Count++] = Entry;
+    }
+    return Count;
+  }
+
+  Length = (Query->Pattern != NULL) ? LiteralPrefixLength(Query->Pattern) : 0;
+  i = (Length != 0) ? LowerBoundByName(Snapshot, Query->Pattern, Length) : 0;
+  for (; i < Snapshot->Count; i++) {
+    Entry = &Snapshot->Entries[Snapshot->ByName[i]];
+    if (Length != 0 && StrnCmp(Entry->Name, Query->Pattern, Length) != 0)
+      break;
+    if (EntryMatches(Entry, Query))
+      Matches[Count++] = Entry;
+  }
+  return Count;
+}
+
+//
+// Print every entry matching Query and return how many did
+//
+UINTN
+RunQuery (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN VARIABLE_QUERY    *Query
+  )
+{
+  VARIABLE_ENTRY **Matches;
+  UINTN Count;
+  UINTN i;
+
+  Matches = ArenaAlloc(&mArena, (Snapshot->Count + 1) * sizeof(VARIABLE_ENTRY *));
+  if (Matches == NULL)
+    return 0;
+
+  Count = FindEntries(Snapshot, Query, Matches);
+  if (Count != 0)
+    PrintEntryHeader();
+  for (i = 0; i < Count; i++)
+    PrintEntry(Matches[i]);
+  return Count;
+}
+
+//
+// The snapshot entry for Name and Guid, or NULL
+//
+VARIABLE_ENTRY *
+LookupEntry (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN CHAR16            *Name,
+  IN EFI_GUID          *Guid
+  )
+{
+  VARIABLE_ENTRY *Entry;
+  UINTN Index;
+
+  for (Index = Snapshot->GuidBuckets[GuidBucket(Guid)]; Index != NO_ENTRY; Index = Entry->NextInBucket) {
+    Entry = &Snapshot->Entries[Index];
+    if (CompareGuid(&Entry->Guid, Guid) && StrCmp(Entry->Name, Name) == 0)
+      return Entry;
+  }
+  return NULL;
+}
+
+//
+// List all variables. Listing always takes a fresh snapshot, which the
+// searches then reuse.
+//
+EFI_STATUS
+ListAllVariables (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN i;
+
+  Status = TakeSnapshot();
+  if (EFI_ERROR(Status)) {
+    Print(L"Error: %r\n", Status);
+    return Status;
+  }
+
+  Print(L"\n=== Listing All Variables (%d, %d bytes of data) ===\n",
+        mSnapshot.Count, mSnapshot.DataBytes);
+  PrintEntryHeader();
+
+  for (i = 0; i < mSnapshot.Count; i++)
+    PrintEntry(&mSnapshot.Entries[i]);
+
+  return EFI_SUCCESS;
+}
+
+//
+// Search variable by name substring
+//
+EFI_STATUS
+SearchVariableByName (
+  VOID
+  )
+{
+  CHAR16 Input[100];
+  CHAR16 Pattern[102];
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_QUERY Query;
+
+  Print(L"\nEnter variable name substring or pattern (* and ?): ");
+  ReadLine(Input, 100);
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  //
+  // Plain text keeps its substring meaning
+  //
+  ZeroMem(&Query, sizeof(Query));
+  if (LiteralPrefixLength(Input) == StrLen(Input)) {
+    UnicodeSPrint(Pattern, sizeof(Pattern), L"*%s*", Input);
+    Query.Pattern = Pattern;
+  } else {
+    Query.Pattern = Input;
+  }
+
+  if (RunQuery(Snapshot, &Query) == 0)
+    Print(L"No match found.\n");
+
+  return EFI_SUCCESS;
+}
+
+//
+// Search variable by GUID
+//
+EFI_STATUS
+SearchVariableByGuid (
+  VOID
+  )
+{
+  CHAR16 Input[50];
+  EFI_GUID Target;
+  EFI_STATUS Status;
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_QUERY Query;
+
+  Print(L"\nEnter GUID to search (xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx): ");
+  ReadLine(Input, 50);
+
+  Status = ParseGuidString(Input, &Target);
+  if (EFI_ERROR(Status)) {
+    Print(L"Invalid GUID format.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  ZeroMem(&Query, sizeof(Query));
+  Query.HasGuid = TRUE;
+  CopyGuid(&Query.Guid, &Target);
+
+  if (RunQuery(Snapshot, &Query) == 0)
+    Print(L"No variables found for that GUID.\n");
+
+  return EFI_SUCCESS;
+}
+
+//
+// Parse attribute names (NV BS RT HR AW AT, separated by spaces) into the
+// bits that must be set; a leading - puts a name in the must-be-clear set
+//
+EFI_STATUS
+ParseAttributeFilter (
+  IN  CHAR16 *Text,
+  OUT UINT32 *Set,
+  OUT UINT32 *Clear
+  )
+{
+  BOOLEAN Negate;
+  UINT32 Bit;
+
+  *Set = 0;
+  *Clear = 0;
+
+  while (*Text != L'\0') {
+    if (*Text == L' ' || *Text == L',') {
+      Text++;
+      continue;
+    }
+
+    Negate = (BOOLEAN)(*Text == L'-');
+    if (Negate)
+      Text++;
+
+    if (StrnCmp(Text, L"NV", 2) == 0)
+      Bit = EFI_VARIABLE_NON_VOLATILE;
+    else if (StrnCmp(Text, L"BS", 2) == 0)
+      Bit = EFI_VARIABLE_BOOTSERVICE_ACCESS;
+    else if (StrnCmp(Text, L"RT", 2) == 0)
+      Bit = EFI_VARIABLE_RUNTIME_ACCESS;
+    else if (StrnCmp(Text, L"HR", 2) == 0)
+      Bit = EFI_VARIABLE_HARDWARE_ERROR_RECORD;
+    else if (StrnCmp(Text, L"AW", 2) == 0)
+      Bit = EFI_VARIABLE_AUTHENTICATED_WRITE_ACCESS;
+    else if (StrnCmp(Text, L"AT", 2) == 0)
+      Bit = EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS;
+    else
+      return EFI_INVALID_PARAMETER;
+
+    if (Negate)
+      *Clear |= Bit;
+    else
+      *Set |= Bit;
+    Text += 2;
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Ask for a GUID, name pattern and attribute filter. Pattern must hold
+// 100 characters and backs Query->Pattern.
+//
+EFI_STATUS
+ReadQuery (
+  OUT VARIABLE_QUERY *Query,
+  OUT CHAR16         *Pattern
+  )
+{
+  CHAR16 GuidStr[50];
+  CHAR16 AttrStr[50];
+  EFI_STATUS Status;
+
+  ZeroMem(Query, sizeof(*Query));
+
+  Print(L"\nGUID (empty = any): ");
+  ReadLine(GuidStr, 50);
+  if (GuidStr[0] != L'\0') {
+    Status = ParseGuidString(GuidStr, &Query->Guid);
+    if (EFI_ERROR(Status)) {
+      Print(L"Invalid GUID format.\n");
+      return EFI_INVALID_PARAMETER;
+    }
+    Query->HasGuid = TRUE;
+  }
+
+  Print(L"Name pattern, * and ? allowed (empty = any): ");
+  ReadLine(Pattern, 100);
+  if (Pattern[0] != L'\0')
+    Query->Pattern = Pattern;
+
+  Print(L"Attributes, e.g. \"NV RT\" or \"-NV\" for volatile (empty = any): ");
+  ReadLine(AttrStr, 50);
+  Status = ParseAttributeFilter(AttrStr, &Query->AttributesSet, &Query->AttributesClear);
+  if (EFI_ERROR(Status)) {
+    Print(L"Unknown attribute; use NV, BS, RT, HR, AW or AT.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Search by any combination of GUID, name pattern and attributes
+//
+EFI_STATUS
+QueryVariables (
+  VOID
+  )
+{
+  CHAR16 Pattern[100];
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_QUERY Query;
+  EFI_STATUS Status;
+  UINTN Matches;
+
+  Status = ReadQuery(&Query, Pattern);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  Matches = RunQuery(Snapshot, &Query);
+  Print(L"%d of %d variables match.\n", Matches, Snapshot->Count);
+
+  return EFI_SUCCESS;
+}
+
+//
+// Sum name and data bytes per GUID. Entries of one GUID share a hash
+// bucket, and buckets are processed one at a time, so a GUID is only
+// looked for among the records of its own bucket.
+//
+GUID_USAGE *
+CollectGuidUsage (
+  IN  VARIABLE_SNAPSHOT *Snapshot,
+  OUT UINTN             *UsageCount
+  )
+{
+  GUID_USAGE *Usage;
+  VARIABLE_ENTRY *Entry;
+  UINTN Count;
+  UINTN First;
+  UINTN Bucket;
+  UINTN Index;
+  UINTN Bytes;
+  UINTN u;
+
+  Usage = ArenaAlloc(&mArena, (Snapshot->Count + 1) * sizeof(GUID_USAGE));
+  if (Usage == NULL)
+    return NULL;
+
+  Count = 0;
+  for (Bucket = 0; Bucket < GUID_HASH_BUCKETS; Bucket++) {
+    First = Count;
+    for (Index = Snapshot->GuidBuckets[Bucket]; Index != NO_ENTRY; Index = Entry->NextInBucket) {
+      Entry = &Snapshot->Entries[Index];
+
+      for (u = First; u < Count; u++) {
+        if (CompareGuid(&Usage[u].Guid, &Entry->Guid))
+          break;
+      }
+      if (u == Count) {
+        ZeroMem(&Usage[u], sizeof(GUID_USAGE));
+        CopyGuid(&Usage[u].Guid, &Entry->Guid);
+        Count++;
+      }
+
+      Bytes = StrSize(Entry->Name) + Entry->DataSize;
+      Usage[u].Variables++;
+      Usage[u].TotalBytes += Bytes;
+      if ((Entry->Attributes & EFI_VARIABLE_NON_VOLATILE) != 0)
+        Usage[u].NvBytes += Bytes;
+    }
+  }
+
+  *UsageCount = Count;
+  return Usage;
+}
+
+//
+// Sort GUID usage records by total bytes, largest first (Shell sort)
+//
+VOID
+SortGuidUsage (
+  IN OUT GUID_USAGE *Usage,
+  IN     UINTN      Count
+  )
+{
+  GUID_USAGE Key;
+  UINTN Gap;
+  UINTN i;
+  UINTN j;
+
+  for (Gap = Count / 2; Gap > 0; Gap /= 2) {
+    for (i = Gap; i < Count; i++) {
+      CopyMem(&Key, &Usage[i], sizeof(Key));
+      for (j = i; j >= Gap && Usage[j - Gap].TotalBytes < Key.TotalBytes; j -= Gap)
+        CopyMem(&Usage[j], &Usage[j - Gap], sizeof(Key));
+      CopyMem(&Usage[j], &Key, sizeof(Key));
+    }
+  }
+}
+
+//
+// Report how full the variable store is: QueryVariableInfo for each
+// attribute class, the largest variables held, and usage per vendor GUID
+//
+EFI_STATUS
+ShowStoreUsage (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  VARIABLE_SNAPSHOT *Snapshot;
+  GUID_USAGE *Usage;
+  VARIABLE_ENTRY *Entry;
+  VARIABLE_ENTRY *LargestNv;
+  VARIABLE_ENTRY *LargestVolatile;
+  UINT64 MaxStorage;
+  UINT64 Remaining;
+  UINT64 MaxVariable;
+  UINTN UsageCount;
+  UINTN i;
+
+  Print(L"\n=== Variable Store Usage ===\n");
+
+  if (gRT->Hdr.Revision < EFI_2_00_SYSTEM_TABLE_REVISION) {
+    Print(L"QueryVariableInfo needs UEFI 2.0 runtime services.\n");
+  } else {
+    Print(L"Class            Maximum   Remaining  Used    Max size\n");
+    for (i = 0; i < sizeof(mStorageClasses) / sizeof(mStorageClasses[0]); i++) {
+      Status = gRT->QueryVariableInfo(mStorageClasses[i].Attributes, &MaxStorage, &Remaining, &MaxVariable);
+      if (EFI_ERROR(Status)) {
+        Print(L"%-12s   %r\n", mStorageClasses[i].Name, Status);
+        continue;
+      }
+      Print(L"%-12s  %10ld  %10ld  %3ld%%  %10ld\n",
+            mStorageClasses[i].Name, MaxStorage, Remaining,
+            (MaxStorage == 0) ? 0 : DivU64x64Remainder(MultU64x32(MaxStorage - Remaining, 100), MaxStorage, NULL),
+            MaxVariable);
+    }
+  }
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  LargestNv = NULL;
+  LargestVolatile = NULL;
+  for (i = 0; i < Snapshot->Count; i++) {
+    Entry = &Snapshot->Entries[i];
+    if ((Entry->Attributes & EFI_VARIABLE_NON_VOLATILE) != 0) {
+      if (LargestNv == NULL || Entry->DataSize > LargestNv->DataSize)
+        LargestNv = Entry;
+    } else if (!EFI_ERROR(Entry->ReadStatus)) {
+      if (LargestVolatile == NULL || Entry->DataSize > LargestVolatile->DataSize)
+        LargestVolatile = Entry;
+    }
+  }
+
+  Print(L"\n%d variables, %d bytes of names, %d bytes of data\n",
+        Snapshot->Count, Snapshot->NameBytes, Snapshot->DataBytes);
+  if (LargestNv != NULL)
+    Print(L"Largest non-volatile: %s (%d bytes)\n", LargestNv->Name, LargestNv->DataSize);
+  if (LargestVolatile != NULL)
+    Print(L"Largest volatile:     %s (%d bytes)\n", LargestVolatile->Name, LargestVolatile->DataSize);
+
+  Usage = CollectGuidUsage(Snapshot, &UsageCount);
+  if (Usage == NULL)
+    return EFI_OUT_OF_RESOURCES;
+  SortGuidUsage(Usage, UsageCount);
+
+  Print(L"\nGUID                                   Vars    NV bytes  Total bytes\n");
+  for (i = 0; i < UsageCount; i++) {
+    PrintGuid(&Usage[i].Guid);
+    Print(L"  %5d  %10d  %11d\n", Usage[i].Variables, Usage[i].NvBytes, Usage[i].TotalBytes);
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// Open FileName in the root of the volume this image was loaded from.
+// With Create set, an existing file is deleted first so a shorter export
+// does not leave stale bytes behind.
+//
+EFI_STATUS
+OpenExportFile (
+  IN  CHAR16            *FileName,
+  IN  BOOLEAN           Create,
+  OUT EFI_FILE_PROTOCOL **File
+  )
+{
+  EFI_STATUS Status;
+  EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SimpleFs;
+  EFI_FILE_PROTOCOL *Root;
+
+  Status = gBS->HandleProtocol(mImageHandle, &gEfiLoadedImageProtocolGuid, (VOID **)&LoadedImage);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  Status = gBS->HandleProtocol(LoadedImage->DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID **)&SimpleFs);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  Status = SimpleFs->OpenVolume(SimpleFs, &Root);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  if (!Create) {
+    Status = Root->Open(Root, File, FileName, EFI_FILE_MODE_READ, 0);
+  } else {
+    if (!EFI_ERROR(Root->Open(Root, File, FileName, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0)))
+      (*File)->Delete(*File);
+    Status = Root->Open(Root, File, FileName,
+                        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+  }
+
+  Root->Close(Root);
+  return Status;
+}
+
+//
+// Ask for the export file name; empty means DEFAULT_EXPORT_FILE
+//
+VOID
+ReadFileName (
+  OUT CHAR16 *FileName,
+  IN  UINTN  FileNameLen
+  )
+{
+  Print(L"File name [%s]: ", DEFAULT_EXPORT_FILE);
+  ReadLine(FileName, FileNameLen);
+  if (FileName[0] == L'\0')
+    StrCpyS(FileName, FileNameLen, DEFAULT_EXPORT_FILE);
+}
+
+//
+// Authenticated variables cannot be replayed from GetVariable data, and
+// unreadable ones have nothing to save
+//
+BOOLEAN
+IsExportable (
+  IN VARIABLE_ENTRY *Entry
+  )
+{
+  if (EFI_ERROR(Entry->ReadStatus))
+    return FALSE;
+  return (BOOLEAN)((Entry->Attributes & (EFI_VARIABLE_AUTHENTICATED_WRITE_ACCESS |
+                                         EFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS)) == 0);
+}
+
+//
+// Save the variables matching a query, with attributes and raw data.
+// The whole file is built in memory and written with one Write call.
+//
+EFI_STATUS
+ExportVariables (
+  VOID
+  )
+{
+  CHAR16 Pattern[100];
+  CHAR16 FileName[100];
+  VARIABLE_QUERY Query;
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_ENTRY **Matches;
+  VARIABLE_ENTRY *Entry;
+  VARIABLE_FILE_HEADER *Header;
+  VARIABLE_FILE_RECORD Record;
+  EFI_FILE_PROTOCOL *File;
+  EFI_STATUS Status;
+  UINT8 *Buffer;
+  UINT8 *Cursor;
+  UINTN Count;
+  UINTN Exported;
+  UINTN FileSize;
+  UINTN NameSize;
+  UINTN Size;
+  UINTN i;
+
+  Status = ReadQuery(&Query, Pattern);
+  if (EFI_ERROR(Status))
+    return Status;
+  ReadFileName(FileName, 100);
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  Matches = ArenaAlloc(&mArena, (Snapshot->Count + 1) * sizeof(VARIABLE_ENTRY *));
+  if (Matches == NULL)
+    return EFI_OUT_OF_RESOURCES;
+  Count = FindEntries(Snapshot, &Query, Matches);
+
+  FileSize = sizeof(VARIABLE_FILE_HEADER);
+  for (i = 0; i < Count; i++) {
+    if (IsExportable(Matches[i]))
+      FileSize += VARIABLE_RECORD_SIZE(StrSize(Matches[i]->Name), Matches[i]->DataSize);
+  }
+
+  Buffer = ArenaAllocZero(&mArena, FileSize);
+  if (Buffer == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Exported = 0;
+  Cursor = Buffer + sizeof(VARIABLE_FILE_HEADER);
+  for (i = 0; i < Count; i++) {
+    Entry = Matches[i];
+    if (!IsExportable(Entry))
+      continue;
+
+    NameSize = StrSize(Entry->Name);
+    CopyGuid(&Record.Guid, &Entry->Guid);
+    Record.Attributes = Entry->Attributes;
+    Record.NameSize = (UINT32)NameSize;
+    Record.DataSize = (UINT32)Entry->DataSize;
+    CopyMem(Cursor, &Record, sizeof(Record));
+    CopyMem(Cursor + sizeof(Record), Entry->Name, NameSize);
+    if (Entry->DataSize != 0)
+      CopyMem(Cursor + sizeof(Record) + NameSize, Entry->Data, Entry->DataSize);
+    Cursor += VARIABLE_RECORD_SIZE(NameSize, Entry->DataSize);
+    Exported++;
+  }
+
+  Header = (VARIABLE_FILE_HEADER *)Buffer;
+  Header->Signature = VARIABLE_FILE_SIGNATURE;
+  Header->Version = VARIABLE_FILE_VERSION;
+  Header->Count = (UINT32)Exported;
+  Header->Size = FileSize - sizeof(VARIABLE_FILE_HEADER);
+  Header->Crc32 = CalculateCrc32(Buffer + sizeof(VARIABLE_FILE_HEADER), (UINTN)Header->Size);
+
+  Status = OpenExportFile(FileName, TRUE, &File);
+  if (EFI_ERROR(Status)) {
+    Print(L"Cannot create %s: %r\n", FileName, Status);
+    return Status;
+  }
+  Size = FileSize;
+  Status = File->Write(File, &Size, Buffer);
+  File->Close(File);
+  if (EFI_ERROR(Status)) {
+    Print(L"Write failed: %r\n", Status);
+    return Status;
+  }
+
+  Print(L"Exported %d variables (%d bytes) to %s", Exported, FileSize, FileName);
+  if (Exported != Count)
+    Print(L"; skipped %d unreadable or authenticated", Count - Exported);
+  Print(L"\n");
+  return EFI_SUCCESS;
+}
+
+//
+// Check an export file and return the next record, its name and data.
+// *Offset is the record position in Buffer and is advanced past it.
+//
+EFI_STATUS
+NextImportRecord (
+  IN     UINT8                *Buffer,
+  IN     UINTN                BufferSize,
+  IN OUT UINTN                *Offset,
+  OUT    VARIABLE_FILE_RECORD *Record,
+  OUT    CHAR16               **Name,
+  OUT    VOID                 **Data
+  )
+{
+  UINTN Size;
+
+  if (BufferSize - *Offset < sizeof(VARIABLE_FILE_RECORD))
+    return EFI_VOLUME_CORRUPTED;
+  CopyMem(Record, Buffer + *Offset, sizeof(*Record));
+
+  if (Record->NameSize < sizeof(CHAR16) || (Record->NameSize & 1) != 0)
+    return EFI_VOLUME_CORRUPTED;
+  if (Record->NameSize > BufferSize || Record->DataSize > BufferSize)
+    return EFI_VOLUME_CORRUPTED;
+  Size = VARIABLE_RECORD_SIZE(Record->NameSize, Record->DataSize);
+  if (Size > BufferSize - *Offset)
+    return EFI_VOLUME_CORRUPTED;
+
+  *Name = (CHAR16 *)(Buffer + *Offset + sizeof(VARIABLE_FILE_RECORD));
+  *Data = (UINT8 *)*Name + Record->NameSize;
+  if ((*Name)[Record->NameSize / sizeof(CHAR16) - 1] != L'\0')
+    return EFI_VOLUME_CORRUPTED;
+
+  *Offset += Size;
+  return EFI_SUCCESS;
+}
+
+//
+// Replay an export file with SetVariable. The file is checked and
+// compared against the snapshot first; variables whose attributes and
+// data already match are skipped, so only real changes reach flash.
+//
+EFI_STATUS
+ImportVariables (
+  VOID
+  )
+{
+  CHAR16 FileName[100];
+  CHAR16 Answer[4];
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_FILE_HEADER Header;
+  VARIABLE_FILE_RECORD Record;
+  VARIABLE_ENTRY *Current;
+  EFI_FILE_PROTOCOL *File;
+  EFI_STATUS Status;
+  UINT64 FileSize;
+  UINT32 Crc32;
+  UINT8 *Buffer;
+  UINT8 *Records;
+  CHAR16 *Name;
+  VOID *Data;
+  UINTN Size;
+  UINTN Offset;
+  UINTN Pass;
+  UINTN New;
+  UINTN Changed;
+  UINTN Unchanged;
+  UINTN Written;
+  UINTN Failed;
+  UINTN Skipped;
+  BOOLEAN Recreate;
+  UINTN i;
+
+  ReadFileName(FileName, 100);
+
+  Status = OpenExportFile(FileName, FALSE, &File);
+  if (EFI_ERROR(Status)) {
+    Print(L"Cannot open %s: %r\n", FileName, Status);
+    return Status;
+  }
+
+  Status = File->SetPosition(File, MAX_UINT64);
+  if (!EFI_ERROR(Status))
+    Status = File->GetPosition(File, &FileSize);
+  if (!EFI_ERROR(Status))
+    Status = File->SetPosition(File, 0);
+  if (!EFI_ERROR(Status) && (FileSize < sizeof(Header) || FileSize > MAX_UINTN))
+    Status = EFI_VOLUME_CORRUPTED;
+
+  Buffer = NULL;
+  if (!EFI_ERROR(Status)) {
+    Buffer = ArenaAlloc(&mArena, (UINTN)FileSize);
+    if (Buffer == NULL)
+      Status = EFI_OUT_OF_RESOURCES;
+  }
+  if (!EFI_ERROR(Status)) {
+    Size = (UINTN)FileSize;
+    Status = File->Read(File, &Size, Buffer);
+    if (!EFI_ERROR(Status) && Size != FileSize)
+      Status = EFI_VOLUME_CORRUPTED;
+  }
+  File->Close(File);
+  if (EFI_ERROR(Status)) {
+    Print(L"Cannot read %s: %r\n", FileName, Status);
+    return Status;
+  }
+
+  CopyMem(&Header, Buffer, sizeof(Header));
+  Records = Buffer + sizeof(Header);
+  if (Header.Signature != VARIABLE_FILE_SIGNATURE || Header.Version != VARIABLE_FILE_VERSION ||
+      Header.Size != FileSize - sizeof(Header)) {
+    Print(L"%s is not a variable export\n", FileName);
+    return EFI_VOLUME_CORRUPTED;
+  }
+  Crc32 = CalculateCrc32(Records, (UINTN)Header.Size);
+  if (Crc32 != Header.Crc32) {
+    Print(L"%s is damaged (CRC mismatch)\n", FileName);
+    return EFI_CRC_ERROR;
+  }
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  //
+  // Pass 0 checks every record and counts what would change; pass 1
+  // writes. Nothing is written unless the whole file is sound.
+  //
+  New = 0;
+  Changed = 0;
+  Unchanged = 0;
+  Skipped = 0;
+  Written = 0;
+  Failed = 0;
+  for (Pass = 0; Pass < 2; Pass++) {
+    Offset = 0;
+    for (i = 0; i < Header.Count; i++) {
+      Status = NextImportRecord(Records, (UINTN)Header.Size, &Offset, &Record, &Name, &Data);
+      if (EFI_ERROR(Status)) {
+        Print(L"%s is damaged at record %d\n", FileName, i);
+        return Status;
+      }
+
+      Current = LookupEntry(Snapshot, Name, &Record.Guid);
+
+      //
+      // A variable whose current value cannot be read is left alone; it
+      // could not be restored if the write failed
+      //
+      if (Current != NULL && EFI_ERROR(Current->ReadStatus)) {
+        if (Pass == 0) {
+          Print(L"  %s: current value unreadable (%r), skipped\n", Name, Current->ReadStatus);
+          Skipped++;
+        }
+        continue;
+      }
+
+      if (Current != NULL &&
+          Current->Attributes == Record.Attributes &&
+          Current->DataSize == Record.DataSize &&
+          (Record.DataSize == 0 || CompareMem(Current->Data, Data, Record.DataSize) == 0)) {
+        if (Pass == 0)
+          Unchanged++;
+        continue;
+      }
+
+      if (Pass == 0) {
+        if (Current == NULL)
+          New++;
+        else
+          Changed++;
+        continue;
+      }
+
+      //
+      // Attributes of an existing variable can only change by deleting it;
+      // if the new value is then refused, put the old one back
+      //
+      Recreate = (BOOLEAN)(Current != NULL && Current->Attributes != Record.Attributes);
+      if (Recreate)
+        gRT->SetVariable(Name, &Record.Guid, 0, 0, NULL);
+
+      Status = gRT->SetVariable(Name, &Record.Guid, Record.Attributes, Record.DataSize, Data);
+      if (EFI_ERROR(Status)) {
+        Print(L"  %s: %r\n", Name, Status);
+        if (Recreate &&
+            EFI_ERROR(gRT->SetVariable(Name, &Record.Guid, Current->Attributes,
+                                       Current->DataSize, Current->Data)))
+          Print(L"  %s: old value could not be restored\n", Name);
+        Failed++;
+      } else {
+        Written++;
+      }
+    }
+
+    if (Pass == 0) {
+      Print(L"%d variables in file: %d new, %d changed, %d unchanged, %d skipped\n",
+            Header.Count, New, Changed, Unchanged, Skipped);
+      if (New + Changed == 0)
+        return EFI_SUCCESS;
+
+      Print(L"Write %d variables? (y/n): ", New + Changed);
+      ReadLine(Answer, 4);
+      if (Answer[0] != L'y' && Answer[0] != L'Y')
+        return EFI_ABORTED;
+    }
+  }
+
+  InvalidateSnapshot();
+  Print(L"%d written, %d failed\n", Written, Failed);
+  return (Failed == 0) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+//
+// Print one benchmark row: label, call count and latency distribution
+//
+VOID
+PrintLatencyRow (
+  IN CONST CHAR16  *Label,
+  IN UINTN         Count,
+  IN LATENCY_STATS *Stats
+  )
+{
+  Print(L"%-26s %5d | %8ld %8ld %8ld %8ld %9ld\n",
+        Label, Count, Stats->Min, Stats->P50, Stats->P90, Stats->P99, Stats->Max);
+}
+
+//
+// Time Count calls of Op on VarBench0000..VarBenchNNNN and print a row
+//
+EFI_STATUS
+BenchVariableOp (
+  IN VAR_BENCH_OP Op,
+  IN UINT32       Attributes,
+  IN UINTN        Size,
+  IN UINTN        Count,
+  IN UINT8        *Data,
+  IN UINT64       *Ticks
+  )
+{
+  CHAR16 Name[16];
+  CHAR16 Label[32];
+  LATENCY_STATS Stats;
+  EFI_STATUS Status;
+  UINT64 Start;
+  UINT32 Attr;
+  UINTN DataSize;
+  UINTN i;
+
+  //
+  // Create and update store different data, so an update is a real write
+  //
+  Data[0] = (UINT8)Op;
+
+  for (i = 0; i < Count; i++) {
+    UnicodeSPrint(Name, sizeof(Name), L"VarBench%04d", i);
+    DataSize = Size;
+
+    Start = GetPerformanceCounter();
+    if (Op == BenchRead)
+      Status = gRT->GetVariable(Name, &mBenchGuid, &Attr, &DataSize, Data);
+    else if (Op == BenchDelete)
+      Status = gRT->SetVariable(Name, &mBenchGuid, 0, 0, NULL);
+    else
+      Status = gRT->SetVariable(Name, &mBenchGuid, Attributes, Size, Data);
+    Ticks[i] = ElapsedTicks(Start, GetPerformanceCounter());
+
+    if (EFI_ERROR(Status)) {
+      Print(L"%s of %s failed: %r\n", mBenchOpName[Op], Name, Status);
+      return Status;
+    }
+  }
+
+  ComputeLatencyStats(Ticks, Count, &Stats);
+  UnicodeSPrint(Label, sizeof(Label), L"%s %5d B %s",
+                ((Attributes & EFI_VARIABLE_NON_VOLATILE) != 0) ? L"NV" : L"V ",
+                Size, mBenchOpName[Op]);
+  PrintLatencyRow(Label, Count, &Stats);
+  return EFI_SUCCESS;
+}
+
+//
+// Create, update, read and delete Count variables of one size and class.
+// The variables are deleted again even if a step fails.
+//
+EFI_STATUS
+BenchVariableSize (
+  IN UINT32 Attributes,
+  IN UINTN  Size,
+  IN UINTN  Count,
+  IN UINT8  *Data,
+  IN UINT64 *Ticks
+  )
+{
+  EFI_STATUS Status;
+  CHAR16 Name[16];
+  UINTN Op;
+  UINTN i;
+
+  Status = EFI_SUCCESS;
+  for (Op = 0; Op < BenchOpMax && !EFI_ERROR(Status); Op++)
+    Status = BenchVariableOp((VAR_BENCH_OP)Op, Attributes, Size, Count, Data, Ticks);
+
+  if (EFI_ERROR(Status)) {
+    for (i = 0; i < Count; i++) {
+      UnicodeSPrint(Name, sizeof(Name), L"VarBench%04d", i);
+      gRT->SetVariable(Name, &mBenchGuid, 0, 0, NULL);
+    }
+  }
+  return Status;
+}
+
+//
+// How many of Calls variables of Size bytes to use so that the run
+// takes at most half of the store's remaining space; 0 if not even
+// BENCH_MIN_CALLS fit. Without QueryVariableInfo all Calls are used.
+//
+UINTN
+BenchCallsThatFit (
+  IN UINT32 Attributes,
+  IN UINTN  Size,
+  IN UINTN  Calls
+  )
+{
+  UINT64 MaxStorage;
+  UINT64 Remaining;
+  UINT64 MaxVariable;
+  UINT64 Fit;
+
+  if (gRT->Hdr.Revision < EFI_2_00_SYSTEM_TABLE_REVISION)
+    return Calls;
+  if (EFI_ERROR(gRT->QueryVariableInfo(Attributes, &MaxStorage, &Remaining, &MaxVariable)))
+    return Calls;
+  if (Size > MaxVariable)
+    return 0;
+
+  Fit = DivU64x32(RShiftU64(Remaining, 1), (UINT32)(Size + BENCH_HEADER_ESTIMATE));
+  if (Fit < BENCH_MIN_CALLS)
+    return 0;
+  return (UINTN)MIN(Fit, Calls);
+}
+
+//
+// Time every GetNextVariableName call of one full enumeration
+//
+EFI_STATUS
+BenchEnumeration (
+  IN UINT64 *Ticks,
+  IN UINTN  MaxSamples
+  )
+{
+  EFI_STATUS Status;
+  LATENCY_STATS Stats;
+  CHAR16 *Name;
+  EFI_GUID Guid;
+  UINTN Capacity;
+  UINTN Count;
+  UINT64 Start;
+  UINT64 Total;
+  UINT64 Elapsed;
+
+  Capacity = NAME_BUFFER_SIZE;
+  Name = ArenaAllocZero(&mArena, Capacity);
+  if (Name == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Count = 0;
+  Total = 0;
+  while (TRUE) {
+    Start = GetPerformanceCounter();
+    Status = GetNextName(&Name, &Capacity, &Guid);
+    Elapsed = ElapsedTicks(Start, GetPerformanceCounter());
+    if (Status == EFI_NOT_FOUND)
+      break;
+    if (EFI_ERROR(Status))
+      return Status;
+
+    Total += Elapsed;
+    if (Count < MaxSamples)
+      Ticks[Count] = Elapsed;
+    Count++;
+  }
+
+  if (Count != 0) {
+    ComputeLatencyStats(Ticks, MIN(Count, MaxSamples), &Stats);
+    PrintLatencyRow(L"GetNextVariableName", Count, &Stats);
+  }
+  Print(L"Full enumeration: %d variables in %ld us\n",
+        Count, DivU64x32(GetTimeInNanoSecond(Total), 1000));
+  return EFI_SUCCESS;
+}
+
+//
+// Read every variable of the snapshot a few times and list the ones
+// with the slowest GetVariable (best of BENCH_PROFILE_READS)
+//
+EFI_STATUS
+ProfileVariables (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN UINT64            *Ticks
+  )
+{
+  VARIABLE_ENTRY *Entry;
+  UINT8 *Data;
+  UINTN MaxSize;
+  UINTN DataSize;
+  UINT32 Attr;
+  UINT64 Start;
+  UINT64 Elapsed;
+  UINT64 Total;
+  UINTN Slowest;
+  UINTN Listed;
+  UINTN Read;
+  UINTN i;
+
+  MaxSize = 1;
+  for (i = 0; i < Snapshot->Count; i++)
+    MaxSize = MAX(MaxSize, Snapshot->Entries[i].DataSize);
+  Data = ArenaAlloc(&mArena, MaxSize);
+  if (Data == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Total = 0;
+  for (i = 0; i < Snapshot->Count; i++) {
+    Entry = &Snapshot->Entries[i];
+    Ticks[i] = 0;
+    if (EFI_ERROR(Entry->ReadStatus))
+      continue;
+
+    for (Read = 0; Read < BENCH_PROFILE_READS; Read++) {
+      DataSize = MaxSize;
+      Start = GetPerformanceCounter();
+      gRT->GetVariable(Entry->Name, &Entry->Guid, &Attr, &DataSize, Data);
+      Elapsed = ElapsedTicks(Start, GetPerformanceCounter());
+      if (Read == 0 || Elapsed < Ticks[i])
+        Ticks[i] = Elapsed;
+    }
+    Total += Ticks[i];
+  }
+
+  Print(L"\nSlowest GetVariable (best of %d reads; all %d variables: %ld us)\n",
+        BENCH_PROFILE_READS, Snapshot->Count, DivU64x32(GetTimeInNanoSecond(Total), 1000));
+  Print(L"      ns    Size  GUID                                  Name\n");
+
+  //
+  // Selection of the top few; each pick is cleared so the next pass
+  // finds the runner-up
+  //
+  for (Listed = 0; Listed < MIN(Snapshot->Count, BENCH_PROFILE_TOP); Listed++) {
+    Slowest = 0;
+    for (i = 1; i < Snapshot->Count; i++) {
+      if (Ticks[i] > Ticks[Slowest])
+        Slowest = i;
+    }
+    if (Ticks[Slowest] == 0)
+      break;
+
+    Entry = &Snapshot->Entries[Slowest];
+    Print(L"%8ld  %6d  ", GetTimeInNanoSecond(Ticks[Slowest]), Entry->DataSize);
+    PrintGuid(&Entry->Guid);
+    Print(L"  %s\n", Entry->Name);
+    Ticks[Slowest] = 0;
+  }
+  return EFI_SUCCESS;
+}
+
+//
+// Time the variable services: SetVariable and GetVariable on private
+// benchmark variables of several sizes, volatile and (if confirmed)
+// non-volatile, GetNextVariableName over a full enumeration, and a
+// GetVariable profile of every existing variable
+//
+EFI_STATUS
+BenchmarkVariables (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  VARIABLE_SNAPSHOT *Snapshot;
+  CHAR16 Answer[4];
+  UINT64 *Ticks;
+  UINT8 *Data;
+  UINT64 Start;
+  UINT64 Elapsed;
+  UINTN Samples;
+  UINTN Calls;
+  UINT32 Attributes;
+  BOOLEAN Nv;
+  UINTN Class;
+  UINTN i;
+
+  Print(L"\nInclude non-volatile writes (%d per size, they wear the flash)? (y/n): ", BENCH_NV_CALLS);
+  ReadLine(Answer, 4);
+  Nv = (BOOLEAN)(Answer[0] == L'y' || Answer[0] == L'Y');
+
+  //
+  // A fresh snapshot, timed: enumeration plus one GetVariable each
+  //
+  Start = GetPerformanceCounter();
+  Status = TakeSnapshot();
+  Elapsed = ElapsedTicks(Start, GetPerformanceCounter());
+  if (EFI_ERROR(Status)) {
+    Print(L"Failed to read variables: %r\n", Status);
+    return Status;
+  }
+  Snapshot = &mSnapshot;
+
+  Samples = MAX(Snapshot->Count + 1, BENCH_VOLATILE_CALLS);
+  Ticks = ArenaAlloc(&mArena, Samples * sizeof(UINT64));
+  Data = ArenaAllocZero(&mArena, mBenchSizes[ARRAY_SIZE(mBenchSizes) - 1]);
+  if (Ticks == NULL || Data == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Print(L"\nVariable services benchmark (latency in ns)\n");
+  Print(L"Snapshot of %d variables with data: %ld us\n\n",
+        Snapshot->Count, DivU64x32(GetTimeInNanoSecond(Elapsed), 1000));
+  Print(L"Operation                  Calls |      min      p50      p90      p99       max\n");
+
+  Status = BenchEnumeration(Ticks, Samples);
+
+  //
+  // Class 0 is volatile, class 1 non-volatile
+  //
+  for (Class = 0; Class < (Nv ? 2 : 1) && !EFI_ERROR(Status); Class++) {
+    Attributes = EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS;
+    if (Class == 1)
+      Attributes |= EFI_VARIABLE_NON_VOLATILE;
+
+    for (i = 0; i < ARRAY_SIZE(mBenchSizes) && !EFI_ERROR(Status); i++) {
+      Calls = BenchCallsThatFit(Attributes, mBenchSizes[i],
+                                (Class == 1) ? BENCH_NV_CALLS : BENCH_VOLATILE_CALLS);
+      if (Calls == 0) {
+        Print(L"%s %5d B skipped: not enough free store\n", (Class == 1) ? L"NV" : L"V ", mBenchSizes[i]);
+        continue;
+      }
+      Status = BenchVariableSize(Attributes, mBenchSizes[i], Calls, Data, Ticks);
+    }
+  }
+
+  if (!EFI_ERROR(Status))
+    Status = ProfileVariables(Snapshot, Ticks);
+
+  return Status;
+}
+
+//
+// Ask for a data format; empty input gives Default, FormatMax means
+// the answer was not a format name
+//
+VALUE_FORMAT
+ReadFormat (
+  IN CONST CHAR16 *Prompt,
+  IN VALUE_FORMAT Default
+  )
+{
+  CHAR16 Input[10];
+  UINTN Format;
+
+  Print(L"%s [%s]: ", Prompt, mFormatNames[Default]);
+  ReadLine(Input, 10);
+  if (Input[0] == L'\0')
+    return Default;
+
+  for (Format = 0; Format < FormatMax; Format++) {
+    if (StrCmp(Input, mFormatNames[Format]) == 0)
+      return (VALUE_FORMAT)Format;
+  }
+  return FormatMax;
+}
+
+//
+// Ask for a GUID; empty input means the EFI global variable GUID
+//
+EFI_STATUS
+ReadVariableGuid (
+  OUT EFI_GUID *Guid
+  )
+{
+  CHAR16 GuidStr[50];
+
+  Print(L"Enter GUID (empty = EFI global variable): ");
+  ReadLine(GuidStr, 50);
+
+  if (GuidStr[0] == L'\0') {
+    CopyGuid(Guid, &gEfiGlobalVariableGuid);
+    return EFI_SUCCESS;
+  }
+
+  if (EFI_ERROR(ParseGuidString(GuidStr, Guid))) {
+    Print(L"Invalid GUID format.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  return EFI_SUCCESS;
+}
+
+//
+// Offset, hex bytes and printable ASCII, 16 bytes per line
+//
+VOID
+PrintHexDump (
+  IN UINT8 *Data,
+  IN UINTN Size
+  )
+{
+  UINTN Line;
+  UINTN i;
+
+  for (Line = 0; Line < Size; Line += 16) {
+    Print(L"  %04x: ", Line);
+    for (i = Line; i < Line + 16; i++) {
+      if (i < Size)
+        Print(L"%02x ", Data[i]);
+      else
+        Print(L"   ");
+    }
+    Print(L" ");
+    for (i = Line; i < Line + 16 && i < Size; i++)
+      Print(L"%c", (Data[i] >= 0x20 && Data[i] <= 0x7E) ? (CHAR16)Data[i] : L'.');
+    Print(L"\n");
+  }
+}
+
+//
+// Is Name one of Boot####, Driver####, SysPrep#### or
+// PlatformRecovery####, i.e. an EFI_LOAD_OPTION
+//
+BOOLEAN
+IsLoadOptionName (
+  IN CHAR16 *Name
+  )
+{
+  STATIC CONST CHAR16 *Prefixes[] = { L"Boot", L"Driver", L"SysPrep", L"PlatformRecovery" };
+  UINTN Length;
+  UINTN p;
+  UINTN i;
+
+  for (p = 0; p < ARRAY_SIZE(Prefixes); p++) {
+    Length = StrLen(Prefixes[p]);
+    if (StrLen(Name) != Length + 4 || StrnCmp(Name, Prefixes[p], Length) != 0)
+      continue;
+
+    for (i = Length; i < Length + 4; i++) {
+      if (!((Name[i] >= L'0' && Name[i] <= L'9') || (Name[i] >= L'A' && Name[i] <= L'F')))
+        return FALSE;
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+//
+// Split an EFI_LOAD_OPTION into its parts after checking every length
+//
+EFI_STATUS
+ParseLoadOption (
+  IN  UINT8            *Data,
+  IN  UINTN            Size,
+  OUT LOAD_OPTION_VIEW *View
+  )
+{
+  UINT16 FilePathLength;
+  UINTN Offset;
+
+  if (Data == NULL || Size < sizeof(UINT32) + sizeof(UINT16) + sizeof(CHAR16))
+    return EFI_VOLUME_CORRUPTED;
+
+  CopyMem(&View->Attributes, Data, sizeof(UINT32));
+  CopyMem(&FilePathLength, Data + sizeof(UINT32), sizeof(UINT16));
+  Offset = sizeof(UINT32) + sizeof(UINT16);
+
+  View->Description = (CHAR16 *)(Data + Offset);
+  while (TRUE) {
+    if (Size - Offset < sizeof(CHAR16))
+      return EFI_VOLUME_CORRUPTED;
+    Offset += sizeof(CHAR16);
+    if (*(CHAR16 *)(Data + Offset - sizeof(CHAR16)) == L'\0')
+      break;
+  }
+
+  //
+  // IsDevicePathValid treats a zero length as unbounded, so a path must
+  // at least hold its end node
+  //
+  if (FilePathLength < sizeof(EFI_DEVICE_PATH_PROTOCOL) || FilePathLength > Size - Offset)
+    return EFI_VOLUME_CORRUPTED;
+  View->FilePath = (EFI_DEVICE_PATH_PROTOCOL *)(Data + Offset);
+  View->FilePathLength = FilePathLength;
+  Offset += FilePathLength;
+
+  View->OptionalData = Data + Offset;
+  View->OptionalDataSize = Size - Offset;
+  return EFI_SUCCESS;
+}
+
+//
+// Print a decoded EFI_LOAD_OPTION
+//
+VOID
+PrintLoadOption (
+  IN UINT8 *Data,
+  IN UINTN Size
+  )
+{
+  LOAD_OPTION_VIEW View;
+  CHAR16 *PathText;
+  UINT32 Category;
+
+  if (EFI_ERROR(ParseLoadOption(Data, Size, &View))) {
+    Print(L"Malformed EFI_LOAD_OPTION\n");
+    PrintHexDump(Data, Size);
+    return;
+  }
+
+  Category = View.Attributes & LOAD_OPTION_CATEGORY;
+  Print(L"Description: %s\n", View.Description);
+  Print(L"Attributes:  0x%08x (%s%s%s, %s)\n",
+        View.Attributes,
+        ((View.Attributes & LOAD_OPTION_ACTIVE) != 0) ? L"active" : L"inactive",
+        ((View.Attributes & LOAD_OPTION_FORCE_RECONNECT) != 0) ? L", force reconnect" : L"",
+        ((View.Attributes & LOAD_OPTION_HIDDEN) != 0) ? L", hidden" : L"",
+        (Category == LOAD_OPTION_CATEGORY_BOOT) ? L"boot" :
+        (Category == LOAD_OPTION_CATEGORY_APP) ? L"application" : L"reserved category");
+
+  if (IsDevicePathValid(View.FilePath, View.FilePathLength)) {
+    PathText = ConvertDevicePathToText(View.FilePath, FALSE, TRUE);
+    Print(L"File path:   %s\n", (PathText != NULL) ? PathText : L"?");
+    if (PathText != NULL)
+      FreePool(PathText);
+  } else {
+    Print(L"File path:   invalid (%d bytes)\n", View.FilePathLength);
+  }
+
+  if (View.OptionalDataSize != 0) {
+    Print(L"Optional data (%d bytes):\n", View.OptionalDataSize);
+    PrintHexDump(View.OptionalData, View.OptionalDataSize);
+  }
+}
+
+//
+// Print data as a list of integers of Width bytes, in hex
+//
+VOID
+PrintIntegers (
+  IN UINT8 *Data,
+  IN UINTN Size,
+  IN UINTN Width
+  )
+{
+  UINT64 Value;
+  UINTN PerLine;
+  UINTN i;
+
+  PerLine = (Width <= 2) ? 8 : 4;
+  for (i = 0; i + Width <= Size; i += Width) {
+    Value = 0;
+    CopyMem(&Value, Data + i, Width);
+    if (Width == 1)
+      Print(L" 0x%02x", (UINT32)Value);
+    else if (Width == 2)
+      Print(L" 0x%04x", (UINT32)Value);
+    else if (Width == 4)
+      Print(L" 0x%08x", (UINT32)Value);
+    else
+      Print(L" 0x%016lx", Value);
+    if ((i / Width) % PerLine == PerLine - 1)
+      Print(L"\n");
+  }
+  if ((Size / Width) % PerLine != 0)
+    Print(L"\n");
+  if (Size % Width != 0)
+    Print(L" (+%d trailing bytes)\n", Size % Width);
 }
 
 //
-// ReadLine helper
+// Print a variable's data in Format. FormatAuto picks a format from the
+// name of well-known EFI global variables and falls back to hex.
 //
-EFI_STATUS
-ReadLine (
-  OUT CHAR16 *Buffer,
-  IN  UINTN   BufferLen
+VOID
+PrintValue (
+  IN CHAR16       *Name,
+  IN EFI_GUID     *Guid,
+  IN UINT8        *Data,
+  IN UINTN        Size,
+  IN VALUE_FORMAT Format
   )
 {
-  UINTN Index;
-  EFI_INPUT_KEY Key;
-  UINTN EventIndex;
-
-  Index = 0;
-  ZeroMem(Buffer, BufferLen * sizeof(CHAR16));
-
-  while (TRUE) {
-    gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
-    gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);
-
-    if (Key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
-      Print(L"\r\n");
-      Buffer[Index] = L'\0';
-      return EFI_SUCCESS;
+  EFI_GUID Value;
+  CHAR16 *Text;
+  CHAR8 *Ascii;
+  UINTN i;
+
+  if (Format == FormatAuto) {
+    Format = FormatHex;
+    if (CompareGuid(Guid, &gEfiGlobalVariableGuid)) {
+      if (IsLoadOptionName(Name)) {
+        PrintLoadOption(Data, Size);
+        return;
+      }
+      if (StrCmp(Name, L"BootOrder") == 0 || StrCmp(Name, L"DriverOrder") == 0 ||
+          StrCmp(Name, L"SysPrepOrder") == 0) {
+        for (i = 0; i + sizeof(UINT16) <= Size; i += sizeof(UINT16))
+          Print(L" %.*s%04X", StrLen(Name) - 5, Name, *(UINT16 *)(Data + i));
+        Print(L"\n");
+        return;
+      }
+      if (StrCmp(Name, L"Timeout") == 0 || StrCmp(Name, L"BootCurrent") == 0 ||
+          StrCmp(Name, L"BootNext") == 0)
+        Format = FormatU16;
+      else if (StrCmp(Name, L"Lang") == 0 || StrCmp(Name, L"PlatformLang") == 0 ||
+               StrCmp(Name, L"LangCodes") == 0 || StrCmp(Name, L"PlatformLangCodes") == 0)
+        Format = FormatAscii;
     }
+  }
 
-    if (Key.UnicodeChar == CHAR_BACKSPACE) {
-      if (Index > 0) {
-        Index--;
-        Print(L"\b \b");
+  switch (Format) {
+    case FormatU8:
+      PrintIntegers(Data, Size, 1);
+      break;
+    case FormatU16:
+      PrintIntegers(Data, Size, 2);
+      break;
+    case FormatU32:
+      PrintIntegers(Data, Size, 4);
+      break;
+    case FormatU64:
+      PrintIntegers(Data, Size, 8);
+      break;
+
+    case FormatGuid:
+      for (i = 0; i + sizeof(EFI_GUID) <= Size; i += sizeof(EFI_GUID)) {
+        CopyMem(&Value, Data + i, sizeof(EFI_GUID));
+        Print(L" ");
+        PrintGuid(&Value);
+        Print(L"\n");
       }
-      continue;
-    }
+      if (Size % sizeof(EFI_GUID) != 0)
+        Print(L" (+%d trailing bytes)\n", Size % sizeof(EFI_GUID));
+      break;
 
-    if (Key.UnicodeChar >= 0x20 && Key.UnicodeChar <= 0x7E) {
-      if (Index + 1 < BufferLen) {
-        Buffer[Index++] = Key.UnicodeChar;
-        Print(L"%c", Key.UnicodeChar);
+    //
+    // Strings are copied so an unterminated value still prints safely
+    //
+    case FormatUtf16:
+      Text = ArenaAllocZero(&mArena, (Size / sizeof(CHAR16) + 1) * sizeof(CHAR16));
+      if (Text != NULL) {
+        CopyMem(Text, Data, Size & ~(UINTN)1);
+        Print(L" \"%s\"\n", Text);
       }
-    }
+      break;
+    case FormatAscii:
+      Ascii = ArenaAllocZero(&mArena, Size + 1);
+      if (Ascii != NULL) {
+        CopyMem(Ascii, Data, Size);
+        Print(L" \"%a\"\n", Ascii);
+      }
+      break;
+
+    default:
+      PrintHexDump(Data, Size);
+      break;
   }
 }
 
 //
-// Parse GUID string like "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+// TRUE for 0-9, a-f and A-F
 //
-EFI_STATUS
-ParseGuidString (
-  IN  CHAR16   *GuidStr,
-  OUT EFI_GUID *Guid
+BOOLEAN
+IsHexDigit (
+  IN CHAR16 Char
   )
 {
-  UINTN i, j, len;
-  CHAR16 temp[3];
-  UINT8 bytes[16];
-
-  if (GuidStr == NULL || Guid == NULL)
-    return EFI_INVALID_PARAMETER;
-
-  len = StrLen(GuidStr);
-  if (len != 36)
-    return EFI_INVALID_PARAMETER;
-
-  j = 0;
-  for (i = 0; i < len && j < 16;) {
-    if (GuidStr[i] == L'-') {
-      i++;
-      continue;
-    }
-    if (i + 1 >= len)
-      return EFI_INVALID_PARAMETER;
+  return (BOOLEAN)((Char >= L'0' && Char <= L'9') ||
+                   (Char >= L'a' && Char <= L'f') ||
+                   (Char >= L'A' && Char <= L'F'));
+}
 
-    temp[0] = GuidStr[i];
-    temp[1] = GuidStr[i + 1];
-    temp[2] = 0;
-    bytes[j++] = (UINT8)StrHexToUintn(temp);
-    i += 2;
+//
+// Split off the next token of *Cursor at spaces or commas, in place
+//
+CHAR16 *
+NextToken (
+  IN OUT CHAR16 **Cursor
+  )
+{
+  CHAR16 *Start;
+
+  while (**Cursor == L' ' || **Cursor == L',')
+    (*Cursor)++;
+  if (**Cursor == L'\0')
+    return NULL;
+
+  Start = *Cursor;
+  while (**Cursor != L'\0' && **Cursor != L' ' && **Cursor != L',')
+    (*Cursor)++;
+  if (**Cursor != L'\0') {
+    **Cursor = L'\0';
+    (*Cursor)++;
   }
+  return Start;
+}
 
-  if (j != 16)
-    return EFI_INVALID_PARAMETER;
+//
+// Parse one integer, decimal or 0x-prefixed hex, that fits Width bytes
+//
+EFI_STATUS
+ParseInteger (
+  IN  CHAR16 *Token,
+  IN  UINTN  Width,
+  OUT UINT64 *Value
+  )
+{
+  CHAR16 *End;
+  RETURN_STATUS Status;
 
-  Guid->Data1 = ((UINT32)bytes[0] << 24) |
-                ((UINT32)bytes[1] << 16) |
-                ((UINT32)bytes[2] << 8)  |
-                ((UINT32)bytes[3]);
-  Guid->Data2 = ((UINT16)bytes[4] << 8) | bytes[5];
-  Guid->Data3 = ((UINT16)bytes[6] << 8) | bytes[7];
-  CopyMem(Guid->Data4, &bytes[8], 8);
+  if (Token[0] == L'0' && (Token[1] == L'x' || Token[1] == L'X'))
+    Status = StrHexToUint64S(Token, &End, Value);
+  else
+    Status = StrDecimalToUint64S(Token, &End, Value);
 
+  if (RETURN_ERROR(Status) || *End != L'\0')
+    return EFI_INVALID_PARAMETER;
+  if (Width < sizeof(UINT64) && RShiftU64(*Value, Width * 8) != 0)
+    return EFI_INVALID_PARAMETER;
   return EFI_SUCCESS;
 }
 
 //
-// List all variables
+// Turn typed input into variable data. Text is split in place.
+//   hex          bytes as hex digit pairs, e.g. "01 02 ff" or "0102ff"
+//   u8..u64      integers, decimal or 0x hex, stored little-endian
+//   guid         GUIDs in registry format
+//   utf16/ascii  the text itself, with its terminating NUL
 //
 EFI_STATUS
-ListAllVariables (
-  VOID
+ParseValue (
+  IN  VALUE_FORMAT Format,
+  IN  CHAR16       *Text,
+  OUT UINT8        **Data,
+  OUT UINTN        *DataSize
   )
 {
-  EFI_STATUS Status;
-  UINTN NameSize;
-  CHAR16 *Name;
-  EFI_GUID Guid;
-  UINTN OldSize;
-  CHAR16 *NewBuf;
-
-  NameSize = 128;
-  Name = AllocateZeroPool(NameSize * sizeof(CHAR16));
-  if (Name == NULL)
+  STATIC CONST UINTN Widths[FormatMax] = { 0, 0, 1, 2, 4, 8, 0, 0, 0 };
+  CHAR16 *Cursor;
+  CHAR16 *Token;
+  CHAR16 Pair[3];
+  UINT8 *Buffer;
+  UINT64 Value;
+  UINTN Length;
+  UINTN Size;
+  UINTN i;
+
+  Length = StrLen(Text);
+  Buffer = ArenaAllocZero(&mArena, (Length + 1) * sizeof(UINT64) + sizeof(EFI_GUID));
+  if (Buffer == NULL)
     return EFI_OUT_OF_RESOURCES;
 
-  Print(L"\n=== Listing All Variables ===\n");
+  Size = 0;
+  Cursor = Text;
+  switch (Format) {
+    case FormatUtf16:
+      Size = (Length + 1) * sizeof(CHAR16);
+      CopyMem(Buffer, Text, Size);
+      break;
 
-  while (TRUE) {
-    OldSize = NameSize;
-    Status = gRT->GetNextVariableName(&NameSize, Name, &Guid);
-
-    if (Status == EFI_BUFFER_TOO_SMALL) {
-      NewBuf = ReallocatePool(OldSize * sizeof(CHAR16),
-                              NameSize * sizeof(CHAR16),
-                              Name);
-      if (NewBuf == NULL) {
-        FreePool(Name);
-        return EFI_OUT_OF_RESOURCES;
+    case FormatAscii:
+      for (i = 0; i < Length; i++)
+        Buffer[i] = (UINT8)Text[i];
+      Size = Length + 1;
+      break;
+
+    case FormatHex:
+      Pair[2] = L'\0';
+      while ((Token = NextToken(&Cursor)) != NULL) {
+        if (StrLen(Token) % 2 != 0)
+          return EFI_INVALID_PARAMETER;
+        for (i = 0; Token[i] != L'\0'; i += 2) {
+          Pair[0] = Token[i];
+          Pair[1] = Token[i + 1];
+          if (!IsHexDigit(Pair[0]) || !IsHexDigit(Pair[1]))
+            return EFI_INVALID_PARAMETER;
+          Buffer[Size++] = (UINT8)StrHexToUintn(Pair);
+        }
       }
-      Name = NewBuf;
-      continue;
-    }
+      break;
 
-    if (Status == EFI_NOT_FOUND)
+    case FormatGuid:
+      while ((Token = NextToken(&Cursor)) != NULL) {
+        if (EFI_ERROR(ParseGuidString(Token, (EFI_GUID *)(Buffer + Size))))
+          return EFI_INVALID_PARAMETER;
+        Size += sizeof(EFI_GUID);
+      }
       break;
 
-    if (EFI_ERROR(Status)) {
-      Print(L"Error: %r\n", Status);
+    case FormatU8:
+    case FormatU16:
+    case FormatU32:
+    case FormatU64:
+      while ((Token = NextToken(&Cursor)) != NULL) {
+        if (EFI_ERROR(ParseInteger(Token, Widths[Format], &Value)))
+          return EFI_INVALID_PARAMETER;
+        CopyMem(Buffer + Size, &Value, Widths[Format]);
+        Size += Widths[Format];
+      }
       break;
-    }
 
-    Print(L"Name: %s  GUID: ", Name);
-    PrintGuid(&Guid);
-    Print(L"\n");
+    default:
+      return EFI_INVALID_PARAMETER;
   }
 
-  FreePool(Name);
+  *Data = Buffer;
+  *DataSize = Size;
   return EFI_SUCCESS;
 }
 
 //
-// Search variable by name substring
+// Show one variable, decoded as the chosen format
 //
 EFI_STATUS
-SearchVariableByName (
+ViewVariable (
   VOID
   )
 {
-  EFI_STATUS Status;
-  CHAR16 Input[100];
+  CHAR16 Name[100];
   EFI_GUID Guid;
-  UINTN NameSize;
-  CHAR16 *Name;
-  BOOLEAN Found;
-  UINTN OldSize;
-  CHAR16 *NewBuf;
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_ENTRY *Entry;
+  VALUE_FORMAT Format;
 
-  Print(L"\nEnter variable name substring: ");
-  ReadLine(Input, 100);
+  Print(L"\nEnter variable name: ");
+  ReadLine(Name, 100);
+  if (EFI_ERROR(ReadVariableGuid(&Guid)))
+    return EFI_INVALID_PARAMETER;
+
+  Format = ReadFormat(L"Format (auto, hex, u8, u16, u32, u64, guid, utf16, ascii)", FormatAuto);
+  if (Format == FormatMax) {
+    Print(L"Unknown format.\n");
+    return EFI_INVALID_PARAMETER;
+  }
 
-  NameSize = 128;
-  Name = AllocateZeroPool(NameSize * sizeof(CHAR16));
-  Found = FALSE;
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
 
-  while (TRUE) {
-    OldSize = NameSize;
-    Status = gRT->GetNextVariableName(&NameSize, Name, &Guid);
-
-    if (Status == EFI_BUFFER_TOO_SMALL) {
-      NewBuf = ReallocatePool(OldSize * sizeof(CHAR16),
-                              NameSize * sizeof(CHAR16),
-                              Name);
-      if (NewBuf == NULL)
-        return EFI_OUT_OF_RESOURCES;
-      Name = NewBuf;
-      continue;
-    }
+  Entry = LookupEntry(Snapshot, Name, &Guid);
+  if (Entry == NULL) {
+    Print(L"Variable not found.\n");
+    return EFI_NOT_FOUND;
+  }
 
-    if (Status == EFI_NOT_FOUND)
-      break;
+  PrintEntryHeader();
+  PrintEntry(Entry);
+  if (!EFI_ERROR(Entry->ReadStatus))
+    PrintValue(Entry->Name, &Entry->Guid, Entry->Data, Entry->DataSize, Format);
 
-    if (EFI_ERROR(Status))
-      break;
+  return Entry->ReadStatus;
+}
 
-    if (StrStr(Name, Input) != NULL) {
-      Found = TRUE;
-      Print(L"Found: %s  GUID: ", Name);
-      PrintGuid(&Guid);
-      Print(L"\n");
+//
+// One line per boot option: number, active flag and description
+//
+VOID
+PrintBootOptionLine (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN UINT16            Number
+  )
+{
+  CHAR16 Name[16];
+  VARIABLE_ENTRY *Entry;
+  LOAD_OPTION_VIEW View;
+
+  UnicodeSPrint(Name, sizeof(Name), L"Boot%04X", Number);
+  Entry = LookupEntry(Snapshot, Name, &gEfiGlobalVariableGuid);
+  if (Entry == NULL) {
+    Print(L"  %s  (missing)\n", Name);
+  } else if (EFI_ERROR(ParseLoadOption(Entry->Data, Entry->DataSize, &View))) {
+    Print(L"  %s  (malformed)\n", Name);
+  } else {
+    Print(L"  %s  %c %s\n", Name,
+          ((View.Attributes & LOAD_OPTION_ACTIVE) != 0) ? L'*' : L' ',
+          View.Description);
+  }
+}
+
+//
+// Read a new BootOrder, check that every option exists once, and write it
+// with the attributes of the current BootOrder
+//
+EFI_STATUS
+WriteBootOrder (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN VARIABLE_ENTRY    *Order OPTIONAL
+  )
+{
+  CHAR16 Input[DATA_INPUT_LENGTH];
+  CHAR16 Name[16];
+  CHAR16 *Cursor;
+  CHAR16 *Token;
+  CHAR16 *End;
+  EFI_STATUS Status;
+  UINT16 *NewOrder;
+  UINT16 Number;
+  UINT64 Value;
+  UINTN Count;
+  UINTN j;
+
+  Print(L"\nNew boot order, e.g. \"0003 0001\" (empty = keep): ");
+  ReadLine(Input, DATA_INPUT_LENGTH);
+  if (Input[0] == L'\0')
+    return EFI_SUCCESS;
+
+  NewOrder = ArenaAlloc(&mArena, (StrLen(Input) + 1) * sizeof(UINT16));
+  if (NewOrder == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Count = 0;
+  Cursor = Input;
+  while ((Token = NextToken(&Cursor)) != NULL) {
+    Status = StrHexToUint64S(Token, &End, &Value);
+    if (RETURN_ERROR(Status) || *End != L'\0' || Value > MAX_UINT16) {
+      Print(L"Invalid option number.\n");
+      return EFI_INVALID_PARAMETER;
+    }
+    Number = (UINT16)Value;
+
+    UnicodeSPrint(Name, sizeof(Name), L"Boot%04X", Number);
+    if (LookupEntry(Snapshot, Name, &gEfiGlobalVariableGuid) == NULL) {
+      Print(L"%s does not exist.\n", Name);
+      return EFI_NOT_FOUND;
+    }
+    for (j = 0; j < Count; j++) {
+      if (NewOrder[j] == Number) {
+        Print(L"%s is listed twice.\n", Name);
+        return EFI_INVALID_PARAMETER;
+      }
     }
+    NewOrder[Count++] = Number;
   }
 
-  if (!Found)
-    Print(L"No match found.\n");
+  //
+  // Zero bytes would delete BootOrder altogether
+  //
+  if (Count == 0) {
+    Print(L"No option numbers entered.\n");
+    return EFI_INVALID_PARAMETER;
+  }
 
-  FreePool(Name);
-  return EFI_SUCCESS;
+  Status = gRT->SetVariable(L"BootOrder", &gEfiGlobalVariableGuid,
+                            (Order != NULL && Order->Attributes != 0) ? Order->Attributes :
+                            EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+                            Count * sizeof(UINT16), NewOrder);
+  InvalidateSnapshot();
+
+  if (EFI_ERROR(Status))
+    Print(L"SetVariable failed: %r\n", Status);
+  else
+    Print(L"BootOrder updated.\n");
+  return Status;
 }
 
 //
-// Search variable by GUID
+// Change one field of Boot#### in place: toggle LOAD_OPTION_ACTIVE, or
+// replace the description. The device path and optional data are carried
+// over from the current value, so the user never types the whole blob.
 //
 EFI_STATUS
-SearchVariableByGuid (
-  VOID
+EditLoadOption (
+  IN VARIABLE_SNAPSHOT *Snapshot,
+  IN UINT16            Number,
+  IN BOOLEAN           ToggleActive
   )
 {
-  CHAR16 Input[50];
-  EFI_GUID Target;
+  CHAR16 Name[16];
+  CHAR16 Description[100];
+  VARIABLE_ENTRY *Entry;
+  LOAD_OPTION_VIEW View;
   EFI_STATUS Status;
-  UINTN NameSize;
-  CHAR16 *Name;
-  EFI_GUID Guid;
-  BOOLEAN Found;
-  UINTN OldSize;
-  CHAR16 *NewBuf;
+  UINT32 Attributes;
+  UINT8 *Data;
+  UINTN DescriptionSize;
+  UINTN HeaderSize;
+  UINTN Size;
+
+  UnicodeSPrint(Name, sizeof(Name), L"Boot%04X", Number);
+  Entry = LookupEntry(Snapshot, Name, &gEfiGlobalVariableGuid);
+  if (Entry == NULL || EFI_ERROR(Entry->ReadStatus)) {
+    Print(L"%s not found.\n", Name);
+    return EFI_NOT_FOUND;
+  }
+  if (EFI_ERROR(ParseLoadOption(Entry->Data, Entry->DataSize, &View))) {
+    Print(L"%s is malformed; not changed.\n", Name);
+    return EFI_VOLUME_CORRUPTED;
+  }
 
-  Print(L"\nEnter GUID to search (xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx): ");
-  ReadLine(Input, 50);
+  HeaderSize = sizeof(UINT32) + sizeof(UINT16);
+  if (ToggleActive) {
+    Size = Entry->DataSize;
+    Data = ArenaAlloc(&mArena, Size);
+    if (Data == NULL)
+      return EFI_OUT_OF_RESOURCES;
+    CopyMem(Data, Entry->Data, Size);
+    Attributes = View.Attributes ^ LOAD_OPTION_ACTIVE;
+    CopyMem(Data, &Attributes, sizeof(UINT32));
+  } else {
+    Print(L"Current description: %s\nNew description (empty = keep): ", View.Description);
+    ReadLine(Description, 100);
+    if (Description[0] == L'\0')
+      return EFI_SUCCESS;
 
-  Status = ParseGuidString(Input, &Target);
-  if (EFI_ERROR(Status)) {
-    Print(L"Invalid GUID format.\n");
-    return EFI_INVALID_PARAMETER;
+    DescriptionSize = StrSize(Description);
+    Size = HeaderSize + DescriptionSize + View.FilePathLength + View.OptionalDataSize;
+    Data = ArenaAlloc(&mArena, Size);
+    if (Data == NULL)
+      return EFI_OUT_OF_RESOURCES;
+    CopyMem(Data, Entry->Data, HeaderSize);
+    CopyMem(Data + HeaderSize, Description, DescriptionSize);
+    CopyMem(Data + HeaderSize + DescriptionSize, View.FilePath, View.FilePathLength);
+    CopyMem(Data + HeaderSize + DescriptionSize + View.FilePathLength,
+            View.OptionalData, View.OptionalDataSize);
   }
 
-  NameSize = 128;
-  Name = AllocateZeroPool(NameSize * sizeof(CHAR16));
-  Found = FALSE;
+  Status = gRT->SetVariable(Name, &gEfiGlobalVariableGuid, Entry->Attributes, Size, Data);
+  InvalidateSnapshot();
 
-  while (TRUE) {
-    OldSize = NameSize;
-    Status = gRT->GetNextVariableName(&NameSize, Name, &Guid);
-
-    if (Status == EFI_BUFFER_TOO_SMALL) {
-      NewBuf = ReallocatePool(OldSize * sizeof(CHAR16),
-                              NameSize * sizeof(CHAR16),
-                              Name);
-      if (NewBuf == NULL)
-        return EFI_OUT_OF_RESOURCES;
-      Name = NewBuf;
-      continue;
-    }
+  if (EFI_ERROR(Status))
+    Print(L"SetVariable failed: %r\n", Status);
+  else if (ToggleActive)
+    Print(L"%s is now %s.\n", Name,
+          ((View.Attributes & LOAD_OPTION_ACTIVE) != 0) ? L"inactive" : L"active");
+  else
+    Print(L"%s description updated.\n", Name);
+  return Status;
+}
 
-    if (Status == EFI_NOT_FOUND)
-      break;
+//
+// List the boot options in BootOrder order, then those BootOrder does
+// not reference. Then optionally write a new BootOrder, or edit one
+// Boot#### option
+//
+EFI_STATUS
+EditBootOptions (
+  VOID
+  )
+{
+  CHAR16 Input[8];
+  CHAR16 Action;
+  CHAR16 *End;
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_ENTRY *Order;
+  VARIABLE_ENTRY *Entry;
+  VARIABLE_QUERY Query;
+  VARIABLE_ENTRY **Options;
+  EFI_STATUS Status;
+  UINT16 *OrderData;
+  UINT16 Number;
+  UINT64 Value;
+  UINTN OrderCount;
+  UINTN OptionCount;
+  UINTN Count;
+  UINTN i;
+  UINTN j;
+
+  Snapshot = GetSnapshot();
+  if (Snapshot == NULL)
+    return EFI_NOT_READY;
+
+  Print(L"\n");
+  Entry = LookupEntry(Snapshot, L"BootCurrent", &gEfiGlobalVariableGuid);
+  if (Entry != NULL && Entry->DataSize == sizeof(UINT16))
+    Print(L"BootCurrent: Boot%04X\n", *(UINT16 *)Entry->Data);
+  Entry = LookupEntry(Snapshot, L"BootNext", &gEfiGlobalVariableGuid);
+  if (Entry != NULL && Entry->DataSize == sizeof(UINT16))
+    Print(L"BootNext:    Boot%04X\n", *(UINT16 *)Entry->Data);
+  Entry = LookupEntry(Snapshot, L"Timeout", &gEfiGlobalVariableGuid);
+  if (Entry != NULL && Entry->DataSize == sizeof(UINT16))
+    Print(L"Timeout:     %d s\n", *(UINT16 *)Entry->Data);
+
+  Order = LookupEntry(Snapshot, L"BootOrder", &gEfiGlobalVariableGuid);
+  OrderData = NULL;
+  OrderCount = 0;
+  if (Order != NULL && !EFI_ERROR(Order->ReadStatus)) {
+    OrderData = (UINT16 *)Order->Data;
+    OrderCount = Order->DataSize / sizeof(UINT16);
+  }
 
-    if (EFI_ERROR(Status))
-      break;
+  Print(L"BootOrder (* = active):\n");
+  for (i = 0; i < OrderCount; i++)
+    PrintBootOptionLine(Snapshot, OrderData[i]);
+
+  //
+  // Boot#### variables that BootOrder leaves out
+  //
+  ZeroMem(&Query, sizeof(Query));
+  Query.HasGuid = TRUE;
+  CopyGuid(&Query.Guid, &gEfiGlobalVariableGuid);
+  Query.Pattern = L"Boot????";
+  Options = ArenaAlloc(&mArena, (Snapshot->Count + 1) * sizeof(VARIABLE_ENTRY *));
+  if (Options == NULL)
+    return EFI_OUT_OF_RESOURCES;
+  OptionCount = FindEntries(Snapshot, &Query, Options);
 
-    if (CompareMem(&Guid, &Target, sizeof(EFI_GUID)) == 0) {
-      Found = TRUE;
-      Print(L"Found: %s\n", Name);
-    }
+  Count = 0;
+  for (i = 0; i < OptionCount; i++) {
+    if (!IsLoadOptionName(Options[i]->Name))
+      continue;
+    Number = (UINT16)StrHexToUintn(Options[i]->Name + 4);
+    for (j = 0; j < OrderCount && OrderData[j] != Number; j++)
+      ;
+    if (j < OrderCount)
+      continue;
+    if (Count++ == 0)
+      Print(L"Not in BootOrder:\n");
+    PrintBootOptionLine(Snapshot, Number);
   }
 
-  if (!Found)
-    Print(L"No variables found for that GUID.\n");
-
-  FreePool(Name);
-  return EFI_SUCCESS;
+  Print(L"\nr = new BootOrder, a = toggle active, d = change description (empty = back): ");
+  ReadLine(Input, 4);
+  if (Input[0] == L'r' || Input[0] == L'R')
+    return WriteBootOrder(Snapshot, Order);
+  if (Input[0] != L'a' && Input[0] != L'A' && Input[0] != L'd' && Input[0] != L'D')
+    return EFI_SUCCESS;
+
+  Action = Input[0];
+  Print(L"Option number, e.g. 0003: ");
+  ReadLine(Input, 8);
+  Status = StrHexToUint64S(Input, &End, &Value);
+  if (RETURN_ERROR(Status) || *End != L'\0' || Value > MAX_UINT16) {
+    Print(L"Invalid option number.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  return EditLoadOption(Snapshot, (UINT16)Value, (BOOLEAN)(Action == L'a' || Action == L'A'));
 }
 
 //
-// Create a new variable
+// Create or write a variable from typed data, optionally appending to
+// the existing value with EFI_VARIABLE_APPEND_WRITE
 //
 EFI_STATUS
 CreateNewVariable (
@@ -308,30 +2707,44 @@ CreateNewVariable (
   )
 {
   CHAR16 Name[100];
-  CHAR16 GuidStr[50];
-  CHAR16 DataStr[200];
+  CHAR16 DataStr[DATA_INPUT_LENGTH];
   CHAR16 AttrStr[5];
+  CHAR16 Answer[4];
   EFI_GUID Guid;
+  VARIABLE_SNAPSHOT *Snapshot;
+  VARIABLE_ENTRY *Existing;
+  VALUE_FORMAT Format;
   UINT32 Attr;
   EFI_STATUS Status;
+  UINT8 *Data;
   UINTN DataSize;
 
-  Print(L"\nEnter new variable name: ");
+  Print(L"\nEnter variable name: ");
   ReadLine(Name, 100);
 
-  Print(L"Enter GUID: ");
-  ReadLine(GuidStr, 50);
-
-  Status = ParseGuidString(GuidStr, &Guid);
-  if (EFI_ERROR(Status)) {
-    Print(L"Invalid GUID format.\n");
-    return EFI_INVALID_PARAMETER;
+  Status = ReadVariableGuid(&Guid);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  Existing = NULL;
+  Snapshot = GetSnapshot();
+  if (Snapshot != NULL)
+    Existing = LookupEntry(Snapshot, Name, &Guid);
+  if (Existing != NULL && !EFI_ERROR(Existing->ReadStatus)) {
+    Print(L"Exists: ");
+    PrintAttributes(Existing->Attributes);
+    Print(L" %d bytes\n", Existing->DataSize);
+  } else {
+    Existing = NULL;
   }
 
-  Print(L"Enter attributes (1=BS, 2=BS+NV, 3=RT+BS, 4=RT+BS+NV): ");
+  Print(L"Enter attributes (1=BS, 2=BS+NV, 3=RT+BS, 4=RT+BS+NV%s): ",
+        (Existing != NULL) ? L", empty=keep" : L"");
   ReadLine(AttrStr, 5);
 
-  if (AttrStr[0] == L'1')
+  if (AttrStr[0] == L'\0' && Existing != NULL)
+    Attr = Existing->Attributes;
+  else if (AttrStr[0] == L'1')
     Attr = EFI_VARIABLE_BOOTSERVICE_ACCESS;
   else if (AttrStr[0] == L'2')
     Attr = EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_NON_VOLATILE;
@@ -342,16 +2755,44 @@ CreateNewVariable (
            EFI_VARIABLE_RUNTIME_ACCESS |
            EFI_VARIABLE_NON_VOLATILE;
 
-  Print(L"Enter data string: ");
-  ReadLine(DataStr, 200);
+  if (Existing != NULL) {
+    Print(L"Append to the existing data? (y/n): ");
+    ReadLine(Answer, 4);
+    if (Answer[0] == L'y' || Answer[0] == L'Y')
+      Attr |= EFI_VARIABLE_APPEND_WRITE;
+  }
+
+  Format = ReadFormat(L"Data type (hex, u8, u16, u32, u64, guid, utf16, ascii)", FormatUtf16);
+  if (Format == FormatMax || Format == FormatAuto) {
+    Print(L"Unknown data type.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Print(L"Enter data: ");
+  ReadLine(DataStr, DATA_INPUT_LENGTH);
 
-  DataSize = StrLen(DataStr) * sizeof(CHAR16);
-  Status = gRT->SetVariable(Name, &Guid, Attr, DataSize, DataStr);
+  Status = ParseValue(Format, DataStr, &Data, &DataSize);
+  if (EFI_ERROR(Status)) {
+    Print(L"Invalid %s data.\n", mFormatNames[Format]);
+    return Status;
+  }
+
+  //
+  // Zero bytes would delete the variable; only an append may be empty
+  //
+  if (DataSize == 0 && (Attr & EFI_VARIABLE_APPEND_WRITE) == 0) {
+    Print(L"No data entered; use Delete to remove a variable.\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = gRT->SetVariable(Name, &Guid, Attr, DataSize, Data);
+  InvalidateSnapshot();
 
   if (EFI_ERROR(Status))
     Print(L"SetVariable failed: %r\n", Status);
   else
-    Print(L"Variable created successfully.\n");
+    Print(L"%d bytes %s.\n", DataSize,
+          ((Attr & EFI_VARIABLE_APPEND_WRITE) != 0) ? L"appended" : L"written");
 
   return Status;
 }
@@ -382,6 +2823,7 @@ DeleteVariable (
   }
 
   Status = gRT->SetVariable(Name, &Guid, 0, 0, NULL);
+  InvalidateSnapshot();
 
   if (EFI_ERROR(Status))
     Print(L"Delete failed: %r\n", Status);
@@ -404,14 +2846,25 @@ UefiMain (
   EFI_INPUT_KEY Key;
   UINTN EventIndex;
 
+  mImageHandle = ImageHandle;
+  ArenaInit(&mArena, 1);
+  ArenaInit(&mSnapshotArena, 16);
+
   while (TRUE) {
     Print(L"\n=== UEFI Variable Management Tool ===\n");
     Print(L"1. List all variables\n");
     Print(L"2. Search variable by name\n");
     Print(L"3. Search variable by GUID\n");
-    Print(L"4. Create new variable\n");
+    Print(L"4. Create or write variable (typed data, append)\n");
     Print(L"5. Delete variable\n");
-    Print(L"6. Exit\n");
+    Print(L"6. Query variables (GUID + name pattern + attributes)\n");
+    Print(L"7. Variable store usage\n");
+    Print(L"8. Export variables to file\n");
+    Print(L"9. Import variables from file\n");
+    Print(L"V. View variable value\n");
+    Print(L"O. Boot options (BootOrder, active flag, description)\n");
+    Print(L"B. Benchmark variable services\n");
+    Print(L"0. Exit\n");
     Print(L"Choose option: ");
 
     gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
@@ -427,13 +2880,37 @@ UefiMain (
       CreateNewVariable();
     else if (Key.UnicodeChar == L'5')
       DeleteVariable();
-    else if (Key.UnicodeChar == L'6') {
+    else if (Key.UnicodeChar == L'6')
+      QueryVariables();
+    else if (Key.UnicodeChar == L'7')
+      ShowStoreUsage();
+    else if (Key.UnicodeChar == L'8')
+      ExportVariables();
+    else if (Key.UnicodeChar == L'9')
+      ImportVariables();
+    else if (Key.UnicodeChar == L'v' || Key.UnicodeChar == L'V')
+      ViewVariable();
+    else if (Key.UnicodeChar == L'o' || Key.UnicodeChar == L'O')
+      EditBootOptions();
+    else if (Key.UnicodeChar == L'b' || Key.UnicodeChar == L'B')
+      BenchmarkVariables();
+    else if (Key.UnicodeChar == L'0') {
       Print(L"Exiting...\n");
+      ArenaFree(&mArena);
+      ArenaFree(&mSnapshotArena);
+      if (mSnapshot.Entries != NULL)
+        FreePool(mSnapshot.Entries);
       return EFI_SUCCESS;
     } else {
       Print(L"Invalid choice.\n");
     }
 
+    //
+    // Everything a command allocated goes back in one step; the first
+    // page stays so the next command starts without a firmware call
+    //
+    ArenaReset(&mArena);
+
     Print(L"\nPress any key to continue...");
     gBS->WaitForEvent(1, &gST->ConIn->WaitForKey, &EventIndex);
     gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);